@@ -327,6 +327,11 @@ int main(int argc, const char **argv)
   Messenger *messenger_hbserver = Messenger::create(g_ceph_context,
 						    entity_name_t::OSD(whoami), "hbserver",
 						    getpid());
+  // we talk to other osds' client side (for copy-from) as a client;
+  // renamed to client.<global id> once we have authenticated
+  Messenger *messenger_objecter = Messenger::create(g_ceph_context,
+						    entity_name_t::CLIENT(-1), "objecter",
+						    getpid());
   cluster_messenger->set_cluster_protocol(CEPH_OSD_PROTOCOL);
   messenger_hbclient->set_cluster_protocol(CEPH_OSD_PROTOCOL);
   messenger_hbserver->set_cluster_protocol(CEPH_OSD_PROTOCOL);
@@ -372,6 +377,9 @@ int main(int argc, const char **argv)
   messenger_hbserver->set_policy(entity_name_t::TYPE_OSD,
 			     Messenger::Policy::stateless_server(0, 0));
 
+  messenger_objecter->set_default_policy(Messenger::Policy::lossy_client(0,
+									 CEPH_FEATURE_OSDREPLYMUX));
+
   r = client_messenger->bind(g_conf->public_addr);
   if (r < 0)
     exit(1);
@@ -411,6 +419,7 @@ int main(int argc, const char **argv)
 
   osd = new OSD(whoami, cluster_messenger, client_messenger,
 		messenger_hbclient, messenger_hbserver,
+		messenger_objecter,
 		&mc,
 		g_conf->osd_data, g_conf->osd_journal);
 
@@ -427,6 +436,7 @@ int main(int argc, const char **argv)
   client_messenger->start();
   messenger_hbclient->start();
   messenger_hbserver->start();
+  messenger_objecter->start();
   cluster_messenger->start();
 
   // install signal handlers
@@ -446,6 +456,7 @@ int main(int argc, const char **argv)
   client_messenger->wait();
   messenger_hbclient->wait();
   messenger_hbserver->wait();
+  messenger_objecter->wait();
   cluster_messenger->wait();
 
   unregister_async_signal_handler(SIGHUP, sighup_handler);
@@ -457,6 +468,7 @@ int main(int argc, const char **argv)
   delete client_messenger;
   delete messenger_hbclient;
   delete messenger_hbserver;
+  delete messenger_objecter;
   delete cluster_messenger;
 
   // cd on exit, so that gmon.out (if any) goes into a separate directory for each node.
@@ -65,6 +65,8 @@ cls_method_handle_t h_snapshot_add;
 cls_method_handle_t h_snapshot_remove;
 cls_method_handle_t h_get_all_features;
 cls_method_handle_t h_copyup;
+cls_method_handle_t h_object_map_resize;
+cls_method_handle_t h_object_map_update;
 cls_method_handle_t h_get_id;
 cls_method_handle_t h_set_id;
 cls_method_handle_t h_dir_get_id;
@@ -1238,6 +1240,122 @@ int copyup(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 }
 
 
+/******************** rbd_object_map.$image_id methods ********************/
+
+/**
+ * Resize an image's object map, creating it if it doesn't exist.
+ * Objects added by growing it are marked as not existing.
+ *
+ * Input:
+ * @param num_objs number of objects the image now has
+ *
+ * Output:
+ * @returns 0 on success, negative error code on failure
+ */
+int object_map_resize(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t num_objs;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(num_objs, iter);
+  } catch (const buffer::error &err) {
+    return -EINVAL;
+  }
+
+  uint64_t size = 0;
+  int r = cls_cxx_stat(hctx, &size, NULL);
+  if (r < 0 && r != -ENOENT)
+    return r;
+
+  bufferlist map;
+  if (size) {
+    r = cls_cxx_read(hctx, 0, size, &map);
+    if (r < 0)
+      return r;
+  }
+
+  uint64_t new_size = object_map_bytes(num_objs);
+  CLS_LOG(20, "object_map_resize: %llu objects, %llu -> %llu bytes",
+	  (unsigned long long)num_objs, (unsigned long long)size,
+	  (unsigned long long)new_size);
+
+  bufferptr bp(new_size);
+  bp.zero();
+  map.copy(0, std::min<uint64_t>(map.length(), new_size), bp.c_str());
+  for (uint64_t i = num_objs; i < new_size * 8; ++i)
+    object_map_assign(bp.c_str(), i, false);
+
+  bufferlist bl;
+  bl.append(bp);
+  return cls_cxx_write_full(hctx, &bl);
+}
+
+/**
+ * Mark a range of objects in an image's object map as existing or
+ * not.  The read-modify-write happens here so that clients updating
+ * different objects can't lose each other's changes.
+ *
+ * Input:
+ * @param start_objno first object to update
+ * @param end_objno one past the last object to update
+ * @param exists whether the objects exist
+ *
+ * Output:
+ * @returns 0 on success, -ERANGE if the range is past the end of the
+ * map, negative error code on other failures
+ */
+int object_map_update(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  uint64_t start_objno, end_objno;
+  bool exists;
+  try {
+    bufferlist::iterator iter = in->begin();
+    ::decode(start_objno, iter);
+    ::decode(end_objno, iter);
+    ::decode(exists, iter);
+  } catch (const buffer::error &err) {
+    return -EINVAL;
+  }
+
+  if (start_objno >= end_objno)
+    return -EINVAL;
+
+  uint64_t size;
+  int r = cls_cxx_stat(hctx, &size, NULL);
+  if (r < 0)
+    return r;
+  if (object_map_bytes(end_objno) > size) {
+    CLS_ERR("object_map_update: object %llu is past the end of the map",
+	    (unsigned long long)(end_objno - 1));
+    return -ERANGE;
+  }
+
+  uint64_t ofs = start_objno / 8;
+  uint64_t len = object_map_bytes(end_objno) - ofs;
+  bufferlist map;
+  r = cls_cxx_read(hctx, ofs, len, &map);
+  if (r < 0)
+    return r;
+  if (map.length() != len)
+    return -EIO;
+
+  char *p = map.c_str();
+  bool dirty = false;
+  for (uint64_t i = start_objno; i < end_objno; ++i) {
+    if (object_map_test(p, i - ofs * 8) != exists) {
+      object_map_assign(p, i - ofs * 8, exists);
+      dirty = true;
+    }
+  }
+  if (!dirty)
+    return 0;
+
+  CLS_LOG(20, "object_map_update: objects %llu~%llu exists=%d",
+	  (unsigned long long)start_objno,
+	  (unsigned long long)(end_objno - start_objno), (int)exists);
+  return cls_cxx_write(hctx, ofs, len, &map);
+}
+
 /************************ rbd_id object methods **************************/
 
 /**
@@ -1947,6 +2065,14 @@ void __cls_init()
 			  CLS_METHOD_RD | CLS_METHOD_WR,
 			  get_children, &h_get_children);
 
+  /* methods for the rbd_object_map.$image_id objects */
+  cls_register_cxx_method(h_class, "object_map_resize",
+			  CLS_METHOD_RD | CLS_METHOD_WR,
+			  object_map_resize, &h_object_map_resize);
+  cls_register_cxx_method(h_class, "object_map_update",
+			  CLS_METHOD_RD | CLS_METHOD_WR,
+			  object_map_update, &h_object_map_update);
+
   /* methods for the rbd_id.$image_name objects */
   cls_register_cxx_method(h_class, "get_id",
 			  CLS_METHOD_RD,
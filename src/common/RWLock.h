@@ -78,6 +78,28 @@ public:
   void put_write() {
     unlock();
   }
+
+  class RLocker {
+    RWLock &m_lock;
+  public:
+    RLocker(RWLock& lock) : m_lock(lock) {
+      m_lock.get_read();
+    }
+    ~RLocker() {
+      m_lock.unlock();
+    }
+  };
+
+  class WLocker {
+    RWLock &m_lock;
+  public:
+    WLocker(RWLock& lock) : m_lock(lock) {
+      m_lock.get_write();
+    }
+    ~WLocker() {
+      m_lock.unlock();
+    }
+  };
 };
 
 #endif // !_Mutex_Posix_
@@ -4,6 +4,7 @@
 #include "Mutex.h"
 #include "Cond.h"
 #include <list>
+#include "include/Context.h"
 
 class CephContext;
 class PerfCounters;
@@ -53,4 +54,41 @@ public:
 };
 
 
+/**
+ * Bound the number of operations a single caller has in flight, e.g.
+ * aio issued one object at a time: start_op() blocks while max ops
+ * are outstanding, end_op() is called as each one finishes, and
+ * wait_for_ret() waits for the rest and returns the first error.
+ * A max of 0 means no limit.
+ */
+class SimpleThrottle {
+public:
+  SimpleThrottle(uint64_t max, bool ignore_enoent);
+  ~SimpleThrottle();
+  void start_op();
+  void end_op(int r);
+  /// whether an op has failed, so there is no point starting more
+  bool pending_error();
+  int wait_for_ret();
+private:
+  Mutex m_lock;
+  Cond m_cond;
+  uint64_t m_max;
+  uint64_t m_current;
+  int m_ret;
+  bool m_ignore_enoent;
+};
+
+class C_SimpleThrottle : public Context {
+public:
+  C_SimpleThrottle(SimpleThrottle *throttle) : m_throttle(throttle) {
+    m_throttle->start_op();
+  }
+  virtual void finish(int r) {
+    m_throttle->end_op(r);
+  }
+private:
+  SimpleThrottle *m_throttle;
+};
+
 #endif
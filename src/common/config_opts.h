@@ -179,6 +179,9 @@ OPTION(objecter_mon_retry_interval, OPT_DOUBLE, 5.0)
 OPTION(objecter_timeout, OPT_DOUBLE, 10.0)    // before we ask for a map
 OPTION(objecter_inflight_op_bytes, OPT_U64, 1024*1024*100) // max in-flight data (both directions)
 OPTION(objecter_inflight_ops, OPT_U64, 1024)               // max in-flight ios
+OPTION(objecter_batch_window, OPT_DOUBLE, .0002)  // how long batchable ops wait for company
+OPTION(objecter_batch_max_ops, OPT_INT, 32)       // send a batch once it is this big
+OPTION(objecter_pgls_per_osd, OPT_INT, 2)         // max in-flight object listing ops per osd (0 = no limit)
 OPTION(journaler_allow_split_entries, OPT_BOOL, true)
 OPTION(journaler_write_head_interval, OPT_INT, 15)
 OPTION(journaler_prefetch_periods, OPT_INT, 10)   // * journal object size
@@ -283,6 +286,8 @@ OPTION(osd_journal, OPT_STR, "/var/lib/ceph/osd/$cluster-$id/journal")
 OPTION(osd_journal_size, OPT_INT, 1024)         // in mb
 OPTION(osd_max_write_size, OPT_INT, 90)
 OPTION(osd_max_pgls, OPT_U64, 1024) // max number of pgls entries to return
+OPTION(osd_copyfrom_max_chunk, OPT_U64, 8<<20)  // max bytes per read while pulling a copy-from source
+OPTION(osd_copyfrom_max_size, OPT_U64, 100<<20)  // largest copy-from source, held in memory until applied; bigger ones fail with EFBIG. 0 is no limit
 OPTION(osd_client_message_size_cap, OPT_U64, 500*1024L*1024L) // client data allowed in-memory (in bytes)
 OPTION(osd_stat_refresh_interval, OPT_DOUBLE, .5)
 OPTION(osd_pg_bits, OPT_INT, 6)  // bits per osd
@@ -300,6 +305,12 @@ OPTION(osd_map_cache_bl_size, OPT_INT, 50)
 OPTION(osd_map_cache_bl_inc_size, OPT_INT, 100)
 OPTION(osd_map_message_max, OPT_INT, 100)  // max maps per MOSDMap message
 OPTION(osd_op_threads, OPT_INT, 2)    // 0 == no threading
+OPTION(osd_peering_wq_batch_size, OPT_U64, 20)  // max pgs a peering worker takes per batch
+OPTION(osd_op_queue_qos, OPT_BOOL, true)  // schedule client ops by pool qos_* settings (mClock); false == fifo
+OPTION(osd_heat_sketch_width, OPT_U32, 512) // counters per sketch row for per-object heat; 0 disables
+OPTION(osd_heat_top_n, OPT_U32, 16)         // hottest objects remembered per pg
+OPTION(osd_heat_half_life, OPT_DOUBLE, 3600) // seconds; heat counts halve this often
+OPTION(osd_heat_persist_interval, OPT_DOUBLE, 300) // seconds between writing pg heat to disk
 OPTION(osd_disk_threads, OPT_INT, 1)
 OPTION(osd_recovery_threads, OPT_INT, 1)
 OPTION(osd_recover_clone_overlap, OPT_BOOL, true)   // preserve clone_overlap during recovery/migration
@@ -409,6 +420,24 @@ OPTION(rbd_cache_size, OPT_LONGLONG, 32<<20)         // cache size in bytes
 OPTION(rbd_cache_max_dirty, OPT_LONGLONG, 24<<20)    // dirty limit in bytes - set to 0 for write-through caching
 OPTION(rbd_cache_target_dirty, OPT_LONGLONG, 16<<20) // target dirty limit in bytes
 OPTION(rbd_cache_max_dirty_age, OPT_FLOAT, 1.0)      // seconds in cache before writeback starts
+OPTION(rbd_cache_shards, OPT_INT, 1)                 // split the cache into this many independently locked parts, by object
+OPTION(rbd_cache_writeback_window, OPT_LONGLONG, 0) // most bytes of background writeback in flight; 0 is unlimited
+OPTION(rbd_write_log_path, OPT_STR, "") // file, block device or directory for a persistent write-back log; empty disables it
+OPTION(rbd_write_log_size, OPT_LONGLONG, 1<<30) // size of a new write log in bytes
+OPTION(rbd_write_log_destage_ops, OPT_INT, 16) // most writes from the log to the osds in flight
+OPTION(rbd_write_log_crash_on_close, OPT_BOOL, false) // for testing: close the write log without destaging it
+OPTION(rbd_write_log_crash_torn, OPT_BOOL, false) // for testing: with rbd_write_log_crash_on_close, also leave a half-written entry at the end of the log
+OPTION(rbd_readahead_trigger_requests, OPT_INT, 10)   // sequential reads before readahead starts
+OPTION(rbd_readahead_max_bytes, OPT_LONGLONG, 512 * 1024) // largest readahead, and most readahead in flight; 0 disables
+OPTION(rbd_readahead_disable_after_bytes, OPT_LONGLONG, 50 * 1024 * 1024) // stop reading ahead after this much has been read (0 for never)
+OPTION(rbd_clone_copy_on_read, OPT_BOOL, false) // copy an object of a clone from its parent after a read had to go there
+OPTION(rbd_clone_copy_on_read_max_ops, OPT_INT, 4) // most objects being copied on read at once; reads past this don't start a copy
+OPTION(rbd_qos_read_iops_limit, OPT_U64, 0) // reads a second per image; overrides the image's own limit unless 0
+OPTION(rbd_qos_write_iops_limit, OPT_U64, 0) // writes and discards a second per image; overrides the image's own limit unless 0
+OPTION(rbd_qos_read_bps_limit, OPT_U64, 0) // bytes read a second per image; overrides the image's own limit unless 0
+OPTION(rbd_qos_write_bps_limit, OPT_U64, 0) // bytes written a second per image; overrides the image's own limit unless 0
+OPTION(rbd_qos_burst_seconds, OPT_DOUBLE, 1.0) // how many seconds' worth of a qos limit may go at once after a quiet spell
+OPTION(rbd_concurrent_management_ops, OPT_INT, 10) // object ops in flight at once for whole-image operations (copy, flatten, remove, resize, rollback, diff)
 OPTION(rgw_data, OPT_STR, "/var/lib/ceph/radosgw/$cluster-$id")
 OPTION(rgw_cache_enabled, OPT_BOOL, true)   // rgw cache enabled
 OPTION(rgw_cache_lru_size, OPT_INT, 10000)   // num of entries in rgw cache
@@ -0,0 +1,222 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MCLOCKQUEUE_H
+#define CEPH_MCLOCKQUEUE_H
+
+#include <map>
+#include <list>
+#include <limits>
+#include <algorithm>
+
+/*
+ * mClock scheduling (Gulati et al., OSDI '10) over a set of clients,
+ * each with its own FIFO of items.
+ *
+ * Every client has a reservation (minimum rate, items/sec), a weight
+ * (share of whatever capacity is left over) and a limit (maximum rate,
+ * items/sec).  Each item is stamped with three tags when it is queued:
+ *
+ *   R = max(R_prev + 1/reservation, now)
+ *   P = max(P_prev + 1/weight, now)
+ *   L = max(L_prev + 1/limit, now)
+ *
+ * dequeue() first serves the head with the smallest R tag that is due
+ * (R <= now).  Otherwise it serves the smallest P tag among the heads
+ * that are under their limit (L <= now), and charges that client's
+ * outstanding R tags for the item so the proportional share does not
+ * count against its reservation.  If every backlogged client is over
+ * its limit, the smallest P tag is served anyway when limit_break is
+ * set; otherwise nothing is returned.
+ *
+ * A reservation or limit of 0 means none.  A weight of 0 is treated as
+ * 1.  Time is whatever monotonic clock the caller passes in, in
+ * seconds.
+ */
+template <class T, class K>
+class mClockQueue {
+public:
+  enum phase_t {
+    PHASE_RESERVATION,
+    PHASE_WEIGHT,
+    PHASE_LIMIT_BREAK,
+  };
+
+private:
+  struct Item {
+    T item;
+    double r, p, l;   ///< r is stored raw; see Client::r_offset
+    double arrival;
+    Item(const T &i, double r, double p, double l, double a)
+      : item(i), r(r), p(p), l(l), arrival(a) {}
+  };
+
+  struct Client {
+    double reservation, weight, limit;
+    double prev_r, prev_p, prev_l;
+    double r_offset;  ///< R tag credit from items served by weight
+    std::list<Item> q;
+    Client()
+      : reservation(0), weight(1), limit(0),
+	prev_r(0), prev_p(0), prev_l(0), r_offset(0) {}
+    double head_r() const {
+      return q.front().r - r_offset;
+    }
+  };
+
+  std::map<K, Client> clients;
+  unsigned size;
+  bool limit_break;
+
+  static double inv(double rate) {
+    return rate > 0 ? 1.0 / rate : 0;
+  }
+
+public:
+  mClockQueue(bool lb = true) : size(0), limit_break(lb) {}
+
+  void set_limit_break(bool lb) {
+    limit_break = lb;
+  }
+
+  void set_client_info(K cl, double reservation, double weight, double limit) {
+    Client &c = clients[cl];
+    c.reservation = reservation;
+    c.weight = weight > 0 ? weight : 1;
+    c.limit = limit;
+  }
+
+  /// forget idle clients not in the given set
+  template <class S>
+  void trim_clients(const S &keep) {
+    typename std::map<K, Client>::iterator p = clients.begin();
+    while (p != clients.end()) {
+      if (p->second.q.empty() && !keep.count(p->first))
+	clients.erase(p++);
+      else
+	++p;
+    }
+  }
+
+  unsigned length() const {
+    return size;
+  }
+  bool empty() const {
+    return size == 0;
+  }
+
+  void enqueue(K cl, const T &item, double now) {
+    Client &c = clients[cl];
+    double r = std::numeric_limits<double>::max();
+    if (c.reservation > 0) {
+      r = std::max(c.prev_r - c.r_offset + inv(c.reservation), now) + c.r_offset;
+      c.prev_r = r;
+    }
+    c.prev_p = std::max(c.prev_p + inv(c.weight), now);
+    if (c.limit > 0)
+      c.prev_l = std::max(c.prev_l + inv(c.limit), now);
+    else
+      c.prev_l = 0;
+    c.q.push_back(Item(item, r, c.prev_p, c.prev_l, now));
+    size++;
+  }
+
+  /// remove every queued instance of item, appending them to *out
+  void remove(const T &item, std::list<T> *out) {
+    for (typename std::map<K, Client>::iterator p = clients.begin();
+	 p != clients.end();
+	 ++p) {
+      typename std::list<Item>::iterator i = p->second.q.begin();
+      while (i != p->second.q.end()) {
+	if (i->item == item) {
+	  if (out)
+	    out->push_back(i->item);
+	  p->second.q.erase(i++);
+	  size--;
+	} else {
+	  ++i;
+	}
+      }
+    }
+  }
+
+  /**
+   * pick the next item
+   *
+   * @param now current time
+   * @param out [out] the item
+   * @param phase [out] which rule selected it
+   * @param arrival [out] when it was queued
+   * @return false if nothing is eligible right now
+   */
+  bool dequeue(double now, T *out, phase_t *phase, double *arrival) {
+    if (!size)
+      return false;
+
+    typename std::map<K, Client>::iterator best = clients.end();
+    phase_t ph = PHASE_RESERVATION;
+
+    // reservations that are due
+    for (typename std::map<K, Client>::iterator p = clients.begin();
+	 p != clients.end();
+	 ++p) {
+      if (p->second.q.empty() || p->second.reservation <= 0)
+	continue;
+      double r = p->second.head_r();
+      if (r <= now && (best == clients.end() || r < best->second.head_r()))
+	best = p;
+    }
+
+    // weight-based share among those under their limit
+    if (best == clients.end()) {
+      ph = PHASE_WEIGHT;
+      typename std::map<K, Client>::iterator lowest = clients.end();
+      for (typename std::map<K, Client>::iterator p = clients.begin();
+	   p != clients.end();
+	   ++p) {
+	if (p->second.q.empty())
+	  continue;
+	double pt = p->second.q.front().p;
+	if (lowest == clients.end() || pt < lowest->second.q.front().p)
+	  lowest = p;
+	if (p->second.q.front().l <= now &&
+	    (best == clients.end() || pt < best->second.q.front().p))
+	  best = p;
+      }
+      if (best == clients.end()) {
+	if (!limit_break)
+	  return false;
+	ph = PHASE_LIMIT_BREAK;
+	best = lowest;
+      }
+      if (best->second.reservation > 0)
+	best->second.r_offset += inv(best->second.reservation);
+    }
+
+    Client &c = best->second;
+    *out = c.q.front().item;
+    if (phase)
+      *phase = ph;
+    if (arrival)
+      *arrival = c.q.front().arrival;
+    c.q.pop_front();
+    size--;
+    if (c.q.empty()) {
+      // nothing outstanding to charge; start clean when next active
+      c.prev_r -= c.r_offset;
+      c.r_offset = 0;
+    }
+    return true;
+  }
+};
+
+#endif
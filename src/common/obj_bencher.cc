@@ -15,6 +15,7 @@
  * it will just loop forever.
  */
 #include "common/Cond.h"
+#include "common/errno.h"
 #include "obj_bencher.h"
 
 #include <iostream>
@@ -172,7 +173,7 @@ int ObjBencher::aio_bench(int operation, int secondsToRun, int concurrentios, in
   int prevPid = 0;
 
   //get data from previous write run, if available
-  if (operation != OP_WRITE) {
+  if (operation == OP_SEQ_READ || operation == OP_RAND_READ) {
     r = fetch_bench_metadata(BENCH_LASTRUN_METADATA, &object_size, &num_objects, &prevPid);
     if (r < 0) {
       delete[] contentsChars;
@@ -214,6 +215,10 @@ int ObjBencher::aio_bench(int operation, int secondsToRun, int concurrentios, in
     cerr << "Random test not implemented yet!" << std::endl;
     r = -1;
   }
+  else if (OP_SMALL == operation) {
+    r = small_op_bench(secondsToRun, concurrentios, cleanup);
+    if (r != 0) goto out;
+  }
 
   if (OP_WRITE == operation && cleanup) {
     r = fetch_bench_metadata(BENCH_LASTRUN_METADATA, &object_size, &num_objects, &prevPid);
@@ -491,6 +496,136 @@ int ObjBencher::write_bench(int secondsToRun, int concurrentios) {
   return -5;
 }
 
+struct small_op_arg {
+  ObjBencher *bencher;
+  int id;
+  int r;
+  pthread_t thread;
+};
+
+/*
+ * one of the small op threads: alternate synchronous writes and reads
+ * of our own object until told to stop.
+ */
+void *ObjBencher::small_op_worker(void *_arg)
+{
+  small_op_arg *arg = (small_op_arg *)_arg;
+  ObjBencher *bencher = arg->bencher;
+  bench_data& data = bencher->data;
+  std::string oid = generate_object_name(arg->id);
+  bufferlist bl;
+  bl.append(data.object_contents, data.object_size);
+  bool write = true;  // the first op creates the object
+
+  bencher->lock.Lock();
+  while (!data.done) {
+    ++data.started;
+    ++data.in_flight;
+    bencher->lock.Unlock();
+
+    utime_t start = ceph_clock_now(g_ceph_context);
+    int r;
+    if (write) {
+      r = bencher->sync_write(oid, bl, data.object_size);
+    } else {
+      bufferlist in;
+      r = bencher->sync_read(oid, in, data.object_size);
+    }
+    utime_t lat = ceph_clock_now(g_ceph_context) - start;
+
+    bencher->lock.Lock();
+    --data.in_flight;
+    if (r < 0) {
+      arg->r = r;
+      break;
+    }
+    data.cur_latency = lat;
+    data.history.latency.push_back(lat);
+    if (lat > data.max_latency) data.max_latency = lat;
+    if (lat < data.min_latency) data.min_latency = lat;
+    ++data.finished;
+    data.avg_latency += ((double)lat - data.avg_latency) / data.finished;
+    write = !write;
+  }
+  bencher->lock.Unlock();
+  return NULL;
+}
+
+/*
+ * small op benchmark: many threads, each with a single small
+ * synchronous op in flight.  this measures how well the client
+ * scales with the number of submitting threads rather than with
+ * queue depth.
+ */
+int ObjBencher::small_op_bench(int secondsToRun, int threads, bool cleanup)
+{
+  out(cout) << "Running " << threads << " threads, each with one "
+	    << data.object_size << " byte write or read in flight, for at least "
+	    << secondsToRun << " seconds." << std::endl;
+  out(cout) << "Object prefix: " << generate_object_prefix() << std::endl;
+
+  int r = 0;
+  vector<small_op_arg> args(threads);
+  pthread_t print_thread;
+
+  pthread_create(&print_thread, NULL, ObjBencher::status_printer, (void *)this);
+  lock.Lock();
+  data.start_time = ceph_clock_now(g_ceph_context);
+  lock.Unlock();
+  for (int i = 0; i < threads; ++i) {
+    args[i].bencher = this;
+    args[i].id = i;
+    args[i].r = 0;
+    pthread_create(&args[i].thread, NULL, ObjBencher::small_op_worker, (void *)&args[i]);
+  }
+
+  utime_t runtime;
+  runtime.set_from_double(secondsToRun);
+  utime_t stopTime = data.start_time + runtime;
+  utime_t ONE_SECOND;
+  ONE_SECOND.set_from_double(1.0);
+  Cond cond;
+  lock.Lock();
+  while (ceph_clock_now(g_ceph_context) < stopTime)
+    cond.WaitInterval(g_ceph_context, lock, ONE_SECOND);
+  data.done = true;
+  lock.Unlock();
+
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(args[i].thread, NULL);
+    if (args[i].r < 0 && r == 0)
+      r = args[i].r;
+  }
+  utime_t timePassed = ceph_clock_now(g_ceph_context) - data.start_time;
+  pthread_join(print_thread, NULL);
+
+  if (r < 0) {
+    cerr << "error during small op benchmark: " << cpp_strerror(r) << std::endl;
+  } else {
+    double iops = (double)data.finished / (double)timePassed;
+    double bandwidth = iops * data.object_size / (1024*1024);
+    out(cout) << "Total time run:         " << timePassed << std::endl
+	 << "Total ops made:         " << data.finished << std::endl
+	 << "Op size:                " << data.object_size << std::endl
+	 << "Threads:                " << threads << std::endl
+	 << "Ops per second:         " << iops << std::endl
+	 << "Bandwidth (MB/sec):     " << bandwidth << std::endl
+	 << "Average Latency:        " << data.avg_latency << std::endl
+	 << "Stddev Latency:         " << vec_stddev(data.history.latency) << std::endl
+	 << "Max latency:            " << data.max_latency << std::endl
+	 << "Min latency:            " << data.min_latency << std::endl;
+  }
+
+  if (cleanup) {
+    for (int i = 0; i < threads; ++i) {
+      int ret = sync_remove(generate_object_name(i));
+      if (ret < 0 && ret != -ENOENT && r == 0)
+	r = ret;
+    }
+  }
+  return r;
+}
+
 int ObjBencher::seq_read_bench(int seconds_to_run, int num_objects, int concurrentios, int pid) {
   lock_cond lc(&lock);
   std::string name[concurrentios];
@@ -48,6 +48,7 @@ struct bench_data {
 const int OP_WRITE     = 1;
 const int OP_SEQ_READ  = 2;
 const int OP_RAND_READ = 3;
+const int OP_SMALL     = 4;
 
 class ObjBencher {
   bool show_time;
@@ -55,6 +56,7 @@ protected:
   Mutex lock;
 
   static void *status_printer(void *bencher);
+  static void *small_op_worker(void *arg);
 
   struct bench_data data;
 
@@ -62,6 +64,7 @@ protected:
 
   int write_bench(int secondsToRun, int concurrentios);
   int seq_read_bench(int secondsToRun, int concurrentios, int num_objects, int writePid);
+  int small_op_bench(int secondsToRun, int threads, bool cleanup);
 
   int clean_up(int num_objects, int prevPid, int concurrentios);
   int clean_up_slow(const std::string& prefix, int concurrentios);
@@ -27,6 +27,7 @@
 #define CEPH_FEATURE_MON_NULLROUTE  (1<<20)
 #define CEPH_FEATURE_MON_GV         (1<<21)
 #define CEPH_FEATURE_BACKFILL_RESERVATION (1<<22)
+#define CEPH_FEATURE_OSD_OP_BATCH   (1<<23)
 
 /*
  * Features supported.  Should be everything above.
@@ -54,7 +55,8 @@
 	 CEPH_FEATURE_CHUNKY_SCRUB |	 \
 	 CEPH_FEATURE_MON_NULLROUTE |	 \
 	 CEPH_FEATURE_MON_GV |		 \
-	 CEPH_FEATURE_BACKFILL_RESERVATION )
+	 CEPH_FEATURE_BACKFILL_RESERVATION | \
+	 CEPH_FEATURE_OSD_OP_BATCH )
 
 #define CEPH_FEATURES_SUPPORTED_DEFAULT  CEPH_FEATURES_ALL
 
@@ -49,6 +49,8 @@ const char *ceph_osd_op_name(int op)
 	case CEPH_OSD_OP_CLONERANGE: return "clonerange";
 	case CEPH_OSD_OP_ASSERT_SRC_VERSION: return "assert-src-version";
 	case CEPH_OSD_OP_SRC_CMPXATTR: return "src-cmpxattr";
+	case CEPH_OSD_OP_COPY_FROM: return "copy-from";
+	case CEPH_OSD_OP_LIST_SNAPS: return "list-snaps";
 
 	case CEPH_OSD_OP_GETXATTR: return "getxattr";
 	case CEPH_OSD_OP_GETXATTRS: return "getxattrs";
@@ -79,6 +81,7 @@ const char *ceph_osd_op_name(int op)
 
 	case CEPH_OSD_OP_PGLS: return "pgls";
 	case CEPH_OSD_OP_PGLS_FILTER: return "pgls-filter";
+	case CEPH_OSD_OP_PGHOT: return "pghot";
 	case CEPH_OSD_OP_OMAPGETKEYS: return "omap-get-keys";
 	case CEPH_OSD_OP_OMAPGETVALS: return "omap-get-vals";
 	case CEPH_OSD_OP_OMAPGETHEADER: return "omap-get-header";
@@ -34,7 +34,7 @@ extern "C" {
 
 /**
  * @defgroup librados_h_xattr_comp xattr comparison operations
- * @note BUG: there's no way to use these in the C api
+ * Used with rados_write_op_cmpxattr() and rados_read_op_cmpxattr().
  * @{
  */
 /** @cond TODO_enums_not_yet_in_asphyxiate */
@@ -50,6 +50,55 @@ enum {
 /** @endcond */
 /** @} */
 
+/**
+ * @defgroup librados_h_op_flags per-op flags
+ * Set on the last op added to a compound operation with
+ * rados_write_op_set_flags() or rados_read_op_set_flags().
+ * @{
+ */
+/** @cond TODO_enums_not_yet_in_asphyxiate */
+enum {
+	/// fail a create that finds the object already exists
+	LIBRADOS_OP_FLAG_EXCL   = 1,
+	/// let the rest of the operation go ahead even if this op fails
+	LIBRADOS_OP_FLAG_FAILOK = 2
+};
+/** @endcond */
+/** @} */
+
+/**
+ * @defgroup librados_h_copy_from_flags flags for copy_from
+ * Passed to rados_write_op_copy_from() and ObjectWriteOperation::copy_from().
+ * @{
+ */
+/** @cond TODO_enums_not_yet_in_asphyxiate */
+enum {
+	/// copy only the data, leaving the target's xattrs and omap alone
+	LIBRADOS_COPY_FROM_DATA_ONLY = 1
+};
+/** @endcond */
+/** @} */
+
+/**
+ * @defgroup librados_h_read_policy read policies
+ * Where reads from an io context are sent; see
+ * rados_ioctx_set_read_policy().
+ * @{
+ */
+/** @cond TODO_enums_not_yet_in_asphyxiate */
+enum {
+	/// always the primary (the default)
+	LIBRADOS_READ_PRIMARY = 0,
+	/// any OSD holding the object, chosen at random
+	LIBRADOS_READ_BALANCE = 1,
+	/// an OSD on this host holding the object, if there is one
+	LIBRADOS_READ_LOCALIZE = 2,
+	/// whichever OSD holding the object has the fewest of our ops in flight
+	LIBRADOS_READ_LEAST_LOADED = 3
+};
+/** @endcond */
+/** @} */
+
 /**
  * @typedef rados_t
  *
@@ -116,6 +165,33 @@ typedef uint64_t rados_snap_t;
  */
 typedef void *rados_xattrs_iter_t;
 
+/**
+ * @typedef rados_omap_iter_t
+ * An iterator for listing omap key/value pairs on an object.
+ * Filled in by rados_read_op_omap_get_vals() and friends, and read
+ * with rados_omap_get_next() and rados_omap_get_end().
+ */
+typedef void *rados_omap_iter_t;
+
+/**
+ * @typedef rados_write_op_t
+ *
+ * A compound write operation: several ops applied atomically to one
+ * object in a single round trip. Build it with the rados_write_op_*
+ * functions and submit it with rados_write_op_operate() or
+ * rados_aio_write_op_operate().
+ */
+typedef void *rados_write_op_t;
+
+/**
+ * @typedef rados_read_op_t
+ *
+ * A compound read operation: several reads of one object in a single
+ * round trip. Build it with the rados_read_op_* functions and submit
+ * it with rados_read_op_operate() or rados_aio_read_op_operate().
+ */
+typedef void *rados_read_op_t;
+
 /**
  * @struct rados_pool_stat_t
  * Usage information for a pool.
@@ -620,6 +696,78 @@ int rados_ioctx_get_pool_name(rados_ioctx_t io, char *buf, unsigned maxlen);
 void rados_ioctx_locator_set_key(rados_ioctx_t io, const char *key);
 /** @} obj_loc */
 
+/**
+ * Enable or disable op batching for an io context.
+ *
+ * With batching on, ops from this io context may wait a short while
+ * (the objecter_batch_window option) before being sent, so that
+ * several ops headed to the same OSD share a single message. Each op
+ * still completes and reports its result individually.
+ *
+ * @param io the io context to change
+ * @param batch nonzero to enable batching
+ */
+void rados_ioctx_set_op_batching(rados_ioctx_t io, int batch);
+
+/**
+ * Choose where reads from an io context go.
+ *
+ * Anything but LIBRADOS_READ_PRIMARY lets pure reads (no writes, no
+ * watch/notify) be served by replicas, which spreads the load of
+ * read-mostly pools over all their OSDs. A replica that can't answer
+ * a read consistently (it is still recovering the object, or has an
+ * update to it in progress) sends it back, and it is retried on the
+ * primary. Reads may observe a write that is still in progress, just
+ * as they could on the primary.
+ *
+ * @param io the io context to change
+ * @param policy one of LIBRADOS_READ_*
+ * @returns 0 on success, -EINVAL for an unknown policy
+ */
+int rados_ioctx_set_read_policy(rados_ioctx_t io, int policy);
+
+/**
+ * Limit the aio in flight on an io context.
+ *
+ * Once either limit would be exceeded, rados_aio_* calls on this io
+ * context fail immediately with -EAGAIN instead of queueing more
+ * work, so an event loop can stop reading requests from its own
+ * clients until some of its ios complete. Writes count until they are
+ * safe, reads until they complete. A single op is always admitted
+ * when nothing else is in flight, however large it is.
+ *
+ * @param io the io context to change
+ * @param max_ops most aio ops in flight, or 0 for no limit
+ * @param max_bytes most bytes of aio data in flight, or 0 for no limit
+ */
+void rados_ioctx_set_aio_limits(rados_ioctx_t io, uint64_t max_ops,
+				uint64_t max_bytes);
+
+/**
+ * Keep aio submission on an io context from blocking.
+ *
+ * By default an aio call that finds the client-wide throttles
+ * (objecter_inflight_ops and objecter_inflight_op_bytes) full sleeps
+ * until an earlier op completes. With this set the op is instead
+ * parked and sent, in order, once there is room, and the call returns
+ * at once.
+ *
+ * @param io the io context to change
+ * @param nonblocking nonzero to never block in aio submission
+ */
+void rados_ioctx_set_aio_nonblocking(rados_ioctx_t io, int nonblocking);
+
+/**
+ * Get how much aio is in flight on an io context, as counted against
+ * the limits set by rados_ioctx_set_aio_limits().
+ *
+ * @param io the io context
+ * @param ops where to store the number of aio ops in flight
+ * @param bytes where to store the bytes of aio data in flight
+ */
+void rados_ioctx_get_aio_inflight(rados_ioctx_t io, uint64_t *ops,
+				  uint64_t *bytes);
+
 /**
  * @defgroup librados_h_list_obj Listing Objects
  * @{
@@ -633,6 +781,23 @@ void rados_ioctx_locator_set_key(rados_ioctx_t io, const char *key);
  */
 int rados_objects_list_open(rados_ioctx_t io, rados_list_ctx_t *ctx);
 
+/**
+ * Start listing part of the objects in a pool
+ *
+ * The pool is split into num_parts parts by placement group, and this
+ * lists the objects in one of them. Listing every part, in any order
+ * and as concurrently as you like, lists the whole pool. Use one
+ * handle per thread.
+ *
+ * @param io the pool to list from
+ * @param part which part to list, from 0 to num_parts - 1
+ * @param num_parts how many parts to split the pool into
+ * @param ctx the handle to store list context in
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_objects_list_open_part(rados_ioctx_t io, uint32_t part,
+				 uint32_t num_parts, rados_list_ctx_t *ctx);
+
 /**
  * Get the next object name and locator in the pool
  *
@@ -1319,6 +1484,14 @@ int rados_aio_is_safe_and_cb(rados_completion_t c);
  */
 int rados_aio_get_return_value(rados_completion_t c);
 
+/**
+ * Get the application-defined data a completion was created with
+ *
+ * @param c completion to inspect
+ * @returns the cb_arg passed when c was created
+ */
+void *rados_aio_get_arg(rados_completion_t c);
+
 /**
  * Release a completion
  *
@@ -1329,6 +1502,77 @@ int rados_aio_get_return_value(rados_completion_t c);
  */
 void rados_aio_release(rados_completion_t c);
 
+/**
+ * @typedef rados_completion_queue_t
+ *
+ * A queue that completions are posted to when their operations
+ * complete, for use from an event loop. The queue has a file
+ * descriptor that is readable whenever completions are waiting, so
+ * it can be watched with poll(2), epoll(7) or similar, and any number
+ * of completions can be reaped per wakeup without blocking or
+ * callbacks.
+ */
+typedef void *rados_completion_queue_t;
+
+/**
+ * Create a completion queue
+ *
+ * @param cq where to store the queue
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_completion_queue_create(rados_completion_queue_t *cq);
+
+/**
+ * Destroy a completion queue
+ *
+ * There must be no operations in flight with completions that post
+ * to it. Completions that were posted but not reaped are dropped.
+ *
+ * @param cq the queue to destroy
+ */
+void rados_completion_queue_destroy(rados_completion_queue_t cq);
+
+/**
+ * Get the file descriptor to wait on for a completion queue
+ *
+ * It is readable while the queue is not empty. Do not read from or
+ * close it; rados_completion_queue_reap() takes care of that.
+ *
+ * @param cq the queue
+ * @returns the file descriptor
+ */
+int rados_completion_queue_get_fd(rados_completion_queue_t cq);
+
+/**
+ * Construct a completion that is posted to a completion queue
+ *
+ * It is posted once its operation completes, at the same point a
+ * complete callback would be called. Use rados_aio_get_arg() to get
+ * cb_arg back after reaping it.
+ *
+ * @param cb_arg application-defined data
+ * @param cq the queue to post to
+ * @param pc where to store the completion
+ * @returns 0
+ */
+int rados_aio_create_completion_cq(void *cb_arg, rados_completion_queue_t cq,
+				   rados_completion_t *pc);
+
+/**
+ * Take completed operations off a completion queue
+ *
+ * Does not block. The completions returned still need to be released
+ * with rados_aio_release(); do not release them before they have been
+ * reaped.
+ *
+ * @param cq the queue
+ * @param completions where to store the completions
+ * @param max size of the completions array
+ * @returns the number of completions stored
+ */
+int rados_completion_queue_reap(rados_completion_queue_t cq,
+				rados_completion_t *completions, int max);
+
 /**
  * Write data to an object asynchronously
  *
@@ -1446,6 +1690,347 @@ int rados_aio_flush(rados_ioctx_t io);
 
 /** @} Asynchronous I/O */
 
+/**
+ * @defgroup librados_h_compound_ops Compound Operations
+ *
+ * A compound operation bundles several ops on a single object into
+ * one request. Write operations are applied atomically: if one op
+ * fails (and was not flagged with LIBRADOS_OP_FLAG_FAILOK), none of
+ * them take effect. Read operations return a result per op through
+ * the prval arguments.
+ *
+ * Output buffers and prval pointers must stay valid until the
+ * operation is complete (for reads) or safe (for writes). An
+ * operation may only be submitted once, and must be released with
+ * rados_release_write_op() or rados_release_read_op() afterwards.
+ *
+ * @{
+ */
+
+/**
+ * Create a new, empty, write operation
+ *
+ * @returns the new operation, or NULL on allocation failure
+ */
+rados_write_op_t rados_create_write_op(void);
+
+/**
+ * Free a write operation and anything it still owns
+ *
+ * @param write_op operation to free
+ */
+void rados_release_write_op(rados_write_op_t write_op);
+
+/**
+ * Set flags on the last op added to the operation
+ *
+ * @param write_op operation to change
+ * @param flags any of LIBRADOS_OP_FLAG_*
+ */
+void rados_write_op_set_flags(rados_write_op_t write_op, int flags);
+
+/**
+ * Fail the whole operation with -ERANGE unless the object's version
+ * is ver
+ *
+ * @param write_op operation to add this to
+ * @param ver version the object must have
+ */
+void rados_write_op_assert_version(rados_write_op_t write_op, uint64_t ver);
+
+/**
+ * Fail the whole operation unless an xattr compares as expected
+ *
+ * @param write_op operation to add this to
+ * @param name xattr to compare
+ * @param comparison_operator one of LIBRADOS_CMPXATTR_OP_*
+ * @param value buffer to compare the xattr against
+ * @param value_len length of value in bytes
+ */
+void rados_write_op_cmpxattr(rados_write_op_t write_op, const char *name,
+			     uint8_t comparison_operator,
+			     const char *value, size_t value_len);
+
+void rados_write_op_setxattr(rados_write_op_t write_op, const char *name,
+			     const char *value, size_t value_len);
+void rados_write_op_rmxattr(rados_write_op_t write_op, const char *name);
+
+/**
+ * Create the object
+ *
+ * @param write_op operation to add this to
+ * @param exclusive nonzero to fail if the object already exists
+ */
+void rados_write_op_create(rados_write_op_t write_op, int exclusive);
+
+void rados_write_op_write(rados_write_op_t write_op, const char *buffer,
+			  size_t len, uint64_t offset);
+void rados_write_op_write_full(rados_write_op_t write_op, const char *buffer,
+			       size_t len);
+void rados_write_op_append(rados_write_op_t write_op, const char *buffer,
+			   size_t len);
+void rados_write_op_remove(rados_write_op_t write_op);
+void rados_write_op_truncate(rados_write_op_t write_op, uint64_t offset);
+void rados_write_op_zero(rados_write_op_t write_op, uint64_t offset,
+			 uint64_t len);
+
+/**
+ * Replace the object with a copy of another one
+ *
+ * The OSD storing the target reads the source's data, xattrs and
+ * omap directly from the OSD storing the source, so none of it passes
+ * through the client. The source may be in a different pool, in which
+ * case the client needs read access to that pool as well.
+ *
+ * @param write_op operation to add this to
+ * @param src_io the ioctx the source object is in; its read snapshot
+ * (see rados_ioctx_snap_set_read()) is the one copied
+ * @param src the name of the source object
+ * @param src_version fail (as rados_write_op_assert_version() would)
+ * unless the source is at this version, or 0 to copy whatever is there
+ * @param flags any of LIBRADOS_COPY_FROM_*
+ */
+void rados_write_op_copy_from(rados_write_op_t write_op, rados_ioctx_t src_io,
+			      const char *src, uint64_t src_version,
+			      int flags);
+
+/**
+ * Call an OSD class method as part of the operation
+ *
+ * @param write_op operation to add this to
+ * @param cls the name of the class
+ * @param method the name of the method
+ * @param in_buf where to find input
+ * @param in_len length of in_buf in bytes
+ * @param prval where to store the return value of the method
+ */
+void rados_write_op_exec(rados_write_op_t write_op, const char *cls,
+			 const char *method, const char *in_buf,
+			 size_t in_len, int *prval);
+
+/**
+ * Set key/value pairs in the object map
+ *
+ * @param write_op operation to add this to
+ * @param keys array of null-terminated keys
+ * @param vals array of values
+ * @param lens array of the lengths of the values
+ * @param num number of key/value pairs
+ */
+void rados_write_op_omap_set(rados_write_op_t write_op,
+			     char const * const *keys,
+			     char const * const *vals,
+			     const size_t *lens, size_t num);
+void rados_write_op_omap_rm_keys(rados_write_op_t write_op,
+				 char const * const *keys, size_t keys_len);
+void rados_write_op_omap_clear(rados_write_op_t write_op);
+
+/**
+ * Perform a write operation synchronously
+ *
+ * @param write_op operation to perform
+ * @param io the ioctx that the object is in
+ * @param oid the object id
+ * @param mtime the time to set the mtime to, NULL for the current time
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_write_op_operate(rados_write_op_t write_op, rados_ioctx_t io,
+			   const char *oid, time_t *mtime);
+
+/**
+ * Perform a write operation asynchronously
+ *
+ * @param write_op operation to perform
+ * @param io the ioctx that the object is in
+ * @param completion what to do when the operation has been attempted
+ * @param oid the object id
+ * @param mtime the time to set the mtime to, NULL for the current time
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_write_op_operate(rados_write_op_t write_op, rados_ioctx_t io,
+			       rados_completion_t completion, const char *oid,
+			       time_t *mtime);
+
+/**
+ * Create a new, empty, read operation
+ *
+ * @returns the new operation, or NULL on allocation failure
+ */
+rados_read_op_t rados_create_read_op(void);
+
+/**
+ * Free a read operation and anything it still owns
+ *
+ * @param read_op operation to free
+ */
+void rados_release_read_op(rados_read_op_t read_op);
+
+void rados_read_op_set_flags(rados_read_op_t read_op, int flags);
+void rados_read_op_assert_version(rados_read_op_t read_op, uint64_t ver);
+void rados_read_op_cmpxattr(rados_read_op_t read_op, const char *name,
+			    uint8_t comparison_operator,
+			    const char *value, size_t value_len);
+
+/**
+ * Get the size and mtime of the object
+ *
+ * @param read_op operation to add this to
+ * @param psize where to store the size, or NULL
+ * @param pmtime where to store the mtime, or NULL
+ * @param prval where to store the return value of this op, or NULL
+ */
+void rados_read_op_stat(rados_read_op_t read_op, uint64_t *psize,
+			time_t *pmtime, int *prval);
+
+/**
+ * Read data from the object
+ *
+ * @param read_op operation to add this to
+ * @param offset offset to read from
+ * @param len the number of bytes to read; buf must be at least this big
+ * @param buf where to put the data
+ * @param bytes_read where to store the number of bytes read, or NULL
+ * @param prval where to store the return value of this op, or NULL
+ */
+void rados_read_op_read(rados_read_op_t read_op, uint64_t offset, size_t len,
+			char *buf, size_t *bytes_read, int *prval);
+
+/**
+ * Get the value of an xattr
+ *
+ * If the value does not fit in buf, *prval is set to -ERANGE.
+ *
+ * @param read_op operation to add this to
+ * @param name xattr to read
+ * @param buf where to put the value
+ * @param len size of buf in bytes
+ * @param value_len where to store the length of the value, or NULL
+ * @param prval where to store the return value of this op, or NULL
+ */
+void rados_read_op_getxattr(rados_read_op_t read_op, const char *name,
+			    char *buf, size_t len, size_t *value_len,
+			    int *prval);
+
+/**
+ * Get all the xattrs of the object
+ *
+ * The iterator is valid once the operation completes, and must be
+ * freed with rados_getxattrs_end() even if the operation fails.
+ *
+ * @param read_op operation to add this to
+ * @param iter where to store the iterator
+ * @param prval where to store the return value of this op, or NULL
+ */
+void rados_read_op_getxattrs(rados_read_op_t read_op,
+			     rados_xattrs_iter_t *iter, int *prval);
+
+/**
+ * Call an OSD class method as part of the operation
+ *
+ * If the output does not fit in out_buf, *prval is set to -ERANGE.
+ *
+ * @param read_op operation to add this to
+ * @param cls the name of the class
+ * @param method the name of the method
+ * @param in_buf where to find input
+ * @param in_len length of in_buf in bytes
+ * @param out_buf where to put the output
+ * @param out_len size of out_buf in bytes
+ * @param used_len where to store the length of the output, or NULL
+ * @param prval where to store the return value of the method, or NULL
+ */
+void rados_read_op_exec(rados_read_op_t read_op, const char *cls,
+			const char *method, const char *in_buf, size_t in_len,
+			char *out_buf, size_t out_len, size_t *used_len,
+			int *prval);
+
+/**
+ * Get key/value pairs from the object map
+ *
+ * The iterator is valid once the operation completes, and must be
+ * freed with rados_omap_get_end() even if the operation fails.
+ *
+ * @param read_op operation to add this to
+ * @param start_after list keys starting after start_after
+ * @param filter_prefix list only keys beginning with filter_prefix
+ * @param max_return list no more than max_return key/value pairs
+ * @param iter where to store the iterator
+ * @param prval where to store the return value of this op, or NULL
+ */
+void rados_read_op_omap_get_vals(rados_read_op_t read_op,
+				 const char *start_after,
+				 const char *filter_prefix,
+				 uint64_t max_return,
+				 rados_omap_iter_t *iter, int *prval);
+
+/**
+ * Get keys from the object map; the values returned by the iterator
+ * are empty.
+ *
+ * @see rados_read_op_omap_get_vals()
+ */
+void rados_read_op_omap_get_keys(rados_read_op_t read_op,
+				 const char *start_after,
+				 uint64_t max_return,
+				 rados_omap_iter_t *iter, int *prval);
+
+/**
+ * Get the values of specific keys from the object map
+ *
+ * @see rados_read_op_omap_get_vals()
+ */
+void rados_read_op_omap_get_vals_by_keys(rados_read_op_t read_op,
+					 char const * const *keys,
+					 size_t keys_len,
+					 rados_omap_iter_t *iter, int *prval);
+
+/**
+ * Get the next key/value pair from an omap iterator
+ *
+ * key and val are NULL once the end of the list is reached. They
+ * stay valid until the next call, or until the iterator is freed.
+ *
+ * @param iter the iterator to advance
+ * @param key where to store the key
+ * @param val where to store the value
+ * @param len where to store the length of the value
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_omap_get_next(rados_omap_iter_t iter, char **key, char **val,
+			size_t *len);
+
+/**
+ * Free an omap iterator
+ *
+ * @param iter the iterator to free
+ */
+void rados_omap_get_end(rados_omap_iter_t iter);
+
+/**
+ * Perform a read operation synchronously
+ *
+ * @param read_op operation to perform
+ * @param io the ioctx that the object is in
+ * @param oid the object id
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_read_op_operate(rados_read_op_t read_op, rados_ioctx_t io,
+			  const char *oid);
+
+/**
+ * Perform a read operation asynchronously
+ *
+ * @param read_op operation to perform
+ * @param io the ioctx that the object is in
+ * @param completion what to do when the operation has been attempted
+ * @param oid the object id
+ * @returns 0 on success, negative error code on failure
+ */
+int rados_aio_read_op_operate(rados_read_op_t read_op, rados_ioctx_t io,
+			      rados_completion_t completion, const char *oid);
+
+/** @} Compound Operations */
+
 /**
  * @defgroup librados_h_watch_notify Watch/Notify
  *
@@ -12,6 +12,7 @@
 #include "buffer.h"
 
 #include "librados.h"
+#include "rados_types.hpp"
 
 namespace librados
 {
@@ -26,7 +27,6 @@ namespace librados
   class RadosClient;
 
   typedef void *list_ctx_t;
-  typedef uint64_t snap_t;
   typedef uint64_t auid_t;
   typedef void *config_t;
 
@@ -49,6 +49,12 @@ namespace librados
 
   typedef std::map<std::string, pool_stat_t> stats_map;
 
+  struct object_heat_t {
+    std::string oid;
+    std::string locator;
+    uint64_t reads, writes;   // recent, decayed counts
+  };
+
   typedef void *completion_t;
   typedef void (*callback_t)(completion_t cb, void *arg);
 
@@ -206,6 +212,28 @@ namespace librados
                      const std::string& src_oid, uint64_t src_off,
                      size_t len);
 
+    /**
+     * replace the object with a copy of src, done entirely by the osds
+     *
+     * @param src [in] name of the object to copy
+     * @param src_ioctx [in] pool (and read snap) src is in
+     * @param src_version [in] required version of src, or 0 for any
+     * @param flags [in] any of LIBRADOS_COPY_FROM_*
+     *
+     * The op fails with -EFBIG if src is larger than the osd's
+     * osd_copyfrom_max_size, and -EOPNOTSUPP on osds without copy-from.
+     */
+    void copy_from(const std::string& src, const IoCtx& src_ioctx,
+		   uint64_t src_version, unsigned flags = 0);
+
+    /**
+     * roll the object back to a self-managed snapshot, like
+     * IoCtx::selfmanaged_snap_rollback()
+     *
+     * @param snapid [in] snapshot to roll back to
+     */
+    void selfmanaged_snap_rollback(snap_t snapid);
+
     /**
      * set keys and values according to map
      *
@@ -321,6 +349,18 @@ namespace librados
 			       std::map<std::string, bufferlist> *map,
 			       int *prval);
 
+    /**
+     * list_snaps: the object's clones, which snaps each belongs to, and
+     * how much of each is shared with the next newer one
+     *
+     * The IoCtx must be reading at SNAP_DIR (see snap_set_read()).
+     *
+     * @param out_snaps [out] clones, oldest first, then the head if it
+     * exists
+     * @param prval [out] place error code in prval upon completion
+     */
+    void list_snaps(snap_set_t *out_snaps, int *prval);
+
   };
 
 
@@ -381,6 +421,8 @@ namespace librados
     int setxattr(const std::string& oid, const char *name, bufferlist& bl);
     int rmxattr(const std::string& oid, const char *name);
     int stat(const std::string& oid, uint64_t *psize, time_t *pmtime);
+    /// see ObjectReadOperation::list_snaps(); -EINVAL unless reading at SNAP_DIR
+    int list_snaps(const std::string& oid, snap_set_t *out_snaps);
     int exec(const std::string& oid, const char *cls, const char *method,
 	     bufferlist& inbl, bufferlist& outbl);
     int tmap_update(const std::string& oid, bufferlist& cmdbl);
@@ -443,8 +485,23 @@ namespace librados
     int selfmanaged_snap_rollback(const std::string& oid, uint64_t snapid);
 
     ObjectIterator objects_begin();
+    /// list part of the pool; see rados_objects_list_open_part()
+    ObjectIterator objects_begin(uint32_t part, uint32_t num_parts);
     const ObjectIterator& objects_end() const;
 
+    /**
+     * the most frequently accessed objects in the pool, hottest first
+     *
+     * Counts are estimates kept by each pg's primary and decay over
+     * time (see osd_heat_half_life); objects are only reported if the
+     * OSDs have heat tracking enabled.
+     *
+     * @param max maximum number of objects to return
+     * @param out [out] the objects
+     * @returns 0 on success, negative error code on failure
+     */
+    int hot_objects(unsigned max, std::list<object_heat_t> *out);
+
     uint64_t get_last_version();
 
     int aio_read(const std::string& oid, AioCompletion *c,
@@ -501,6 +558,34 @@ namespace librados
 
     void locator_set_key(const std::string& key);
 
+    /**
+     * let small ops from this io context wait briefly (see
+     * objecter_batch_window) so that several ops to the same osd can
+     * go out in a single message.  completions are unaffected.
+     */
+    void set_op_batching(bool batch);
+
+    /**
+     * choose where reads go: one of LIBRADOS_READ_*.  see
+     * rados_ioctx_set_read_policy().
+     */
+    int set_read_policy(int policy);
+
+    /**
+     * fail aio on this io context with -EAGAIN once max_ops ops or
+     * max_bytes bytes are in flight (0 for no limit).  see
+     * rados_ioctx_set_aio_limits().
+     */
+    void set_aio_limits(uint64_t max_ops, uint64_t max_bytes);
+
+    /**
+     * park aio that hits the client-wide throttles instead of
+     * sleeping in the submitting thread.
+     */
+    void set_aio_nonblocking(bool nonblocking);
+
+    void get_aio_inflight(uint64_t *ops, uint64_t *bytes);
+
     int64_t get_id();
 
     config_t cct();
@@ -510,6 +595,7 @@ namespace librados
     IoCtx(IoCtxImpl *io_ctx_impl_);
 
     friend class Rados; // Only Rados can use our private constructor to create IoCtxes.
+    friend class ObjectWriteOperation; // copy_from needs the source's locator
 
     IoCtxImpl *io_ctx_impl;
   };
@@ -0,0 +1,33 @@
+#ifndef CEPH_RADOS_TYPES_HPP
+#define CEPH_RADOS_TYPES_HPP
+
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+namespace librados {
+
+  typedef uint64_t snap_t;
+
+  enum {
+    SNAP_HEAD = (uint64_t)(-2),
+    SNAP_DIR = (uint64_t)(-1)
+  };
+
+  struct clone_info_t {
+    snap_t cloneid;                     // SNAP_HEAD for the head
+    std::vector<snap_t> snaps;          // ascending
+    std::vector< std::pair<uint64_t,uint64_t> > overlap;  // with next newest
+    uint64_t size;
+    clone_info_t() : cloneid(0), size(0) {}
+  };
+
+  struct snap_set_t {
+    std::vector<clone_info_t> clones;   // ascending
+    snap_t seq;   // newest snapid seen by the object
+    snap_set_t() : seq(0) {}
+  };
+
+}
+
+#endif
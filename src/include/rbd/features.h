@@ -2,8 +2,11 @@
 #define CEPH_RBD_FEATURES_H
 
 #define RBD_FEATURE_LAYERING      1
+#define RBD_FEATURE_OBJECT_MAP    2
 
-#define RBD_FEATURES_INCOMPATIBLE (RBD_FEATURE_LAYERING)
-#define RBD_FEATURES_ALL          (RBD_FEATURE_LAYERING)
+#define RBD_FEATURES_INCOMPATIBLE (RBD_FEATURE_LAYERING | \
+				   RBD_FEATURE_OBJECT_MAP)
+#define RBD_FEATURES_ALL          (RBD_FEATURE_LAYERING | \
+				   RBD_FEATURE_OBJECT_MAP)
 
 #endif
@@ -42,6 +42,11 @@ extern "C" {
 typedef void *rbd_snap_t;
 typedef void *rbd_image_t;
 
+/*
+ * A negative return cancels the copy, flatten, remove, resize or
+ * rollback being reported on: it stops once the object operations
+ * already in flight finish, and returns the same value.
+ */
 typedef int (*librbd_progress_fn_t)(uint64_t offset, uint64_t total, void *ptr);
 
 typedef struct {
@@ -92,6 +97,38 @@ int rbd_get_parent_info(rbd_image_t image,
 			char *parent_poolname, size_t ppoolnamelen,
 			char *parent_name, size_t pnamelen,
 			char *parent_snapname, size_t psnapnamelen);
+/**
+ * Get how much of the image, or of the snapshot set via rbd_snap_set(),
+ * has been written to: the size of each data object that exists. For
+ * the image itself this comes from its object map, if it has one;
+ * otherwise every object is looked for.
+ *
+ * @param used where to store the number of bytes
+ * @returns 0 on success, negative error code on failure
+ */
+int rbd_get_used_size(rbd_image_t image, uint64_t *used);
+/**
+ * Get one of the image's own qos limits, as kept in its header. The
+ * limit in effect may differ if the client's configuration sets it.
+ *
+ * @param name read_iops, write_iops, read_bps or write_bps
+ * @param limit where to store the limit, in ios or bytes a second,
+ * or 0 if there is none
+ * @returns 0 on success, negative error code on failure
+ * @returns -EINVAL if name isn't a qos limit
+ */
+int rbd_qos_get_limit(rbd_image_t image, const char *name, uint64_t *limit);
+/**
+ * Set one of the image's own qos limits, for every client that has it
+ * open or opens it later. IO over the limit is held back, not failed.
+ *
+ * @param name read_iops, write_iops, read_bps or write_bps
+ * @param limit ios or bytes a second, or 0 for no limit
+ * @returns 0 on success, negative error code on failure
+ * @returns -EINVAL if name isn't a qos limit
+ * @returns -EROFS if the image is open at a snapshot
+ */
+int rbd_qos_set_limit(rbd_image_t image, const char *name, uint64_t limit);
 int rbd_copy(rbd_image_t image, rados_ioctx_t dest_io_ctx, const char *destname);
 int rbd_copy_with_progress(rbd_image_t image, rados_ioctx_t dest_p, const char *destname,
 			   librbd_progress_fn_t cb, void *cbdata);
@@ -133,6 +170,33 @@ int rbd_snap_set(rbd_image_t image, const char *snapname);
 
 int rbd_flatten(rbd_image_t image);
 
+/**
+ * Compare an image's object map with the data objects that exist.
+ *
+ * @param missing where to store the number of objects that exist but
+ * are not in the map, which reads would wrongly treat as zeroes
+ * @param stale where to store the number of objects in the map that
+ * don't exist, which is harmless
+ * @returns 0 on success, negative error code on failure
+ * @returns -EINVAL if the image has no object map
+ */
+int rbd_object_map_check(rbd_image_t image, uint64_t *missing,
+			 uint64_t *stale);
+int rbd_object_map_check_with_progress(rbd_image_t image, uint64_t *missing,
+				       uint64_t *stale,
+				       librbd_progress_fn_t cb, void *cbdata);
+/**
+ * Rewrite an image's object map from the data objects that exist.
+ * Nobody else may be using the image while this runs.
+ *
+ * @returns 0 on success, negative error code on failure
+ * @returns -EINVAL if the image has no object map
+ * @returns -EBUSY if someone else holds a lock on the image
+ */
+int rbd_object_map_rebuild(rbd_image_t image);
+int rbd_object_map_rebuild_with_progress(rbd_image_t image,
+					 librbd_progress_fn_t cb, void *cbdata);
+
 /**
  * List all images that are cloned from the image at the
  * snapshot that is set via rbd_snap_set().
@@ -261,6 +325,31 @@ typedef void (*rbd_callback_t)(rbd_completion_t cb, void *arg);
 ssize_t rbd_read(rbd_image_t image, uint64_t ofs, size_t len, char *buf);
 int64_t rbd_read_iterate(rbd_image_t image, uint64_t ofs, size_t len,
 			 int (*cb)(uint64_t, size_t, const char *, void *), void *arg);
+/**
+ * get the extents that differ between a snapshot and the image
+ *
+ * Call cb for each extent in ofs~len that changed between fromsnapname
+ * and the snapshot set via rbd_snap_set() (or the image itself, if
+ * none is set), in ascending order.  exists is 1 if the extent has
+ * data at the newer point, or 0 if it reads as zeroes there.  Extents
+ * may be larger than what was actually written; they are reported in
+ * units of what the osds keep track of.
+ *
+ * @param fromsnapname the older snapshot, or NULL for the whole
+ * history of the image (including its parent, if it is a clone)
+ * @param ofs start of the range to compare
+ * @param len length of the range to compare
+ * @param cb called as cb(offset, length, exists, arg); a negative
+ * return stops the iteration and is returned
+ * @param arg passed through to cb
+ * @returns 0 on success, negative error code on failure
+ * @returns -ENOENT if fromsnapname does not exist
+ * @returns -EINVAL if fromsnapname is newer than the snapshot set
+ */
+int rbd_diff_iterate(rbd_image_t image,
+		     const char *fromsnapname,
+		     uint64_t ofs, uint64_t len,
+		     int (*cb)(uint64_t, size_t, int, void *), void *arg);
 ssize_t rbd_write(rbd_image_t image, uint64_t ofs, size_t len, const char *buf);
 int rbd_discard(rbd_image_t image, uint64_t ofs, uint64_t len);
 int rbd_aio_write(rbd_image_t image, uint64_t off, size_t len, const char *buf, rbd_completion_t c);
@@ -51,6 +51,7 @@ namespace librbd {
   {
   public:
     virtual ~ProgressContext();
+    /* see librbd_progress_fn_t in librbd.h for what a negative return does */
     virtual int update_progress(uint64_t offset, uint64_t total) = 0;
   };
 
@@ -104,12 +105,23 @@ public:
   int size(uint64_t *size);
   int features(uint64_t *features);
   int overlap(uint64_t *overlap);
+  int used_size(uint64_t *used);
+  /* qos limits (see librbd.h for details) */
+  int qos_get_limit(const char *name, uint64_t *limit);
+  int qos_set_limit(const char *name, uint64_t limit);
   int copy(IoCtx& dest_io_ctx, const char *destname);
   int copy_with_progress(IoCtx& dest_io_ctx, const char *destname,
 			 ProgressContext &prog_ctx);
 
   int flatten();
   int flatten_with_progress(ProgressContext &prog_ctx);
+
+  /* object map (see librbd.h for details) */
+  int object_map_check(uint64_t *missing, uint64_t *stale);
+  int object_map_check_with_progress(uint64_t *missing, uint64_t *stale,
+				     ProgressContext &prog_ctx);
+  int object_map_rebuild();
+  int object_map_rebuild_with_progress(ProgressContext &prog_ctx);
   /**
    * Returns a pair of poolname, imagename for each clone
    * of this image at the currently set snapshot.
@@ -139,6 +151,10 @@ public:
   ssize_t read(uint64_t ofs, size_t len, ceph::bufferlist& bl);
   int64_t read_iterate(uint64_t ofs, size_t len,
 		       int (*cb)(uint64_t, size_t, const char *, void *), void *arg);
+  /* see rbd_diff_iterate() in librbd.h */
+  int diff_iterate(const char *fromsnapname,
+		   uint64_t ofs, uint64_t len,
+		   int (*cb)(uint64_t, size_t, int, void *), void *arg);
   ssize_t write(uint64_t ofs, size_t len, ceph::bufferlist& bl);
   int discard(uint64_t ofs, uint64_t len);
 
@@ -24,6 +24,8 @@
 /* New-style rbd image 'foo' consists of objects
  *   rbd_id.foo              - id of image
  *   rbd_header.<id>         - image metadata
+ *   rbd_object_map.<id>     - which data objects exist (if the image
+ *                             has RBD_FEATURE_OBJECT_MAP)
  *   rbd_data.<id>.00000000
  *   rbd_data.<id>.00000001
  *   ...                     - data
@@ -32,6 +34,7 @@
 #define RBD_HEADER_PREFIX      "rbd_header."
 #define RBD_DATA_PREFIX        "rbd_data."
 #define RBD_ID_PREFIX          "rbd_id."
+#define RBD_OBJECT_MAP_PREFIX  "rbd_object_map."
 
 /*
  * old-style rbd image 'foo' consists of objects
@@ -26,6 +26,10 @@
 
 class IoCtxImpl;
 
+namespace librados {
+  struct CompletionQueueImpl;
+}
+
 struct librados::AioCompletionImpl {
   Mutex lock;
   Cond cond;
@@ -37,6 +41,9 @@ struct librados::AioCompletionImpl {
   rados_callback_t callback_complete, callback_safe;
   void *callback_arg;
 
+  /// posted here once complete, if set
+  CompletionQueueImpl *cq;
+
   // for read
   bool is_read;
   bufferlist bl, *pbl;
@@ -44,14 +51,17 @@ struct librados::AioCompletionImpl {
   unsigned maxlen;
 
   IoCtxImpl *io;
+  /// counted against io's aio limits until it completes
+  bool admitted;
+  uint64_t admit_bytes;
   tid_t aio_write_seq;
   xlist<AioCompletionImpl*>::item aio_write_list_item;
 
   AioCompletionImpl() : lock("AioCompletionImpl lock"),
 			ref(1), rval(0), released(false), ack(false), safe(false),
-			callback_complete(0), callback_safe(0), callback_arg(0),
+			callback_complete(0), callback_safe(0), callback_arg(0), cq(NULL),
 			is_read(false), pbl(0), buf(0), maxlen(0),
-			io(NULL), aio_write_seq(0), aio_write_list_item(this) { }
+			io(NULL), admitted(false), admit_bytes(0), aio_write_seq(0), aio_write_list_item(this) { }
 
   int set_complete_callback(void *cb_arg, rados_callback_t cb) {
     lock.Lock();
@@ -125,6 +135,12 @@ struct librados::AioCompletionImpl {
     lock.Unlock();
     return r;
   }
+  void *get_arg() {
+    lock.Lock();
+    void *arg = callback_arg;
+    lock.Unlock();
+    return arg;
+  }
   uint64_t get_version() {
     lock.Lock();
     eversion_t v = objver;
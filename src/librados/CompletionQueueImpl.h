@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_LIBRADOS_COMPLETIONQUEUEIMPL_H
+#define CEPH_LIBRADOS_COMPLETIONQUEUEIMPL_H
+
+#include <deque>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "common/Mutex.h"
+#include "librados/AioCompletionImpl.h"
+
+/*
+ * completed aios, waiting to be reaped by an event loop.
+ *
+ * the eventfd is readable exactly when the queue is non-empty: post()
+ * only signals it on the empty -> non-empty transition, and reap()
+ * drains it when it takes the last entry.  both happen under the lock,
+ * so the two can't get out of step, and a burst of completions costs
+ * the reaper a single wakeup.
+ */
+struct librados::CompletionQueueImpl {
+  Mutex lock;
+  int fd;
+  std::deque<AioCompletionImpl*> done;
+
+  CompletionQueueImpl() : lock("CompletionQueueImpl::lock"), fd(-1) {}
+  ~CompletionQueueImpl() {
+    // drop the refs of anything nobody reaped
+    while (!done.empty()) {
+      done.front()->put();
+      done.pop_front();
+    }
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  int init() {
+    fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+      return -errno;
+    return 0;
+  }
+
+  /// c->lock held; the queue holds a ref until c is reaped
+  void post(AioCompletionImpl *c) {
+    c->ref++;
+    Mutex::Locker l(lock);
+    done.push_back(c);
+    if (done.size() == 1) {
+      uint64_t one = 1;
+      int r = ::write(fd, &one, sizeof(one));
+      assert(r == sizeof(one));
+    }
+  }
+
+  int reap(AioCompletionImpl **out, int max) {
+    int n = 0;
+    lock.Lock();
+    while (n < max && !done.empty()) {
+      out[n++] = done.front();
+      done.pop_front();
+    }
+    if (n && done.empty()) {
+      uint64_t v;
+      int r = ::read(fd, &v, sizeof(v));
+      assert(r == sizeof(v));
+    }
+    lock.Unlock();
+
+    // the caller still holds its own ref on each of these
+    for (int i = 0; i < n; i++)
+      out[i]->put();
+    return n;
+  }
+};
+
+#endif
@@ -17,8 +17,10 @@
 #include "IoCtxImpl.h"
 
 #include "librados/AioCompletionImpl.h"
+#include "librados/CompletionQueueImpl.h"
 #include "librados/PoolAsyncCompletionImpl.h"
 #include "librados/RadosClient.h"
+#include "osd/ObjectHeat.h"
 #include "include/assert.h"
 
 #define dout_subsys ceph_subsys_rados
@@ -27,8 +29,12 @@
 
 librados::IoCtxImpl::IoCtxImpl() :
   ref_cnt(0), client(NULL), poolid(0), assert_ver(0), notify_timeout(30),
+  extra_op_flags(0),
   aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock"),
-  aio_write_seq(0), lock(NULL), objecter(NULL)
+  aio_write_seq(0),
+  aio_admit_lock("librados::IoCtxImpl::aio_admit_lock"),
+  aio_max_ops(0), aio_max_bytes(0), aio_ops(0), aio_bytes(0),
+  lock(NULL), objecter(NULL)
 {
 }
 
@@ -37,9 +43,12 @@ librados::IoCtxImpl::IoCtxImpl(RadosClient *c, Objecter *objecter,
 			       const char *pool_name, snapid_t s)
   : ref_cnt(0), client(c), poolid(poolid), pool_name(pool_name), snap_seq(s),
     assert_ver(0), notify_timeout(c->cct->_conf->client_notify_timeout),
-    oloc(poolid),
+    oloc(poolid), extra_op_flags(0),
     aio_write_list_lock("librados::IoCtxImpl::aio_write_list_lock"),
-    aio_write_seq(0), lock(client_lock), objecter(objecter)
+    aio_write_seq(0),
+    aio_admit_lock("librados::IoCtxImpl::aio_admit_lock"),
+    aio_max_ops(0), aio_max_bytes(0), aio_ops(0), aio_bytes(0),
+    lock(client_lock), objecter(objecter)
 {
 }
 
@@ -341,6 +350,73 @@ int librados::IoCtxImpl::list(Objecter::ListContext *context, int max_entries)
   return r;
 }
 
+static bool hotter(const pair<uint64_t, librados::object_heat_t>& l,
+		   const pair<uint64_t, librados::object_heat_t>& r)
+{
+  return l.first > r.first;
+}
+
+int librados::IoCtxImpl::hot_objects(unsigned max,
+				     std::list<librados::object_heat_t> *out)
+{
+  Mutex mylock("IoCtxImpl::hot_objects::mylock");
+  Cond cond;
+  bool done;
+  int r = 0;
+
+  // ask every pg at once
+  lock->Lock();
+  const pg_pool_t *pool = objecter->osdmap->get_pg_pool(poolid);
+  if (!pool) {
+    lock->Unlock();
+    return -ENOENT;
+  }
+  unsigned pg_num = pool->get_pg_num();
+  vector<bufferlist> bls(pg_num);
+  C_GatherBuilder gather(client->cct, new C_SafeCond(&mylock, &cond, &done, &r));
+  for (unsigned ps = 0; ps < pg_num; ++ps) {
+    ::ObjectOperation op;
+    op.pg_hot(max);
+    objecter->pg_read(ps, oloc, op, &bls[ps], 0, gather.new_sub());
+  }
+  gather.activate();
+  lock->Unlock();
+
+  mylock.Lock();
+  while (!done)
+    cond.Wait(mylock);
+  mylock.Unlock();
+  if (r < 0)
+    return r;
+
+  vector<pair<uint64_t, librados::object_heat_t> > all;
+  for (unsigned ps = 0; ps < pg_num; ++ps) {
+    std::list<pair<hobject_t, ObjectHeat::entry_t> > top;
+    try {
+      bufferlist::iterator p = bls[ps].begin();
+      if (!p.end())
+	::decode(top, p);
+    } catch (buffer::error& e) {
+      return -EIO;
+    }
+    for (std::list<pair<hobject_t, ObjectHeat::entry_t> >::iterator p = top.begin();
+	 p != top.end();
+	 ++p) {
+      librados::object_heat_t h;
+      h.oid = p->first.oid.name;
+      h.locator = p->first.get_key();
+      h.reads = p->second.reads;
+      h.writes = p->second.writes;
+      all.push_back(make_pair(p->second.heat(), h));
+    }
+  }
+
+  sort(all.begin(), all.end(), hotter);
+  for (unsigned i = 0; i < all.size() && i < max; ++i)
+    out->push_back(all[i].second);
+  return 0;
+}
+
 int librados::IoCtxImpl::create(const object_t& oid, bool exclusive)
 {
   utime_t ut = ceph_clock_now(client->cct);
@@ -357,11 +433,9 @@ int librados::IoCtxImpl::create(const object_t& oid, bool exclusive)
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   objecter->create(oid, oloc,
-		  snapc, ut, 0, (exclusive ? CEPH_OSD_OP_FLAG_EXCL : 0),
+		  snapc, ut, extra_op_flags, (exclusive ? CEPH_OSD_OP_FLAG_EXCL : 0),
 		  onack, NULL, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -393,9 +467,7 @@ int librados::IoCtxImpl::create(const object_t& oid, bool exclusive,
   ::ObjectOperation o;
   o.create(exclusive ? CEPH_OSD_OP_FLAG_EXCL : 0, category);
 
-  lock->Lock();
-  objecter->mutate(oid, oloc, o, snapc, ut, 0, onack, NULL, &ver);
-  lock->Unlock();
+  objecter->mutate(oid, oloc, o, snapc, ut, extra_op_flags, onack, NULL, &ver);
 
   mylock.Lock();
   while (!done)
@@ -455,11 +527,9 @@ int librados::IoCtxImpl::write(const object_t& oid, bufferlist& bl,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->write(oid, oloc,
-		  off, len, snapc, bl, ut, 0,
+		  off, len, snapc, bl, ut, extra_op_flags,
 		  onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -493,11 +563,9 @@ int librados::IoCtxImpl::append(const object_t& oid, bufferlist& bl, size_t len)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->append(oid, oloc,
-		   len, snapc, bl, ut, 0,
+		   len, snapc, bl, ut, extra_op_flags,
 		   onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -532,11 +600,9 @@ int librados::IoCtxImpl::write_full(const object_t& oid, bufferlist& bl)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->write_full(oid, oloc,
-		       snapc, bl, ut, 0,
+		       snapc, bl, ut, extra_op_flags,
 		       onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -569,12 +635,10 @@ int librados::IoCtxImpl::clone_range(const object_t& dst_oid,
 
   bufferlist outbl;
 
-  lock->Lock();
   ::ObjectOperation wr;
   prepare_assert_ops(&wr);
   wr.clone_range(src_oid, src_offset, len, dst_offset);
-  objecter->mutate(dst_oid, oloc, wr, snapc, ut, 0, onack, NULL, &ver);
-  lock->Unlock();
+  objecter->mutate(dst_oid, oloc, wr, snapc, ut, extra_op_flags, onack, NULL, &ver);
 
   mylock.Lock();
   while (!done)
@@ -611,11 +675,9 @@ int librados::IoCtxImpl::operate(const object_t& oid, ::ObjectOperation *o,
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   objecter->mutate(oid, oloc,
-	           *o, snapc, ut, 0,
+	           *o, snapc, ut, extra_op_flags,
 	           onack, NULL, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -641,11 +703,9 @@ int librados::IoCtxImpl::operate_read(const object_t& oid,
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   objecter->read(oid, oloc,
-	           *o, snap_seq, pbl, 0,
+	           *o, snap_seq, pbl, extra_op_flags,
 	           onack, &ver);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -657,39 +717,110 @@ int librados::IoCtxImpl::operate_read(const object_t& oid,
   return r;
 }
 
+void librados::IoCtxImpl::set_aio_limits(uint64_t max_ops, uint64_t max_bytes)
+{
+  Mutex::Locker l(aio_admit_lock);
+  aio_max_ops = max_ops;
+  aio_max_bytes = max_bytes;
+}
+
+void librados::IoCtxImpl::set_aio_nonblocking(bool nb)
+{
+  if (nb)
+    extra_op_flags |= CEPH_OSD_FLAG_OBJECTER_NOBLOCK;
+  else
+    extra_op_flags &= ~CEPH_OSD_FLAG_OBJECTER_NOBLOCK;
+}
+
+void librados::IoCtxImpl::get_aio_inflight(uint64_t *ops, uint64_t *bytes)
+{
+  Mutex::Locker l(aio_admit_lock);
+  if (ops)
+    *ops = aio_ops;
+  if (bytes)
+    *bytes = aio_bytes;
+}
+
+/*
+ * count an aio against this ioctx's limits, or fail it with -EAGAIN
+ * before anything has been allocated for it.  a lone op is always let
+ * through, however big, so that an over-sized request can't wedge.
+ */
+int librados::IoCtxImpl::aio_admit(AioCompletionImpl *c, uint64_t bytes)
+{
+  Mutex::Locker l(aio_admit_lock);
+  if (aio_ops > 0 &&
+      ((aio_max_ops && aio_ops + 1 > aio_max_ops) ||
+       (aio_max_bytes && aio_bytes + bytes > aio_max_bytes))) {
+    ldout(client->cct, 20) << "aio_admit " << aio_ops << " ops " << aio_bytes
+			   << " bytes in flight, refusing " << bytes << dendl;
+    return -EAGAIN;
+  }
+  aio_ops++;
+  aio_bytes += bytes;
+  c->admitted = true;
+  c->admit_bytes = bytes;
+  return 0;
+}
+
+/// c->lock held
+void librados::IoCtxImpl::aio_unadmit(AioCompletionImpl *c)
+{
+  if (!c->admitted)
+    return;
+  Mutex::Locker l(aio_admit_lock);
+  aio_ops--;
+  aio_bytes -= c->admit_bytes;
+  c->admitted = false;
+}
+
 int librados::IoCtxImpl::aio_operate_read(const object_t &oid,
 					  ::ObjectOperation *o,
 					  AioCompletionImpl *c, bufferlist *pbl)
 {
+  int r = aio_admit(c, 0);
+  if (r < 0)
+    return r;
+
   Context *onack = new C_aio_Ack(c);
 
   c->is_read = true;
   c->io = this;
   c->pbl = pbl;
 
-  Mutex::Locker l(*lock);
   objecter->read(oid, oloc,
-		 *o, snap_seq, pbl, 0,
+		 *o, snap_seq, pbl, extra_op_flags,
 		 onack, &c->objver);
   return 0;
 }
 
 int librados::IoCtxImpl::aio_operate(const object_t& oid,
-				     ::ObjectOperation *o, AioCompletionImpl *c)
+				     ::ObjectOperation *o, AioCompletionImpl *c,
+				     time_t *pmtime)
 {
-  utime_t ut = ceph_clock_now(client->cct);
+  utime_t ut;
+  if (pmtime)
+    ut = utime_t(*pmtime, 0);
+  else
+    ut = ceph_clock_now(client->cct);
   /* can't write to a snapshot */
   if (snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  uint64_t bytes = 0;
+  for (vector<OSDOp>::iterator p = o->ops.begin(); p != o->ops.end(); ++p)
+    bytes += p->indata.length();
+  int r = aio_admit(c, bytes);
+  if (r < 0)
+    return r;
+
   Context *onack = new C_aio_Ack(c);
   Context *oncommit = new C_aio_Safe(c);
 
   c->io = this;
   queue_aio_write(c);
 
-  Mutex::Locker l(*lock);
-  objecter->mutate(oid, oloc, *o, snapc, ut, 0, onack, oncommit, &c->objver);
+  objecter->mutate(oid, oloc, *o, snapc, ut, extra_op_flags, onack, oncommit, &c->objver);
 
   return 0;
 }
@@ -700,6 +831,10 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
   if (len > (size_t) INT_MAX)
     return -EDOM;
 
+  int r = aio_admit(c, len);
+  if (r < 0)
+    return r;
+
   Context *onack = new C_aio_Ack(c);
   eversion_t ver;
 
@@ -707,9 +842,8 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
   c->io = this;
   c->pbl = pbl;
 
-  Mutex::Locker l(*lock);
   objecter->read(oid, oloc,
-		 off, len, snap_seq, &c->bl, 0,
+		 off, len, snap_seq, &c->bl, extra_op_flags,
 		 onack, &c->objver);
   return 0;
 }
@@ -720,6 +854,10 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
   if (len > (size_t) INT_MAX)
     return -EDOM;
 
+  int r = aio_admit(c, len);
+  if (r < 0)
+    return r;
+
   Context *onack = new C_aio_Ack(c);
 
   c->is_read = true;
@@ -727,9 +865,13 @@ int librados::IoCtxImpl::aio_read(const object_t oid, AioCompletionImpl *c,
   c->buf = buf;
   c->maxlen = len;
 
-  Mutex::Locker l(*lock);
+  // have the messenger read the reply straight into buf
+  c->bl.clear();
+  if (len)
+    c->bl.push_back(buffer::create_static(len, buf));
+
   objecter->read(oid, oloc,
-		 off, len, snap_seq, &c->bl, 0,
+		 off, len, snap_seq, &c->bl, extra_op_flags,
 		 onack, &c->objver);
 
   return 0;
@@ -744,15 +886,18 @@ int librados::IoCtxImpl::aio_sparse_read(const object_t oid,
   if (len > (size_t) INT_MAX)
     return -EDOM;
 
+  int r = aio_admit(c, len);
+  if (r < 0)
+    return r;
+
   C_aio_sparse_read_Ack *onack = new C_aio_sparse_read_Ack(c, data_bl, m);
   eversion_t ver;
 
   c->io = this;
   c->pbl = NULL;
 
-  Mutex::Locker l(*lock);
   objecter->sparse_read(oid, oloc,
-		 off, len, snap_seq, &c->bl, 0,
+		 off, len, snap_seq, &c->bl, extra_op_flags,
 		 onack);
   return 0;
 }
@@ -768,15 +913,18 @@ int librados::IoCtxImpl::aio_write(const object_t &oid, AioCompletionImpl *c,
   if (snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  int r = aio_admit(c, len);
+  if (r < 0)
+    return r;
+
   c->io = this;
   queue_aio_write(c);
 
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->write(oid, oloc,
-		  off, len, snapc, bl, ut, 0,
+		  off, len, snapc, bl, ut, extra_op_flags,
 		  onack, onsafe, &c->objver);
 
   return 0;
@@ -791,15 +939,18 @@ int librados::IoCtxImpl::aio_append(const object_t &oid, AioCompletionImpl *c,
   if (snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  int r = aio_admit(c, len);
+  if (r < 0)
+    return r;
+
   c->io = this;
   queue_aio_write(c);
 
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->append(oid, oloc,
-		   len, snapc, bl, ut, 0,
+		   len, snapc, bl, ut, extra_op_flags,
 		   onack, onsafe, &c->objver);
 
   return 0;
@@ -815,15 +966,18 @@ int librados::IoCtxImpl::aio_write_full(const object_t &oid,
   if (snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  int r = aio_admit(c, bl.length());
+  if (r < 0)
+    return r;
+
   c->io = this;
   queue_aio_write(c);
 
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->write_full(oid, oloc,
-		       snapc, bl, ut, 0,
+		       snapc, bl, ut, extra_op_flags,
 		       onack, onsafe, &c->objver);
 
   return 0;
@@ -837,15 +991,18 @@ int librados::IoCtxImpl::aio_remove(const object_t &oid, AioCompletionImpl *c)
   if (snap_seq != CEPH_NOSNAP)
     return -EROFS;
 
+  int r = aio_admit(c, 0);
+  if (r < 0)
+    return r;
+
   c->io = this;
   queue_aio_write(c);
 
   Context *onack = new C_aio_Ack(c);
   Context *onsafe = new C_aio_Safe(c);
 
-  Mutex::Locker l(*lock);
   objecter->remove(oid, oloc,
-		   snapc, ut, 0,
+		   snapc, ut, extra_op_flags,
 		   onack, onsafe, &c->objver);
 
   return 0;
@@ -869,11 +1026,9 @@ int librados::IoCtxImpl::remove(const object_t& oid)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->remove(oid, oloc,
-		   snapc, ut, 0,
+		   snapc, ut, extra_op_flags,
 		   onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -904,12 +1059,10 @@ int librados::IoCtxImpl::trunc(const object_t& oid, uint64_t size)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->trunc(oid, oloc,
-		  snapc, ut, 0,
+		  snapc, ut, extra_op_flags,
 		  size, 0,
 		  onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -938,12 +1091,10 @@ int librados::IoCtxImpl::tmap_update(const object_t& oid, bufferlist& cmdbl)
 
   bufferlist outbl;
 
-  lock->Lock();
   ::ObjectOperation wr;
   prepare_assert_ops(&wr);
   wr.tmap_update(cmdbl);
-  objecter->mutate(oid, oloc, wr, snapc, ut, 0, onack, NULL, &ver);
-  lock->Unlock();
+  objecter->mutate(oid, oloc, wr, snapc, ut, extra_op_flags, onack, NULL, &ver);
 
   mylock.Lock();
   while (!done)
@@ -972,12 +1123,10 @@ int librados::IoCtxImpl::tmap_put(const object_t& oid, bufferlist& bl)
 
   bufferlist outbl;
 
-  lock->Lock();
   ::ObjectOperation wr;
   prepare_assert_ops(&wr);
   wr.tmap_put(bl);
-  objecter->mutate(oid, oloc, wr, snapc, ut, 0, onack, NULL, &ver);
-  lock->Unlock();
+  objecter->mutate(oid, oloc, wr, snapc, ut, extra_op_flags, onack, NULL, &ver);
 
   mylock.Lock();
   while (!done)
@@ -1004,12 +1153,10 @@ int librados::IoCtxImpl::tmap_get(const object_t& oid, bufferlist& bl)
 
   bufferlist outbl;
 
-  lock->Lock();
   ::ObjectOperation rd;
   prepare_assert_ops(&rd);
   rd.tmap_get(&bl, NULL);
-  objecter->read(oid, oloc, rd, snap_seq, 0, 0, onack, &ver);
-  lock->Unlock();
+  objecter->read(oid, oloc, rd, snap_seq, 0, extra_op_flags, onack, &ver);
 
   mylock.Lock();
   while (!done)
@@ -1034,12 +1181,10 @@ int librados::IoCtxImpl::exec(const object_t& oid,
   eversion_t ver;
 
 
-  lock->Lock();
   ::ObjectOperation rd;
   prepare_assert_ops(&rd);
   rd.call(cls, method, inbl);
-  objecter->read(oid, oloc, rd, snap_seq, &outbl, 0, onack, &ver);
-  lock->Unlock();
+  objecter->read(oid, oloc, rd, snap_seq, &outbl, extra_op_flags, onack, &ver);
 
   mylock.Lock();
   while (!done)
@@ -1055,16 +1200,19 @@ int librados::IoCtxImpl::aio_exec(const object_t& oid, AioCompletionImpl *c,
 				  const char *cls, const char *method,
 				  bufferlist& inbl, bufferlist *outbl)
 {
+  int r = aio_admit(c, inbl.length());
+  if (r < 0)
+    return r;
+
   Context *onack = new C_aio_Ack(c);
 
   c->is_read = true;
   c->io = this;
 
-  Mutex::Locker l(*lock);
   ::ObjectOperation rd;
   prepare_assert_ops(&rd);
   rd.call(cls, method, inbl);
-  objecter->read(oid, oloc, rd, snap_seq, outbl, 0, onack, &c->objver);
+  objecter->read(oid, oloc, rd, snap_seq, outbl, extra_op_flags, onack, &c->objver);
 
   return 0;
 }
@@ -1086,11 +1234,9 @@ int librados::IoCtxImpl::read(const object_t& oid,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->read(oid, oloc,
-		 off, len, snap_seq, &bl, 0,
+		 off, len, snap_seq, &bl, extra_op_flags,
 		 onack, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1123,11 +1269,9 @@ int librados::IoCtxImpl::mapext(const object_t& oid,
   int r;
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   objecter->mapext(oid, oloc,
-		   off, len, snap_seq, &bl, 0,
+		   off, len, snap_seq, &bl, extra_op_flags,
 		   onack);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1160,11 +1304,9 @@ int librados::IoCtxImpl::sparse_read(const object_t& oid,
   int r;
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   objecter->sparse_read(oid, oloc,
-			off, len, snap_seq, &bl, 0,
+			off, len, snap_seq, &bl, extra_op_flags,
 			onack);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1199,11 +1341,9 @@ int librados::IoCtxImpl::stat(const object_t& oid, uint64_t *psize, time_t *pmti
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->stat(oid, oloc,
-		 snap_seq, psize, &mtime, 0,
+		 snap_seq, psize, &mtime, extra_op_flags,
 		 onack, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1233,11 +1373,9 @@ int librados::IoCtxImpl::getxattr(const object_t& oid,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->getxattr(oid, oloc,
-		     name, snap_seq, &bl, 0,
+		     name, snap_seq, &bl, extra_op_flags,
 		     onack, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1272,11 +1410,9 @@ int librados::IoCtxImpl::rmxattr(const object_t& oid, const char *name)
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->removexattr(oid, oloc, name,
-			snapc, ut, 0,
+			snapc, ut, extra_op_flags,
 			onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1311,11 +1447,9 @@ int librados::IoCtxImpl::setxattr(const object_t& oid,
   ::ObjectOperation op;
   ::ObjectOperation *pop = prepare_assert_ops(&op);
 
-  lock->Lock();
   objecter->setxattr(oid, oloc, name,
-		     snapc, bl, ut, 0,
+		     snapc, bl, ut, extra_op_flags,
 		     onack, NULL, &ver, pop);
-  lock->Unlock();
 
   mylock.Lock();
   while (!done)
@@ -1344,12 +1478,10 @@ int librados::IoCtxImpl::getxattrs(const object_t& oid,
 
   Context *onack = new C_SafeCond(&mylock, &cond, &done, &r);
 
-  lock->Lock();
   map<string, bufferlist> aset;
   objecter->getxattrs(oid, oloc, snap_seq,
 		      aset,
-		      0, onack, &ver, pop);
-  lock->Unlock();
+		      extra_op_flags, onack, &ver, pop);
 
   attrset.clear();
 
@@ -1527,8 +1659,49 @@ void librados::IoCtxImpl::set_notify_timeout(uint32_t timeout)
   notify_timeout = timeout;
 }
 
+void librados::IoCtxImpl::set_op_batching(bool batch)
+{
+  if (batch)
+    extra_op_flags |= CEPH_OSD_FLAG_OBJECTER_BATCH;
+  else
+    extra_op_flags &= ~CEPH_OSD_FLAG_OBJECTER_BATCH;
+}
+
+int librados::IoCtxImpl::set_read_policy(int policy)
+{
+  int flags;
+  switch (policy) {
+  case LIBRADOS_READ_PRIMARY:
+    flags = 0;
+    break;
+  case LIBRADOS_READ_BALANCE:
+    flags = CEPH_OSD_FLAG_BALANCE_READS;
+    break;
+  case LIBRADOS_READ_LOCALIZE:
+    flags = CEPH_OSD_FLAG_LOCALIZE_READS;
+    break;
+  case LIBRADOS_READ_LEAST_LOADED:
+    flags = CEPH_OSD_FLAG_OBJECTER_LEAST_LOADED;
+    break;
+  default:
+    return -EINVAL;
+  }
+  extra_op_flags = (extra_op_flags & ~CEPH_OSD_FLAG_REPLICA_READS) | flags;
+  return 0;
+}
+
 ///////////////////////////// C_aio_Ack ////////////////////////////////
 
+/*
+ * true if the reply data was received in place, into the caller's
+ * buffer that aio_read posted for it.  if the buffer was revoked first
+ * (say the op was resent), the messenger allocates its own and we copy.
+ */
+static bool read_in_place(const bufferlist& bl, const char *buf)
+{
+  return bl.buffers().size() == 1 && bl.buffers().front().c_str() == buf;
+}
+
 librados::IoCtxImpl::C_aio_Ack::C_aio_Ack(AioCompletionImpl *_c) : c(_c)
 {
   c->get();
@@ -1539,13 +1712,16 @@ void librados::IoCtxImpl::C_aio_Ack::finish(int r)
   c->lock.Lock();
   c->rval = r;
   c->ack = true;
-  if (c->is_read)
+  if (c->is_read) {
     c->safe = true;
+    c->io->aio_unadmit(c);
+  }
   c->cond.Signal();
 
-  if (c->buf && c->bl.length() > 0) {
+  if (c->buf && r >= 0 && c->bl.length() > 0) {
     unsigned l = MIN(c->bl.length(), c->maxlen);
-    c->bl.copy(0, l, c->buf);
+    if (!read_in_place(c->bl, c->buf))
+      c->bl.copy(0, l, c->buf);
     c->rval = c->bl.length();
   }
   if (c->pbl) {
@@ -1558,6 +1734,8 @@ void librados::IoCtxImpl::C_aio_Ack::finish(int r)
   if (c->is_read && c->callback_safe) {
     c->io->client->finisher.queue(new C_AioSafe(c));
   }
+  if (c->cq)
+    c->cq->post(c);
 
   c->put_unlock();
 }
@@ -1577,6 +1755,7 @@ void librados::IoCtxImpl::C_aio_sparse_read_Ack::finish(int r)
   c->lock.Lock();
   c->rval = r;
   c->ack = true;
+  c->io->aio_unadmit(c);
   c->cond.Signal();
 
   bufferlist::iterator iter = c->bl.begin();
@@ -1588,6 +1767,8 @@ void librados::IoCtxImpl::C_aio_sparse_read_Ack::finish(int r)
   if (c->callback_complete) {
     c->io->client->finisher.queue(new C_AioComplete(c));
   }
+  if (c->cq)
+    c->cq->post(c);
 
   c->put_unlock();
 }
@@ -1605,8 +1786,11 @@ void librados::IoCtxImpl::C_aio_Safe::finish(int r)
   if (!c->ack) {
     c->rval = r;
     c->ack = true;
+    if (c->cq)
+      c->cq->post(c);
   }
   c->safe = true;
+  c->io->aio_unadmit(c);
   c->cond.Signal();
 
   if (c->callback_safe) {
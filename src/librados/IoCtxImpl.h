@@ -41,12 +41,18 @@ struct librados::IoCtxImpl {
   eversion_t last_objver;
   uint32_t notify_timeout;
   object_locator_t oloc;
+  int extra_op_flags;  ///< or'd into the flags of each data op
 
   Mutex aio_write_list_lock;
   tid_t aio_write_seq;
   Cond aio_write_cond;
   xlist<AioCompletionImpl*> aio_write_list;
 
+  // admission limits for aio on this ioctx; 0 means unlimited
+  Mutex aio_admit_lock;
+  uint64_t aio_max_ops, aio_max_bytes;
+  uint64_t aio_ops, aio_bytes;
+
   Mutex *lock;
   Objecter *objecter;
 
@@ -66,6 +72,9 @@ struct librados::IoCtxImpl {
     last_objver = rhs.last_objver;
     notify_timeout = rhs.notify_timeout;
     oloc = rhs.oloc;
+    extra_op_flags = rhs.extra_op_flags;
+    aio_max_ops = rhs.aio_max_ops;
+    aio_max_bytes = rhs.aio_max_bytes;
     lock = rhs.lock;
     objecter = rhs.objecter;
   }
@@ -86,6 +95,12 @@ struct librados::IoCtxImpl {
   void complete_aio_write(struct AioCompletionImpl *c);
   void flush_aio_writes();
 
+  void set_aio_limits(uint64_t max_ops, uint64_t max_bytes);
+  void set_aio_nonblocking(bool nb);
+  void get_aio_inflight(uint64_t *ops, uint64_t *bytes);
+  int aio_admit(AioCompletionImpl *c, uint64_t bytes);
+  void aio_unadmit(AioCompletionImpl *c);
+
   int64_t get_id() {
     return poolid;
   }
@@ -107,6 +122,7 @@ struct librados::IoCtxImpl {
 
   // io
   int list(Objecter::ListContext *context, int max_entries);
+  int hot_objects(unsigned max, std::list<librados::object_heat_t> *out);
   int create(const object_t& oid, bool exclusive);
   int create(const object_t& oid, bool exclusive, const std::string& category);
   int write(const object_t& oid, bufferlist& bl, size_t len, uint64_t off);
@@ -136,7 +152,8 @@ struct librados::IoCtxImpl {
 
   int operate(const object_t& oid, ::ObjectOperation *o, time_t *pmtime);
   int operate_read(const object_t& oid, ::ObjectOperation *o, bufferlist *pbl);
-  int aio_operate(const object_t& oid, ::ObjectOperation *o, AioCompletionImpl *c);
+  int aio_operate(const object_t& oid, ::ObjectOperation *o,
+		  AioCompletionImpl *c, time_t *pmtime);
   int aio_operate_read(const object_t& oid, ::ObjectOperation *o, AioCompletionImpl *c, bufferlist *pbl);
 
   struct C_aio_Ack : public Context {
@@ -191,6 +208,8 @@ struct librados::IoCtxImpl {
   void set_assert_version(uint64_t ver);
   void set_assert_src_version(const object_t& oid, uint64_t ver);
   void set_notify_timeout(uint32_t timeout);
+  void set_op_batching(bool batch);
+  int set_read_policy(int policy);
 
   struct C_NotifyComplete : public librados::WatchCtx {
     Mutex *lock;
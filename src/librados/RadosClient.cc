@@ -264,6 +264,13 @@ int librados::RadosClient::create_ioctx(const char *name, IoCtxImpl **io)
 
 bool librados::RadosClient::ms_dispatch(Message *m)
 {
+  // the objecter does its own locking for op replies; keep them off
+  // the client lock so that completions don't serialize behind it.
+  if (m->get_type() == CEPH_MSG_OSD_OPREPLY) {
+    objecter->handle_osd_op_reply((class MOSDOpReply*)m);
+    return true;
+  }
+
   Mutex::Locker l(lock);
   bool ret;
 
@@ -301,9 +308,6 @@ bool librados::RadosClient::_dispatch(Message *m)
 {
   switch (m->get_type()) {
   // OSD
-  case CEPH_MSG_OSD_OPREPLY:
-    objecter->handle_osd_op_reply((class MOSDOpReply*)m);
-    break;
   case CEPH_MSG_OSD_MAP:
     objecter->handle_osd_map((MOSDMap*)m);
     cond.Signal();
@@ -23,6 +23,7 @@ using namespace std;
 #include "include/types.h"
 
 #include "librados/AioCompletionImpl.h"
+#include "librados/CompletionQueueImpl.h"
 #include "librados/IoCtxImpl.h"
 #include "librados/PoolAsyncCompletionImpl.h"
 #include "librados/RadosClient.h"
@@ -59,16 +60,20 @@ size_t librados::ObjectOperation::size()
   return o->size();
 }
 
-void librados::ObjectOperation::set_op_flags(ObjectOperationFlags flags)
+static int translate_op_flags(int flags)
 {
   int rados_flags = 0;
-  if (flags & OP_EXCL)
+  if (flags & librados::OP_EXCL)
     rados_flags |= CEPH_OSD_OP_FLAG_EXCL;
-  if (flags & OP_FAILOK)
+  if (flags & librados::OP_FAILOK)
     rados_flags |= CEPH_OSD_OP_FLAG_FAILOK;
+  return rados_flags;
+}
 
+void librados::ObjectOperation::set_op_flags(ObjectOperationFlags flags)
+{
   ::ObjectOperation *o = (::ObjectOperation *)impl;
-  o->set_last_op_flags(rados_flags);
+  o->set_last_op_flags(translate_op_flags(flags));
 }
 
 void librados::ObjectOperation::cmpxattr(const char *name, uint8_t op, const bufferlist& v)
@@ -185,6 +190,14 @@ void librados::ObjectReadOperation::omap_get_vals_by_keys(
   o->omap_get_vals_by_keys(keys, map, prval);
 }
 
+void librados::ObjectReadOperation::list_snaps(
+  snap_set_t *out_snaps,
+  int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)impl;
+  o->list_snaps(out_snaps, prval);
+}
+
 void librados::ObjectOperation::omap_cmp(
   const std::map<std::string, pair<bufferlist, int> > &assertions,
   int *prval)
@@ -255,6 +268,12 @@ void librados::ObjectWriteOperation::remove()
   o->remove();
 }
 
+void librados::ObjectWriteOperation::selfmanaged_snap_rollback(snap_t snapid)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)impl;
+  o->rollback(snapid);
+}
+
 void librados::ObjectWriteOperation::truncate(uint64_t off)
 {
   ::ObjectOperation *o = (::ObjectOperation *)impl;
@@ -328,6 +347,16 @@ void librados::ObjectWriteOperation::clone_range(uint64_t dst_off,
   o->clone_range(src_oid, src_off, len, dst_off);
 }
 
+void librados::ObjectWriteOperation::copy_from(const std::string& src,
+					       const IoCtx& src_ioctx,
+					       uint64_t src_version,
+					       unsigned flags)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)impl;
+  IoCtxImpl *ictx = src_ioctx.io_ctx_impl;
+  o->copy_from(object_t(src), ictx->snap_seq, ictx->oloc, src_version, flags);
+}
+
 librados::WatchCtx::
 ~WatchCtx()
 {
@@ -692,6 +721,20 @@ int librados::IoCtx::stat(const std::string& oid, uint64_t *psize, time_t *pmtim
   return io_ctx_impl->stat(oid, psize, pmtime);
 }
 
+int librados::IoCtx::list_snaps(const std::string& oid, snap_set_t *out_snaps)
+{
+  if (io_ctx_impl->snap_seq != CEPH_SNAPDIR)
+    return -EINVAL;
+  ObjectReadOperation op;
+  int r;
+  op.list_snaps(out_snaps, &r);
+  bufferlist bl;
+  int ret = operate(oid, &op, &bl);
+  if (ret < 0)
+    return ret;
+  return r;
+}
+
 int librados::IoCtx::exec(const std::string& oid, const char *cls, const char *method,
 			  bufferlist& inbl, bufferlist& outbl)
 {
@@ -824,7 +867,8 @@ int librados::IoCtx::operate(const std::string& oid, librados::ObjectReadOperati
 int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c, librados::ObjectWriteOperation *o)
 {
   object_t obj(oid);
-  return io_ctx_impl->aio_operate(obj, (::ObjectOperation*)o->impl, c->pc);
+  return io_ctx_impl->aio_operate(obj, (::ObjectOperation*)o->impl, c->pc,
+				  o->pmtime);
 }
 
 int librados::IoCtx::aio_operate(const std::string& oid, AioCompletion *c, librados::ObjectReadOperation *o, bufferlist *pbl)
@@ -908,11 +952,31 @@ librados::ObjectIterator librados::IoCtx::objects_begin()
   return iter;
 }
 
+librados::ObjectIterator librados::IoCtx::objects_begin(uint32_t part,
+							 uint32_t num_parts)
+{
+  rados_list_ctx_t listh;
+  int r = rados_objects_list_open_part(io_ctx_impl, part, num_parts, &listh);
+  if (r < 0) {
+    ostringstream oss;
+    oss << "rados_objects_list_open_part returned " << r;
+    throw std::runtime_error(oss.str());
+  }
+  ObjectIterator iter((ObjListCtx*)listh);
+  iter.get_next();
+  return iter;
+}
+
 const librados::ObjectIterator& librados::IoCtx::objects_end() const
 {
   return ObjectIterator::__EndObjectIterator;
 }
 
+int librados::IoCtx::hot_objects(unsigned max, std::list<object_heat_t> *out)
+{
+  return io_ctx_impl->hot_objects(max, out);
+}
+
 uint64_t librados::IoCtx::get_last_version()
 {
   eversion_t ver = io_ctx_impl->last_version();
@@ -1018,6 +1082,31 @@ void librados::IoCtx::locator_set_key(const string& key)
   io_ctx_impl->oloc.key = key;
 }
 
+void librados::IoCtx::set_op_batching(bool batch)
+{
+  io_ctx_impl->set_op_batching(batch);
+}
+
+int librados::IoCtx::set_read_policy(int policy)
+{
+  return io_ctx_impl->set_read_policy(policy);
+}
+
+void librados::IoCtx::set_aio_limits(uint64_t max_ops, uint64_t max_bytes)
+{
+  io_ctx_impl->set_aio_limits(max_ops, max_bytes);
+}
+
+void librados::IoCtx::set_aio_nonblocking(bool nonblocking)
+{
+  io_ctx_impl->set_aio_nonblocking(nonblocking);
+}
+
+void librados::IoCtx::get_aio_inflight(uint64_t *ops, uint64_t *bytes)
+{
+  io_ctx_impl->get_aio_inflight(ops, bytes);
+}
+
 int64_t librados::IoCtx::get_id()
 {
   return io_ctx_impl->get_id();
@@ -1716,6 +1805,38 @@ extern "C" void rados_ioctx_locator_set_key(rados_ioctx_t io, const char *key)
     ctx->oloc.key = "";
 }
 
+extern "C" void rados_ioctx_set_op_batching(rados_ioctx_t io, int batch)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  ctx->set_op_batching(batch);
+}
+
+extern "C" int rados_ioctx_set_read_policy(rados_ioctx_t io, int policy)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  return ctx->set_read_policy(policy);
+}
+
+extern "C" void rados_ioctx_set_aio_limits(rados_ioctx_t io, uint64_t max_ops,
+					  uint64_t max_bytes)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  ctx->set_aio_limits(max_ops, max_bytes);
+}
+
+extern "C" void rados_ioctx_set_aio_nonblocking(rados_ioctx_t io, int nonblocking)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  ctx->set_aio_nonblocking(nonblocking);
+}
+
+extern "C" void rados_ioctx_get_aio_inflight(rados_ioctx_t io, uint64_t *ops,
+					    uint64_t *bytes)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  ctx->get_aio_inflight(ops, bytes);
+}
+
 extern "C" rados_t rados_ioctx_get_cluster(rados_ioctx_t io)
 {
   librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
@@ -1997,6 +2118,22 @@ extern "C" int rados_objects_list_open(rados_ioctx_t io, rados_list_ctx_t *listh
   return 0;
 }
 
+extern "C" int rados_objects_list_open_part(rados_ioctx_t io, uint32_t part,
+					    uint32_t num_parts,
+					    rados_list_ctx_t *listh)
+{
+  if (num_parts == 0 || part >= num_parts)
+    return -EINVAL;
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  Objecter::ListContext *h = new Objecter::ListContext;
+  h->pool_id = ctx->poolid;
+  h->pool_snap_seq = ctx->snap_seq;
+  h->part = part;
+  h->num_parts = num_parts;
+  *listh = (void *)new librados::ObjListCtx(ctx, h);
+  return 0;
+}
+
 extern "C" void rados_objects_list_close(rados_list_ctx_t h)
 {
   librados::ObjListCtx *lh = (librados::ObjListCtx *)h;
@@ -2102,11 +2239,57 @@ extern "C" uint64_t rados_aio_get_version(rados_completion_t c)
   return ((librados::AioCompletionImpl*)c)->get_version();
 }
 
+extern "C" void *rados_aio_get_arg(rados_completion_t c)
+{
+  return ((librados::AioCompletionImpl*)c)->get_arg();
+}
+
 extern "C" void rados_aio_release(rados_completion_t c)
 {
   ((librados::AioCompletionImpl*)c)->put();
 }
 
+extern "C" int rados_completion_queue_create(rados_completion_queue_t *cq)
+{
+  librados::CompletionQueueImpl *q = new librados::CompletionQueueImpl;
+  int r = q->init();
+  if (r < 0) {
+    delete q;
+    return r;
+  }
+  *cq = q;
+  return 0;
+}
+
+extern "C" void rados_completion_queue_destroy(rados_completion_queue_t cq)
+{
+  delete (librados::CompletionQueueImpl*)cq;
+}
+
+extern "C" int rados_completion_queue_get_fd(rados_completion_queue_t cq)
+{
+  return ((librados::CompletionQueueImpl*)cq)->fd;
+}
+
+extern "C" int rados_aio_create_completion_cq(void *cb_arg,
+					      rados_completion_queue_t cq,
+					      rados_completion_t *pc)
+{
+  librados::AioCompletionImpl *c = new librados::AioCompletionImpl;
+  c->callback_arg = cb_arg;
+  c->cq = (librados::CompletionQueueImpl*)cq;
+  *pc = c;
+  return 0;
+}
+
+extern "C" int rados_completion_queue_reap(rados_completion_queue_t cq,
+					   rados_completion_t *completions,
+					   int max)
+{
+  return ((librados::CompletionQueueImpl*)cq)->reap(
+    (librados::AioCompletionImpl**)completions, max);
+}
+
 extern "C" int rados_aio_read(rados_ioctx_t io, const char *o,
 			       rados_completion_t completion,
 			       char *buf, size_t len, uint64_t off)
@@ -2167,6 +2350,431 @@ extern "C" int rados_aio_flush(rados_ioctx_t io)
   return 0;
 }
 
+/* compound operations */
+
+class RadosOmapIter {
+public:
+  std::map<std::string, bufferlist> values;
+  std::map<std::string, bufferlist>::iterator i;
+  RadosOmapIter() {
+    i = values.end();
+  }
+};
+
+/*
+ * output handlers for compound reads.  the objecter fills in bl and
+ * *prval before calling these, so they may override *prval if the
+ * result can't be handed back.
+ */
+struct C_bl_to_buf : public Context {
+  bufferlist bl;
+  char *out_buf;
+  size_t out_len;
+  size_t *bytes_read;
+  int *prval;
+  C_bl_to_buf(char *b, size_t l, size_t *br, int *pr)
+    : out_buf(b), out_len(l), bytes_read(br), prval(pr) {}
+  void finish(int r) {
+    if (bytes_read)
+      *bytes_read = bl.length();
+    if (r < 0)
+      return;
+    if (bl.length() > out_len) {
+      if (prval)
+	*prval = -ERANGE;
+      return;
+    }
+    bl.copy(0, bl.length(), out_buf);
+  }
+};
+
+struct C_XattrsIter : public Context {
+  bufferlist bl;
+  RadosXattrsIter *iter;
+  int *prval;
+  C_XattrsIter(RadosXattrsIter *it, int *pr) : iter(it), prval(pr) {}
+  void finish(int r) {
+    if (r >= 0) {
+      bufferlist::iterator p = bl.begin();
+      try {
+	::decode(iter->attrset, p);
+      } catch (buffer::error& e) {
+	iter->attrset.clear();
+	if (prval)
+	  *prval = -EIO;
+      }
+    }
+    iter->i = iter->attrset.begin();
+  }
+};
+
+struct C_OmapIter : public Context {
+  bufferlist bl;
+  RadosOmapIter *iter;
+  bool keys_only;
+  int *prval;
+  C_OmapIter(RadosOmapIter *it, bool k, int *pr)
+    : iter(it), keys_only(k), prval(pr) {}
+  void finish(int r) {
+    if (r >= 0) {
+      bufferlist::iterator p = bl.begin();
+      try {
+	if (keys_only) {
+	  std::set<std::string> keys;
+	  ::decode(keys, p);
+	  for (std::set<std::string>::iterator k = keys.begin();
+	       k != keys.end();
+	       ++k)
+	    iter->values[*k];
+	} else {
+	  ::decode(iter->values, p);
+	}
+      } catch (buffer::error& e) {
+	iter->values.clear();
+	if (prval)
+	  *prval = -EIO;
+      }
+    }
+    iter->i = iter->values.begin();
+  }
+};
+
+/// route the output of the last op in o through h, which owns the buffer
+static void set_last_op_handler(::ObjectOperation *o, bufferlist *pbl,
+				Context *h)
+{
+  unsigned p = o->size() - 1;
+  o->out_bl[p] = pbl;
+  o->out_handler[p] = h;
+}
+
+static void release_op(::ObjectOperation *o)
+{
+  // handlers of ops that were never sent
+  for (vector<Context*>::iterator p = o->out_handler.begin();
+       p != o->out_handler.end();
+       ++p)
+    delete *p;
+  delete o;
+}
+
+extern "C" rados_write_op_t rados_create_write_op(void)
+{
+  return new (std::nothrow) ::ObjectOperation;
+}
+
+extern "C" void rados_release_write_op(rados_write_op_t write_op)
+{
+  release_op((::ObjectOperation *)write_op);
+}
+
+extern "C" void rados_write_op_set_flags(rados_write_op_t write_op, int flags)
+{
+  ((::ObjectOperation *)write_op)->set_last_op_flags(translate_op_flags(flags));
+}
+
+extern "C" void rados_write_op_assert_version(rados_write_op_t write_op, uint64_t ver)
+{
+  ((::ObjectOperation *)write_op)->assert_version(ver);
+}
+
+extern "C" void rados_write_op_cmpxattr(rados_write_op_t write_op, const char *name,
+					uint8_t comparison_operator,
+					const char *value, size_t value_len)
+{
+  bufferlist bl;
+  bl.append(value, value_len);
+  ((::ObjectOperation *)write_op)->cmpxattr(name, comparison_operator,
+					    CEPH_OSD_CMPXATTR_MODE_STRING, bl);
+}
+
+extern "C" void rados_write_op_setxattr(rados_write_op_t write_op, const char *name,
+					const char *value, size_t value_len)
+{
+  bufferlist bl;
+  bl.append(value, value_len);
+  ((::ObjectOperation *)write_op)->setxattr(name, bl);
+}
+
+extern "C" void rados_write_op_rmxattr(rados_write_op_t write_op, const char *name)
+{
+  ((::ObjectOperation *)write_op)->rmxattr(name);
+}
+
+extern "C" void rados_write_op_create(rados_write_op_t write_op, int exclusive)
+{
+  ((::ObjectOperation *)write_op)->create(!!exclusive);
+}
+
+extern "C" void rados_write_op_write(rados_write_op_t write_op, const char *buffer,
+				     size_t len, uint64_t offset)
+{
+  bufferlist bl;
+  bl.append(buffer, len);
+  ((::ObjectOperation *)write_op)->write(offset, bl);
+}
+
+extern "C" void rados_write_op_write_full(rados_write_op_t write_op, const char *buffer,
+					  size_t len)
+{
+  bufferlist bl;
+  bl.append(buffer, len);
+  ((::ObjectOperation *)write_op)->write_full(bl);
+}
+
+extern "C" void rados_write_op_append(rados_write_op_t write_op, const char *buffer,
+				      size_t len)
+{
+  bufferlist bl;
+  bl.append(buffer, len);
+  ((::ObjectOperation *)write_op)->append(bl);
+}
+
+extern "C" void rados_write_op_remove(rados_write_op_t write_op)
+{
+  ((::ObjectOperation *)write_op)->remove();
+}
+
+extern "C" void rados_write_op_truncate(rados_write_op_t write_op, uint64_t offset)
+{
+  ((::ObjectOperation *)write_op)->truncate(offset);
+}
+
+extern "C" void rados_write_op_zero(rados_write_op_t write_op, uint64_t offset,
+				    uint64_t len)
+{
+  ((::ObjectOperation *)write_op)->zero(offset, len);
+}
+
+extern "C" void rados_write_op_copy_from(rados_write_op_t write_op,
+					 rados_ioctx_t src_io,
+					 const char *src,
+					 uint64_t src_version,
+					 int flags)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)src_io;
+  ((::ObjectOperation *)write_op)->copy_from(object_t(src), ctx->snap_seq,
+					     ctx->oloc, src_version, flags);
+}
+
+extern "C" void rados_write_op_exec(rados_write_op_t write_op, const char *cls,
+				    const char *method, const char *in_buf,
+				    size_t in_len, int *prval)
+{
+  bufferlist inbl;
+  inbl.append(in_buf, in_len);
+  ((::ObjectOperation *)write_op)->call(cls, method, inbl, NULL, NULL, prval);
+}
+
+extern "C" void rados_write_op_omap_set(rados_write_op_t write_op,
+					char const * const *keys,
+					char const * const *vals,
+					const size_t *lens, size_t num)
+{
+  std::map<std::string, bufferlist> entries;
+  for (size_t i = 0; i < num; ++i) {
+    bufferlist bl;
+    bl.append(vals[i], lens[i]);
+    entries[keys[i]] = bl;
+  }
+  ((::ObjectOperation *)write_op)->omap_set(entries);
+}
+
+extern "C" void rados_write_op_omap_rm_keys(rados_write_op_t write_op,
+					    char const * const *keys,
+					    size_t keys_len)
+{
+  std::set<std::string> to_remove(keys, keys + keys_len);
+  ((::ObjectOperation *)write_op)->omap_rm_keys(to_remove);
+}
+
+extern "C" void rados_write_op_omap_clear(rados_write_op_t write_op)
+{
+  ((::ObjectOperation *)write_op)->omap_clear();
+}
+
+extern "C" int rados_write_op_operate(rados_write_op_t write_op, rados_ioctx_t io,
+				      const char *oid, time_t *mtime)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t obj(oid);
+  return ctx->operate(obj, (::ObjectOperation *)write_op, mtime);
+}
+
+extern "C" int rados_aio_write_op_operate(rados_write_op_t write_op, rados_ioctx_t io,
+					  rados_completion_t completion,
+					  const char *oid, time_t *mtime)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t obj(oid);
+  return ctx->aio_operate(obj, (::ObjectOperation *)write_op,
+			  (librados::AioCompletionImpl *)completion, mtime);
+}
+
+extern "C" rados_read_op_t rados_create_read_op(void)
+{
+  return new (std::nothrow) ::ObjectOperation;
+}
+
+extern "C" void rados_release_read_op(rados_read_op_t read_op)
+{
+  release_op((::ObjectOperation *)read_op);
+}
+
+extern "C" void rados_read_op_set_flags(rados_read_op_t read_op, int flags)
+{
+  ((::ObjectOperation *)read_op)->set_last_op_flags(translate_op_flags(flags));
+}
+
+extern "C" void rados_read_op_assert_version(rados_read_op_t read_op, uint64_t ver)
+{
+  ((::ObjectOperation *)read_op)->assert_version(ver);
+}
+
+extern "C" void rados_read_op_cmpxattr(rados_read_op_t read_op, const char *name,
+				       uint8_t comparison_operator,
+				       const char *value, size_t value_len)
+{
+  bufferlist bl;
+  bl.append(value, value_len);
+  ((::ObjectOperation *)read_op)->cmpxattr(name, comparison_operator,
+					   CEPH_OSD_CMPXATTR_MODE_STRING, bl);
+}
+
+extern "C" void rados_read_op_stat(rados_read_op_t read_op, uint64_t *psize,
+				   time_t *pmtime, int *prval)
+{
+  ((::ObjectOperation *)read_op)->stat(psize, pmtime, prval);
+}
+
+extern "C" void rados_read_op_read(rados_read_op_t read_op, uint64_t offset,
+				   size_t len, char *buf, size_t *bytes_read,
+				   int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  C_bl_to_buf *h = new C_bl_to_buf(buf, len, bytes_read, prval);
+  o->read(offset, len, NULL, prval);
+  set_last_op_handler(o, &h->bl, h);
+}
+
+extern "C" void rados_read_op_getxattr(rados_read_op_t read_op, const char *name,
+				       char *buf, size_t len, size_t *value_len,
+				       int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  C_bl_to_buf *h = new C_bl_to_buf(buf, len, value_len, prval);
+  o->getxattr(name, NULL, prval);
+  set_last_op_handler(o, &h->bl, h);
+}
+
+extern "C" void rados_read_op_getxattrs(rados_read_op_t read_op,
+					rados_xattrs_iter_t *iter, int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  RadosXattrsIter *it = new RadosXattrsIter;
+  C_XattrsIter *h = new C_XattrsIter(it, prval);
+  o->getxattrs(NULL, prval);
+  set_last_op_handler(o, &h->bl, h);
+  *iter = it;
+}
+
+extern "C" void rados_read_op_exec(rados_read_op_t read_op, const char *cls,
+				   const char *method, const char *in_buf,
+				   size_t in_len, char *out_buf, size_t out_len,
+				   size_t *used_len, int *prval)
+{
+  bufferlist inbl;
+  inbl.append(in_buf, in_len);
+  C_bl_to_buf *h = new C_bl_to_buf(out_buf, out_len, used_len, prval);
+  ((::ObjectOperation *)read_op)->call(cls, method, inbl, &h->bl, h, prval);
+}
+
+extern "C" void rados_read_op_omap_get_vals(rados_read_op_t read_op,
+					    const char *start_after,
+					    const char *filter_prefix,
+					    uint64_t max_return,
+					    rados_omap_iter_t *iter, int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  RadosOmapIter *it = new RadosOmapIter;
+  C_OmapIter *h = new C_OmapIter(it, false, prval);
+  o->omap_get_vals(start_after ? start_after : "",
+		   filter_prefix ? filter_prefix : "",
+		   max_return, NULL, prval);
+  set_last_op_handler(o, &h->bl, h);
+  *iter = it;
+}
+
+extern "C" void rados_read_op_omap_get_keys(rados_read_op_t read_op,
+					    const char *start_after,
+					    uint64_t max_return,
+					    rados_omap_iter_t *iter, int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  RadosOmapIter *it = new RadosOmapIter;
+  C_OmapIter *h = new C_OmapIter(it, true, prval);
+  o->omap_get_keys(start_after ? start_after : "", max_return, NULL, prval);
+  set_last_op_handler(o, &h->bl, h);
+  *iter = it;
+}
+
+extern "C" void rados_read_op_omap_get_vals_by_keys(rados_read_op_t read_op,
+						    char const * const *keys,
+						    size_t keys_len,
+						    rados_omap_iter_t *iter,
+						    int *prval)
+{
+  ::ObjectOperation *o = (::ObjectOperation *)read_op;
+  std::set<std::string> to_get(keys, keys + keys_len);
+  RadosOmapIter *it = new RadosOmapIter;
+  C_OmapIter *h = new C_OmapIter(it, false, prval);
+  o->omap_get_vals_by_keys(to_get, NULL, prval);
+  set_last_op_handler(o, &h->bl, h);
+  *iter = it;
+}
+
+extern "C" int rados_omap_get_next(rados_omap_iter_t iter, char **key,
+				   char **val, size_t *len)
+{
+  RadosOmapIter *it = (RadosOmapIter *)iter;
+  if (it->i == it->values.end()) {
+    *key = NULL;
+    *val = NULL;
+    *len = 0;
+    return 0;
+  }
+  bufferlist &bl(it->i->second);
+  *key = (char*)it->i->first.c_str();
+  *val = bl.length() ? bl.c_str() : NULL;
+  *len = bl.length();
+  ++it->i;
+  return 0;
+}
+
+extern "C" void rados_omap_get_end(rados_omap_iter_t iter)
+{
+  RadosOmapIter *it = (RadosOmapIter *)iter;
+  delete it;
+}
+
+extern "C" int rados_read_op_operate(rados_read_op_t read_op, rados_ioctx_t io,
+				     const char *oid)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t obj(oid);
+  return ctx->operate_read(obj, (::ObjectOperation *)read_op, NULL);
+}
+
+extern "C" int rados_aio_read_op_operate(rados_read_op_t read_op, rados_ioctx_t io,
+					 rados_completion_t completion,
+					 const char *oid)
+{
+  librados::IoCtxImpl *ctx = (librados::IoCtxImpl *)io;
+  object_t obj(oid);
+  return ctx->aio_operate_read(obj, (::ObjectOperation *)read_op,
+			       (librados::AioCompletionImpl *)completion, NULL);
+}
+
 struct C_WatchCB : public librados::WatchCtx {
   rados_watchcb_t wcb;
   void *arg;
@@ -0,0 +1,110 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "include/types.h"
+#include "common/dout.h"
+
+#include "librados/snap_set_diff.h"
+
+#define dout_subsys ceph_subsys_rados
+#undef dout_prefix
+#define dout_prefix *_dout << "snap_set_diff "
+
+using std::vector;
+
+void calc_snap_set_diff(CephContext *cct,
+			const librados::snap_set_t& snap_set,
+			librados::snap_t start, librados::snap_t end,
+			interval_set<uint64_t> *diff, uint64_t *end_size,
+			bool *end_exists)
+{
+  ldout(cct, 10) << "start " << start << " end " << end
+		 << ", snap_set seq " << snap_set.seq << dendl;
+  bool saw_start = false;
+  uint64_t start_size = 0;
+  diff->clear();
+  *end_size = 0;
+  *end_exists = false;
+
+  for (vector<librados::clone_info_t>::const_iterator r = snap_set.clones.begin();
+       r != snap_set.clones.end();
+       ) {
+    // the snaps [a, b] this clone (or the head) holds the data for
+    librados::snap_t a, b;
+    if (r->cloneid == librados::SNAP_HEAD) {
+      // the head isn't in any snap, but is what any newer one will see
+      a = snap_set.seq + 1;
+      b = librados::SNAP_HEAD;
+    } else {
+      if (r->snaps.empty()) {
+	// all of its snaps have been trimmed
+	++r;
+	continue;
+      }
+      a = r->snaps.front();
+      // b may be < cloneid if a snap has been trimmed
+      b = r->snaps.back();
+    }
+    ldout(cct, 20) << " clone " << r->cloneid << " -> [" << a << "," << b
+		   << "] size " << r->size << dendl;
+
+    if (b < start) {
+      ++r;
+      continue;
+    }
+
+    if (!saw_start) {
+      if (start < a) {
+	// the object didn't exist at start
+	ldout(cct, 20) << "  start " << start << " predates it" << dendl;
+	if (r->size)
+	  diff->insert(0, r->size);
+	start_size = 0;
+      } else {
+	ldout(cct, 20) << "  start" << dendl;
+	start_size = r->size;
+      }
+      saw_start = true;
+    }
+
+    *end_size = r->size;
+    if (end < a) {
+      // the object didn't exist at end: everything it had at start is gone
+      ldout(cct, 20) << "  past end " << end << ", object does not exist"
+		     << dendl;
+      *end_size = 0;
+      diff->clear();
+      if (start_size)
+	diff->insert(0, start_size);
+      break;
+    }
+    if (end <= b) {
+      ldout(cct, 20) << "  end" << dendl;
+      *end_exists = true;
+      break;
+    }
+
+    // anything in this clone or the next newer one that they don't share
+    const vector<pair<uint64_t, uint64_t> > *overlap = &r->overlap;
+    uint64_t max_size = r->size;
+    ++r;
+    if (r != snap_set.clones.end() && r->size > max_size)
+      max_size = r->size;
+    interval_set<uint64_t> diff_to_next;
+    if (max_size)
+      diff_to_next.insert(0, max_size);
+    for (vector<pair<uint64_t, uint64_t> >::const_iterator p = overlap->begin();
+	 p != overlap->end();
+	 ++p)
+      diff_to_next.erase(p->first, p->second);
+    ldout(cct, 20) << "  diff_to_next " << diff_to_next << dendl;
+    diff->union_of(diff_to_next);
+  }
+
+  if (!saw_start) {
+    // every clone predates start and there's no head: nothing to compare
+    ldout(cct, 20) << " object gone since before start" << dendl;
+  }
+  ldout(cct, 10) << " diff " << *diff << " end_size " << *end_size
+		 << " end_exists " << *end_exists << dendl;
+}
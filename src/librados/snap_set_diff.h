@@ -0,0 +1,27 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRADOS_SNAP_SET_DIFF_H
+#define CEPH_LIBRADOS_SNAP_SET_DIFF_H
+
+class CephContext;
+
+#include "include/rados/rados_types.hpp"
+#include "include/interval_set.h"
+
+/**
+ * work out which parts of an object changed between two snapshots
+ * from its snap set (see ObjectReadOperation::list_snaps())
+ *
+ * @param start the older snap; 0 means since before the object existed
+ * @param end the newer snap, or SNAP_HEAD
+ * @param diff [out] byte ranges that differ between start and end
+ * @param end_size [out] size of the object at end
+ * @param end_exists [out] whether the object exists at end
+ */
+void calc_snap_set_diff(CephContext *cct,
+			const librados::snap_set_t& snap_set,
+			librados::snap_t start, librados::snap_t end,
+			interval_set<uint64_t> *diff, uint64_t *end_size,
+			bool *end_exists);
+
+#endif
@@ -21,32 +21,35 @@ namespace librbd {
   {
     ldout(cct, 20) << "AioCompletion::complete_request() this="
 		   << (void *)this << " complete_cb=" << (void *)complete_cb << dendl;
-    lock.Lock();
-    if (rval >= 0) {
-      if (r < 0 && r != -EEXIST)
+    if (r < 0 && r != -EEXIST) {
+      lock.Lock();
+      if (rval >= 0)
 	rval = r;
-      else if (r > 0)
-	rval += r;
+      lock.Unlock();
+    } else if (r > 0) {
+      // added to rval when the last request completes
+      pending_bytes.add(r);
     }
-    assert(pending_count);
-    int count = --pending_count;
-    if (!count) {
-      complete();
-    }
-    put_unlock();
+    dec_pending();
   }
 
   void C_AioRead::finish(int r)
   {
-    ldout(m_cct, 10) << "C_AioRead::finish() " << this << dendl;
+    CephContext *cct = m_completion->ictx->cct;
+    ldout(cct, 10) << "C_AioRead::finish() " << this << dendl;
     if (r >= 0 || r == -ENOENT) { // this was a sparse_read operation
-      ldout(m_cct, 10) << "ofs=" << m_req->offset()
-		       << " len=" << m_req->length() << dendl;
-      r = handle_sparse_read(m_cct, m_req->data(), m_req->offset(),
+      ldout(cct, 10) << "ofs=" << m_req->offset()
+		     << " len=" << m_req->length() << dendl;
+      r = handle_sparse_read(cct, m_req->data(), m_req->offset(),
 			     m_req->ext_map(), 0, m_req->length(),
 			     simple_read_cb, m_out_buf);
     }
-    m_completion->complete_request(m_cct, r);
+    m_completion->complete_request(cct, r);
+  }
+
+  void C_AioWrite::finish(int r)
+  {
+    m_completion->complete_request(m_completion->ictx->cct, r);
   }
 
   void C_CacheRead::finish(int r)
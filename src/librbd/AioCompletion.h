@@ -7,6 +7,7 @@
 #include "common/Mutex.h"
 #include "common/ceph_context.h"
 #include "common/perf_counters.h"
+#include "include/atomic.h"
 #include "include/Context.h"
 #include "include/utime.h"
 #include "include/rbd/librbd.hpp"
@@ -17,6 +18,7 @@
 namespace librbd {
 
   class AioRead;
+  struct AioCompletion;
 
   typedef enum {
     AIO_TYPE_READ = 0,
@@ -25,6 +27,52 @@ namespace librbd {
     AIO_TYPE_NONE,
   } aio_type_t;
 
+  /**
+   * The completion of one object's part of a read: copies what was
+   * read to the caller's buffer. These live in an array owned by the
+   * AioCompletion (see alloc_read_ctxs()), rather than being allocated
+   * one at a time, so completing one doesn't delete it.
+   */
+  class C_AioRead : public Context {
+  public:
+    C_AioRead() : m_completion(NULL), m_req(NULL), m_out_buf(NULL) {}
+    virtual ~C_AioRead() {}
+    virtual void complete(int r) {
+      finish(r);
+    }
+    virtual void finish(int r);
+    void set_completion(AioCompletion *completion) {
+      m_completion = completion;
+    }
+    void set_req(AioRead *req) {
+      m_req = req;
+    }
+    void set_out_buf(char *out_buf) {
+      m_out_buf = out_buf;
+    }
+  private:
+    AioCompletion *m_completion;
+    AioRead *m_req;
+    char *m_out_buf;
+  };
+
+  /**
+   * The completion of one object's part of a write or discard. There
+   * is nothing to do for each but count it, so all of an
+   * AioCompletion's share the one it owns.
+   */
+  class C_AioWrite : public Context {
+  public:
+    C_AioWrite(AioCompletion *completion) : m_completion(completion) {}
+    virtual ~C_AioWrite() {}
+    virtual void complete(int r) {
+      finish(r);
+    }
+    virtual void finish(int r);
+  private:
+    AioCompletion *m_completion;
+  };
+
   /**
    * AioCompletion is the overall completion for a single
    * rbd I/O request. It may be composed of many AioRequests,
@@ -32,10 +80,15 @@ namespace librbd {
    *
    * The retrying of individual requests is handled at a lower level,
    * so all AioCompletion cares about is the count of outstanding
-   * requests. Note that this starts at 1 to prevent the reference
+   * requests, which is atomic so that requests completing don't
+   * contend for the lock. Note that this starts at 1 to keep the
    * count from reaching 0 while more requests are being added. When
-   * all requests have been added, finish_adding_requests() releases
-   * this initial reference.
+   * all requests have been added, finish_adding_requests() drops
+   * this initial count.
+   *
+   * Whoever adds requests get()s a reference first; it is put when
+   * the count reaches 0, so the requests themselves don't need one
+   * each.
    */
   struct AioCompletion {
     Mutex lock;
@@ -45,20 +98,25 @@ namespace librbd {
     callback_t complete_cb;
     void *complete_arg;
     rbd_completion_t rbd_comp;
-    int pending_count;
+    ceph::atomic_t pending_count;
+    ceph::atomic_t pending_bytes; // read by completed requests, not yet in rval
     int ref;
     bool released;
     ImageCtx *ictx;
     utime_t start_time;
     aio_type_t aio_type;
+    C_AioWrite write_ctx;
+    C_AioRead *read_ctxs;
 
     AioCompletion() : lock("AioCompletion::lock", true),
 		      done(false), rval(0), complete_cb(NULL),
 		      complete_arg(NULL), rbd_comp(NULL), pending_count(1),
-		      ref(1), released(false), ictx(NULL),
-		      aio_type(AIO_TYPE_NONE) {
+		      pending_bytes(0), ref(1), released(false), ictx(NULL),
+		      aio_type(AIO_TYPE_NONE), write_ctx(this),
+		      read_ctxs(NULL) {
     }
     ~AioCompletion() {
+      delete[] read_ctxs;
     }
 
     int wait_for_complete() {
@@ -70,20 +128,20 @@ namespace librbd {
     }
 
     void add_request() {
-      lock.Lock();
-      pending_count++;
-      lock.Unlock();
-      get();
+      pending_count.inc();
     }
 
     void finish_adding_requests() {
-      lock.Lock();
-      assert(pending_count);
-      int count = --pending_count;
-      if (!count) {
-	complete();
-      }
-      lock.Unlock();
+      dec_pending();
+    }
+
+    /// the contexts for the n objects of a read, freed with this
+    C_AioRead *alloc_read_ctxs(size_t n) {
+      assert(!read_ctxs);
+      read_ctxs = new C_AioRead[n];
+      for (size_t i = 0; i < n; ++i)
+	read_ctxs[i].set_completion(this);
+      return read_ctxs;
     }
 
     void init_time(ImageCtx *i, aio_type_t t) {
@@ -92,9 +150,21 @@ namespace librbd {
       start_time = ceph_clock_now(ictx->cct);
     }
 
+    /// complete with error r an io that failed before adding requests
+    void fail(ImageCtx *i, aio_type_t t, ssize_t r) {
+      get();
+      init_time(i, t);
+      lock.Lock();
+      rval = r;
+      lock.Unlock();
+      finish_adding_requests();
+    }
+
     void complete() {
       utime_t elapsed;
       assert(lock.is_locked());
+      if (rval >= 0)
+	rval += pending_bytes.read();
       elapsed = ceph_clock_now(ictx->cct) - start_time;
       if (complete_cb) {
 	complete_cb(rbd_comp, complete_arg);
@@ -151,35 +221,15 @@ namespace librbd {
       if (!n)
 	delete this;
     }
-  };
 
-  class C_AioRead : public Context {
-  public:
-    C_AioRead(CephContext *cct, AioCompletion *completion, char *out_buf)
-      : m_cct(cct), m_completion(completion), m_req(NULL), m_out_buf(out_buf) {}
-    virtual ~C_AioRead() {}
-    virtual void finish(int r);
-    void set_req(AioRead *req) {
-      m_req = req;
-    }
   private:
-    CephContext *m_cct;
-    AioCompletion *m_completion;
-    AioRead *m_req;
-    char *m_out_buf;
-  };
-
-  class C_AioWrite : public Context {
-  public:
-    C_AioWrite(CephContext *cct, AioCompletion *completion)
-      : m_cct(cct), m_completion(completion) {}
-    virtual ~C_AioWrite() {}
-    virtual void finish(int r) {
-      m_completion->complete_request(m_cct, r);
+    void dec_pending() {
+      if (pending_count.dec() == 0) {
+	lock.Lock();
+	complete();
+	put_unlock();
+      }
     }
-  private:
-    CephContext *m_cct;
-    AioCompletion *m_completion;
   };
 
   class C_CacheRead : public Context {
@@ -4,6 +4,7 @@
 #include "common/ceph_context.h"
 #include "common/dout.h"
 #include "common/Mutex.h"
+#include "common/perf_counters.h"
 
 #include "librbd/AioCompletion.h"
 #include "librbd/ImageCtx.h"
@@ -76,10 +77,17 @@ namespace librbd {
 	// fill in single extent for sparse read callback
 	m_ext_map[m_block_ofs] = len;
 	read_from_parent(m_image_ofs, len);
+	m_ictx->aio_copy_on_read(get_block_num(m_ictx->order, m_image_ofs));
 	return false;
       }
     }
 
+    if (!m_tried_parent && r >= 0 && m_snap_id == CEPH_NOSNAP &&
+	m_ictx->cct->_conf->rbd_clone_copy_on_read &&
+	m_ictx->copy_on_read.was_copied(get_block_num(m_ictx->order,
+						      m_image_ofs)))
+      m_ictx->perfcounter->inc(l_librbd_cor_parent_reads_avoided);
+
     return true;
   }
 
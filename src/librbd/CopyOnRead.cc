@@ -0,0 +1,58 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <errno.h>
+
+#include "include/assert.h"
+
+#include "librbd/CopyOnRead.h"
+
+namespace librbd {
+
+  CopyOnRead::CopyOnRead()
+    : m_lock("librbd::CopyOnRead::m_lock"),
+      m_max_ops(0)
+  {
+  }
+
+  void CopyOnRead::set_max_ops(unsigned n) {
+    Mutex::Locker l(m_lock);
+    m_max_ops = n;
+  }
+
+  int CopyOnRead::start(uint64_t objno) {
+    Mutex::Locker l(m_lock);
+    if (m_in_flight.count(objno) || m_done.contains(objno))
+      return -EEXIST;
+    if (m_in_flight.size() >= m_max_ops)
+      return -EBUSY;
+    m_in_flight.insert(objno);
+    return 0;
+  }
+
+  void CopyOnRead::finish(uint64_t objno, int r) {
+    Mutex::Locker l(m_lock);
+    assert(m_in_flight.count(objno));
+    m_in_flight.erase(objno);
+    // a failed copy can be tried again by a later read
+    if (r >= 0 && !m_done.contains(objno))
+      m_done.insert(objno, 1);
+    m_cond.Signal();
+  }
+
+  bool CopyOnRead::was_copied(uint64_t objno) {
+    Mutex::Locker l(m_lock);
+    return m_done.contains(objno);
+  }
+
+  void CopyOnRead::reset() {
+    Mutex::Locker l(m_lock);
+    m_done.clear();
+  }
+
+  void CopyOnRead::wait_for_pending() {
+    Mutex::Locker l(m_lock);
+    while (!m_in_flight.empty())
+      m_cond.Wait(m_lock);
+  }
+}
@@ -0,0 +1,68 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRBD_COPYONREAD_H
+#define CEPH_LIBRBD_COPYONREAD_H
+
+#include <inttypes.h>
+
+#include <set>
+
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "include/interval_set.h"
+
+namespace librbd {
+
+  /**
+   * Decides which objects of a clone to copy from its parent after a
+   * read had to go there, so the next read of them doesn't.
+   *
+   * At most max_ops objects are being copied at once; a read that
+   * would start another copy while that many are in flight just
+   * doesn't, and the next read of the object tries again. An object is
+   * only copied once per open of the image, whether or not the copy
+   * found anything in the parent to copy. max_ops of 0 turns copying
+   * off.
+   */
+  class CopyOnRead {
+  public:
+    CopyOnRead();
+
+    void set_max_ops(unsigned n);
+
+    /**
+     * a read of object objno had to go to the parent
+     *
+     * @returns 0 if the caller should copy the object now, and call
+     * finish() when it is done, -EEXIST if it is being or has been
+     * copied, or -EBUSY if too many copies are in flight
+     */
+    int start(uint64_t objno);
+
+    /// a copy start() asked for is done, with result r
+    void finish(uint64_t objno, int r);
+
+    /// whether objno has been copied since the image was opened
+    bool was_copied(uint64_t objno);
+
+    /// forget what was copied, e.g. after a rollback
+    void reset();
+
+    /// wait for all copies to finish
+    void wait_for_pending();
+
+    unsigned get_pending() {
+      Mutex::Locker l(m_lock);
+      return m_in_flight.size();
+    }
+
+  private:
+    Mutex m_lock;
+    Cond m_cond;
+    unsigned m_max_ops;
+    std::set<uint64_t> m_in_flight;
+    interval_set<uint64_t> m_done;
+  };
+}
+
+#endif
@@ -6,9 +6,12 @@
 #include "common/dout.h"
 #include "common/errno.h"
 #include "common/perf_counters.h"
+#include "include/ceph_hash.h"
 
+#include "librbd/AioCompletion.h"
 #include "librbd/internal.h"
 #include "librbd/WatchCtx.h"
+#include "librbd/WriteLog.h"
 
 #include "librbd/ImageCtx.h"
 
@@ -40,13 +43,13 @@ namespace librbd {
       last_refresh(0),
       last_header_version(0),
       md_lock("librbd::ImageCtx::md_lock"),
-      cache_lock("librbd::ImageCtx::cache_lock"),
       snap_lock("librbd::ImageCtx::snap_lock"),
       parent_lock("librbd::ImageCtx::parent_lock"),
       refresh_lock("librbd::ImageCtx::refresh_lock"),
       old_format(true),
       order(0), size(0), features(0),	id(image_id), parent(NULL),
-      object_cacher(NULL), writeback_handler(NULL), object_set(NULL)
+      parent_refs(0),
+      write_log(NULL), object_map(this), qos(cct)
   {
     md_ctx.dup(p);
     data_ctx.dup(p);
@@ -61,36 +64,63 @@ namespace librbd {
       pname += snap_name;
     }
     perf_start(pname);
-
-    if (cct->_conf->rbd_cache) {
-      Mutex::Locker l(cache_lock);
-      ldout(cct, 20) << "enabling writeback caching..." << dendl;
-      writeback_handler = new LibrbdWriteback(this, cache_lock);
-      object_cacher = new ObjectCacher(cct, pname, *writeback_handler, cache_lock,
-				       NULL, NULL,
-				       cct->_conf->rbd_cache_size,
-				       cct->_conf->rbd_cache_max_dirty,
-				       cct->_conf->rbd_cache_target_dirty,
-				       cct->_conf->rbd_cache_max_dirty_age);
-      object_set = new ObjectCacher::ObjectSet(NULL, data_ctx.get_id(), 0);
-      object_cacher->start();
+    qos.set_perfcounter(perfcounter);
+
+    if (!cct->_conf->rbd_write_log_path.empty() && !snap) {
+      ldout(cct, 20) << "enabling the write log at "
+		     << cct->_conf->rbd_write_log_path << dendl;
+      write_log = new WriteLog(this);
+    } else if (cct->_conf->rbd_cache) {
+      // the size, dirty and writeback limits are for the whole image,
+      // so each shard gets an even share of them
+      int num_shards = MAX(1, cct->_conf->rbd_cache_shards);
+      ldout(cct, 20) << "enabling writeback caching with " << num_shards
+		     << " shards..." << dendl;
+      for (int i = 0; i < num_shards; ++i) {
+	std::ostringstream suffix;
+	if (num_shards > 1)
+	  suffix << "-" << i;
+	CacheShard *shard = new CacheShard("librbd::ImageCtx::cache_lock" +
+					   suffix.str());
+	Mutex::Locker l(shard->lock);
+	shard->writeback_handler = new LibrbdWriteback(this, shard->lock);
+	shard->object_cacher =
+	  new ObjectCacher(cct, pname + suffix.str(), *shard->writeback_handler,
+			   shard->lock, NULL, NULL,
+			   cct->_conf->rbd_cache_size / num_shards,
+			   cct->_conf->rbd_cache_max_dirty / num_shards,
+			   cct->_conf->rbd_cache_target_dirty / num_shards,
+			   cct->_conf->rbd_cache_max_dirty_age);
+	// a non-zero window is never split down to 0 (unlimited)
+	int64_t window = cct->_conf->rbd_cache_writeback_window;
+	shard->object_cacher->set_max_flush_in_flight(
+	  window ? MAX((int64_t)1, window / num_shards) : 0);
+	shard->object_set = new ObjectCacher::ObjectSet(NULL, data_ctx.get_id(),
+							0);
+	shard->object_cacher->start();
+	cache_shards.push_back(shard);
+      }
     }
+
+    readahead.set_trigger_requests(cct->_conf->rbd_readahead_trigger_requests);
+    readahead.set_max_bytes(cct->_conf->rbd_readahead_max_bytes);
+    readahead.set_disable_after_bytes(cct->_conf->rbd_readahead_disable_after_bytes);
+    if (cct->_conf->rbd_clone_copy_on_read)
+      copy_on_read.set_max_ops(MAX(1, cct->_conf->rbd_clone_copy_on_read_max_ops));
   }
 
   ImageCtx::~ImageCtx() {
+    qos.shut_down();
     perf_stop();
-    if (object_cacher) {
-      delete object_cacher;
-      object_cacher = NULL;
-    }
-    if (writeback_handler) {
-      delete writeback_handler;
-      writeback_handler = NULL;
-    }
-    if (object_set) {
-      delete object_set;
-      object_set = NULL;
+    delete write_log;
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p) {
+      delete (*p)->object_cacher;
+      delete (*p)->writeback_handler;
+      delete (*p)->object_set;
+      delete *p;
     }
+    cache_shards.clear();
   }
 
   int ImageCtx::init() {
@@ -157,6 +187,22 @@ namespace librbd {
     plb.add_u64_counter(l_librbd_snap_rollback, "snap_rollback");
     plb.add_u64_counter(l_librbd_notify, "notify");
     plb.add_u64_counter(l_librbd_resize, "resize");
+    plb.add_u64_counter(l_librbd_readahead, "readahead");
+    plb.add_u64_counter(l_librbd_readahead_bytes, "readahead_bytes");
+    plb.add_u64_counter(l_librbd_cor, "copy_on_read");
+    plb.add_u64_counter(l_librbd_cor_bytes, "copy_on_read_bytes");
+    plb.add_u64_counter(l_librbd_cor_skipped, "copy_on_read_skipped");
+    plb.add_u64_counter(l_librbd_cor_parent_reads_avoided,
+			"copy_on_read_parent_reads_avoided");
+    plb.add_u64_counter(l_librbd_wl_write, "write_log_write");
+    plb.add_u64_counter(l_librbd_wl_write_bytes, "write_log_write_bytes");
+    plb.add_u64_counter(l_librbd_wl_destage, "write_log_destage");
+    plb.add_u64_counter(l_librbd_wl_destage_bytes, "write_log_destage_bytes");
+    plb.add_u64_counter(l_librbd_wl_replay, "write_log_replay");
+    plb.add_u64_counter(l_librbd_wl_full, "write_log_full");
+    plb.add_u64_counter(l_librbd_qos_throttled, "qos_throttled");
+    plb.add_u64(l_librbd_qos_queued, "qos_queued");
+    plb.add_fl_avg(l_librbd_qos_wait_latency, "qos_wait_latency");
 
     perfcounter = plb.create_perf_counters();
     cct->get_perfcounters_collection()->add(perfcounter);
@@ -368,35 +414,212 @@ namespace librbd {
     return 0;
   }
 
+  ImageCtx *ImageCtx::get_parent()
+  {
+    assert(parent_lock.is_locked());
+    if (parent)
+      ++parent_refs;
+    return parent;
+  }
+
+  void ImageCtx::put_parent()
+  {
+    Mutex::Locker l(parent_lock);
+    assert(parent_refs > 0);
+    if (--parent_refs == 0)
+      parent_cond.Signal();
+  }
+
+  void ImageCtx::wait_for_parent_refs()
+  {
+    assert(parent_lock.is_locked());
+    while (parent_refs)
+      parent_cond.Wait(parent_lock);
+  }
+
+  CacheShard *ImageCtx::get_cache_shard(const object_t &o) {
+    assert(!cache_shards.empty());
+    if (cache_shards.size() == 1)
+      return cache_shards[0];
+    unsigned h = ceph_str_hash_rjenkins(o.name.c_str(), o.name.length());
+    return cache_shards[h % cache_shards.size()];
+  }
+
   void ImageCtx::aio_read_from_cache(object_t o, bufferlist *bl, size_t len,
 				     uint64_t off, Context *onfinish) {
+    CacheShard *shard = get_cache_shard(o);
     snap_lock.Lock();
-    ObjectCacher::OSDRead *rd = object_cacher->prepare_read(snap_id, bl, 0);
+    ObjectCacher::OSDRead *rd = shard->object_cacher->prepare_read(snap_id, bl,
+								   0);
     snap_lock.Unlock();
     ObjectExtent extent(o, off, len);
     extent.oloc.pool = data_ctx.get_id();
     extent.buffer_extents[0] = len;
     rd->extents.push_back(extent);
-    cache_lock.Lock();
-    int r = object_cacher->readx(rd, object_set, onfinish);
-    cache_lock.Unlock();
+    shard->lock.Lock();
+    int r = shard->object_cacher->readx(rd, shard->object_set, onfinish);
+    shard->lock.Unlock();
     if (r > 0)
       onfinish->complete(r);
   }
 
+  class C_ReadaheadComplete : public Context {
+  public:
+    C_ReadaheadComplete(ImageCtx *ictx, uint64_t len)
+      : m_ictx(ictx), m_len(len) {}
+    bufferlist bl;
+    virtual void finish(int r) {
+      ldout(m_ictx->cct, 20) << "readahead of " << m_len << " bytes done: "
+			     << r << dendl;
+      m_ictx->readahead.dec_pending(m_len);
+    }
+  private:
+    ImageCtx *m_ictx;
+    uint64_t m_len;
+  };
+
+  /**
+   * note a read of [off, off+len), and if it continues a sequential
+   * stream, prefetch what comes next into the cache, an object at a
+   * time.  nothing waits for the prefetches; a read that gets there
+   * first just joins the cache's read of the same data.
+   */
+  void ImageCtx::aio_readahead(uint64_t off, uint64_t len) {
+    if (!cache_enabled())
+      return;
+
+    md_lock.Lock();
+    snap_lock.Lock();
+    uint64_t image_size = get_image_size(snap_id);
+    snap_lock.Unlock();
+    md_lock.Unlock();
+
+    uint64_t block_size = get_block_size(order);
+    Readahead::extent_t ra = readahead.update(off, len, image_size,
+					      block_size);
+    if (!ra.second)
+      return;
+
+    ldout(cct, 20) << "readahead " << ra.first << "~" << ra.second << dendl;
+    perfcounter->inc(l_librbd_readahead);
+    perfcounter->inc(l_librbd_readahead_bytes, ra.second);
+
+    uint64_t pos = ra.first, left = ra.second;
+    while (left) {
+      string oid = get_block_oid(object_prefix, get_block_num(order, pos),
+				 old_format);
+      uint64_t block_ofs = get_block_ofs(order, pos);
+      uint64_t read_len = min(block_size - block_ofs, left);
+      C_ReadaheadComplete *ctx = new C_ReadaheadComplete(this, read_len);
+      aio_read_from_cache(oid, &ctx->bl, read_len, block_ofs, ctx);
+      pos += read_len;
+      left -= read_len;
+    }
+  }
+
+  class C_CopyOnReadWrite : public Context {
+  public:
+    C_CopyOnReadWrite(ImageCtx *ictx, uint64_t objno, uint64_t len)
+      : m_ictx(ictx), m_objno(objno), m_len(len) {}
+    virtual void finish(int r) {
+      if (r < 0) {
+	lderr(m_ictx->cct) << "error copying object " << m_objno
+			   << " from the parent: " << cpp_strerror(r) << dendl;
+      } else {
+	ldout(m_ictx->cct, 20) << "copied object " << m_objno
+			       << " from the parent" << dendl;
+	m_ictx->perfcounter->inc(l_librbd_cor);
+	m_ictx->perfcounter->inc(l_librbd_cor_bytes, m_len);
+      }
+      m_ictx->copy_on_read.finish(m_objno, r);
+    }
+  private:
+    ImageCtx *m_ictx;
+    uint64_t m_objno;
+    uint64_t m_len;
+  };
+
+  class C_CopyOnReadRead : public Context {
+  public:
+    C_CopyOnReadRead(ImageCtx *ictx, uint64_t objno, uint64_t len)
+      : m_ictx(ictx), m_objno(objno), m_bp(len) {}
+    char *buf() {
+      return m_bp.c_str();
+    }
+    virtual void finish(int r) {
+      if (r >= 0 && m_bp.is_zero()) {
+	// nothing there to copy
+	m_ictx->copy_on_read.finish(m_objno, 0);
+	return;
+      }
+      if (r >= 0) {
+	bufferlist bl;
+	bl.append(m_bp);
+	Context *ctx = new C_CopyOnReadWrite(m_ictx, m_objno, bl.length());
+	r = aio_copyup_block(m_ictx, m_objno * get_block_size(m_ictx->order),
+			     bl, ctx);
+	if (r == 0)
+	  return;
+	delete ctx;
+      }
+      ldout(m_ictx->cct, 10) << "error reading object " << m_objno
+			     << " from the parent to copy it: "
+			     << cpp_strerror(r) << dendl;
+      m_ictx->copy_on_read.finish(m_objno, r);
+    }
+  private:
+    ImageCtx *m_ictx;
+    uint64_t m_objno;
+    bufferptr m_bp;
+  };
+
+  /**
+   * a read of object objno had to go to the parent: copy the whole
+   * object from the parent in the background, so later reads of it
+   * don't. the copy is dropped if too many are in flight already.
+   *
+   * snap_lock and parent_lock must be held
+   */
+  void ImageCtx::aio_copy_on_read(uint64_t objno) {
+    assert(snap_lock.is_locked());
+    assert(parent_lock.is_locked());
+    if (!cct->_conf->rbd_clone_copy_on_read || snap_id != CEPH_NOSNAP ||
+	!parent)
+      return;
+
+    uint64_t block_size = get_block_size(order);
+    size_t len = parent_io_len(objno * block_size, block_size, snap_id);
+    if (!len)
+      return;
+    int r = copy_on_read.start(objno);
+    if (r == -EBUSY)
+      perfcounter->inc(l_librbd_cor_skipped);
+    if (r < 0)
+      return;
+
+    ldout(cct, 20) << "copying object " << objno << " from the parent" << dendl;
+    C_CopyOnReadRead *ctx = new C_CopyOnReadRead(this, objno, len);
+    AioCompletion *comp = aio_create_completion_internal(ctx, rbd_ctx_cb);
+    r = aio_read(parent, objno * block_size, len, ctx->buf(), comp);
+    comp->release();
+    if (r < 0)
+      ctx->complete(r);
+  }
+
   void ImageCtx::write_to_cache(object_t o, bufferlist& bl, size_t len,
 				uint64_t off) {
+    CacheShard *shard = get_cache_shard(o);
     snap_lock.Lock();
-    ObjectCacher::OSDWrite *wr = object_cacher->prepare_write(snapc, bl,
-							      utime_t(), 0);
+    ObjectCacher::OSDWrite *wr =
+      shard->object_cacher->prepare_write(snapc, bl, utime_t(), 0);
     snap_lock.Unlock();
     ObjectExtent extent(o, off, len);
     extent.oloc.pool = data_ctx.get_id();
     extent.buffer_extents[0] = len;
     wr->extents.push_back(extent);
     {
-      Mutex::Locker l(cache_lock);
-      object_cacher->writex(wr, object_set, cache_lock);
+      Mutex::Locker l(shard->lock);
+      shard->object_cacher->writex(wr, shard->object_set, shard->lock);
     }
   }
 
@@ -421,9 +644,18 @@ namespace librbd {
     Cond cond;
     bool done;
     Context *onfinish = new C_SafeCond(&mylock, &cond, &done, &r);
-    cache_lock.Lock();
-    bool already_flushed = object_cacher->commit_set(object_set, onfinish);
-    cache_lock.Unlock();
+    // flush every shard at once and wait for the slowest; a shard
+    // that is already clean deletes its sub, which completes it
+    C_GatherBuilder gather(cct, onfinish);
+    bool already_flushed = true;
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p) {
+      Mutex::Locker l((*p)->lock);
+      if (!(*p)->object_cacher->commit_set((*p)->object_set,
+					    gather.new_sub()))
+	already_flushed = false;
+    }
+    gather.activate();
     if (!already_flushed) {
       mylock.Lock();
       while (!done) {
@@ -437,29 +669,58 @@ namespace librbd {
   }
 
   void ImageCtx::shutdown_cache() {
+    readahead.wait_for_pending();
     md_lock.Lock();
     invalidate_cache();
     md_lock.Unlock();
-    object_cacher->stop();
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p)
+      (*p)->object_cacher->stop();
   }
 
   void ImageCtx::invalidate_cache() {
     assert(md_lock.is_locked());
-    if (!object_cacher)
+    if (!cache_enabled())
       return;
-    cache_lock.Lock();
-    object_cacher->release_set(object_set);
-    cache_lock.Unlock();
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p) {
+      Mutex::Locker l((*p)->lock);
+      (*p)->object_cacher->release_set((*p)->object_set);
+    }
     int r = flush_cache();
     if (r)
       lderr(cct) << "flush_cache returned " << r << dendl;
-    cache_lock.Lock();
-    bool unclean = object_cacher->release_set(object_set);
-    cache_lock.Unlock();
+    bool unclean = false;
+    for (vector<CacheShard*>::iterator p = cache_shards.begin();
+	 p != cache_shards.end(); ++p) {
+      Mutex::Locker l((*p)->lock);
+      if ((*p)->object_cacher->release_set((*p)->object_set))
+	unclean = true;
+    }
     if (unclean)
       lderr(cct) << "could not release all objects from cache" << dendl;
   }
 
+  void ImageCtx::discard_cache(vector<ObjectExtent> &extents) {
+    if (!cache_enabled())
+      return;
+    if (cache_shards.size() == 1) {
+      CacheShard *shard = cache_shards[0];
+      Mutex::Locker l(shard->lock);
+      shard->object_cacher->discard_set(shard->object_set, extents);
+      return;
+    }
+    map<CacheShard*, vector<ObjectExtent> > by_shard;
+    for (vector<ObjectExtent>::iterator p = extents.begin();
+	 p != extents.end(); ++p)
+      by_shard[get_cache_shard(p->oid)].push_back(*p);
+    for (map<CacheShard*, vector<ObjectExtent> >::iterator p =
+	   by_shard.begin(); p != by_shard.end(); ++p) {
+      Mutex::Locker l(p->first->lock);
+      p->first->object_cacher->discard_set(p->first->object_set, p->second);
+    }
+  }
+
   int ImageCtx::register_watch() {
     assert(!wctx);
     wctx = new WatchCtx(this);
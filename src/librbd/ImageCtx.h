@@ -10,6 +10,7 @@
 #include <string>
 #include <vector>
 
+#include "common/Cond.h"
 #include "common/Mutex.h"
 #include "common/snap_types.h"
 #include "include/buffer.h"
@@ -19,7 +20,11 @@
 #include "osdc/ObjectCacher.h"
 
 #include "librbd/cls_rbd_client.h"
+#include "librbd/CopyOnRead.h"
 #include "librbd/LibrbdWriteback.h"
+#include "librbd/ObjectMap.h"
+#include "librbd/Qos.h"
+#include "librbd/Readahead.h"
 #include "librbd/SnapInfo.h"
 #include "librbd/parent_types.h"
 
@@ -29,6 +34,24 @@ class PerfCounters;
 namespace librbd {
 
   class WatchCtx;
+  class WriteLog;
+
+  /**
+   * A slice of the cache: the objects that hash to it, with their own
+   * ObjectCacher, and so their own lock, LRU, dirty accounting and
+   * flusher, so IO to objects in different shards doesn't contend.
+   */
+  struct CacheShard {
+    std::string lock_name; // Mutex only keeps a pointer to its name
+    Mutex lock; // used as client_lock for the ObjectCacher
+    LibrbdWriteback *writeback_handler;
+    ObjectCacher *object_cacher;
+    ObjectCacher::ObjectSet *object_set;
+
+    CacheShard(const std::string &name)
+      : lock_name(name), lock(lock_name.c_str()), writeback_handler(NULL),
+	object_cacher(NULL), object_set(NULL) {}
+  };
 
   struct ImageCtx {
     CephContext *cct;
@@ -57,12 +80,14 @@ namespace librbd {
 
     /**
      * Lock ordering:
-     * md_lock, cache_lock, snap_lock, parent_lock, refresh_lock
+     * md_lock, a cache shard's lock, snap_lock, parent_lock,
+     * refresh_lock, object_map's lock
+     *
+     * Only one cache shard's lock is held at a time.
      */
     Mutex md_lock; // protects access to the mutable image metadata that
                    // isn't guarded by other locks below
                    // (size, features, image locks, etc)
-    Mutex cache_lock; // used as client_lock for the ObjectCacher
     Mutex snap_lock; // protects snapshot-related member variables:
     Mutex parent_lock; // protects parent_md and parent
     Mutex refresh_lock; // protects refresh_seq and last_refresh
@@ -76,10 +101,16 @@ namespace librbd {
     std::string id; // only used for new-format images
     parent_info parent_md;
     ImageCtx *parent;
+    int parent_refs; // users of parent that dropped parent_lock
+    Cond parent_cond;
 
-    ObjectCacher *object_cacher;
-    LibrbdWriteback *writeback_handler;
-    ObjectCacher::ObjectSet *object_set;
+    std::vector<CacheShard*> cache_shards; // empty if caching is off
+    WriteLog *write_log; // replaces the cache if set
+
+    Readahead readahead;
+    CopyOnRead copy_on_read;
+    ObjectMap object_map;
+    Qos qos;
 
     /**
      * Either image_name or image_id must be set.
@@ -110,11 +141,26 @@ namespace librbd {
     uint64_t get_parent_snap_id(librados::snap_t in_snap_id) const;
     int get_parent_overlap(librados::snap_t in_snap_id,
 			   uint64_t *overlap) const;
+    /**
+     * parent, with a ref that keeps it open after parent_lock is
+     * dropped, or NULL. parent_lock must be held.
+     */
+    ImageCtx *get_parent();
+    void put_parent();
+    /// wait until nobody holds a ref to parent; parent_lock must be held
+    void wait_for_parent_refs();
+    bool cache_enabled() const {
+      return !cache_shards.empty();
+    }
+    CacheShard *get_cache_shard(const object_t &o);
     void aio_read_from_cache(object_t o, bufferlist *bl, size_t len,
 			     uint64_t off, Context *onfinish);
+    void aio_readahead(uint64_t off, uint64_t len);
+    void aio_copy_on_read(uint64_t objno);
     void write_to_cache(object_t o, bufferlist& bl, size_t len, uint64_t off);
     int read_from_cache(object_t o, bufferlist *bl, size_t len, uint64_t off);
     int flush_cache();
+    void discard_cache(std::vector<ObjectExtent> &extents);
     void shutdown_cache();
     void invalidate_cache();
     int register_watch();
@@ -0,0 +1,318 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include <errno.h>
+
+#include "common/ceph_context.h"
+#include "common/dout.h"
+#include "common/errno.h"
+#include "include/rbd/features.h"
+
+#include "librbd/cls_rbd.h"
+#include "librbd/cls_rbd_client.h"
+#include "librbd/ImageCtx.h"
+#include "librbd/internal.h"
+
+#include "librbd/ObjectMap.h"
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::ObjectMap: "
+
+using std::string;
+using std::vector;
+
+namespace librbd {
+
+  ObjectMap::ObjectMap(ImageCtx *ictx)
+    : m_ictx(ictx),
+      m_lock("librbd::ObjectMap::m_lock"),
+      m_enabled(false),
+      m_owner(false),
+      m_in_flight(0)
+  {
+  }
+
+  bool ObjectMap::enabled()
+  {
+    Mutex::Locker l(m_lock);
+    return m_enabled;
+  }
+
+  void ObjectMap::refresh(bool owner)
+  {
+    assert(m_ictx->md_lock.is_locked());
+    bool enable = !m_ictx->old_format &&
+      (m_ictx->features & RBD_FEATURE_OBJECT_MAP);
+    uint64_t num_objs = get_max_block(m_ictx->size, m_ictx->order);
+
+    Mutex::Locker l(m_lock);
+    if (!enable) {
+      m_enabled = false;
+      m_owner = false;
+      m_state.clear();
+      return;
+    }
+    bool reload = !m_enabled || num_objs != m_state.size() ||
+      (owner && !m_owner);
+    m_owner = owner;
+    if (reload)
+      _load(num_objs);
+  }
+
+  void ObjectMap::clear_owner()
+  {
+    Mutex::Locker l(m_lock);
+    m_owner = false;
+  }
+
+  int ObjectMap::load()
+  {
+    assert(m_ictx->md_lock.is_locked());
+    uint64_t num_objs = get_max_block(m_ictx->size, m_ictx->order);
+    Mutex::Locker l(m_lock);
+    return _load(num_objs);
+  }
+
+  // m_lock held
+  int ObjectMap::_load(uint64_t num_objs)
+  {
+    vector<bool> exists;
+    int r = read(m_ictx->md_ctx, object_map_name(m_ictx->id), num_objs,
+		 &exists);
+    if (r < 0) {
+      // carry on without it; writes won't keep it up to date either,
+      // so it has to be rebuilt before it can be used again
+      lderr(m_ictx->cct) << "error loading object map, ignoring it until it "
+			 << "is rebuilt: " << cpp_strerror(r) << dendl;
+      m_enabled = false;
+      m_state.clear();
+      return r;
+    }
+
+    ldout(m_ictx->cct, 10) << "loaded object map for " << num_objs
+			   << " objects" << dendl;
+    m_state.resize(num_objs);
+    for (uint64_t i = 0; i < num_objs; ++i)
+      m_state[i] = exists[i] ? OBJECT_EXISTS : OBJECT_NONEXISTENT;
+    m_enabled = true;
+    return 0;
+  }
+
+  bool ObjectMap::object_may_exist(uint64_t objno)
+  {
+    Mutex::Locker l(m_lock);
+    if (!m_enabled || !m_owner || objno >= m_state.size())
+      return true;
+    return m_state[objno] != OBJECT_NONEXISTENT;
+  }
+
+  int ObjectMap::mark_exists(uint64_t start_objno, uint64_t end_objno)
+  {
+    Mutex::Locker l(m_lock);
+    if (!m_enabled)
+      return 0;
+
+    end_objno = MIN(end_objno, m_state.size());
+    if (m_owner) {
+      while (start_objno < end_objno &&
+	     m_state[start_objno] == OBJECT_EXISTS)
+	++start_objno;
+      while (end_objno > start_objno &&
+	     m_state[end_objno - 1] == OBJECT_EXISTS)
+	--end_objno;
+    }
+    if (start_objno == end_objno)
+      return 0;
+
+    // synchronous librados calls are woken by the messenger, not the
+    // finisher, so this is safe from librados callbacks too. m_lock
+    // stays held so this is ordered with removed()'s updates
+    ldout(m_ictx->cct, 20) << "marking objects " << start_objno << "~"
+			   << (end_objno - start_objno) << " as existing"
+			   << dendl;
+    int r = cls_client::object_map_update(&m_ictx->md_ctx,
+					  object_map_name(m_ictx->id),
+					  start_objno, end_objno, true);
+    if (r < 0) {
+      lderr(m_ictx->cct) << "error updating object map: " << cpp_strerror(r)
+			 << dendl;
+      return r;
+    }
+    for (uint64_t i = start_objno; i < end_objno; ++i)
+      m_state[i] = OBJECT_EXISTS;
+    return 0;
+  }
+
+  class ObjectMap::C_MarkExists : public Context {
+  public:
+    C_MarkExists(ObjectMap *object_map, uint64_t start_objno,
+		 uint64_t end_objno, Context *on_finish)
+      : m_object_map(object_map), m_start_objno(start_objno),
+	m_end_objno(end_objno), m_on_finish(on_finish) {}
+    virtual void finish(int r) {
+      m_object_map->finish_mark_exists(m_start_objno, m_end_objno, r);
+      m_on_finish->complete(r);
+    }
+  private:
+    ObjectMap *m_object_map;
+    uint64_t m_start_objno;
+    uint64_t m_end_objno;
+    Context *m_on_finish;
+  };
+
+  bool ObjectMap::aio_mark_exists(uint64_t start_objno, uint64_t end_objno,
+				  Context *on_finish)
+  {
+    Mutex::Locker l(m_lock);
+    if (!m_enabled)
+      return false;
+
+    // only the lock holder's copy is complete enough to skip the update
+    end_objno = MIN(end_objno, m_state.size());
+    if (m_owner) {
+      while (start_objno < end_objno &&
+	     m_state[start_objno] == OBJECT_EXISTS)
+	++start_objno;
+      while (end_objno > start_objno &&
+	     m_state[end_objno - 1] == OBJECT_EXISTS)
+	--end_objno;
+    }
+    if (start_objno == end_objno)
+      return false;
+
+    ldout(m_ictx->cct, 20) << "marking objects " << start_objno << "~"
+			   << (end_objno - start_objno) << " as existing"
+			   << dendl;
+    // until the update commits, writers to these objects still have to
+    // send (and wait for) one of their own
+    for (uint64_t i = start_objno; i < end_objno; ++i)
+      m_state[i] = OBJECT_PENDING;
+
+    // sent under m_lock, so the osd sees it in order with removed()'s
+    librados::ObjectWriteOperation op;
+    cls_client::object_map_update(&op, start_objno, end_objno, true);
+    Context *ctx = new C_MarkExists(this, start_objno, end_objno, on_finish);
+    librados::AioCompletion *c =
+      librados::Rados::aio_create_completion(ctx, NULL, context_cb);
+    m_in_flight++;
+    m_ictx->md_ctx.aio_operate(object_map_name(m_ictx->id), c, &op);
+    c->release();
+    return true;
+  }
+
+  void ObjectMap::finish_mark_exists(uint64_t start_objno, uint64_t end_objno,
+				     int r)
+  {
+    Mutex::Locker l(m_lock);
+    if (r < 0) {
+      // the objects stay pending, so the next write tries again
+      lderr(m_ictx->cct) << "error updating object map: " << cpp_strerror(r)
+			 << dendl;
+    } else {
+      end_objno = MIN(end_objno, m_state.size());
+      for (uint64_t i = start_objno; i < end_objno; ++i)
+	if (m_state[i] == OBJECT_PENDING)
+	  m_state[i] = OBJECT_EXISTS;
+    }
+    if (--m_in_flight == 0)
+      m_cond.Signal();
+  }
+
+  bool ObjectMap::mark_removing(uint64_t objno)
+  {
+    Mutex::Locker l(m_lock);
+    if (!m_enabled || !m_owner || objno >= m_state.size() ||
+	m_state[objno] != OBJECT_EXISTS)
+      return false;
+    m_state[objno] = OBJECT_REMOVING;
+    return true;
+  }
+
+  void ObjectMap::removed(uint64_t objno, int r)
+  {
+    Mutex::Locker l(m_lock);
+    // a write since mark_removing() has marked it existing again
+    if (objno >= m_state.size() || m_state[objno] != OBJECT_REMOVING)
+      return;
+    if (r < 0) {
+      m_state[objno] = OBJECT_EXISTS;
+      return;
+    }
+
+    m_state[objno] = OBJECT_NONEXISTENT;
+    // if this never makes it to the osd, the object just looks like it
+    // may exist
+    librados::ObjectWriteOperation op;
+    cls_client::object_map_update(&op, objno, objno + 1, false);
+    librados::AioCompletion *c =
+      librados::Rados::aio_create_completion(this, NULL, update_cb);
+    m_in_flight++;
+    m_ictx->md_ctx.aio_operate(object_map_name(m_ictx->id), c, &op);
+    c->release();
+  }
+
+  void ObjectMap::update_cb(librados::completion_t c, void *arg)
+  {
+    ObjectMap *object_map = reinterpret_cast<ObjectMap *>(arg);
+    object_map->finish_update(rados_aio_get_return_value(c));
+  }
+
+  void ObjectMap::context_cb(librados::completion_t c, void *arg)
+  {
+    Context *ctx = reinterpret_cast<Context *>(arg);
+    ctx->complete(rados_aio_get_return_value(c));
+  }
+
+  void ObjectMap::finish_update(int r)
+  {
+    Mutex::Locker l(m_lock);
+    if (r < 0)
+      ldout(m_ictx->cct, 5) << "error clearing object map bit: "
+			    << cpp_strerror(r) << dendl;
+    if (--m_in_flight == 0)
+      m_cond.Signal();
+  }
+
+  int ObjectMap::resize(uint64_t num_objs)
+  {
+    assert(m_ictx->md_lock.is_locked());
+    Mutex::Locker l(m_lock);
+    if (!m_enabled)
+      return 0;
+
+    int r = cls_client::object_map_resize(&m_ictx->md_ctx,
+					  object_map_name(m_ictx->id),
+					  num_objs);
+    if (r < 0) {
+      lderr(m_ictx->cct) << "error resizing object map: " << cpp_strerror(r)
+			 << dendl;
+      return r;
+    }
+    m_state.resize(num_objs, OBJECT_NONEXISTENT);
+    return 0;
+  }
+
+  void ObjectMap::flush()
+  {
+    Mutex::Locker l(m_lock);
+    while (m_in_flight)
+      m_cond.Wait(m_lock);
+  }
+
+  int ObjectMap::read(librados::IoCtx &io_ctx, const string &oid,
+		      uint64_t num_objs, vector<bool> *exists)
+  {
+    bufferlist bl;
+    int r = io_ctx.read(oid, bl, 0, 0);
+    if (r < 0)
+      return r;
+
+    // anything the map is too short to cover may exist
+    exists->assign(num_objs, true);
+    uint64_t covered = MIN(num_objs, (uint64_t)bl.length() * 8);
+    const char *map = bl.c_str();
+    for (uint64_t i = 0; i < covered; ++i)
+      (*exists)[i] = object_map_test(map, i);
+    return 0;
+  }
+}
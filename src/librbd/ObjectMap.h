@@ -0,0 +1,116 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRBD_OBJECTMAP_H
+#define CEPH_LIBRBD_OBJECTMAP_H
+
+#include <inttypes.h>
+
+#include <string>
+#include <vector>
+
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "include/Context.h"
+#include "include/rados/librados.hpp"
+
+namespace librbd {
+
+  class ImageCtx;
+
+  /**
+   * Our copy of the object map of an image with RBD_FEATURE_OBJECT_MAP:
+   * which of its data objects may exist. The map itself is kept in
+   * rbd_object_map.<id>, one bit per object (see cls_rbd.h).
+   *
+   * Anyone writing to an object marks it in the map first, on the osd,
+   * before the write is sent. Only the holder of the image's exclusive
+   * lock clears bits, once it has removed objects, and only the holder
+   * trusts a clear bit to mean the object doesn't exist: anyone else's
+   * copy may be missing objects created since it was read. Bits are
+   * only kept for the image itself, not its snapshots.
+   */
+  class ObjectMap {
+  public:
+    ObjectMap(ImageCtx *ictx);
+
+    bool enabled();
+
+    /**
+     * pick up changes to the image after its header was reread:
+     * (re)load the map if it was just enabled, the image was
+     * resized, or we just became the exclusive lock holder
+     *
+     * md_lock must be held
+     */
+    void refresh(bool owner);
+    /// we no longer hold the exclusive lock
+    void clear_owner();
+    /// reload the map from the osd
+    int load();
+
+    /// false only if the object is known not to exist
+    bool object_may_exist(uint64_t objno);
+
+    /**
+     * mark [start_objno, end_objno) as existing before writing to
+     * them, waiting for the osd; unlike waiting on aio_mark_exists(),
+     * this may be called from librados callbacks
+     */
+    int mark_exists(uint64_t start_objno, uint64_t end_objno);
+    /**
+     * mark_exists() without waiting
+     *
+     * @returns false if the map already says they exist; otherwise
+     * on_finish is completed once the update is on the osd, and only
+     * then may the objects be written
+     */
+    bool aio_mark_exists(uint64_t start_objno, uint64_t end_objno,
+			 Context *on_finish);
+    /**
+     * note that objno is about to be removed
+     *
+     * @returns true if removed() should be called when it has been
+     */
+    bool mark_removing(uint64_t objno);
+    /// the removal of objno finished with result r
+    void removed(uint64_t objno, int r);
+
+    /// resize the map along with the image; md_lock must be held
+    int resize(uint64_t num_objs);
+    /// wait for updates sent by aio_mark_exists() and removed()
+    void flush();
+
+    /**
+     * read an image's object map from the osd, without using or
+     * changing our copy
+     */
+    static int read(librados::IoCtx &io_ctx, const std::string &oid,
+		    uint64_t num_objs, std::vector<bool> *exists);
+
+  private:
+    enum {
+      OBJECT_NONEXISTENT,
+      OBJECT_EXISTS,
+      OBJECT_REMOVING,
+      OBJECT_PENDING,  ///< being marked as existing
+    };
+
+    class C_MarkExists;
+
+    int _load(uint64_t num_objs);
+    void finish_mark_exists(uint64_t start_objno, uint64_t end_objno, int r);
+    void finish_update(int r);
+    static void update_cb(librados::completion_t c, void *arg);
+    static void context_cb(librados::completion_t c, void *arg);
+
+    ImageCtx *m_ictx;
+    Mutex m_lock;
+    Cond m_cond;
+    bool m_enabled;
+    bool m_owner;
+    std::vector<uint8_t> m_state;
+    int m_in_flight;
+  };
+}
+
+#endif
@@ -0,0 +1,262 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <algorithm>
+
+#include "common/ceph_context.h"
+#include "common/Clock.h"
+#include "common/dout.h"
+#include "common/perf_counters.h"
+#include "include/assert.h"
+#include "include/Context.h"
+
+#include "librbd/internal.h"
+
+#include "librbd/Qos.h"
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::Qos: "
+
+namespace librbd {
+
+  void TokenBucket::set_limit(uint64_t rate, uint64_t burst, utime_t now)
+  {
+    refill(now);
+    bool was_limited = m_rate;
+    m_rate = rate;
+    m_burst = std::max<uint64_t>(burst, 1);
+    // a bucket that starts limiting starts full
+    if (!was_limited || m_tokens > m_burst)
+      m_tokens = m_burst;
+    m_last = now;
+  }
+
+  void TokenBucket::refill(utime_t now)
+  {
+    if (now <= m_last)
+      return;
+    m_tokens += (double)(now - m_last) * m_rate;
+    if (m_tokens > m_burst)
+      m_tokens = m_burst;
+    m_last = now;
+  }
+
+  double TokenBucket::get_wait(utime_t now, uint64_t n)
+  {
+    if (!m_rate)
+      return 0;
+    refill(now);
+    double need = std::min(n, m_burst);
+    if (m_tokens >= need)
+      return 0;
+    return (need - m_tokens) / m_rate;
+  }
+
+  void TokenBucket::take(uint64_t n)
+  {
+    if (m_rate)
+      m_tokens -= n;
+  }
+
+  Qos::Qos(CephContext *cct)
+    : m_cct(cct),
+      m_perfcounter(NULL),
+      m_lock("librbd::Qos::m_lock"),
+      m_dispatch_thread(this),
+      m_enabled(false),
+      m_stop(false)
+  {
+    m_dispatching[0] = m_dispatching[1] = 0;
+  }
+
+  Qos::~Qos()
+  {
+    assert(!m_dispatch_thread.is_started());
+    assert(m_queue[0].empty() && m_queue[1].empty());
+  }
+
+  void Qos::set_perfcounter(PerfCounters *perfcounter)
+  {
+    Mutex::Locker l(m_lock);
+    m_perfcounter = perfcounter;
+  }
+
+  void Qos::set_limits(uint64_t read_iops, uint64_t write_iops,
+		       uint64_t read_bps, uint64_t write_bps,
+		       double burst_seconds)
+  {
+    Mutex::Locker l(m_lock);
+    ldout(m_cct, 10) << "set_limits read " << read_iops << " iops "
+		     << read_bps << " bytes/s, write " << write_iops
+		     << " iops " << write_bps << " bytes/s, burst "
+		     << burst_seconds << "s" << dendl;
+    if (m_stop)
+      return;
+    utime_t now = ceph_clock_now(m_cct);
+    m_iops[0].set_limit(read_iops, read_iops * burst_seconds, now);
+    m_iops[1].set_limit(write_iops, write_iops * burst_seconds, now);
+    m_bps[0].set_limit(read_bps, read_bps * burst_seconds, now);
+    m_bps[1].set_limit(write_bps, write_bps * burst_seconds, now);
+    m_enabled = read_iops || write_iops || read_bps || write_bps;
+    // whatever is queued may be able to go sooner now
+    m_cond.Signal();
+  }
+
+  bool Qos::is_active()
+  {
+    Mutex::Locker l(m_lock);
+    return m_enabled || !m_queue[0].empty() || !m_queue[1].empty() ||
+      m_dispatching[0] || m_dispatching[1];
+  }
+
+  double Qos::get_wait(int dir, utime_t now, uint64_t len)
+  {
+    return std::max(m_iops[dir].get_wait(now, 1),
+		    m_bps[dir].get_wait(now, len));
+  }
+
+  void Qos::take(int dir, uint64_t len)
+  {
+    m_iops[dir].take(1);
+    m_bps[dir].take(len);
+  }
+
+  void Qos::update_queued()
+  {
+    if (m_perfcounter)
+      m_perfcounter->set(l_librbd_qos_queued,
+			 m_queue[0].size() + m_queue[1].size());
+  }
+
+  bool Qos::start_io(bool write, uint64_t len)
+  {
+    int dir = write;
+    Mutex::Locker l(m_lock);
+    if (!m_enabled && m_queue[dir].empty() && !m_dispatching[dir])
+      return true;
+    // nothing jumps the queue, so writes are sent in the order they
+    // were made
+    if (m_queue[dir].empty() && !m_dispatching[dir] &&
+	get_wait(dir, ceph_clock_now(m_cct), len) == 0) {
+      take(dir, len);
+      return true;
+    }
+    return false;
+  }
+
+  void Qos::queue_io(bool write, uint64_t len, Context *ctx)
+  {
+    int dir = write;
+    m_lock.Lock();
+    if (m_stop) {
+      // shut down since start_io(): nothing to wait for any more
+      m_lock.Unlock();
+      ctx->complete(0);
+      return;
+    }
+    ldout(m_cct, 20) << "queueing " << (write ? "write" : "read")
+		     << " of " << len << " bytes behind "
+		     << m_queue[dir].size() << dendl;
+    m_queue[dir].push_back(QueuedIo(len, ctx, ceph_clock_now(m_cct)));
+    // only images something is actually throttled on need the thread
+    if (!m_dispatch_thread.is_started())
+      m_dispatch_thread.create();
+    if (m_perfcounter)
+      m_perfcounter->inc(l_librbd_qos_throttled);
+    update_queued();
+    m_cond.Signal();
+    m_lock.Unlock();
+  }
+
+  void Qos::wait_io(bool write, uint64_t len)
+  {
+    if (start_io(write, len))
+      return;
+    Mutex mylock("librbd::Qos::wait_io::mylock");
+    Cond cond;
+    bool done = false;
+    int r;
+    queue_io(write, len, new C_SafeCond(&mylock, &cond, &done, &r));
+    mylock.Lock();
+    while (!done)
+      cond.Wait(mylock);
+    mylock.Unlock();
+  }
+
+  void Qos::drain_writes()
+  {
+    Mutex::Locker l(m_lock);
+    while (!m_queue[1].empty() || m_dispatching[1])
+      m_cond.Wait(m_lock);
+  }
+
+  void Qos::shut_down()
+  {
+    m_lock.Lock();
+    m_stop = true;
+    m_enabled = false;
+    m_cond.Signal();
+    m_lock.Unlock();
+    if (m_dispatch_thread.is_started())
+      m_dispatch_thread.join();
+
+    // nothing to wait for any more
+    m_lock.Lock();
+    for (int dir = 0; dir < 2; ++dir) {
+      while (!m_queue[dir].empty()) {
+	Context *ctx = m_queue[dir].front().ctx;
+	m_queue[dir].pop_front();
+	m_lock.Unlock();
+	ctx->complete(0);
+	m_lock.Lock();
+      }
+    }
+    update_queued();
+    m_cond.Signal();
+    m_lock.Unlock();
+  }
+
+  void Qos::dispatch_entry()
+  {
+    m_lock.Lock();
+    while (!m_stop) {
+      double wait = 0;
+      for (int dir = 0; dir < 2 && !m_stop; ++dir) {
+	while (!m_queue[dir].empty() && !m_stop) {
+	  utime_t now = ceph_clock_now(m_cct);
+	  QueuedIo &io = m_queue[dir].front();
+	  double w = m_enabled ? get_wait(dir, now, io.len) : 0;
+	  if (w > 0) {
+	    if (wait == 0 || w < wait)
+	      wait = w;
+	    break;
+	  }
+	  take(dir, io.len);
+	  Context *ctx = io.ctx;
+	  if (m_perfcounter)
+	    m_perfcounter->finc(l_librbd_qos_wait_latency, now - io.queued);
+	  m_queue[dir].pop_front();
+	  update_queued();
+
+	  ++m_dispatching[dir];
+	  m_lock.Unlock();
+	  ctx->complete(0);
+	  m_lock.Lock();
+	  --m_dispatching[dir];
+	  m_cond.Signal();
+	}
+      }
+      if (m_stop)
+	break;
+      if (wait > 0) {
+	utime_t interval;
+	interval.set_from_double(wait);
+	m_cond.WaitInterval(m_cct, m_lock, interval);
+      } else if (m_queue[0].empty() && m_queue[1].empty()) {
+	m_cond.Wait(m_lock);
+      }
+    }
+    m_lock.Unlock();
+  }
+}
@@ -0,0 +1,134 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRBD_QOS_H
+#define CEPH_LIBRBD_QOS_H
+
+#include <inttypes.h>
+
+#include <deque>
+
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "include/utime.h"
+
+class CephContext;
+class Context;
+class PerfCounters;
+
+namespace librbd {
+
+  /**
+   * Lets through at most rate units a second on average, and up to
+   * burst at once after a quiet spell. A request for more than burst
+   * goes once the bucket is full, and the time it overdraws by is
+   * paid for by whatever comes after it.
+   */
+  class TokenBucket {
+  public:
+    TokenBucket() : m_rate(0), m_burst(0), m_tokens(0) {}
+
+    /// a rate of 0 lets everything through
+    void set_limit(uint64_t rate, uint64_t burst, utime_t now);
+    uint64_t get_rate() const {
+      return m_rate;
+    }
+
+    /// seconds from now until n units can be let through; 0 if now
+    double get_wait(utime_t now, uint64_t n);
+    /// let n units through
+    void take(uint64_t n);
+
+  private:
+    void refill(utime_t now);
+
+    uint64_t m_rate, m_burst;
+    double m_tokens;
+    utime_t m_last; // when m_tokens was last refilled
+  };
+
+  /**
+   * Limits on the ios and bytes a second an image's user may read and
+   * write. An io the limits don't let through yet is queued, behind
+   * any others of the same kind, and sent from a thread of its own
+   * once they do, rather than failed. Discards count as write ios of
+   * no bytes.
+   */
+  class Qos {
+  public:
+    Qos(CephContext *cct);
+    ~Qos();
+
+    void set_perfcounter(PerfCounters *perfcounter);
+    /**
+     * set the limits, in ios or bytes a second, with 0 meaning no
+     * limit; up to burst_seconds' worth may go at once
+     */
+    void set_limits(uint64_t read_iops, uint64_t write_iops,
+		    uint64_t read_bps, uint64_t write_bps,
+		    double burst_seconds);
+    /**
+     * whether ios need to go through start_io(): limits are set, or
+     * some queued while they were are still waiting
+     */
+    bool is_active();
+
+    /**
+     * an io of len bytes wants to go
+     *
+     * @returns true if it may go now; otherwise the caller hands it to
+     * queue_io()
+     */
+    bool start_io(bool write, uint64_t len);
+    /**
+     * queue an io start_io() didn't let go; ctx is completed from the
+     * qos thread when it may
+     */
+    void queue_io(bool write, uint64_t len, Context *ctx);
+    /// wait until an io of len bytes may go
+    void wait_io(bool write, uint64_t len);
+    /// wait until every write queued so far has been sent
+    void drain_writes();
+    /// stop limiting, and send everything queued now
+    void shut_down();
+
+  private:
+    struct QueuedIo {
+      uint64_t len;
+      Context *ctx;
+      utime_t queued;
+      QueuedIo(uint64_t l, Context *c, utime_t q) : len(l), ctx(c), queued(q) {}
+    };
+
+    class DispatchThread : public Thread {
+      Qos *m_qos;
+    public:
+      DispatchThread(Qos *qos) : m_qos(qos) {}
+      void *entry() {
+	m_qos->dispatch_entry();
+	return 0;
+      }
+    };
+
+    double get_wait(int dir, utime_t now, uint64_t len);
+    void take(int dir, uint64_t len);
+    void update_queued();
+    void dispatch_entry();
+
+    CephContext *m_cct;
+    PerfCounters *m_perfcounter;
+    Mutex m_lock;
+    Cond m_cond;
+    DispatchThread m_dispatch_thread;
+    bool m_enabled;
+    bool m_stop;
+
+    // by direction: 0 for reads, 1 for writes
+    TokenBucket m_iops[2];
+    TokenBucket m_bps[2];
+    std::deque<QueuedIo> m_queue[2];
+    int m_dispatching[2]; // taken off the queue but not yet sent
+  };
+}
+
+#endif
@@ -0,0 +1,118 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <algorithm>
+
+#include "include/assert.h"
+
+#include "librbd/Readahead.h"
+
+using std::max;
+using std::min;
+
+namespace librbd {
+
+  Readahead::Readahead()
+    : m_lock("librbd::Readahead::m_lock"),
+      m_trigger_requests(10),
+      m_max_bytes(512 * 1024),
+      m_disable_after_bytes(0),
+      m_pending(0),
+      m_total_read(0),
+      m_disabled(false)
+  {
+    reset();
+  }
+
+  void Readahead::set_trigger_requests(unsigned n) {
+    Mutex::Locker l(m_lock);
+    m_trigger_requests = n;
+  }
+
+  void Readahead::set_max_bytes(uint64_t bytes) {
+    Mutex::Locker l(m_lock);
+    m_max_bytes = bytes;
+  }
+
+  void Readahead::set_disable_after_bytes(uint64_t bytes) {
+    Mutex::Locker l(m_lock);
+    m_disable_after_bytes = bytes;
+  }
+
+  // m_lock held
+  void Readahead::reset() {
+    m_last_pos = 0;
+    m_nr_consec_read = 0;
+    m_consec_read_bytes = 0;
+    m_readahead_pos = 0;
+    m_readahead_trigger_pos = 0;
+    m_readahead_size = 0;
+  }
+
+  Readahead::extent_t Readahead::update(uint64_t off, uint64_t len,
+					uint64_t image_size,
+					uint64_t object_size) {
+    Mutex::Locker l(m_lock);
+    if (m_disabled || !m_max_bytes)
+      return extent_t(0, 0);
+
+    m_total_read += len;
+    if (m_disable_after_bytes && m_total_read >= m_disable_after_bytes) {
+      m_disabled = true;
+      return extent_t(0, 0);
+    }
+
+    if (off != m_last_pos) {
+      // random io, or a new stream
+      reset();
+    }
+    m_last_pos = off + len;
+    m_nr_consec_read++;
+    m_consec_read_bytes += len;
+
+    if (m_nr_consec_read < m_trigger_requests ||
+	m_last_pos < m_readahead_trigger_pos)
+      return extent_t(0, 0);
+
+    uint64_t start = max(m_readahead_pos, m_last_pos);
+    uint64_t size;
+    if (m_readahead_size)
+      size = min(m_readahead_size * 2, m_max_bytes);
+    else
+      size = min(m_consec_read_bytes, m_max_bytes);
+    uint64_t end = min(start + size, image_size);
+
+    // stop at an object boundary if there is one past the middle
+    if (object_size && end < image_size) {
+      uint64_t aligned = end - end % object_size;
+      if (aligned > start + (end - start) / 2)
+	end = aligned;
+    }
+    if (end <= start)
+      return extent_t(0, 0);
+
+    // stay within the byte budget
+    if (m_pending + (end - start) > m_max_bytes)
+      return extent_t(0, 0);
+
+    m_readahead_size = end - start;
+    m_readahead_pos = end;
+    m_readahead_trigger_pos = start + m_readahead_size / 2;
+    m_pending += m_readahead_size;
+    return extent_t(start, m_readahead_size);
+  }
+
+  void Readahead::dec_pending(uint64_t len) {
+    Mutex::Locker l(m_lock);
+    assert(m_pending >= len);
+    m_pending -= len;
+    if (!m_pending)
+      m_pending_cond.Signal();
+  }
+
+  void Readahead::wait_for_pending() {
+    Mutex::Locker l(m_lock);
+    while (m_pending)
+      m_pending_cond.Wait(m_lock);
+  }
+}
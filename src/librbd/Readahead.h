@@ -0,0 +1,88 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRBD_READAHEAD_H
+#define CEPH_LIBRBD_READAHEAD_H
+
+#include <inttypes.h>
+
+#include <utility>
+
+#include "common/Cond.h"
+#include "common/Mutex.h"
+
+namespace librbd {
+
+  /**
+   * Decides when and what to read ahead of a stream of reads.
+   *
+   * Once trigger_requests reads in a row have each started where the
+   * last one ended, the stream is taken to be sequential and update()
+   * starts returning extents to prefetch. The first window is as big
+   * as the stream so far; each later one doubles, up to max_bytes, and
+   * goes out when the reader is halfway through the previous one.
+   * Window ends are pulled back to an object boundary when one falls
+   * in the second half of the window, so prefetches don't leave a
+   * sliver of an object to be fetched on its own. A read anywhere
+   * else resets the stream.
+   *
+   * Prefetches in flight are limited to max_bytes in total. After
+   * disable_after_bytes have been read (0 for never), readahead turns
+   * itself off: by then the guest's own readahead has taken over.
+   */
+  class Readahead {
+  public:
+    typedef std::pair<uint64_t, uint64_t> extent_t;
+
+    Readahead();
+
+    void set_trigger_requests(unsigned n);
+    void set_max_bytes(uint64_t bytes);
+    void set_disable_after_bytes(uint64_t bytes);
+
+    /**
+     * note a read of [off, off+len) of an image of image_size bytes,
+     * made of objects of object_size bytes
+     *
+     * @returns the extent to prefetch now; its length is 0 if none
+     */
+    extent_t update(uint64_t off, uint64_t len, uint64_t image_size,
+		    uint64_t object_size);
+
+    /// a prefetch of len bytes returned by update() completed
+    void dec_pending(uint64_t len);
+
+    /// wait for all prefetches to complete
+    void wait_for_pending();
+
+    uint64_t get_pending() {
+      Mutex::Locker l(m_lock);
+      return m_pending;
+    }
+    bool is_disabled() {
+      Mutex::Locker l(m_lock);
+      return m_disabled;
+    }
+
+  private:
+    void reset();
+
+    Mutex m_lock;
+    Cond m_pending_cond;
+
+    unsigned m_trigger_requests;
+    uint64_t m_max_bytes;
+    uint64_t m_disable_after_bytes;
+
+    uint64_t m_last_pos;        ///< end of the last read
+    unsigned m_nr_consec_read;  ///< reads in the current stream
+    uint64_t m_consec_read_bytes;
+    uint64_t m_readahead_pos;   ///< end of the last prefetch
+    uint64_t m_readahead_trigger_pos;
+    uint64_t m_readahead_size;  ///< size of the last prefetch
+    uint64_t m_pending;         ///< prefetch bytes in flight
+    uint64_t m_total_read;
+    bool m_disabled;
+  };
+}
+
+#endif
@@ -0,0 +1,908 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <sstream>
+
+#include "common/ceph_context.h"
+#include "common/dout.h"
+#include "common/errno.h"
+#include "common/perf_counters.h"
+#include "common/safe_io.h"
+#include "include/crc32c.h"
+#include "include/encoding.h"
+
+#include "librbd/AioCompletion.h"
+#include "librbd/ImageCtx.h"
+#include "librbd/internal.h"
+
+#include "librbd/WriteLog.h"
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::WriteLog: "
+
+using std::string;
+
+namespace librbd {
+
+  // two header slots, then the ring of entries
+  static const uint64_t HEADER_SLOT_SIZE = 4096;
+  static const uint64_t DATA_START = 2 * HEADER_SLOT_SIZE;
+  static const uint64_t ENTRY_ALIGN = 512;
+  static const uint64_t ENTRY_HEADER_SIZE = 64;
+
+  // how long to wait before destaging again after a failure
+  static const utime_t DESTAGE_RETRY_INTERVAL(1, 0);
+
+  static const char HEADER_MAGIC[] = "rbd write log v1";
+  static const uint32_t ENTRY_MAGIC = 0x5257424c; // RWBL
+
+  enum {
+    ENTRY_WRITE = 1,
+    ENTRY_PAD = 2, // the rest of the ring is unused; wrap to the start
+  };
+
+  static uint64_t entry_size(uint64_t len)
+  {
+    return (ENTRY_HEADER_SIZE + len + ENTRY_ALIGN - 1) & ~(ENTRY_ALIGN - 1);
+  }
+
+  static void encode_entry_header(uint32_t type, uint64_t seq, uint64_t off,
+				  uint32_t len, uint32_t data_crc,
+				  bufferlist &bl)
+  {
+    bufferlist h;
+    ::encode(ENTRY_MAGIC, h);
+    ::encode(type, h);
+    ::encode(seq, h);
+    ::encode(off, h);
+    ::encode(len, h);
+    ::encode(data_crc, h);
+    ::encode(h.crc32c(0), h);
+    bl.claim_append(h);
+    bl.append_zero(ENTRY_HEADER_SIZE - bl.length());
+  }
+
+  static bool decode_entry_header(bufferlist &bl, uint32_t *type,
+				  uint64_t *seq, uint64_t *off,
+				  uint32_t *len, uint32_t *data_crc)
+  {
+    try {
+      bufferlist::iterator p = bl.begin();
+      uint32_t magic, crc;
+      ::decode(magic, p);
+      if (magic != ENTRY_MAGIC)
+	return false;
+      ::decode(*type, p);
+      ::decode(*seq, p);
+      ::decode(*off, p);
+      ::decode(*len, p);
+      ::decode(*data_crc, p);
+      unsigned hlen = p.get_off();
+      ::decode(crc, p);
+      bufferlist h;
+      h.substr_of(bl, 0, hlen);
+      return h.crc32c(0) == crc;
+    } catch (buffer::error& e) {
+      return false;
+    }
+  }
+
+  class WriteLog::C_Destaged : public Context {
+  public:
+    C_Destaged(WriteLog *log, uint64_t seq) : m_log(log), m_seq(seq) {}
+    virtual void finish(int r) {
+      m_log->destaged(m_seq, r);
+    }
+  private:
+    WriteLog *m_log;
+    uint64_t m_seq;
+  };
+
+  WriteLog::WriteLog(ImageCtx *ictx)
+    : m_ictx(ictx),
+      m_lock("librbd::WriteLog::m_lock"),
+      m_destage_thread(this),
+      m_sync_thread(this),
+      m_fd(-1),
+      m_active(false),
+      m_stop(false),
+      m_error(0),
+      m_syncing(false),
+      m_size(0),
+      m_header_gen(0),
+      m_header_head_pos(DATA_START),
+      m_header_head_seq(1),
+      m_head_pos(DATA_START),
+      m_head_seq(1),
+      m_tail_pos(DATA_START),
+      m_next_seq(1),
+      m_destage_seq(1)
+  {
+  }
+
+  WriteLog::~WriteLog()
+  {
+    assert(!m_destage_thread.is_started());
+    assert(!m_sync_thread.is_started());
+    assert(m_fd < 0);
+  }
+
+  string WriteLog::log_path()
+  {
+    string path = m_ictx->cct->_conf->rbd_write_log_path;
+    struct stat st;
+    if (::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      std::ostringstream oss;
+      oss << path << "/rbd-write-log." << m_ictx->md_ctx.get_id() << "."
+	  << (m_ictx->old_format ? m_ictx->name : m_ictx->id);
+      return oss.str();
+    }
+    return path;
+  }
+
+  bool WriteLog::is_active()
+  {
+    Mutex::Locker l(m_lock);
+    return m_active;
+  }
+
+  void WriteLog::set_owner(bool owner, const string &cookie)
+  {
+    assert(m_ictx->md_lock.is_locked());
+    Mutex::Locker l(m_lock);
+    // after losing the lock, the log is open until the destage thread
+    // is done with it
+    if (owner && !m_active && m_fd < 0) {
+      m_cookie = cookie;
+      int r = open_log();
+      if (r < 0) {
+	lderr(m_ictx->cct) << "error opening write log, writing to the osds "
+			   << "directly: " << cpp_strerror(r) << dendl;
+	return;
+      }
+      m_active = true;
+      if (!m_destage_thread.is_started()) {
+	m_destage_thread.create();
+	m_sync_thread.create();
+      }
+      m_cond.Signal();
+    } else if (!owner && m_active) {
+      // whoever has the lock now may write over anything we would
+      // destage
+      ldout(m_ictx->cct, 1) << "lost the exclusive lock, leaving "
+			    << (m_next_seq - m_head_seq) << " entries in the "
+			    << "write log" << dendl;
+      m_active = false;
+      m_cond.Signal();
+    }
+  }
+
+  // m_lock held
+  int WriteLog::open_log()
+  {
+    CephContext *cct = m_ictx->cct;
+    string path = log_path();
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+    if (m_fd < 0) {
+      int r = -errno;
+      lderr(cct) << "error opening " << path << ": " << cpp_strerror(r)
+		 << dendl;
+      return r;
+    }
+
+    int r = read_header();
+    if (r == -ENOENT) {
+      // a new log
+      m_size = cct->_conf->rbd_write_log_size & ~(ENTRY_ALIGN - 1);
+      if (m_size < DATA_START + 2 * ENTRY_ALIGN) {
+	lderr(cct) << "rbd_write_log_size is too small" << dendl;
+	close_log();
+	return -EINVAL;
+      }
+      struct stat st;
+      if (::fstat(m_fd, &st) == 0 && S_ISREG(st.st_mode) &&
+	  (uint64_t)st.st_size < m_size &&
+	  ::ftruncate(m_fd, m_size) < 0) {
+	r = -errno;
+	close_log();
+	return r;
+      }
+      m_header_gen = 0;
+      m_head_pos = m_tail_pos = DATA_START;
+      m_head_seq = m_next_seq = 1;
+      r = write_header();
+      if (r < 0) {
+	close_log();
+	return r;
+      }
+      ldout(cct, 5) << "created write log " << path << " of " << m_size
+		    << " bytes" << dendl;
+    } else if (r < 0) {
+      close_log();
+      return r;
+    } else {
+      // what we left when we lost the lock is replayed here, if the
+      // lock is still ours
+      m_dirty.clear();
+      r = replay();
+      // nothing left under another lock: the log is ours now
+      if (r == 0 && m_header_cookie != m_cookie)
+	r = write_header();
+      if (r < 0) {
+	close_log();
+	return r;
+      }
+    }
+    m_destage_seq = m_head_seq;
+    m_error = 0;
+    return 0;
+  }
+
+  // m_lock held
+  void WriteLog::close_log()
+  {
+    if (m_fd >= 0) {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+  }
+
+  /**
+   * read whichever header slot is valid and newer
+   *
+   * @returns -ENOENT if neither is, -EINVAL if the log is for another
+   * image
+   */
+  int WriteLog::read_header()
+  {
+    bool found = false;
+    for (unsigned slot = 0; slot < 2; ++slot) {
+      bufferptr bp(HEADER_SLOT_SIZE);
+      ssize_t r = safe_pread(m_fd, bp.c_str(), bp.length(),
+			     slot * HEADER_SLOT_SIZE);
+      if (r < 0)
+	return r;
+      if ((uint64_t)r < HEADER_SLOT_SIZE)
+	continue;
+      bufferlist bl;
+      bl.append(bp);
+      try {
+	bufferlist::iterator p = bl.begin();
+	string magic, image, cookie;
+	int64_t pool;
+	uint64_t gen, size, head_pos, head_seq;
+	uint32_t crc;
+	::decode(magic, p);
+	if (magic != HEADER_MAGIC)
+	  continue;
+	::decode(gen, p);
+	::decode(pool, p);
+	::decode(image, p);
+	::decode(size, p);
+	::decode(head_pos, p);
+	::decode(head_seq, p);
+	::decode(cookie, p);
+	unsigned hlen = p.get_off();
+	::decode(crc, p);
+	bufferlist h;
+	h.substr_of(bl, 0, hlen);
+	if (h.crc32c(0) != crc)
+	  continue;
+	if (found && gen <= m_header_gen)
+	  continue;
+
+	string ours = m_ictx->old_format ? m_ictx->name : m_ictx->id;
+	if (pool != m_ictx->md_ctx.get_id() || image != ours) {
+	  lderr(m_ictx->cct) << "write log belongs to image " << image
+			     << " in pool " << pool << dendl;
+	  return -EINVAL;
+	}
+	found = true;
+	m_header_gen = gen;
+	m_size = size;
+	m_header_head_pos = m_head_pos = head_pos;
+	m_header_head_seq = m_head_seq = head_seq;
+	m_header_cookie = cookie;
+      } catch (buffer::error& e) {
+	continue;
+      }
+    }
+    return found ? 0 : -ENOENT;
+  }
+
+  // m_lock held
+  int WriteLog::write_header()
+  {
+    uint64_t gen = m_header_gen + 1;
+    bufferlist bl;
+    ::encode(string(HEADER_MAGIC), bl);
+    ::encode(gen, bl);
+    ::encode(m_ictx->md_ctx.get_id(), bl);
+    ::encode(m_ictx->old_format ? m_ictx->name : m_ictx->id, bl);
+    ::encode(m_size, bl);
+    ::encode(m_head_pos, bl);
+    ::encode(m_head_seq, bl);
+    ::encode(m_cookie, bl);
+    ::encode(bl.crc32c(0), bl);
+    assert(bl.length() <= HEADER_SLOT_SIZE);
+    bl.append_zero(HEADER_SLOT_SIZE - bl.length());
+
+    // the other slot still has the last header if this is torn
+    int r = safe_pwrite(m_fd, bl.c_str(), bl.length(),
+			(gen % 2) * HEADER_SLOT_SIZE);
+    if (r == 0 && ::fdatasync(m_fd) < 0)
+      r = -errno;
+    if (r < 0) {
+      lderr(m_ictx->cct) << "error writing write log header: "
+			 << cpp_strerror(r) << dendl;
+      return r;
+    }
+    m_header_gen = gen;
+    m_header_head_pos = m_head_pos;
+    m_header_head_seq = m_head_seq;
+    m_header_cookie = m_cookie;
+    return 0;
+  }
+
+  /**
+   * find the entries after the head that made it to disk: every one
+   * with the next sequence number and a good checksum, until one
+   * doesn't. these may or may not have been destaged already, so they
+   * all are again, in order.
+   *
+   * @returns -ESTALE if there are any, but the log was written under
+   * another lock than ours
+   */
+  int WriteLog::replay()
+  {
+    CephContext *cct = m_ictx->cct;
+    uint64_t pos = m_head_pos;
+    uint64_t seq = m_head_seq;
+    uint64_t scanned = 0;
+    while (scanned < m_size - DATA_START) {
+      if (pos == m_size)
+	pos = DATA_START;
+      bufferptr hp(ENTRY_HEADER_SIZE);
+      ssize_t r = safe_pread(m_fd, hp.c_str(), hp.length(), pos);
+      if (r < 0)
+	return r;
+      if ((uint64_t)r < ENTRY_HEADER_SIZE)
+	break;
+      bufferlist hbl;
+      hbl.append(hp);
+      uint32_t type, len, data_crc;
+      uint64_t entry_seq, off;
+      if (!decode_entry_header(hbl, &type, &entry_seq, &off, &len, &data_crc) ||
+	  entry_seq != seq)
+	break;
+      if (type == ENTRY_PAD) {
+	scanned += m_size - pos;
+	pos = DATA_START;
+	continue;
+      }
+
+      bufferptr dp(len);
+      r = safe_pread(m_fd, dp.c_str(), len, pos + ENTRY_HEADER_SIZE);
+      if (r < 0)
+	return r;
+      if ((uint64_t)r < len)
+	break;
+      bufferlist dbl;
+      dbl.append(dp);
+      if (dbl.crc32c(0) != data_crc)
+	break;
+
+      ldout(cct, 20) << "replaying entry " << seq << " at " << pos << ": "
+		     << off << "~" << len << dendl;
+      m_entries.push_back(Entry(seq, pos, off, len));
+      mark_dirty(off, len, seq);
+      ++seq;
+      pos += entry_size(len);
+      scanned += entry_size(len);
+    }
+    m_tail_pos = pos;
+    m_next_seq = seq;
+    if (!m_entries.empty() && m_header_cookie != m_cookie) {
+      // whoever had the lock in between may have written over them
+      lderr(cct) << "write log has " << m_entries.size() << " entries "
+		 << "written under lock cookie '" << m_header_cookie
+		 << "', not ours ('" << m_cookie << "'); not replaying them. "
+		 << "remove " << log_path() << " to discard them" << dendl;
+      m_entries.clear();
+      m_dirty.clear();
+      return -ESTALE;
+    }
+    if (!m_entries.empty()) {
+      ldout(cct, 1) << "write log has " << m_entries.size() << " entries "
+		    << "that may not have been written to the osds; "
+		    << "writing them now" << dendl;
+      m_ictx->perfcounter->inc(l_librbd_wl_replay, m_entries.size());
+    }
+    return 0;
+  }
+
+  /**
+   * find room for an entry, without reusing anything the header on
+   * disk doesn't say has been destaged
+   */
+  bool WriteLog::reserve(uint64_t size, uint64_t *pos)
+  {
+    uint64_t head = m_header_head_pos;
+    bool full = m_tail_pos == head && m_next_seq != m_header_head_seq;
+    if (full)
+      return false;
+    if (m_tail_pos >= head) {
+      if (m_size - m_tail_pos >= size) {
+	*pos = m_tail_pos;
+	return true;
+      }
+      if (head - DATA_START >= size) {
+	*pos = DATA_START;
+	return true;
+      }
+      return false;
+    }
+    if (head - m_tail_pos >= size) {
+      *pos = m_tail_pos;
+      return true;
+    }
+    return false;
+  }
+
+  int WriteLog::aio_write(uint64_t off, bufferlist &bl, Context *on_safe)
+  {
+    CephContext *cct = m_ictx->cct;
+    uint64_t len = bl.length();
+    uint64_t size = entry_size(len);
+
+    m_lock.Lock();
+    if (!m_active) {
+      int r = is_dirty(off, len) ? -ESHUTDOWN : -EAGAIN;
+      m_lock.Unlock();
+      return r;
+    }
+    if (size > m_size - DATA_START) {
+      // too big for the log; it can go straight to the osds once
+      // everything before it has
+      int r = _flush();
+      m_lock.Unlock();
+      return r < 0 ? r : -EAGAIN;
+    }
+
+    uint64_t pos;
+    bool waited = false;
+    while (!reserve(size, &pos)) {
+      if (!m_active) {
+	// lost the lock while waiting
+	int r = is_dirty(off, len) ? -ESHUTDOWN : -EAGAIN;
+	m_lock.Unlock();
+	return r;
+      }
+      if (m_head_seq != m_header_head_seq) {
+	// space has been destaged; let it be reused
+	int r = write_header();
+	if (r < 0) {
+	  m_lock.Unlock();
+	  return r;
+	}
+	continue;
+      }
+      ldout(cct, 20) << "write log full, waiting for destage" << dendl;
+      waited = true;
+      m_cond.Wait(m_lock);
+    }
+    if (waited)
+      m_ictx->perfcounter->inc(l_librbd_wl_full);
+
+    uint64_t seq = m_next_seq++;
+    if (pos != m_tail_pos && m_tail_pos < m_size) {
+      // tell replay to wrap around
+      bufferlist pad;
+      encode_entry_header(ENTRY_PAD, seq, 0, 0, 0, pad);
+      int r = safe_pwrite(m_fd, pad.c_str(), pad.length(), m_tail_pos);
+      if (r < 0) {
+	lderr(cct) << "error writing to write log: " << cpp_strerror(r)
+		   << dendl;
+	m_next_seq--;
+	m_lock.Unlock();
+	return r;
+      }
+    }
+
+    bufferlist ebl;
+    encode_entry_header(ENTRY_WRITE, seq, off, len, bl.crc32c(0), ebl);
+    ebl.append(bl);
+    ebl.append_zero(size - ebl.length());
+    int r = safe_pwrite(m_fd, ebl.c_str(), ebl.length(), pos);
+    if (r < 0) {
+      lderr(cct) << "error writing to write log: " << cpp_strerror(r) << dendl;
+      m_next_seq--;
+      m_lock.Unlock();
+      return r;
+    }
+    ldout(cct, 20) << "logged entry " << seq << " at " << pos << ": " << off
+		   << "~" << len << dendl;
+
+    m_entries.push_back(Entry(seq, pos, off, len));
+    mark_dirty(off, len, seq);
+    m_tail_pos = pos + size;
+    m_sync_waiters.push_back(on_safe);
+    m_cond.Signal();
+    m_lock.Unlock();
+
+    m_ictx->perfcounter->inc(l_librbd_wl_write);
+    m_ictx->perfcounter->inc(l_librbd_wl_write_bytes, len);
+    return 0;
+  }
+
+  /**
+   * make what has been appended durable, completing the writes that
+   * were waiting for it. entries are written in order, so one sync
+   * covers everything appended before it, however many that is.
+   */
+  void WriteLog::sync_entry()
+  {
+    CephContext *cct = m_ictx->cct;
+    ldout(cct, 10) << "sync thread start" << dendl;
+    m_lock.Lock();
+    while (true) {
+      if (m_sync_waiters.empty()) {
+	if (m_stop)
+	  break;
+	m_cond.Wait(m_lock);
+	continue;
+      }
+      std::list<Context*> waiters;
+      waiters.swap(m_sync_waiters);
+      int fd = m_fd;
+      m_syncing = true;
+      m_lock.Unlock();
+
+      int r = 0;
+      if (::fdatasync(fd) < 0) {
+	r = -errno;
+	lderr(cct) << "error syncing write log: " << cpp_strerror(r) << dendl;
+      }
+      ldout(cct, 20) << "synced " << waiters.size() << " writes" << dendl;
+      finish_contexts(cct, waiters, r);
+
+      m_lock.Lock();
+      m_syncing = false;
+      m_cond.Signal();
+    }
+    m_lock.Unlock();
+    ldout(cct, 10) << "sync thread finish" << dendl;
+  }
+
+  int WriteLog::aio_wait_for_destage(uint64_t off, uint64_t len,
+				     Context *on_finish)
+  {
+    Mutex::Locker l(m_lock);
+    // the last write to each part of the extent. overlapping entries
+    // are destaged in order, so once it is, so are those before it
+    DestageWaiter w;
+    get_dirty_seqs(off, len, &w.seqs);
+    if (w.seqs.empty())
+      return 0;
+    if (!m_active)
+      return -ESHUTDOWN;
+    ldout(m_ictx->cct, 20) << "waiting for " << off << "~" << len
+			   << " to be destaged, up to entry " << *w.seqs.rbegin()
+			   << dendl;
+    w.ctx = on_finish;
+    m_destage_waiters.push_back(w);
+    return 1;
+  }
+
+  int WriteLog::flush()
+  {
+    Mutex::Locker l(m_lock);
+    return _flush();
+  }
+
+  // m_lock held
+  int WriteLog::_flush()
+  {
+    uint64_t seq = m_next_seq;
+    while (m_head_seq < seq && m_active)
+      m_cond.Wait(m_lock);
+    if (m_head_seq < seq)
+      return -ESHUTDOWN; // lost the lock first
+    if (m_fd >= 0 && m_head_seq != m_header_head_seq)
+      return write_header();
+    return 0;
+  }
+
+  void WriteLog::close(bool crash)
+  {
+    m_lock.Lock();
+    if (crash) {
+      ldout(m_ictx->cct, 1) << "closing write log without destaging it, "
+			    << m_entries.size() << " entries left" << dendl;
+      if (m_ictx->cct->_conf->rbd_write_log_crash_torn)
+	write_torn_entry();
+    } else {
+      _flush();
+    }
+    m_active = false;
+    m_stop = true;
+    m_cond.Signal();
+    m_lock.Unlock();
+
+    if (m_destage_thread.is_started()) {
+      m_destage_thread.join();
+      m_sync_thread.join();
+    }
+
+    std::list<Context*> waiters;
+    m_lock.Lock();
+    for (std::list<DestageWaiter>::iterator p = m_destage_waiters.begin();
+	 p != m_destage_waiters.end(); ++p)
+      waiters.push_back(p->ctx);
+    m_destage_waiters.clear();
+    close_log();
+    m_lock.Unlock();
+    finish_contexts(m_ictx->cct, waiters, -ESHUTDOWN);
+  }
+
+  // can't be sent while an earlier write to the same place is in flight
+  bool WriteLog::destage_blocked(const Entry &e)
+  {
+    for (std::map<uint64_t, Entry*>::iterator p = m_in_flight.begin();
+	 p != m_in_flight.end(); ++p) {
+      if (p->second->off < e.off + e.len && e.off < p->second->off + p->second->len)
+	return true;
+    }
+    return false;
+  }
+
+  void WriteLog::destage_entry()
+  {
+    CephContext *cct = m_ictx->cct;
+    ldout(cct, 10) << "destage thread start" << dendl;
+    m_lock.Lock();
+    while (true) {
+      if (m_stop && m_in_flight.empty())
+	break;
+      if (m_active && m_error && m_in_flight.empty()) {
+	if (ceph_clock_now(cct) < m_retry_time) {
+	  m_cond.WaitUntil(m_lock, m_retry_time);
+	  continue;
+	}
+	// start again from the oldest entry that hasn't been destaged
+	ldout(cct, 5) << "retrying destage from entry " << m_head_seq << dendl;
+	m_error = 0;
+	m_destage_seq = m_head_seq;
+      }
+      uint64_t max_in_flight = MAX(1, cct->_conf->rbd_write_log_destage_ops);
+      if (m_active && !m_error && m_destage_seq < m_next_seq &&
+	  m_in_flight.size() < max_in_flight) {
+	Entry &e = m_entries[m_destage_seq - m_entries.front().seq];
+	if (e.done) {
+	  // made it before an earlier entry failed
+	  m_destage_seq++;
+	  continue;
+	}
+	if (!destage_blocked(e)) {
+	  m_destage_seq++;
+	  m_in_flight[e.seq] = &e;
+	  uint64_t seq = e.seq, pos = e.pos, off = e.off, len = e.len;
+	  int fd = m_fd;
+	  m_lock.Unlock();
+
+	  bufferptr bp(len);
+	  int r = safe_pread_exact(fd, bp.c_str(), len, pos + ENTRY_HEADER_SIZE);
+	  if (r < 0) {
+	    lderr(cct) << "error reading entry " << seq << " from write log: "
+		       << cpp_strerror(r) << dendl;
+	    destaged(seq, r);
+	  } else {
+	    ldout(cct, 20) << "destaging entry " << seq << ": " << off << "~"
+			   << len << dendl;
+	    Context *ctx = new C_Destaged(this, seq);
+	    AioCompletion *comp = aio_create_completion_internal(ctx, rbd_ctx_cb);
+	    r = aio_write_to_osds(m_ictx, off, len, bp.c_str(), comp);
+	    comp->release();
+	    if (r < 0) {
+	      delete ctx;
+	      destaged(seq, r);
+	    }
+	  }
+	  m_lock.Lock();
+	  continue;
+	}
+      }
+
+      if (!m_active && !m_stop && m_fd >= 0 && m_in_flight.empty() &&
+	  !m_syncing && m_sync_waiters.empty()) {
+	// lost the lock: record how far we got and leave the rest, and
+	// the reads waiting for it, to the next holder
+	if (m_head_seq != m_header_head_seq)
+	  write_header();
+	close_log();
+	m_entries.clear();
+	m_error = 0;
+	std::list<Context*> waiters;
+	for (std::list<DestageWaiter>::iterator p = m_destage_waiters.begin();
+	     p != m_destage_waiters.end(); ++p)
+	  waiters.push_back(p->ctx);
+	m_destage_waiters.clear();
+	m_cond.Signal();
+	m_lock.Unlock();
+	finish_contexts(cct, waiters, -ESHUTDOWN);
+	m_lock.Lock();
+	continue;
+      }
+      m_cond.Wait(m_lock);
+    }
+    m_lock.Unlock();
+    ldout(cct, 10) << "destage thread finish" << dendl;
+  }
+
+  void WriteLog::destaged(uint64_t seq, int r)
+  {
+    CephContext *cct = m_ictx->cct;
+    m_lock.Lock();
+    m_in_flight.erase(seq);
+    if (r < 0) {
+      // nothing more is sent until this is retried: later writes to the
+      // same place have to land after it
+      lderr(cct) << "error destaging write log entry " << seq << ", will "
+		 << "retry: " << cpp_strerror(r) << dendl;
+      if (!m_error) {
+	m_error = r;
+	m_retry_time = ceph_clock_now(cct);
+	m_retry_time += DESTAGE_RETRY_INTERVAL;
+      }
+      m_cond.Signal();
+      m_lock.Unlock();
+      return;
+    }
+
+    Entry &e = m_entries[seq - m_entries.front().seq];
+    e.done = true;
+    clear_dirty(e);
+    m_ictx->perfcounter->inc(l_librbd_wl_destage);
+    m_ictx->perfcounter->inc(l_librbd_wl_destage_bytes, e.len);
+    while (!m_entries.empty() && m_entries.front().done) {
+      m_head_seq = m_entries.front().seq + 1;
+      m_entries.pop_front();
+    }
+    m_head_pos = m_entries.empty() ? m_tail_pos : m_entries.front().pos;
+    std::list<Context*> finished;
+    take_destage_waiters(&finished);
+    m_cond.Signal();
+    m_lock.Unlock();
+    finish_contexts(cct, finished);
+  }
+
+  // m_lock held
+  void WriteLog::mark_dirty(uint64_t off, uint64_t len, uint64_t seq)
+  {
+    if (!len)
+      return;
+    uint64_t end = off + len;
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> >::iterator p =
+      m_dirty.lower_bound(off);
+    if (p != m_dirty.begin()) {
+      --p;
+      if (p->first + p->second.first <= off)
+	++p;
+    }
+    // this write is now the last to whatever it covers; keep the
+    // parts of older ranges that stick out either side
+    while (p != m_dirty.end() && p->first < end) {
+      uint64_t start = p->first;
+      uint64_t stop = start + p->second.first;
+      uint64_t old_seq = p->second.second;
+      m_dirty.erase(p++);
+      if (start < off)
+	m_dirty[start] = std::make_pair(off - start, old_seq);
+      if (stop > end)
+	m_dirty[end] = std::make_pair(stop - end, old_seq);
+    }
+    m_dirty[off] = std::make_pair(len, seq);
+  }
+
+  // m_lock held
+  void WriteLog::get_dirty_seqs(uint64_t off, uint64_t len,
+				std::set<uint64_t> *seqs)
+  {
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> >::iterator p =
+      m_dirty.lower_bound(off);
+    if (p != m_dirty.begin()) {
+      --p;
+      if (p->first + p->second.first <= off)
+	++p;
+    }
+    for (; p != m_dirty.end() && p->first < off + len; ++p)
+      seqs->insert(p->second.second);
+  }
+
+  // m_lock held
+  bool WriteLog::is_dirty(uint64_t off, uint64_t len)
+  {
+    std::set<uint64_t> seqs;
+    get_dirty_seqs(off, len, &seqs);
+    return !seqs.empty();
+  }
+
+  // m_lock held: drop what e was still the last write to
+  void WriteLog::clear_dirty(const Entry &e)
+  {
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> >::iterator p =
+      m_dirty.lower_bound(e.off);
+    while (p != m_dirty.end() && p->first < e.off + e.len) {
+      if (p->second.second == e.seq)
+	m_dirty.erase(p++);
+      else
+	++p;
+    }
+  }
+
+  // m_lock held
+  bool WriteLog::is_destaged(uint64_t seq)
+  {
+    if (seq < m_head_seq)
+      return true;
+    return m_entries[seq - m_entries.front().seq].done;
+  }
+
+  // m_lock held: hand over the readers with nothing left to wait for
+  void WriteLog::take_destage_waiters(std::list<Context*> *finished)
+  {
+    std::list<DestageWaiter>::iterator p = m_destage_waiters.begin();
+    while (p != m_destage_waiters.end()) {
+      std::set<uint64_t>::iterator q = p->seqs.begin();
+      while (q != p->seqs.end() && is_destaged(*q))
+	p->seqs.erase(q++);
+      if (p->seqs.empty()) {
+	finished->push_back(p->ctx);
+	m_destage_waiters.erase(p++);
+      } else {
+	++p;
+      }
+    }
+  }
+
+  /**
+   * for testing: leave behind what a write the client died in the
+   * middle of could, an entry whose header is on disk but only half of
+   * its data. it was never acknowledged, so replay must stop there.
+   *
+   * m_lock held
+   */
+  void WriteLog::write_torn_entry()
+  {
+    CephContext *cct = m_ictx->cct;
+    uint64_t len = 8 * ENTRY_ALIGN;
+    uint64_t pos;
+    if (m_fd < 0 || !reserve(entry_size(len), &pos) || pos != m_tail_pos)
+      return;
+
+    bufferptr data(len);
+    memset(data.c_str(), 0xdb, len);
+    bufferlist dbl;
+    dbl.append(data);
+    bufferlist ebl;
+    encode_entry_header(ENTRY_WRITE, m_next_seq, 0, len, dbl.crc32c(0), ebl);
+    ebl.append(data.c_str(), len / 2);
+    ebl.append_zero(entry_size(len) - ebl.length());
+    int r = safe_pwrite(m_fd, ebl.c_str(), ebl.length(), pos);
+    if (r == 0 && ::fdatasync(m_fd) < 0)
+      r = -errno;
+    if (r < 0) {
+      lderr(cct) << "error writing torn entry: " << cpp_strerror(r) << dendl;
+      return;
+    }
+    ldout(cct, 1) << "left torn entry " << m_next_seq << " at " << pos
+		  << dendl;
+  }
+}
@@ -0,0 +1,184 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+#ifndef CEPH_LIBRBD_WRITELOG_H
+#define CEPH_LIBRBD_WRITELOG_H
+
+#include <inttypes.h>
+
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "include/buffer.h"
+#include "include/Context.h"
+#include "include/utime.h"
+
+namespace librbd {
+
+  class ImageCtx;
+
+  /**
+   * A persistent write-back log for an image, kept on a local file or
+   * block device (rbd_write_log_path). Writes are appended to it and
+   * acknowledged once they are durable there, which a sync thread
+   * takes care of for as many of them at a time as it can. They are
+   * then written to the osds (destaged) by a thread of its own, in the
+   * order they were made; a failed destage is retried. If the client
+   * dies, whatever wasn't destaged is still in the log, and is
+   * destaged the next time the image is opened.
+   *
+   * Only the holder of the image's exclusive lock uses the log. Anyone
+   * else writes to the osds directly. The header records the cookie of
+   * the lock the log was written under, and what is left in it is
+   * only replayed under that same lock: anyone else may have written
+   * the image since. For the same reason, a client that loses the lock
+   * stops destaging, and leaves the rest to the next holder of the
+   * lock with its cookie; until then, its reads and writes of what it
+   * left fail with -ESHUTDOWN.
+   *
+   * Reads of data that is still in the log wait for the last write to
+   * it to be destaged.
+   *
+   * The log is a ring: two header slots, written alternately, record
+   * where the oldest entry that may not have been destaged is, and
+   * each entry is a checksummed header followed by the data, padded
+   * to a sector. Space is only reused once a header saying it has been
+   * destaged is on disk.
+   */
+  class WriteLog {
+  public:
+    WriteLog(ImageCtx *ictx);
+    ~WriteLog();
+
+    /**
+     * we hold, with cookie, or no longer hold, the image's exclusive
+     * lock: open the log, destaging anything left in it, or stop
+     * destaging and using it
+     *
+     * md_lock must be held
+     */
+    void set_owner(bool owner, const std::string &cookie = std::string());
+    bool is_active();
+
+    /**
+     * append a write to the log; on_safe is completed once it is
+     * durable there
+     *
+     * @returns -EAGAIN if the log isn't in use and the write should go
+     * straight to the osds, or a negative error code, in which case
+     * on_safe isn't used
+     */
+    int aio_write(uint64_t off, ceph::bufferlist &bl, Context *on_safe);
+    /**
+     * wait until nothing written so far to [off, off+len) is only in
+     * the log
+     *
+     * @returns 0 if nothing is, 1 if on_finish will be completed once
+     * it has been destaged, or -ESHUTDOWN if we lost the lock first
+     */
+    int aio_wait_for_destage(uint64_t off, uint64_t len, Context *on_finish);
+    /// destage everything written so far, and record that it has been
+    int flush();
+    /**
+     * stop using the log: destage everything in it first, or if crash
+     * is set, just stop, as if the client had died
+     */
+    void close(bool crash);
+
+  private:
+    struct Entry {
+      uint64_t seq;
+      uint64_t pos; // of its header in the log
+      uint64_t off, len; // in the image
+      bool done;
+      Entry(uint64_t s, uint64_t p, uint64_t o, uint64_t l)
+	: seq(s), pos(p), off(o), len(l), done(false) {}
+    };
+
+    class DestageThread : public Thread {
+      WriteLog *m_log;
+    public:
+      DestageThread(WriteLog *log) : m_log(log) {}
+      void *entry() {
+	m_log->destage_entry();
+	return 0;
+      }
+    };
+
+    class SyncThread : public Thread {
+      WriteLog *m_log;
+    public:
+      SyncThread(WriteLog *log) : m_log(log) {}
+      void *entry() {
+	m_log->sync_entry();
+	return 0;
+      }
+    };
+
+    struct DestageWaiter {
+      std::set<uint64_t> seqs; // not destaged yet
+      Context *ctx;
+    };
+
+    class C_Destaged;
+
+    std::string log_path();
+    int open_log();
+    void close_log();
+    int read_header();
+    int write_header();
+    int replay();
+    void write_torn_entry();
+    bool reserve(uint64_t entry_size, uint64_t *pos);
+    int _flush();
+    void sync_entry();
+    void destage_entry();
+    bool destage_blocked(const Entry &e);
+    void destaged(uint64_t seq, int r);
+    void mark_dirty(uint64_t off, uint64_t len, uint64_t seq);
+    void get_dirty_seqs(uint64_t off, uint64_t len, std::set<uint64_t> *seqs);
+    bool is_dirty(uint64_t off, uint64_t len);
+    bool is_destaged(uint64_t seq);
+    void clear_dirty(const Entry &e);
+    void take_destage_waiters(std::list<Context*> *finished);
+
+    ImageCtx *m_ictx;
+    Mutex m_lock;
+    Cond m_cond;
+    DestageThread m_destage_thread;
+    SyncThread m_sync_thread;
+    int m_fd;
+    bool m_active;
+    bool m_stop;
+    int m_error; // a failed destage; nothing more is sent until it's retried
+    utime_t m_retry_time;
+    std::list<Context*> m_sync_waiters; // appended, waiting for the next sync
+    bool m_syncing; // the sync thread is syncing the log outside m_lock
+
+    std::string m_cookie; // of the lock we hold
+    uint64_t m_size;
+    uint64_t m_header_gen;
+    std::string m_header_cookie; // the lock the log was written under
+    // where the log starts, as far as the header on disk says
+    uint64_t m_header_head_pos;
+    uint64_t m_header_head_seq;
+    // where it really starts and ends
+    uint64_t m_head_pos, m_head_seq;
+    uint64_t m_tail_pos, m_next_seq;
+
+    std::deque<Entry> m_entries; // not yet destaged, oldest first
+    uint64_t m_destage_seq; // next entry to send
+    std::map<uint64_t, Entry*> m_in_flight; // being destaged, by seq
+    // what m_entries cover: off -> (len, seq of the last write to it).
+    // once we lose the lock, what we left in the log
+    std::map<uint64_t, std::pair<uint64_t, uint64_t> > m_dirty;
+    std::list<DestageWaiter> m_destage_waiters;
+  };
+}
+
+#endif
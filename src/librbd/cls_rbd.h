@@ -143,4 +143,27 @@ struct cls_rbd_snap {
 };
 WRITE_CLASS_ENCODER(cls_rbd_snap)
 
+/*
+ * The object map of an image is a bitmap with one bit per data
+ * object, set if the object may exist: object n is bit n % 8 of byte
+ * n / 8.  Bits past the last object are always clear.
+ */
+static inline uint64_t object_map_bytes(uint64_t num_objs)
+{
+  return (num_objs + 7) / 8;
+}
+
+static inline bool object_map_test(const char *map, uint64_t objno)
+{
+  return map[objno / 8] & (1 << (objno % 8));
+}
+
+static inline void object_map_assign(char *map, uint64_t objno, bool exists)
+{
+  if (exists)
+    map[objno / 8] |= (1 << (objno % 8));
+  else
+    map[objno / 8] &= ~(1 << (objno % 8));
+}
+
 #endif
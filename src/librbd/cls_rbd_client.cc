@@ -476,6 +476,36 @@ namespace librbd {
       return ioctx->exec(oid, "rbd", "set_protection_status", in, out);
     }
 
+    /******************** rbd_object_map object methods ********************/
+
+    int object_map_resize(librados::IoCtx *ioctx, const std::string &oid,
+			  uint64_t num_objs)
+    {
+      bufferlist in, out;
+      ::encode(num_objs, in);
+      return ioctx->exec(oid, "rbd", "object_map_resize", in, out);
+    }
+
+    int object_map_update(librados::IoCtx *ioctx, const std::string &oid,
+			  uint64_t start_objno, uint64_t end_objno,
+			  bool exists)
+    {
+      librados::ObjectWriteOperation op;
+      object_map_update(&op, start_objno, end_objno, exists);
+      return ioctx->operate(oid, &op);
+    }
+
+    void object_map_update(librados::ObjectWriteOperation *rados_op,
+			   uint64_t start_objno, uint64_t end_objno,
+			   bool exists)
+    {
+      bufferlist in;
+      ::encode(start_objno, in);
+      ::encode(end_objno, in);
+      ::encode(exists, in);
+      rados_op->exec("rbd", "object_map_update", in);
+    }
+
     /************************ rbd_id object methods ************************/
 
     int get_id(librados::IoCtx *ioctx, const std::string &oid, std::string *id)
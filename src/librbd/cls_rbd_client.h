@@ -75,6 +75,16 @@ namespace librbd {
     int set_protection_status(librados::IoCtx *ioctx, const std::string &oid,
 			      snapid_t snap_id, uint8_t protection_status);
 
+    // operations on rbd_object_map objects
+    int object_map_resize(librados::IoCtx *ioctx, const std::string &oid,
+			  uint64_t num_objs);
+    int object_map_update(librados::IoCtx *ioctx, const std::string &oid,
+			  uint64_t start_objno, uint64_t end_objno,
+			  bool exists);
+    void object_map_update(librados::ObjectWriteOperation *rados_op,
+			   uint64_t start_objno, uint64_t end_objno,
+			   bool exists);
+
     // operations on rbd_id objects
     int get_id(librados::IoCtx *ioctx, const std::string &oid, std::string *id);
     int set_id(librados::IoCtx *ioctx, const std::string &oid, std::string id);
@@ -2,10 +2,13 @@
 // vim: ts=8 sw=2 smarttab
 #include <errno.h>
 #include <limits.h>
+#include <deque>
 
 #include "common/ceph_context.h"
 #include "common/dout.h"
 #include "common/errno.h"
+#include "common/Finisher.h"
+#include "common/Throttle.h"
 #include "cls/lock/cls_lock_client.h"
 #include "include/inttypes.h"
 #include "include/stringify.h"
@@ -17,6 +20,8 @@
 
 #include "librbd/internal.h"
 #include "librbd/parent_types.h"
+#include "librbd/WriteLog.h"
+#include "librados/snap_set_diff.h"
 
 #define dout_subsys ceph_subsys_rbd
 #undef dout_prefix
@@ -52,6 +57,11 @@ namespace librbd {
     return image_name + RBD_SUFFIX;
   }
 
+  const string object_map_name(const string &image_id)
+  {
+    return RBD_OBJECT_MAP_PREFIX + image_id;
+  }
+
   int detect_format(IoCtx &io_ctx, const string &name,
 		    bool *old_format, uint64_t *size)
   {
@@ -163,6 +173,34 @@ namespace librbd {
     return 1ULL << order;
   }
 
+  // the part of an image extent that falls in one block
+  struct BlockExtent {
+    uint64_t block;
+    uint64_t block_ofs;
+    uint64_t len;
+    uint64_t buf_ofs; // from the start of the image extent
+    BlockExtent(uint64_t b, uint64_t o, uint64_t l, uint64_t bo)
+      : block(b), block_ofs(o), len(l), buf_ofs(bo) {}
+  };
+
+  // split [off, off+len) into the pieces each block holds, in order
+  static void map_block_extents(uint8_t order, uint64_t off, uint64_t len,
+				vector<BlockExtent> *extents)
+  {
+    uint64_t block_size = get_block_size(order);
+    uint64_t start_block = get_block_num(order, off);
+    uint64_t end_block = get_block_num(order, off + len - 1);
+    extents->clear();
+    extents->reserve(end_block - start_block + 1);
+    uint64_t buf_ofs = 0;
+    for (uint64_t i = start_block; i <= end_block; i++) {
+      uint64_t block_ofs = get_block_ofs(order, off + buf_ofs);
+      uint64_t block_len = min(block_size - block_ofs, len - buf_ofs);
+      extents->push_back(BlockExtent(i, block_ofs, block_len, buf_ofs));
+      buf_ofs += block_len;
+    }
+  }
+
   uint64_t get_block_num(uint8_t order, uint64_t ofs)
   {
     uint64_t num = ofs >> order;
@@ -176,7 +214,32 @@ namespace librbd {
     return 0;
   }
 
-  void trim_image(ImageCtx *ictx, uint64_t newsize, ProgressContext& prog_ctx)
+  // completes a Context with the result of a librados aio
+  static void rados_ctx_cb(rados_completion_t c, void *arg)
+  {
+    Context *ctx = reinterpret_cast<Context *>(arg);
+    ctx->complete(rados_aio_get_return_value(c));
+  }
+
+  // send op to oid without waiting for it, once throttle has room
+  static void aio_operate_throttled(IoCtx& io_ctx, const string& oid,
+				    librados::ObjectWriteOperation *op,
+				    SimpleThrottle *throttle)
+  {
+    Context *ctx = new C_SimpleThrottle(throttle);
+    librados::AioCompletion *c =
+      Rados::aio_create_completion(ctx, NULL, rados_ctx_cb);
+    int r = io_ctx.aio_operate(oid, c, op);
+    assert(r == 0);
+    c->release();
+  }
+
+  static uint64_t management_ops(ImageCtx *ictx)
+  {
+    return max<int64_t>(1, ictx->cct->_conf->rbd_concurrent_management_ops);
+  }
+
+  int trim_image(ImageCtx *ictx, uint64_t newsize, ProgressContext& prog_ctx)
   {
     assert(ictx->md_lock.is_locked());
     CephContext *cct = (CephContext *)ictx->data_ctx.cct();
@@ -184,25 +247,67 @@ namespace librbd {
     uint64_t numseg = get_max_block(ictx->size, ictx->order);
     uint64_t start = get_block_num(ictx->order, newsize);
 
+    // a copy from the parent that lands after its object is trimmed
+    // would bring the object back, and what was copied past the new
+    // size is gone
+    ictx->copy_on_read.wait_for_pending();
+    ictx->copy_on_read.reset();
+
+    // only touch objects that may exist.  what's on the osd is
+    // enough for that even if we don't hold the exclusive lock: bits
+    // are set before objects are created
+    vector<bool> exists;
+    bool use_map = ictx->object_map.enabled() &&
+      ObjectMap::read(ictx->md_ctx, object_map_name(ictx->id), numseg,
+		      &exists) == 0;
+
     uint64_t block_ofs = get_block_ofs(ictx->order, newsize);
     if (block_ofs) {
-      ldout(cct, 2) << "trim_image object " << numseg << " truncate to "
-		    << block_ofs << dendl;
-      string oid = get_block_oid(ictx->object_prefix, start, ictx->old_format);
-      librados::ObjectWriteOperation write_op;
-      write_op.truncate(block_ofs);
-      ictx->data_ctx.operate(oid, &write_op);
+      if (!use_map || exists[start]) {
+	ldout(cct, 2) << "trim_image object " << numseg << " truncate to "
+		      << block_ofs << dendl;
+	string oid = get_block_oid(ictx->object_prefix, start,
+				   ictx->old_format);
+	librados::ObjectWriteOperation write_op;
+	write_op.truncate(block_ofs);
+	int r = ictx->data_ctx.operate(oid, &write_op);
+	if (r < 0 && r != -ENOENT) {
+	  lderr(cct) << "trim_image error truncating object " << start
+		     << ": " << cpp_strerror(r) << dendl;
+	  return r;
+	}
+      }
       start++;
     }
     if (start < numseg) {
       ldout(cct, 2) << "trim_image objects " << start << " to "
 		    << (numseg - 1) << dendl;
-      for (uint64_t i = start; i < numseg; ++i) {
-	string oid = get_block_oid(ictx->object_prefix, i, ictx->old_format);
-	ictx->data_ctx.remove(oid);
-	prog_ctx.update_progress(i * bsize, (numseg - start) * bsize);
+      SimpleThrottle throttle(management_ops(ictx), true);
+      int r = 0;
+      for (uint64_t i = start; i < numseg && !throttle.pending_error(); ++i) {
+	if (!use_map || exists[i]) {
+	  string oid = get_block_oid(ictx->object_prefix, i, ictx->old_format);
+	  librados::ObjectWriteOperation op;
+	  op.remove();
+	  aio_operate_throttled(ictx->data_ctx, oid, &op, &throttle);
+	}
+	r = prog_ctx.update_progress((i - start) * bsize,
+				     (numseg - start) * bsize);
+	if (r < 0) {
+	  ldout(cct, 2) << "trim_image cancelled at object " << i << dendl;
+	  break;
+	}
+      }
+      int ret = throttle.wait_for_ret();
+      if (r < 0)
+	return r;
+      if (ret < 0) {
+	lderr(cct) << "trim_image error removing objects: "
+		   << cpp_strerror(ret) << dendl;
+	return ret;
       }
     }
+    return 0;
   }
 
   int read_rbd_info(IoCtx& io_ctx, const string& info_oid,
@@ -330,15 +435,32 @@ namespace librbd {
     uint64_t numseg = get_max_block(ictx->size, ictx->order);
     uint64_t bsize = get_block_size(ictx->order);
 
-    for (uint64_t i = 0; i < numseg; i++) {
-      int r;
+    // any object may come back from the snapshot
+    int r = ictx->object_map.mark_exists(0, numseg);
+    if (r < 0)
+      return r;
+
+    SimpleThrottle throttle(management_ops(ictx), true);
+    for (uint64_t i = 0; i < numseg && !throttle.pending_error(); i++) {
       string oid = get_block_oid(ictx->object_prefix, i, ictx->old_format);
-      r = ictx->data_ctx.selfmanaged_snap_rollback(oid, snap_id);
       ldout(ictx->cct, 10) << "selfmanaged_snap_rollback on " << oid << " to "
-			   << snap_id << " returned " << r << dendl;
-      prog_ctx.update_progress(i * bsize, numseg * bsize);
-      if (r < 0 && r != -ENOENT)
-	return r;
+			   << snap_id << dendl;
+      librados::ObjectWriteOperation op;
+      op.selfmanaged_snap_rollback(snap_id);
+      aio_operate_throttled(ictx->data_ctx, oid, &op, &throttle);
+      r = prog_ctx.update_progress(i * bsize, numseg * bsize);
+      if (r < 0) {
+	ldout(ictx->cct, 2) << "rollback cancelled at object " << i << dendl;
+	break;
+      }
+    }
+    int ret = throttle.wait_for_ret();
+    if (r < 0)
+      return r;
+    if (ret < 0) {
+      lderr(ictx->cct) << "error rolling back objects: " << cpp_strerror(ret)
+		       << dendl;
+      return ret;
     }
     return 0;
   }
@@ -444,7 +566,16 @@ namespace librbd {
     if (r < 0)
       return r;
 
+    // including writes the qos limits are still holding back
+    ictx->qos.drain_writes();
+
     Mutex::Locker l(ictx->md_lock);
+    if (ictx->write_log) {
+      // what was written before the snapshot belongs in it
+      r = ictx->write_log->flush();
+      if (r < 0)
+	return r;
+    }
     do {
       r = add_snap(ictx, snap_name);
     } while (r == -ESTALE);
@@ -749,6 +880,17 @@ reprotect_and_return_err:
 	return r;
       }
 
+      if (features & RBD_FEATURE_OBJECT_MAP) {
+	ldout(cct, 2) << "creating object map..." << dendl;
+	r = cls_client::object_map_resize(&io_ctx, object_map_name(id),
+					  get_max_block(size, *order));
+	if (r < 0) {
+	  lderr(cct) << "error creating object map: " << cpp_strerror(r)
+		     << dendl;
+	  return r;
+	}
+      }
+
       ostringstream oss;
       oss << RBD_DATA_PREFIX << id;
       r = cls_client::create_image(&io_ctx, header_name(id), size, *order,
@@ -1066,6 +1208,120 @@ reprotect_and_return_err:
     return ictx->get_parent_overlap(ictx->snap_id, overlap);
   }
 
+  // an image's own qos limits are kept in its header's omap, under
+  // these names prefixed with QOS_KEY_PREFIX
+  static const char *QOS_KEY_PREFIX = "qos_";
+  static const char *qos_limit_names[] = {
+    "read_iops", "write_iops", "read_bps", "write_bps"
+  };
+  static const int QOS_NUM_LIMITS = 4;
+
+  static int qos_limit_index(const char *name)
+  {
+    for (int i = 0; i < QOS_NUM_LIMITS; ++i)
+      if (strcmp(name, qos_limit_names[i]) == 0)
+	return i;
+    return -1;
+  }
+
+  static int read_qos_limits(ImageCtx *ictx, uint64_t limits[])
+  {
+    map<string, bufferlist> vals;
+    int r = ictx->md_ctx.omap_get_vals(ictx->header_oid, "", QOS_KEY_PREFIX,
+				       QOS_NUM_LIMITS, &vals);
+    if (r < 0)
+      return r;
+    for (int i = 0; i < QOS_NUM_LIMITS; ++i) {
+      limits[i] = 0;
+      map<string, bufferlist>::iterator p =
+	vals.find(QOS_KEY_PREFIX + string(qos_limit_names[i]));
+      if (p == vals.end())
+	continue;
+      try {
+	bufferlist::iterator it = p->second.begin();
+	::decode(limits[i], it);
+      } catch (const buffer::error &err) {
+	return -EIO;
+      }
+    }
+    return 0;
+  }
+
+  // apply the image's own limits, or those configured instead; if
+  // they can't be read, the ones already in effect stay
+  static void refresh_qos(ImageCtx *ictx)
+  {
+    CephContext *cct = ictx->cct;
+    uint64_t limits[QOS_NUM_LIMITS];
+    int r = read_qos_limits(ictx, limits);
+    if (r < 0) {
+      lderr(cct) << "Error reading qos limits: " << cpp_strerror(r) << dendl;
+      return;
+    }
+    uint64_t conf_limits[QOS_NUM_LIMITS] = {
+      cct->_conf->rbd_qos_read_iops_limit,
+      cct->_conf->rbd_qos_write_iops_limit,
+      cct->_conf->rbd_qos_read_bps_limit,
+      cct->_conf->rbd_qos_write_bps_limit
+    };
+    for (int i = 0; i < QOS_NUM_LIMITS; ++i)
+      if (conf_limits[i])
+	limits[i] = conf_limits[i];
+    ictx->qos.set_limits(limits[0], limits[1], limits[2], limits[3],
+			 cct->_conf->rbd_qos_burst_seconds);
+  }
+
+  int qos_get_limit(ImageCtx *ictx, const char *name, uint64_t *limit)
+  {
+    int i = qos_limit_index(name);
+    if (i < 0)
+      return -EINVAL;
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+    uint64_t limits[QOS_NUM_LIMITS];
+    r = read_qos_limits(ictx, limits);
+    if (r < 0)
+      return r;
+    *limit = limits[i];
+    return 0;
+  }
+
+  int qos_set_limit(ImageCtx *ictx, const char *name, uint64_t limit)
+  {
+    CephContext *cct = ictx->cct;
+    ldout(cct, 20) << "qos_set_limit " << ictx << " " << name << " = "
+		   << limit << dendl;
+    int i = qos_limit_index(name);
+    if (i < 0)
+      return -EINVAL;
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+    // the limits are the image's, not the snapshot's
+    if (ictx->snap_id != CEPH_NOSNAP)
+      return -EROFS;
+
+    Mutex::Locker l(ictx->md_lock);
+    string key = QOS_KEY_PREFIX + string(qos_limit_names[i]);
+    if (limit) {
+      map<string, bufferlist> vals;
+      ::encode(limit, vals[key]);
+      r = ictx->md_ctx.omap_set(ictx->header_oid, vals);
+    } else {
+      set<string> keys;
+      keys.insert(key);
+      r = ictx->md_ctx.omap_rm_keys(ictx->header_oid, keys);
+    }
+    if (r < 0) {
+      lderr(cct) << "error setting qos limit " << name << ": "
+		 << cpp_strerror(r) << dendl;
+      return r;
+    }
+    notify_change(ictx->md_ctx, ictx->header_oid, NULL, ictx);
+    return 0;
+  }
+
   int open_parent(ImageCtx *ictx)
   {
     assert(ictx->snap_lock.is_locked());
@@ -1205,8 +1461,14 @@ reprotect_and_return_err:
       unknown_format = false;
       id = ictx->id;
       ictx->md_lock.Lock();
-      trim_image(ictx, 0, prog_ctx);
+      r = trim_image(ictx, 0, prog_ctx);
       ictx->md_lock.Unlock();
+      if (r < 0) {
+	lderr(cct) << "error removing data objects - not removing the image: "
+		   << cpp_strerror(r) << dendl;
+	close_image(ictx);
+	return r;
+      }
 
       ictx->parent_lock.Lock();
       // struct assignment
@@ -1223,6 +1485,16 @@ reprotect_and_return_err:
       }
       close_image(ictx);
 
+      if (!old_format) {
+	ldout(cct, 2) << "removing object map..." << dendl;
+	r = io_ctx.remove(object_map_name(id));
+	if (r < 0 && r != -ENOENT) {
+	  lderr(cct) << "error removing object map: " << cpp_strerror(-r)
+		     << dendl;
+	  return r;
+	}
+      }
+
       ldout(cct, 2) << "removing header..." << dendl;
       r = io_ctx.remove(header_oid);
       if (r < 0 && r != -ENOENT) {
@@ -1279,6 +1551,9 @@ reprotect_and_return_err:
       return 0;
     }
 
+    // the map always covers at least the image, so it grows first
+    // and shrinks after the objects are gone
+    int r;
     if (size > ictx->size) {
       ldout(cct, 2) << "expanding image " << ictx->size << " -> " << size
 		    << dendl;
@@ -1286,11 +1561,15 @@ reprotect_and_return_err:
     } else {
       ldout(cct, 2) << "shrinking image " << ictx->size << " -> " << size
 		    << dendl;
-      trim_image(ictx, size, prog_ctx);
+      r = trim_image(ictx, size, prog_ctx);
+      if (r < 0)
+	return r;
     }
+    r = ictx->object_map.resize(get_max_block(size, ictx->order));
+    if (r < 0)
+      return r;
     ictx->size = size;
 
-    int r;
     if (ictx->old_format) {
       // rewrite header
       bufferlist bl;
@@ -1326,7 +1605,12 @@ reprotect_and_return_err:
       return r;
 
     Mutex::Locker l(ictx->md_lock);
-    if (size < ictx->size && ictx->object_cacher) {
+    if (ictx->write_log) {
+      r = ictx->write_log->flush();
+      if (r < 0)
+	return r;
+    }
+    if (size < ictx->size && ictx->cache_enabled()) {
       // need to invalidate since we're deleting objects, and
       // ObjectCacher doesn't track non-existent objects
       ictx->invalidate_cache();
@@ -1452,6 +1736,9 @@ reprotect_and_return_err:
 	  ictx->get_parent_pool_id(ictx->snap_id) ||
 	  ictx->parent->id != ictx->get_parent_image_id(ictx->snap_id) ||
 	  ictx->parent->snap_id != ictx->get_parent_snap_id(ictx->snap_id)) {
+	// copies from the parent read from it, as may a diff_iterate
+	ictx->copy_on_read.wait_for_pending();
+	ictx->wait_for_parent_refs();
 	close_image(ictx->parent);
 	ictx->parent = NULL;
       }
@@ -1469,6 +1756,26 @@ reprotect_and_return_err:
     return 0;
   }
 
+  // true if we hold the image's exclusive lock, with its cookie
+  static bool is_lock_owner(ImageCtx *ictx, string *cookie = NULL)
+  {
+    assert(ictx->md_lock.is_locked());
+    if (!ictx->exclusive_locked)
+      return false;
+    Rados rados(ictx->md_ctx);
+    entity_name_t me = entity_name_t::CLIENT(rados.get_instance_id());
+    map<rados::cls::lock::locker_id_t,
+	rados::cls::lock::locker_info_t>::const_iterator it;
+    for (it = ictx->lockers.begin(); it != ictx->lockers.end(); ++it) {
+      if (it->first.locker == me) {
+	if (cookie)
+	  *cookie = it->first.cookie;
+	return true;
+      }
+    }
+    return false;
+  }
+
   int ictx_refresh(ImageCtx *ictx)
   {
     CephContext *cct = ictx->cct;
@@ -1613,6 +1920,14 @@ reprotect_and_return_err:
       ictx->data_ctx.selfmanaged_snap_set_write_ctx(ictx->snapc.seq, ictx->snaps);
     } // release snap_lock
 
+    string cookie;
+    bool owner = is_lock_owner(ictx, &cookie);
+    ictx->object_map.refresh(owner);
+    if (ictx->write_log)
+      ictx->write_log->set_owner(owner, cookie);
+
+    refresh_qos(ictx);
+
     if (new_snap) {
       _flush(ictx);
     }
@@ -1636,6 +1951,11 @@ reprotect_and_return_err:
       return r;
 
     Mutex::Locker l(ictx->md_lock);
+    if (ictx->write_log) {
+      r = ictx->write_log->flush();
+      if (r < 0)
+	return r;
+    }
     Mutex::Locker l2(ictx->snap_lock);
     if (!ictx->snap_exists)
       return -ENOENT;
@@ -1653,6 +1973,8 @@ reprotect_and_return_err:
     // writes might create new snapshots. Rolling back will replace
     // the current version, so we have to invalidate that too.
     ictx->invalidate_cache();
+    // objects copied from the parent may not be there any more
+    ictx->copy_on_read.reset();
 
     uint64_t new_size = ictx->get_image_size(ictx->snap_id);
     ictx->get_snap_size(snap_name, &new_size);
@@ -1682,38 +2004,91 @@ reprotect_and_return_err:
     return r;
   }
 
-  struct CopyProgressCtx {
-    CopyProgressCtx(ProgressContext &p)
-      : destictx(NULL), src_size(0), prog_ctx(p)
-    { }
+  // keeps the data of a copy's write around until the write is done
+  class C_CopyWrite : public Context {
+  public:
+    C_CopyWrite(SimpleThrottle *throttle, const bufferptr& bp)
+      : m_throttle(throttle), m_bp(bp) {}
+    virtual void finish(int r) {
+      m_throttle->end_op(r);
+    }
+  private:
+    SimpleThrottle *m_throttle;
+    bufferptr m_bp;
+  };
 
-    ImageCtx *destictx;
-    uint64_t src_size;
-    ProgressContext &prog_ctx;
+  // sends a copy's write; aio_write may wait for room in the cache or
+  // for the object map, so this runs on the copy's own finisher rather
+  // than in a librados callback
+  class C_CopySendWrite : public Context {
+  public:
+    C_CopySendWrite(SimpleThrottle *throttle, ImageCtx *dest,
+		    uint64_t offset, const bufferptr& bp)
+      : m_throttle(throttle), m_dest(dest), m_offset(offset), m_bp(bp) {}
+    virtual void finish(int r) {
+      Context *ctx = new C_CopyWrite(m_throttle, m_bp);
+      AioCompletion *comp = aio_create_completion_internal(ctx, rbd_ctx_cb);
+      r = aio_write(m_dest, m_offset, m_bp.length(), m_bp.c_str(), comp);
+      comp->release();
+      if (r < 0) {
+	lderr(m_dest->cct) << "error writing to destination image at offset "
+			   << m_offset << ": " << cpp_strerror(r) << dendl;
+	delete ctx;
+	m_throttle->end_op(r);
+      }
+    }
+  private:
+    SimpleThrottle *m_throttle;
+    ImageCtx *m_dest;
+    uint64_t m_offset;
+    bufferptr m_bp;
   };
 
-  int do_copy_extent(uint64_t offset, size_t len, const char *buf, void *data)
-  {
-    CopyProgressCtx *cp = reinterpret_cast<CopyProgressCtx*>(data);
-    cp->prog_ctx.update_progress(offset, cp->src_size);
-    int ret = 0;
-    if (buf) {
-      ret = write(cp->destictx, offset, len, buf);
+  // one object's worth of a copy: read it from the source and, unless
+  // it is all zeroes, write it to the destination
+  class C_CopyRead : public Context {
+  public:
+    C_CopyRead(SimpleThrottle *throttle, Finisher *finisher, ImageCtx *dest,
+	       uint64_t offset, size_t len)
+      : m_throttle(throttle), m_finisher(finisher), m_dest(dest),
+	m_offset(offset), m_bp(len) {
+      m_throttle->start_op();
     }
-    return ret;
-  }
+    char *buf() {
+      return m_bp.c_str();
+    }
+    virtual void finish(int r) {
+      if (r < 0) {
+	lderr(m_dest->cct) << "error reading from source image at offset "
+			   << m_offset << ": " << cpp_strerror(r) << dendl;
+	m_throttle->end_op(r);
+	return;
+      }
+      if (m_bp.is_zero()) {
+	m_throttle->end_op(0);
+	return;
+      }
+      m_finisher->queue(new C_CopySendWrite(m_throttle, m_dest, m_offset,
+					    m_bp));
+    }
+  private:
+    SimpleThrottle *m_throttle;
+    Finisher *m_finisher;
+    ImageCtx *m_dest;
+    uint64_t m_offset;
+    bufferptr m_bp;
+  };
 
   int copy(ImageCtx *ictx, IoCtx& dest_md_ctx, const char *destname,
 	   ProgressContext &prog_ctx)
   {
     CephContext *cct = (CephContext *)dest_md_ctx.cct();
-    CopyProgressCtx cp(prog_ctx);
     ictx->md_lock.Lock();
     ictx->snap_lock.Lock();
     uint64_t src_size = ictx->get_image_size(ictx->snap_id);
     ictx->snap_lock.Unlock();
     ictx->md_lock.Unlock();
-    int64_t r;
+    int r;
 
     int order = ictx->order;
     r = create(dest_md_ctx, destname, src_size, ictx->old_format,
@@ -1723,22 +2098,48 @@ reprotect_and_return_err:
       return r;
     }
 
-    cp.destictx = new librbd::ImageCtx(destname, "", NULL, dest_md_ctx);
-    cp.src_size = src_size;
-    r = open_image(cp.destictx, true);
+    ImageCtx *destictx = new librbd::ImageCtx(destname, "", NULL, dest_md_ctx);
+    r = open_image(destictx, true);
     if (r < 0) {
       lderr(cct) << "failed to read newly created header" << dendl;
       return r;
     }
 
-    r = read_iterate(ictx, 0, src_size, do_copy_extent, &cp);
-
+    // a window of objects at a time, each read and then written
+    // without waiting on the others
+    SimpleThrottle throttle(management_ops(ictx), false);
+    Finisher finisher(cct);
+    finisher.start();
+    uint64_t period = get_block_size(ictx->order);
+    for (uint64_t offset = 0; offset < src_size; offset += period) {
+      if (throttle.pending_error())
+	break;
+      r = prog_ctx.update_progress(offset, src_size);
+      if (r < 0) {
+	ldout(cct, 2) << "copy cancelled at offset " << offset << dendl;
+	break;
+      }
+      uint64_t len = min(period, src_size - offset);
+      C_CopyRead *ctx = new C_CopyRead(&throttle, &finisher, destictx,
+				       offset, len);
+      AioCompletion *comp = aio_create_completion_internal(ctx, rbd_ctx_cb);
+      int ar = aio_read(ictx, offset, len, ctx->buf(), comp);
+      comp->release();
+      if (ar < 0)
+	ctx->complete(ar);
+    }
+
+    int ret = throttle.wait_for_ret();
+    finisher.stop();
+    if (r >= 0)
+      r = ret;
     if (r >= 0) {
-      // don't return total bytes read, which may not fit in an int
-      r = 0;
-      prog_ctx.update_progress(cp.src_size, cp.src_size);
+      // with the cache on, the writes only completed into it
+      r = flush(destictx);
     }
-    close_image(cp.destictx);
+    if (r >= 0)
+      prog_ctx.update_progress(src_size, src_size);
+    close_image(destictx);
     return r;
   }
 
@@ -1807,11 +2208,20 @@ reprotect_and_return_err:
   void close_image(ImageCtx *ictx)
   {
     ldout(ictx->cct, 20) << "close_image " << ictx << dendl;
-    if (ictx->object_cacher)
+    // send whatever the qos limits are holding back, so it's flushed
+    ictx->qos.shut_down();
+    ictx->copy_on_read.wait_for_pending();
+    if (ictx->write_log)
+      ictx->write_log->close(ictx->cct->_conf->rbd_write_log_crash_on_close);
+    if (ictx->cache_enabled())
       ictx->shutdown_cache(); // implicitly flushes
     else
       flush(ictx);
+    ictx->object_map.flush();
 
+    ictx->parent_lock.Lock();
+    ictx->wait_for_parent_refs();
+    ictx->parent_lock.Unlock();
     if (ictx->parent) {
       close_image(ictx->parent);
       ictx->parent = NULL;
@@ -1834,33 +2244,160 @@ reprotect_and_return_err:
       return -EINVAL;
 
     bufferlist bl;
-    string oid = get_block_oid(ictx->object_prefix,
-			       get_block_num(ictx->order, offset),
-			       ictx->old_format);
+    uint64_t objno = get_block_num(ictx->order, offset);
+    string oid = get_block_oid(ictx->object_prefix, objno, ictx->old_format);
+
+    int r = ictx->object_map.mark_exists(objno, objno + 1);
+    if (r < 0)
+      return r;
 
     bl.append(buf, len);
     return cls_client::copyup(&ictx->data_ctx, oid, bl);
   }
 
-  // test if an entire buf is zero in 8-byte chunks
-  static bool buf_is_zero(char *buf, size_t len)
+  // send a copyup once the object map says the object exists
+  class C_AioCopyup : public Context {
+  public:
+    C_AioCopyup(ImageCtx *ictx, const string &oid, bufferlist &bl,
+		Context *ctx)
+      : m_ictx(ictx), m_oid(oid), m_ctx(ctx) {
+      m_bl.claim(bl);
+    }
+    virtual void finish(int r) {
+      if (r < 0) {
+	m_ctx->complete(r);
+	return;
+      }
+      librados::ObjectWriteOperation op;
+      op.exec("rbd", "copyup", m_bl);
+      librados::AioCompletion *c =
+	Rados::aio_create_completion(m_ctx, NULL, rados_ctx_cb);
+      r = m_ictx->data_ctx.aio_operate(m_oid, c, &op);
+      assert(r == 0);
+      c->release();
+    }
+  private:
+    ImageCtx *m_ictx;
+    string m_oid;
+    bufferlist m_bl;
+    Context *m_ctx;
+  };
+
+  // copyup_block, but ctx is completed with the result
+  int aio_copyup_block(ImageCtx *ictx, uint64_t offset, bufferlist &bl,
+		       Context *ctx)
   {
-    size_t ofs;
-    int chunk = sizeof(uint64_t);
+    uint64_t blksize = get_block_size(ictx->order);
+    if ((bl.length() > blksize) || (get_block_ofs(ictx->order, offset) != 0))
+      return -EINVAL;
 
-    for (ofs = 0; ofs < len; ofs += sizeof(uint64_t)) {
-      if (*(uint64_t *)(buf + ofs) != 0) {
-	return false;
-      }
+    uint64_t objno = get_block_num(ictx->order, offset);
+    string oid = get_block_oid(ictx->object_prefix, objno, ictx->old_format);
+
+    Context *copyup = new C_AioCopyup(ictx, oid, bl, ctx);
+    if (!ictx->object_map.aio_mark_exists(objno, objno + 1, copyup))
+      copyup->complete(0);
+    return 0;
+  }
+
+  // a copy-from of a block the child already has, or the parent
+  // doesn't, has nothing to do
+  class C_CopyupFromParent : public Context {
+  public:
+    C_CopyupFromParent(SimpleThrottle *throttle) : m_throttle(throttle) {
+      m_throttle->start_op();
     }
-    for (ofs = (len / chunk) * chunk; ofs < len; ofs++) {
-      if (buf[ofs] != '\0') {
-	return false;
-      }
+    virtual void finish(int r) {
+      if (r == -EEXIST || r == -ENOENT)
+	r = 0;
+      m_throttle->end_op(r);
+    }
+  private:
+    SimpleThrottle *m_throttle;
+  };
+
+  // have the osd copy a parent block to the child ictx(offset, len),
+  // unless the child already has it.  the parent and child must use the
+  // same object size.  with a throttle, this only waits for room in it
+  // and the result goes to the throttle.
+  static int copyup_block_from_parent(ImageCtx *ictx, uint64_t offset,
+				      size_t len, SimpleThrottle *throttle)
+  {
+    ImageCtx *parent = ictx->parent;
+    uint64_t blksize = get_block_size(ictx->order);
+    uint64_t objno = get_block_num(ictx->order, offset);
+    string oid = get_block_oid(ictx->object_prefix, objno, ictx->old_format);
+    string parent_oid = get_block_oid(parent->object_prefix, objno,
+				      parent->old_format);
+
+    int r = ictx->object_map.mark_exists(objno, objno + 1);
+    if (r < 0)
+      return r;
+
+    librados::ObjectWriteOperation op;
+    op.create(true);
+    op.copy_from(parent_oid, parent->data_ctx, 0,
+		 LIBRADOS_COPY_FROM_DATA_ONLY);
+    // nothing past the overlap belongs to us
+    if (len < blksize)
+      op.truncate(len);
+    if (throttle) {
+      Context *ctx = new C_CopyupFromParent(throttle);
+      librados::AioCompletion *c =
+	Rados::aio_create_completion(ctx, NULL, rados_ctx_cb);
+      r = ictx->data_ctx.aio_operate(oid, c, &op);
+      assert(r == 0);
+      c->release();
+      return 0;
     }
-    return true;
+    r = ictx->data_ctx.operate(oid, &op);
+    if (r == -EEXIST || r == -ENOENT)  // child has it, or parent doesn't
+      return 0;
+    return r;
   }
 
+  // copy a block of the parent to the child via the client: read it
+  // from the parent and, unless it's all zeroes, copy it up
+  class C_FlattenRead : public Context {
+  public:
+    C_FlattenRead(SimpleThrottle *throttle, ImageCtx *ictx, uint64_t offset,
+		  size_t len)
+      : m_throttle(throttle), m_ictx(ictx), m_offset(offset), m_bp(len) {
+      m_throttle->start_op();
+    }
+    char *buf() {
+      return m_bp.c_str();
+    }
+    virtual void finish(int r) {
+      if (r < 0) {
+	lderr(m_ictx->cct) << "reading from parent failed at offset "
+			   << m_offset << ": " << cpp_strerror(r) << dendl;
+	m_throttle->end_op(r);
+	return;
+      }
+      if (m_bp.is_zero()) {
+	m_throttle->end_op(0);
+	return;
+      }
+
+      // the copyup takes over this read's place in the throttle; it
+      // waits for the object map update without blocking this callback
+      bufferlist bl;
+      bl.append(m_bp);
+      Context *ctx = new C_CopyWrite(m_throttle, m_bp);
+      r = aio_copyup_block(m_ictx, m_offset, bl, ctx);
+      if (r < 0) {
+	delete ctx;
+	m_throttle->end_op(r);
+      }
+    }
+  private:
+    SimpleThrottle *m_throttle;
+    ImageCtx *m_ictx;
+    uint64_t m_offset;
+    bufferptr m_bp;
+  };
+
   // 'flatten' child image by copying all parent's blocks
   int flatten(ImageCtx *ictx, ProgressContext &prog_ctx)
   {
@@ -1890,27 +2427,65 @@ reprotect_and_return_err:
 
     uint64_t overlap = ictx->parent_md.overlap;
     uint64_t cblksize = get_block_size(ictx->order);
-    char *buf = new char[cblksize];
 
+    // copies from the parent in flight finish before it is removed
+    ictx->copy_on_read.wait_for_pending();
+
+    // with matching object sizes, each child object is a copy of the
+    // parent's, so let the osd copy it without the data going through
+    // us.  the first block goes on its own to find out whether the osds
+    // can.
+    bool copy_from = (ictx->parent->order == ictx->order);
+    bool copy_from_checked = false;
+
+    SimpleThrottle throttle(management_ops(ictx), false);
     size_t ofs = 0;
-    while (ofs < overlap) {
-      prog_ctx.update_progress(ofs, overlap);
-      size_t readsize = min(overlap - ofs, cblksize);
-      if ((r = read(ictx->parent, ofs, readsize, buf)) < 0) {
-	lderr(ictx->cct) << "reading from parent failed" << dendl;
-	goto err;
+    while (ofs < overlap && !throttle.pending_error()) {
+      r = prog_ctx.update_progress(ofs, overlap);
+      if (r < 0) {
+	ldout(ictx->cct, 2) << "flatten cancelled at offset " << ofs << dendl;
+	break;
       }
+      size_t readsize = min(overlap - ofs, cblksize);
 
-      // for actual amount read, if data is all zero, don't bother with block
-      if (!buf_is_zero(buf, r)) {
-	if ((r = copyup_block(ictx, ofs, r, buf)) < 0) {
+      if (copy_from) {
+	r = copyup_block_from_parent(ictx, ofs, readsize,
+				     copy_from_checked ? &throttle : NULL);
+	if (r == 0) {
+	  copy_from_checked = true;
+	  ofs += cblksize;
+	  continue;
+	}
+	if (r != -EOPNOTSUPP || copy_from_checked) {
 	  lderr(ictx->cct) << "failed to copy block to child" << dendl;
-	  goto err;
+	  break;
 	}
+	ldout(ictx->cct, 10) << "osds can't copy-from, copying via client"
+			     << dendl;
+	copy_from = false;
+      }
+
+      C_FlattenRead *ctx = new C_FlattenRead(&throttle, ictx, ofs, readsize);
+      AioCompletion *comp = aio_create_completion_internal(ctx, rbd_ctx_cb);
+      r = aio_read(ictx->parent, ofs, readsize, ctx->buf(), comp);
+      comp->release();
+      if (r < 0) {
+	ctx->complete(r);
+	r = 0;
       }
       ofs += cblksize;
     }
 
+    // the parent is only removed once every block made it to the child
+    int ret = throttle.wait_for_ret();
+    if (r >= 0)
+      r = ret;
+    if (r < 0) {
+      lderr(ictx->cct) << "failed to flatten image: " << cpp_strerror(r)
+		       << dendl;
+      return r;
+    }
+
     // remove parent from this (base) image
     r = cls_client::remove_parent(&ictx->md_ctx, ictx->header_oid);
     if (r < 0) {
@@ -1933,58 +2508,201 @@ reprotect_and_return_err:
     notify_change(ictx->md_ctx, ictx->header_oid, NULL, ictx);
 
     ldout(ictx->cct, 20) << "finished flattening" << dendl;
-
-  err:
-    delete[] buf;
-    return r;
+    return 0;
   }
 
-  int list_lockers(ImageCtx *ictx,
-		   std::list<locker_t> *lockers,
-		   bool *exclusive,
-		   string *tag)
+  // find out which of the first num_objs data objects exist, at the
+  // snapshot data_ctx reads from
+  static int stat_objects(ImageCtx *ictx, uint64_t num_objs,
+			  vector<bool> *exists, ProgressContext &prog_ctx)
   {
-    ldout(ictx->cct, 20) << "list_locks on image " << ictx << dendl;
-
-    int r = ictx_check(ictx);
-    if (r < 0)
-      return r;
-
-    Mutex::Locker locker(ictx->md_lock);
-    if (exclusive)
-      *exclusive = ictx->exclusive_locked;
-    if (tag)
-      *tag = ictx->lock_tag;
-    if (lockers) {
-      lockers->clear();
-      map<rados::cls::lock::locker_id_t,
-	  rados::cls::lock::locker_info_t>::const_iterator it;
-      for (it = ictx->lockers.begin(); it != ictx->lockers.end(); ++it) {
-	locker_t locker;
-	locker.client = stringify(it->first.locker);
-	locker.cookie = it->first.cookie;
-	locker.address = stringify(it->second.addr);
-	lockers->push_back(locker);
+    exists->assign(num_objs, false);
+    for (uint64_t i = 0; i < num_objs; ++i) {
+      string oid = get_block_oid(ictx->object_prefix, i, ictx->old_format);
+      int r = ictx->data_ctx.stat(oid, NULL, NULL);
+      if (r < 0 && r != -ENOENT) {
+	lderr(ictx->cct) << "error checking for " << oid << ": "
+			 << cpp_strerror(r) << dendl;
+	return r;
       }
+      (*exists)[i] = (r == 0);
+      prog_ctx.update_progress(i, num_objs);
     }
-
     return 0;
   }
 
-  int lock(ImageCtx *ictx, bool exclusive, const string& cookie,
-	   const string& tag)
+  int get_used_size(ImageCtx *ictx, uint64_t *used)
   {
-    ldout(ictx->cct, 20) << "lock image " << ictx << " exclusive=" << exclusive
-			 << " cookie='" << cookie << "' tag='" << tag << "'"
-			 << dendl;
+    ldout(ictx->cct, 20) << "get_used_size " << ictx << dendl;
 
     int r = ictx_check(ictx);
     if (r < 0)
       return r;
 
-    /**
-     * If we wanted we could do something more intelligent, like local
-     * checks that we think we will succeed. But for now, let's not
+    Mutex::Locker l(ictx->md_lock);
+    ictx->snap_lock.Lock();
+    snap_t snap_id = ictx->snap_id;
+    uint64_t size = ictx->get_image_size(snap_id);
+    ictx->snap_lock.Unlock();
+    uint64_t numseg = get_max_block(size, ictx->order);
+    uint64_t bsize = get_block_size(ictx->order);
+
+    // object maps only cover the image itself
+    vector<bool> exists;
+    if (snap_id != CEPH_NOSNAP || !ictx->object_map.enabled() ||
+	ObjectMap::read(ictx->md_ctx, object_map_name(ictx->id), numseg,
+			&exists) < 0) {
+      NoOpProgressContext no_op;
+      r = stat_objects(ictx, numseg, &exists, no_op);
+      if (r < 0)
+	return r;
+    }
+
+    *used = 0;
+    for (uint64_t i = 0; i < numseg; ++i) {
+      if (exists[i])
+	*used += min(bsize, size - i * bsize);
+    }
+    return 0;
+  }
+
+  int object_map_check(ImageCtx *ictx, ProgressContext &prog_ctx,
+		       uint64_t *missing, uint64_t *stale)
+  {
+    ldout(ictx->cct, 20) << "object_map_check " << ictx << dendl;
+
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+
+    Mutex::Locker l(ictx->md_lock);
+    if (ictx->old_format || !(ictx->features & RBD_FEATURE_OBJECT_MAP)) {
+      lderr(ictx->cct) << "image has no object map" << dendl;
+      return -EINVAL;
+    }
+    if (ictx->snap_id != CEPH_NOSNAP) {
+      lderr(ictx->cct) << "snapshots have no object map" << dendl;
+      return -EINVAL;
+    }
+
+    uint64_t numseg = get_max_block(ictx->size, ictx->order);
+    vector<bool> exists, in_map;
+    r = stat_objects(ictx, numseg, &exists, prog_ctx);
+    if (r < 0)
+      return r;
+    // read the map after looking at the objects: anything created in
+    // the meantime was marked in it first
+    r = ObjectMap::read(ictx->md_ctx, object_map_name(ictx->id), numseg,
+			&in_map);
+    if (r < 0) {
+      lderr(ictx->cct) << "error reading object map: " << cpp_strerror(r)
+		       << dendl;
+      return r;
+    }
+
+    *missing = 0;
+    *stale = 0;
+    for (uint64_t i = 0; i < numseg; ++i) {
+      if (exists[i] && !in_map[i]) {
+	ldout(ictx->cct, 2) << "object " << i << " exists but is not in the "
+			    << "object map" << dendl;
+	++*missing;
+      } else if (!exists[i] && in_map[i]) {
+	++*stale;
+      }
+    }
+    return 0;
+  }
+
+  int object_map_rebuild(ImageCtx *ictx, ProgressContext &prog_ctx)
+  {
+    ldout(ictx->cct, 20) << "object_map_rebuild " << ictx << dendl;
+
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+
+    Mutex::Locker l(ictx->md_lock);
+    if (ictx->old_format || !(ictx->features & RBD_FEATURE_OBJECT_MAP)) {
+      lderr(ictx->cct) << "image has no object map" << dendl;
+      return -EINVAL;
+    }
+    if (ictx->snap_id != CEPH_NOSNAP)
+      return -EROFS;
+    // a writer could mark an object after we looked for it, and have
+    // that undone when we write out the new map
+    if (!ictx->lockers.empty() && !is_lock_owner(ictx)) {
+      lderr(ictx->cct) << "image is locked by someone else" << dendl;
+      return -EBUSY;
+    }
+
+    uint64_t numseg = get_max_block(ictx->size, ictx->order);
+    vector<bool> exists;
+    r = stat_objects(ictx, numseg, &exists, prog_ctx);
+    if (r < 0)
+      return r;
+
+    bufferptr bp(object_map_bytes(numseg));
+    bp.zero();
+    for (uint64_t i = 0; i < numseg; ++i)
+      object_map_assign(bp.c_str(), i, exists[i]);
+    bufferlist bl;
+    bl.append(bp);
+    r = ictx->md_ctx.write_full(object_map_name(ictx->id), bl);
+    if (r < 0) {
+      lderr(ictx->cct) << "error writing object map: " << cpp_strerror(r)
+		       << dendl;
+      return r;
+    }
+    return ictx->object_map.load();
+  }
+
+  int list_lockers(ImageCtx *ictx,
+		   std::list<locker_t> *lockers,
+		   bool *exclusive,
+		   string *tag)
+  {
+    ldout(ictx->cct, 20) << "list_locks on image " << ictx << dendl;
+
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+
+    Mutex::Locker locker(ictx->md_lock);
+    if (exclusive)
+      *exclusive = ictx->exclusive_locked;
+    if (tag)
+      *tag = ictx->lock_tag;
+    if (lockers) {
+      lockers->clear();
+      map<rados::cls::lock::locker_id_t,
+	  rados::cls::lock::locker_info_t>::const_iterator it;
+      for (it = ictx->lockers.begin(); it != ictx->lockers.end(); ++it) {
+	locker_t locker;
+	locker.client = stringify(it->first.locker);
+	locker.cookie = it->first.cookie;
+	locker.address = stringify(it->second.addr);
+	lockers->push_back(locker);
+      }
+    }
+
+    return 0;
+  }
+
+  int lock(ImageCtx *ictx, bool exclusive, const string& cookie,
+	   const string& tag)
+  {
+    ldout(ictx->cct, 20) << "lock image " << ictx << " exclusive=" << exclusive
+			 << " cookie='" << cookie << "' tag='" << tag << "'"
+			 << dendl;
+
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+
+    /**
+     * If we wanted we could do something more intelligent, like local
+     * checks that we think we will succeed. But for now, let's not
      * duplicate that code.
      */
     Mutex::Locker locker(ictx->md_lock);
@@ -2008,10 +2726,20 @@ reprotect_and_return_err:
       return r;
 
     Mutex::Locker locker(ictx->md_lock);
+    if (ictx->write_log) {
+      // the next owner must see everything we wrote
+      r = ictx->write_log->flush();
+      if (r < 0)
+	return r;
+    }
     r = rados::cls::lock::unlock(&ictx->md_ctx, ictx->header_oid,
 				 RBD_LOCK_NAME, cookie);
     if (r < 0)
       return r;
+    // stop trusting our object map now, rather than at the next refresh
+    ictx->object_map.clear_owner();
+    if (ictx->write_log)
+      ictx->write_log->set_owner(false);
     notify_change(ictx->md_ctx, ictx->header_oid, NULL, ictx);
     return 0;
   }
@@ -2065,6 +2793,8 @@ reprotect_and_return_err:
     if (r < 0)
       return r;
 
+    ictx->qos.wait_io(false, len);
+
     int64_t total_read = 0;
     uint64_t start_block = get_block_num(ictx->order, off);
     uint64_t end_block = get_block_num(ictx->order, off + len - 1);
@@ -2134,6 +2864,186 @@ reprotect_and_return_err:
     return read_iterate(ictx, ofs, len, simple_read_cb, buf);
   }
 
+  static int simple_diff_cb(uint64_t off, size_t len, int exists, void *arg)
+  {
+    // a hole discarded in the parent shows through as zeroes anyway
+    if (exists) {
+      interval_set<uint64_t> *diff = static_cast<interval_set<uint64_t> *>(arg);
+      diff->insert(off, len);
+    }
+    return 0;
+  }
+
+  // one object's list_snaps, in flight or done
+  struct DiffObject {
+    uint64_t objno;
+    librados::snap_set_t snap_set;
+    int r;
+    librados::AioCompletion *c;
+    DiffObject(uint64_t o) : objno(o), r(0), c(NULL) {}
+  };
+
+  int diff_iterate(ImageCtx *ictx, const char *fromsnapname,
+		   uint64_t off, uint64_t len,
+		   int (*cb)(uint64_t, size_t, int, void *),
+		   void *arg)
+  {
+    ldout(ictx->cct, 20) << "diff_iterate " << ictx << " from "
+			 << (fromsnapname ? fromsnapname : "(beginning)")
+			 << " off = " << off << " len = " << len << dendl;
+
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+
+    ictx->md_lock.Lock();
+    ictx->snap_lock.Lock();
+    snap_t from_snap_id = 0;
+    if (fromsnapname)
+      from_snap_id = ictx->get_snap_id(fromsnapname);
+    snap_t end_snap_id = ictx->snap_id;
+    uint64_t end_size = ictx->get_image_size(end_snap_id);
+    ictx->snap_lock.Unlock();
+    ictx->md_lock.Unlock();
+
+    if (from_snap_id == CEPH_NOSNAP)
+      return -ENOENT;
+    if (from_snap_id == end_snap_id)
+      return 0;
+    if (from_snap_id > end_snap_id)
+      return -EINVAL;
+
+    if (off >= end_size)
+      return 0;
+    len = min(len, end_size - off);
+
+    // what is on the osds is all there is to compare
+    if (end_snap_id == CEPH_NOSNAP) {
+      r = _flush(ictx);
+      if (r < 0)
+	return r;
+    }
+
+    // from the beginning of time, whatever a clone's parent has shows
+    // through wherever the clone has no object of its own
+    interval_set<uint64_t> parent_diff;
+    if (from_snap_id == 0) {
+      // don't hold our locks while we walk the parent
+      ictx->snap_lock.Lock();
+      ictx->parent_lock.Lock();
+      uint64_t overlap = 0;
+      ictx->get_parent_overlap(end_snap_id, &overlap);
+      ImageCtx *parent = overlap > 0 ? ictx->get_parent() : NULL;
+      ictx->parent_lock.Unlock();
+      ictx->snap_lock.Unlock();
+      if (parent) {
+	ldout(ictx->cct, 10) << "diff_iterate getting parent diff up to "
+			     << overlap << dendl;
+	r = diff_iterate(parent, NULL, 0, overlap, simple_diff_cb,
+			 &parent_diff);
+	ictx->put_parent();
+	if (r < 0)
+	  return r;
+      }
+    }
+
+    // clones have to be listed via the head or snapdir, whatever
+    // snap we're reading
+    librados::IoCtx snapdir_ctx;
+    snapdir_ctx.dup(ictx->data_ctx);
+    snapdir_ctx.snap_set_read(CEPH_SNAPDIR);
+
+    uint64_t block_size = get_block_size(ictx->order);
+    uint64_t start_block = get_block_num(ictx->order, off);
+    uint64_t end_block = get_block_num(ictx->order, off + len - 1);
+    uint64_t max_ops = management_ops(ictx);
+
+    // keep up to max_ops list_snaps in flight, but call back in order
+    // from this thread, which the callback may well use to read
+    std::deque<DiffObject*> in_flight;
+    uint64_t next_block = start_block;
+    while (r == 0 && (next_block <= end_block || !in_flight.empty())) {
+      while (next_block <= end_block && in_flight.size() < max_ops) {
+	DiffObject *d = new DiffObject(next_block++);
+	string oid = get_block_oid(ictx->object_prefix, d->objno,
+				   ictx->old_format);
+	librados::ObjectReadOperation op;
+	op.list_snaps(&d->snap_set, &d->r);
+	d->c = librados::Rados::aio_create_completion();
+	int ar = snapdir_ctx.aio_operate(oid, d->c, &op, NULL);
+	if (ar < 0) {
+	  d->c->release();
+	  delete d;
+	  r = ar;
+	  break;
+	}
+	in_flight.push_back(d);
+      }
+      if (in_flight.empty())
+	break;
+
+      DiffObject *d = in_flight.front();
+      in_flight.pop_front();
+      d->c->wait_for_complete();
+      int dr = d->c->get_return_value();
+      d->c->release();
+      if (dr == 0)
+	dr = d->r;
+      uint64_t objno = d->objno;
+
+      // the part of this object the caller asked about
+      uint64_t obj_off = objno * block_size;
+      uint64_t begin = max(off, obj_off) - obj_off;
+      uint64_t end = min(off + len, obj_off + block_size) - obj_off;
+
+      interval_set<uint64_t> diff;
+      bool end_exists = false;
+      if (dr == 0) {
+	uint64_t end_obj_size;
+	calc_snap_set_diff(ictx->cct, d->snap_set, from_snap_id, end_snap_id,
+			   &diff, &end_obj_size, &end_exists);
+      } else if (dr != -ENOENT) {
+	lderr(ictx->cct) << "diff_iterate error listing snaps of object "
+			 << objno << ": " << cpp_strerror(dr) << dendl;
+	r = dr;
+      }
+      delete d;
+      if (r < 0)
+	break;
+
+      if (!end_exists && !parent_diff.empty()) {
+	diff.clear();
+	interval_set<uint64_t> from_parent;
+	from_parent.insert(obj_off + begin, end - begin);
+	from_parent.intersection_of(parent_diff);
+	for (interval_set<uint64_t>::iterator p = from_parent.begin();
+	     p != from_parent.end();
+	     ++p)
+	  diff.insert(p.get_start() - obj_off, p.get_len());
+	end_exists = true;
+      }
+
+      interval_set<uint64_t> wanted;
+      wanted.insert(begin, end - begin);
+      diff.intersection_of(wanted);
+      ldout(ictx->cct, 20) << "diff_iterate object " << objno << " diff "
+			   << diff << " exists " << end_exists << dendl;
+      for (interval_set<uint64_t>::iterator p = diff.begin();
+	   p != diff.end() && r == 0;
+	   ++p)
+	r = cb(obj_off + p.get_start(), p.get_len(), end_exists, arg);
+    }
+
+    // don't leave any completions behind
+    for (std::deque<DiffObject*>::iterator p = in_flight.begin();
+	 p != in_flight.end(); ++p) {
+      (*p)->c->wait_for_complete();
+      (*p)->c->release();
+      delete *p;
+    }
+    return r;
+  }
+
   ssize_t write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf)
   {
     utime_t start_time, elapsed;
@@ -2146,9 +3056,15 @@ reprotect_and_return_err:
     bool done;
     int ret;
 
+    // pick up any change to the limits first
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+    ictx->qos.wait_io(true, len);
+
     Context *ctx = new C_SafeCond(&mylock, &cond, &done, &ret);
     AioCompletion *c = aio_create_completion_internal(ctx, rbd_ctx_cb);
-    int r = aio_write(ictx, off, len, buf, c);
+    r = aio_write(ictx, off, len, buf, c);
     if (r < 0) {
       c->release();
       delete ctx;
@@ -2183,9 +3099,14 @@ reprotect_and_return_err:
     bool done;
     int ret;
 
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+    ictx->qos.wait_io(true, 0);
+
     Context *ctx = new C_SafeCond(&mylock, &cond, &done, &ret);
     AioCompletion *c = aio_create_completion_internal(ctx, rbd_ctx_cb);
-    int r = aio_discard(ictx, off, len, c);
+    r = aio_discard(ictx, off, len, c);
     if (r < 0) {
       c->release();
       delete ctx;
@@ -2310,6 +3231,13 @@ reprotect_and_return_err:
     if (r < 0)
       return r;
 
+    // writes made before the flush include those still held back
+    ictx->qos.drain_writes();
+
+    // anything in the write log is already as durable as it needs to be
+    if (ictx->write_log && ictx->write_log->is_active())
+      return 0;
+
     return _flush(ictx);
   }
 
@@ -2318,7 +3246,11 @@ reprotect_and_return_err:
     CephContext *cct = ictx->cct;
     int r;
     // flush any outstanding writes
-    if (ictx->object_cacher) {
+    if (ictx->write_log) {
+      r = ictx->write_log->flush();
+      if (r == 0)
+	r = ictx->data_ctx.aio_flush();
+    } else if (ictx->cache_enabled()) {
       r = ictx->flush_cache();
     } else {
       r = ictx->data_ctx.aio_flush();
@@ -2330,6 +3262,27 @@ reprotect_and_return_err:
     return r;
   }
 
+  // completes a write once the write log has it on disk
+  class C_LogWriteSafe : public Context {
+  public:
+    C_LogWriteSafe(ImageCtx *ictx, AioCompletion *c)
+      : m_ictx(ictx), m_comp(c), m_start(ceph_clock_now(ictx->cct)) {}
+    virtual void finish(int r) {
+      // the log may get here before aio_write() has returned, so the
+      // completion is only set up now; the reference aio_write() took
+      // for it is put once it completes
+      m_comp->init_time(m_ictx, AIO_TYPE_WRITE);
+      m_comp->start_time = m_start;
+      m_comp->add_request();
+      m_comp->complete_request(m_ictx->cct, r);
+      m_comp->finish_adding_requests();
+    }
+  private:
+    ImageCtx *m_ictx;
+    AioCompletion *m_comp;
+    utime_t m_start;
+  };
+
   int aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
 		AioCompletion *c)
   {
@@ -2344,10 +3297,68 @@ reprotect_and_return_err:
     if (r < 0)
       return r;
 
-    size_t total_write = 0;
-    uint64_t start_block = get_block_num(ictx->order, off);
-    uint64_t end_block = get_block_num(ictx->order, off + len - 1);
-    uint64_t block_size = get_block_size(ictx->order);
+    r = check_io(ictx, off, len);
+    if (r < 0)
+      return r;
+
+    if (ictx->write_log) {
+      ictx->snap_lock.Lock();
+      snapid_t snap_id = ictx->snap_id;
+      ictx->snap_lock.Unlock();
+      if (snap_id != CEPH_NOSNAP)
+	return -EROFS;
+
+      // once it is durable in the log, it will get to the osds from
+      // there
+      bufferlist bl;
+      bl.append(buf, len);
+      c->get();
+      Context *ctx = new C_LogWriteSafe(ictx, c);
+      r = ictx->write_log->aio_write(off, bl, ctx);
+      if (r == 0) {
+	ictx->perfcounter->inc(l_librbd_aio_wr);
+	ictx->perfcounter->inc(l_librbd_aio_wr_bytes, len);
+	return 0;
+      }
+      delete ctx;
+      c->put();
+      if (r != -EAGAIN)
+	return r;
+    }
+
+    return aio_write_to_osds(ictx, off, len, buf, c);
+  }
+
+  // send a write's requests once the object map says their objects
+  // exist, or fail them all
+  class C_SendWrites : public Context {
+  public:
+    C_SendWrites(Context *write_ctx) : m_write_ctx(write_ctx) {}
+    void add(AioRequest *req) {
+      m_reqs.push_back(req);
+    }
+    virtual void finish(int r) {
+      for (vector<AioRequest*>::iterator p = m_reqs.begin();
+	   p != m_reqs.end(); ++p) {
+	int send_r = r < 0 ? r : (*p)->send();
+	if (send_r < 0) {
+	  delete *p;
+	  m_write_ctx->complete(send_r);
+	}
+      }
+    }
+  private:
+    Context *m_write_ctx;
+    vector<AioRequest*> m_reqs;
+  };
+
+  int aio_write_to_osds(ImageCtx *ictx, uint64_t off, size_t len,
+			const char *buf, AioCompletion *c)
+  {
+    CephContext *cct = ictx->cct;
+    int r = 0;
+    vector<BlockExtent> extents;
+    map_block_extents(ictx->order, off, len, &extents);
     ictx->snap_lock.Lock();
     snapid_t snap_id = ictx->snap_id;
     ::SnapContext snapc = ictx->snapc;
@@ -2357,49 +3368,58 @@ reprotect_and_return_err:
     ictx->get_parent_overlap(ictx->snap_id, &overlap);
     ictx->parent_lock.Unlock();
     ictx->snap_lock.Unlock();
-    uint64_t left = len;
-
-    r = check_io(ictx, off, len);
-    if (r < 0)
-      return r;
 
     if (snap_id != CEPH_NOSNAP)
       return -EROFS;
 
+    // the cache writes back later, so wait for the object map here;
+    // otherwise the writes go out once the map update is on the osd
+    C_SendWrites *send = NULL;
+    if (ictx->cache_enabled()) {
+      r = ictx->object_map.mark_exists(extents.front().block,
+				       extents.back().block + 1);
+      if (r < 0)
+	return r;
+    } else {
+      send = new C_SendWrites(&c->write_ctx);
+    }
+
+    // copy the caller's buffer once; each block's write refers to its
+    // part of the copy
+    bufferptr data(buf, len);
+
     c->get();
     c->init_time(ictx, AIO_TYPE_WRITE);
-    for (uint64_t i = start_block; i <= end_block; i++) {
-      string oid = get_block_oid(ictx->object_prefix, i, ictx->old_format);
-      ldout(cct, 20) << "oid = '" << oid << "' i = " << i << dendl;
-      uint64_t total_off = off + total_write;
-      uint64_t block_ofs = get_block_ofs(ictx->order, total_off);
-      uint64_t write_len = min(block_size - block_ofs, left);
+    for (vector<BlockExtent>::iterator p = extents.begin();
+	 p != extents.end(); ++p) {
+      string oid = get_block_oid(ictx->object_prefix, p->block,
+				 ictx->old_format);
+      ldout(cct, 20) << "oid = '" << oid << "' i = " << p->block << dendl;
+      uint64_t total_off = off + p->buf_ofs;
 
       bufferlist bl;
-      bl.append(buf + total_write, write_len);
-      if (ictx->object_cacher) {
+      bl.append(data, p->buf_ofs, p->len);
+      if (ictx->cache_enabled()) {
 	// may block
-	ictx->write_to_cache(oid, bl, write_len, block_ofs);
+	ictx->write_to_cache(oid, bl, p->len, p->block_ofs);
       } else {
-	C_AioWrite *req_comp = new C_AioWrite(cct, c);
-	bool parent_exists = has_parent(parent_pool_id, total_off - block_ofs, overlap);
+	bool parent_exists = has_parent(parent_pool_id,
+					total_off - p->block_ofs, overlap);
 	ldout(ictx->cct, 20) << "has_parent(pool=" << parent_pool_id
 			     << ", off=" << total_off
 			     << ", overlap=" << overlap << ") = "
 			     << parent_exists << dendl;
 	AioWrite *req = new AioWrite(ictx, oid, total_off, bl, snapc, snap_id,
-				     parent_exists, req_comp);
+				     parent_exists, &c->write_ctx);
 	c->add_request();
-	r = req->send();
-	if (r < 0)
-	  goto done;
+	send->add(req);
       }
-      total_write += write_len;
-      left -= write_len;
     }
-  done:
+    if (send && !ictx->object_map.aio_mark_exists(extents.front().block,
+						  extents.back().block + 1,
+						  send))
+      send->complete(0);
     c->finish_adding_requests();
-    c->put();
 
     ictx->perfcounter->inc(l_librbd_aio_wr);
     ictx->perfcounter->inc(l_librbd_aio_wr_bytes, len);
@@ -2408,6 +3428,21 @@ reprotect_and_return_err:
     return r;
   }
 
+  // clear an object's bit in the object map once it has been removed
+  class C_ObjectRemoved : public Context {
+  public:
+    C_ObjectRemoved(ImageCtx *ictx, uint64_t objno, Context *ctx)
+      : m_ictx(ictx), m_objno(objno), m_ctx(ctx) {}
+    virtual void finish(int r) {
+      m_ictx->object_map.removed(m_objno, r);
+      m_ctx->complete(r);
+    }
+  private:
+    ImageCtx *m_ictx;
+    uint64_t m_objno;
+    Context *m_ctx;
+  };
+
   int aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len, AioCompletion *c)
   {
     CephContext *cct = ictx->cct;
@@ -2421,10 +3456,15 @@ reprotect_and_return_err:
     if (r < 0)
       return r;
 
-    // TODO: check for snap
-    size_t total_write = 0;
-    uint64_t start_block = get_block_num(ictx->order, off);
-    uint64_t end_block = get_block_num(ictx->order, off + len - 1);
+    if (ictx->write_log) {
+      // earlier writes to the same place mustn't land after this
+      r = ictx->write_log->flush();
+      if (r < 0)
+	return r;
+    }
+
+    vector<BlockExtent> extents;
+    map_block_extents(ictx->order, off, len, &extents);
     uint64_t block_size = get_block_size(ictx->order);
     ictx->snap_lock.Lock();
     snapid_t snap_id = ictx->snap_id;
@@ -2435,35 +3475,55 @@ reprotect_and_return_err:
     ictx->get_parent_overlap(ictx->snap_id, &overlap);
     ictx->parent_lock.Unlock();
     ictx->snap_lock.Unlock();
-    uint64_t left = len;
+
+    if (snap_id != CEPH_NOSNAP)
+      return -EROFS;
 
     r = check_io(ictx, off, len);
     if (r < 0)
       return r;
 
     vector<ObjectExtent> v;
-    if (ictx->object_cacher)
-      v.reserve(end_block - start_block + 1);
+    if (ictx->cache_enabled())
+      v.reserve(extents.size());
 
     c->get();
     c->init_time(ictx, AIO_TYPE_DISCARD);
-    for (uint64_t i = start_block; i <= end_block; i++) {
+    for (vector<BlockExtent>::iterator p = extents.begin();
+	 p != extents.end(); ++p) {
+      uint64_t i = p->block;
       string oid = get_block_oid(ictx->object_prefix, i, ictx->old_format);
-      uint64_t total_off = off + total_write;
-      uint64_t block_ofs = get_block_ofs(ictx->order, total_off);;
-      uint64_t write_len = min(block_size - block_ofs, left);
+      uint64_t total_off = off + p->buf_ofs;
+      uint64_t block_ofs = p->block_ofs;
+      uint64_t write_len = p->len;
 
-      if (ictx->object_cacher) {
+      if (ictx->cache_enabled()) {
 	v.push_back(ObjectExtent(oid, block_ofs, write_len));
 	v.back().oloc.pool = ictx->data_ctx.get_id();
       }
 
-      C_AioWrite *req_comp = new C_AioWrite(cct, c);
+      bool parent_exists = has_parent(parent_pool_id, total_off - block_ofs, overlap);
+      if (!parent_exists && !ictx->object_map.object_may_exist(i)) {
+	// nothing there to discard
+	continue;
+      }
+
+      Context *req_comp = &c->write_ctx;
       AbstractWrite *req;
       c->add_request();
 
-      bool parent_exists = has_parent(parent_pool_id, total_off - block_ofs, overlap);
+      if (parent_exists) {
+	// a copyup may create the object
+	r = ictx->object_map.mark_exists(i, i + 1);
+	if (r < 0) {
+	  req_comp->complete(r);
+	  goto done;
+	}
+      }
+
       if (block_ofs == 0 && write_len == block_size) {
+	if (!parent_exists && ictx->object_map.mark_removing(i))
+	  req_comp = new C_ObjectRemoved(ictx, i, req_comp);
 	req = new AioRemove(ictx, oid, total_off, snapc, snap_id,
 			    parent_exists, req_comp);
       } else if (block_ofs + write_len == block_size) {
@@ -2477,16 +3537,13 @@ reprotect_and_return_err:
       r = req->send();
       if (r < 0)
 	goto done;
-      total_write += write_len;
-      left -= write_len;
     }
     r = 0;
   done:
-    if (ictx->object_cacher)
-      ictx->object_cacher->discard_set(ictx->object_set, v);
+    if (ictx->cache_enabled())
+      ictx->discard_cache(v);
 
     c->finish_adding_requests();
-    c->put();
 
     ictx->perfcounter->inc(l_librbd_aio_discard);
     ictx->perfcounter->inc(l_librbd_aio_discard_bytes, len);
@@ -2502,45 +3559,38 @@ reprotect_and_return_err:
     req->complete(comp->get_return_value());
   }
 
-  int aio_read(ImageCtx *ictx, uint64_t off, size_t len,
-	       char *buf,
-	       AioCompletion *c)
+  // aio_read() once the extent has been checked
+  static int aio_read_from_osds(ImageCtx *ictx, uint64_t off, size_t len,
+				char *buf, AioCompletion *c)
   {
-    ldout(ictx->cct, 20) << "aio_read " << ictx << " off = " << off << " len = "
-			 << len << dendl;
-
-    int r = ictx_check(ictx);
-    if (r < 0)
-      return r;
-
-    r = check_io(ictx, off, len);
-    if (r < 0)
-      return r;
-
+    int r;
     int64_t ret;
-    int total_read = 0;
-    uint64_t start_block = get_block_num(ictx->order, off);
-    uint64_t end_block = get_block_num(ictx->order, off + len - 1);
-    uint64_t block_size = get_block_size(ictx->order);
+    vector<BlockExtent> extents;
+    map_block_extents(ictx->order, off, len, &extents);
     ictx->snap_lock.Lock();
     snap_t snap_id = ictx->snap_id;
     ictx->snap_lock.Unlock();
-    uint64_t left = len;
 
     c->get();
     c->init_time(ictx, AIO_TYPE_READ);
-    for (uint64_t i = start_block; i <= end_block; i++) {
+    C_AioRead *req_comps = c->alloc_read_ctxs(extents.size());
+    for (size_t j = 0; j < extents.size(); j++) {
+      uint64_t i = extents[j].block;
       string oid = get_block_oid(ictx->object_prefix, i, ictx->old_format);
-      uint64_t block_ofs = get_block_ofs(ictx->order, off + total_read);
-      uint64_t read_len = min(block_size - block_ofs, left);
+      uint64_t block_ofs = extents[j].block_ofs;
+      uint64_t read_len = extents[j].len;
 
-      C_AioRead *req_comp = new C_AioRead(ictx->cct, c, buf + total_read);
-      AioRead *req = new AioRead(ictx, oid, off + total_read,
+      C_AioRead *req_comp = &req_comps[j];
+      req_comp->set_out_buf(buf + extents[j].buf_ofs);
+      AioRead *req = new AioRead(ictx, oid, off + extents[j].buf_ofs,
 				 read_len, snap_id, true, req_comp);
       req_comp->set_req(req);
       c->add_request();
 
-      if (ictx->object_cacher) {
+      if (snap_id == CEPH_NOSNAP && !ictx->object_map.object_may_exist(i)) {
+	// a hole: go straight to the parent, or complete with zeros
+	req->complete(-ENOENT);
+      } else if (ictx->cache_enabled()) {
 	req->ext_map()[block_ofs] = read_len;
 	// cache has already handled possible reading from parent, so
 	// this AioRead is just used to pass data to the
@@ -2559,14 +3609,13 @@ reprotect_and_return_err:
 	  goto done;
 	}
       }
-
-      total_read += read_len;
-      left -= read_len;
     }
-    ret = total_read;
+    ret = len;
   done:
     c->finish_adding_requests();
-    c->put();
+
+    if (ret >= 0)
+      ictx->aio_readahead(off, len);
 
     ictx->perfcounter->inc(l_librbd_aio_rd);
     ictx->perfcounter->inc(l_librbd_aio_rd_bytes, len);
@@ -2574,6 +3623,168 @@ reprotect_and_return_err:
     return ret;
   }
 
+  // a read of data that was still in the write log, sent once it has
+  // been destaged
+  class C_ReadAfterDestage : public Context {
+  public:
+    C_ReadAfterDestage(ImageCtx *ictx, uint64_t off, size_t len, char *buf,
+		       AioCompletion *c)
+      : m_ictx(ictx), m_off(off), m_len(len), m_buf(buf), m_comp(c) {}
+    virtual void finish(int r) {
+      if (r >= 0)
+	r = aio_read_from_osds(m_ictx, m_off, m_len, m_buf, m_comp);
+      if (r < 0 && m_comp->aio_type == AIO_TYPE_NONE)
+	m_comp->fail(m_ictx, AIO_TYPE_READ, r);
+      m_comp->put();
+    }
+  private:
+    ImageCtx *m_ictx;
+    uint64_t m_off;
+    size_t m_len;
+    char *m_buf;
+    AioCompletion *m_comp;
+  };
+
+  int aio_read(ImageCtx *ictx, uint64_t off, size_t len,
+	       char *buf,
+	       AioCompletion *c)
+  {
+    ldout(ictx->cct, 20) << "aio_read " << ictx << " off = " << off << " len = "
+			 << len << dendl;
+
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+
+    r = check_io(ictx, off, len);
+    if (r < 0)
+      return r;
+
+    if (ictx->write_log) {
+      // hold c until the read is sent
+      c->get();
+      Context *ctx = new C_ReadAfterDestage(ictx, off, len, buf, c);
+      r = ictx->write_log->aio_wait_for_destage(off, len, ctx);
+      if (r > 0)
+	return len;
+      delete ctx;
+      c->put();
+      if (r < 0)
+	return r;
+    }
+
+    return aio_read_from_osds(ictx, off, len, buf, c);
+  }
+
+  // an io the qos limits held back, sent once they let it go
+  class C_QosAio : public Context {
+  public:
+    C_QosAio(ImageCtx *ictx, aio_type_t type, uint64_t off, size_t len,
+	     const char *buf, AioCompletion *c)
+      : m_ictx(ictx), m_type(type), m_off(off), m_len(len),
+	m_buf(const_cast<char *>(buf)), m_comp(c) {
+      // a write's caller may reuse its buffer as soon as it returns
+      if (type == AIO_TYPE_WRITE) {
+	m_data = bufferptr(buf, len);
+	m_buf = m_data.c_str();
+      }
+    }
+    virtual ~C_QosAio() {}
+    virtual void finish(int r) {
+      switch (m_type) {
+      case AIO_TYPE_READ:
+	r = aio_read(m_ictx, m_off, m_len, m_buf, m_comp);
+	break;
+      case AIO_TYPE_WRITE:
+	r = aio_write(m_ictx, m_off, m_len, m_buf, m_comp);
+	break;
+      default:
+	r = aio_discard(m_ictx, m_off, m_len, m_comp);
+	break;
+      }
+      // the caller was told the io was started, so an error before it
+      // got anywhere has to go to the completion instead
+      if (r < 0 && m_comp->aio_type == AIO_TYPE_NONE)
+	m_comp->fail(m_ictx, m_type, r);
+    }
+  private:
+    ImageCtx *m_ictx;
+    aio_type_t m_type;
+    uint64_t m_off;
+    size_t m_len;
+    char *m_buf;
+    bufferptr m_data;
+    AioCompletion *m_comp;
+  };
+
+  // what aio_read(), aio_write() and aio_discard() would fail with at
+  // once, checked before an io is held back so it fails the same way
+  static int check_qos_io(ImageCtx *ictx, bool write, uint64_t off,
+			  uint64_t len)
+  {
+    int r = check_io(ictx, off, len);
+    if (r < 0)
+      return r;
+    if (write) {
+      Mutex::Locker l(ictx->snap_lock);
+      if (ictx->snap_id != CEPH_NOSNAP)
+	return -EROFS;
+    }
+    return 0;
+  }
+
+  int qos_aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
+		    AioCompletion *c)
+  {
+    // pick up any change to the limits first
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+    r = check_qos_io(ictx, true, off, len);
+    if (r < 0)
+      return r;
+    if (!ictx->qos.start_io(true, len)) {
+      Context *ctx = new C_QosAio(ictx, AIO_TYPE_WRITE, off, len, buf, c);
+      ictx->qos.queue_io(true, len, ctx);
+      return 0;
+    }
+    return aio_write(ictx, off, len, buf, c);
+  }
+
+  int qos_aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len,
+		      AioCompletion *c)
+  {
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+    r = check_qos_io(ictx, true, off, len);
+    if (r < 0)
+      return r;
+    if (!ictx->qos.start_io(true, 0)) {
+      Context *ctx = new C_QosAio(ictx, AIO_TYPE_DISCARD, off, len, NULL, c);
+      ictx->qos.queue_io(true, 0, ctx);
+      return 0;
+    }
+    return aio_discard(ictx, off, len, c);
+  }
+
+  int qos_aio_read(ImageCtx *ictx, uint64_t off, size_t len, char *buf,
+		   AioCompletion *c)
+  {
+    int r = ictx_check(ictx);
+    if (r < 0)
+      return r;
+    r = check_qos_io(ictx, false, off, len);
+    if (r < 0)
+      return r;
+    if (!ictx->qos.start_io(false, len)) {
+      Context *ctx = new C_QosAio(ictx, AIO_TYPE_READ, off, len, buf, c);
+      ictx->qos.queue_io(false, len, ctx);
+      return 0;
+    }
+    return aio_read(ictx, off, len, buf, c);
+  }
+
   AioCompletion *aio_create_completion() {
     AioCompletion *c = new AioCompletion();
     return c;
@@ -45,6 +45,25 @@ enum {
   l_librbd_notify,
   l_librbd_resize,
 
+  l_librbd_readahead,
+  l_librbd_readahead_bytes,
+
+  l_librbd_cor,              // objects copied from the parent on read
+  l_librbd_cor_bytes,
+  l_librbd_cor_skipped,      // copies not started, too many in flight
+  l_librbd_cor_parent_reads_avoided,
+
+  l_librbd_wl_write,
+  l_librbd_wl_write_bytes,
+  l_librbd_wl_destage,
+  l_librbd_wl_destage_bytes,
+  l_librbd_wl_replay,        // entries found in the log on open
+  l_librbd_wl_full,          // writes that waited for room in the log
+
+  l_librbd_qos_throttled,    // ios queued by the qos limits
+  l_librbd_qos_queued,       // ios in the qos queue now
+  l_librbd_qos_wait_latency, // time spent there
+
   l_librbd_last,
 };
 
@@ -68,6 +87,7 @@ namespace librbd {
   const std::string id_obj_name(const std::string &name);
   const std::string header_name(const std::string &image_id);
   const std::string old_header_name(const std::string &image_name);
+  const std::string object_map_name(const std::string &image_id);
 
   int detect_format(librados::IoCtx &io_ctx, const std::string &name,
 		    bool *old_format, uint64_t *size);
@@ -89,6 +109,8 @@ namespace librbd {
   int get_size(ImageCtx *ictx, uint64_t *size);
   int get_features(ImageCtx *ictx, uint64_t *features);
   int get_overlap(ImageCtx *ictx, uint64_t *overlap);
+  int qos_get_limit(ImageCtx *ictx, const char *name, uint64_t *limit);
+  int qos_set_limit(ImageCtx *ictx, const char *name, uint64_t limit);
   int get_parent_info(ImageCtx *ictx, string *parent_pool_name,
 		      string *parent_name, string *parent_snap_name);
 
@@ -118,8 +140,16 @@ namespace librbd {
 
   int copyup_block(ImageCtx *ictx, uint64_t offset, size_t len,
 		   const char *buf);
+  int aio_copyup_block(ImageCtx *ictx, uint64_t offset,
+		       ceph::bufferlist &bl, Context *ctx);
   int flatten(ImageCtx *ictx, ProgressContext &prog_ctx);
 
+  /* object map */
+  int get_used_size(ImageCtx *ictx, uint64_t *used);
+  int object_map_check(ImageCtx *ictx, ProgressContext &prog_ctx,
+		       uint64_t *missing, uint64_t *stale);
+  int object_map_rebuild(ImageCtx *ictx, ProgressContext &prog_ctx);
+
   /* cooperative locking */
   int list_lockers(ImageCtx *ictx,
 		   std::list<locker_t> *locks,
@@ -133,7 +163,7 @@ namespace librbd {
   int break_lock(ImageCtx *ictx, const std::string& client,
                  const std::string& cookie);
 
-  void trim_image(ImageCtx *ictx, uint64_t newsize, ProgressContext& prog_ctx);
+  int trim_image(ImageCtx *ictx, uint64_t newsize, ProgressContext& prog_ctx);
   int read_rbd_info(librados::IoCtx& io_ctx, const std::string& info_oid,
 		    struct rbd_info *info);
 
@@ -168,13 +198,30 @@ namespace librbd {
 		       int (*cb)(uint64_t, size_t, const char *, void *),
 		       void *arg);
   ssize_t read(ImageCtx *ictx, uint64_t off, size_t len, char *buf);
+  int diff_iterate(ImageCtx *ictx, const char *fromsnapname,
+		   uint64_t off, uint64_t len,
+		   int (*cb)(uint64_t, size_t, int, void *),
+		   void *arg);
   ssize_t write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf);
   int discard(ImageCtx *ictx, uint64_t off, uint64_t len);
   int aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
                 AioCompletion *c);
+  int aio_write_to_osds(ImageCtx *ictx, uint64_t off, size_t len,
+			const char *buf, AioCompletion *c);
   int aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len, AioCompletion *c);
   int aio_read(ImageCtx *ictx, uint64_t off, size_t len,
                char *buf, AioCompletion *c);
+  /**
+   * the aio entry points for the image's user: like the above, but
+   * subject to the image's qos limits, which may hold an io back to
+   * be sent later
+   */
+  int qos_aio_write(ImageCtx *ictx, uint64_t off, size_t len, const char *buf,
+		    AioCompletion *c);
+  int qos_aio_discard(ImageCtx *ictx, uint64_t off, uint64_t len,
+		      AioCompletion *c);
+  int qos_aio_read(ImageCtx *ictx, uint64_t off, size_t len, char *buf,
+		   AioCompletion *c);
   int flush(ImageCtx *ictx);
   int _flush(ImageCtx *ictx);
 
@@ -196,6 +243,7 @@ namespace librbd {
   int simple_read_cb(uint64_t ofs, size_t len, const char *buf, void *arg);
   void rados_req_cb(rados_completion_t cb, void *arg);
   void rbd_req_cb(completion_t cb, void *arg);
+  void rbd_ctx_cb(completion_t cb, void *arg);
 }
 
 #endif
@@ -231,6 +231,24 @@ namespace librbd {
     return librbd::get_overlap(ictx, overlap);
   }
 
+  int Image::used_size(uint64_t *used)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    return librbd::get_used_size(ictx, used);
+  }
+
+  int Image::qos_get_limit(const char *name, uint64_t *limit)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    return librbd::qos_get_limit(ictx, name, limit);
+  }
+
+  int Image::qos_set_limit(const char *name, uint64_t limit)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    return librbd::qos_set_limit(ictx, name, limit);
+  }
+
   int Image::parent_info(string *parent_pool_name, string *parent_name,
 			 string *parent_snap_name)
   {
@@ -266,6 +284,33 @@ namespace librbd {
     return librbd::flatten(ictx, prog_ctx);
   }
 
+  int Image::object_map_check(uint64_t *missing, uint64_t *stale)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    librbd::NoOpProgressContext prog_ctx;
+    return librbd::object_map_check(ictx, prog_ctx, missing, stale);
+  }
+
+  int Image::object_map_check_with_progress(uint64_t *missing, uint64_t *stale,
+					    librbd::ProgressContext& prog_ctx)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    return librbd::object_map_check(ictx, prog_ctx, missing, stale);
+  }
+
+  int Image::object_map_rebuild()
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    librbd::NoOpProgressContext prog_ctx;
+    return librbd::object_map_rebuild(ictx, prog_ctx);
+  }
+
+  int Image::object_map_rebuild_with_progress(librbd::ProgressContext& prog_ctx)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    return librbd::object_map_rebuild(ictx, prog_ctx);
+  }
+
   int Image::list_children(set<pair<string, string> > *children)
   {
     ImageCtx *ictx = (ImageCtx *)ctx;
@@ -375,6 +420,15 @@ namespace librbd {
     return librbd::read_iterate(ictx, ofs, len, cb, arg);
   }
 
+  int Image::diff_iterate(const char *fromsnapname,
+			  uint64_t ofs, uint64_t len,
+			  int (*cb)(uint64_t, size_t, int, void *),
+			  void *arg)
+  {
+    ImageCtx *ictx = (ImageCtx *)ctx;
+    return librbd::diff_iterate(ictx, fromsnapname, ofs, len, cb, arg);
+  }
+
   ssize_t Image::write(uint64_t ofs, size_t len, bufferlist& bl)
   {
     ImageCtx *ictx = (ImageCtx *)ctx;
@@ -395,14 +449,14 @@ namespace librbd {
     ImageCtx *ictx = (ImageCtx *)ctx;
     if (bl.length() < len)
       return -EINVAL;
-    return librbd::aio_write(ictx, off, len, bl.c_str(),
+    return librbd::qos_aio_write(ictx, off, len, bl.c_str(),
 			     (librbd::AioCompletion *)c->pc);
   }
 
   int Image::aio_discard(uint64_t off, uint64_t len, RBD::AioCompletion *c)
   {
     ImageCtx *ictx = (ImageCtx *)ctx;
-    return librbd::aio_discard(ictx, off, len, (librbd::AioCompletion *)c->pc);
+    return librbd::qos_aio_discard(ictx, off, len, (librbd::AioCompletion *)c->pc);
   }
 
   int Image::aio_read(uint64_t off, size_t len, bufferlist& bl,
@@ -413,7 +467,7 @@ namespace librbd {
     bl.push_back(ptr);
     ldout(ictx->cct, 10) << "Image::aio_read() buf=" << (void *)bl.c_str() << "~"
 			 << (void *)(bl.c_str() + len - 1) << dendl;
-    return librbd::aio_read(ictx, off, len, bl.c_str(), (librbd::AioCompletion *)c->pc);
+    return librbd::qos_aio_read(ictx, off, len, bl.c_str(), (librbd::AioCompletion *)c->pc);
   }
 
   int Image::flush()
@@ -545,6 +599,41 @@ extern "C" int rbd_flatten_with_progress(rbd_image_t image,
   return librbd::flatten(ictx, prog_ctx);
 }
 
+extern "C" int rbd_object_map_check(rbd_image_t image, uint64_t *missing,
+				    uint64_t *stale)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  librbd::NoOpProgressContext prog_ctx;
+  return librbd::object_map_check(ictx, prog_ctx, missing, stale);
+}
+
+extern "C" int rbd_object_map_check_with_progress(rbd_image_t image,
+						  uint64_t *missing,
+						  uint64_t *stale,
+						  librbd_progress_fn_t cb,
+						  void *cbdata)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  librbd::CProgressContext prog_ctx(cb, cbdata);
+  return librbd::object_map_check(ictx, prog_ctx, missing, stale);
+}
+
+extern "C" int rbd_object_map_rebuild(rbd_image_t image)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  librbd::NoOpProgressContext prog_ctx;
+  return librbd::object_map_rebuild(ictx, prog_ctx);
+}
+
+extern "C" int rbd_object_map_rebuild_with_progress(rbd_image_t image,
+						    librbd_progress_fn_t cb,
+						    void *cbdata)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  librbd::CProgressContext prog_ctx(cb, cbdata);
+  return librbd::object_map_rebuild(ictx, prog_ctx);
+}
+
 extern "C" int rbd_rename(rados_ioctx_t src_p, const char *srcname,
 			  const char *destname)
 {
@@ -617,6 +706,26 @@ extern "C" int rbd_get_overlap(rbd_image_t image, uint64_t *overlap)
   return librbd::get_overlap(ictx, overlap);
 }
 
+extern "C" int rbd_get_used_size(rbd_image_t image, uint64_t *used)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::get_used_size(ictx, used);
+}
+
+extern "C" int rbd_qos_get_limit(rbd_image_t image, const char *name,
+				 uint64_t *limit)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::qos_get_limit(ictx, name, limit);
+}
+
+extern "C" int rbd_qos_set_limit(rbd_image_t image, const char *name,
+				 uint64_t limit)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::qos_set_limit(ictx, name, limit);
+}
+
 extern "C" int rbd_get_parent_info(rbd_image_t image,
   char *parent_pool_name, size_t ppool_namelen, char *parent_name,
   size_t pnamelen, char *parent_snap_name, size_t psnap_namelen)
@@ -885,6 +994,16 @@ extern "C" int64_t rbd_read_iterate(rbd_image_t image, uint64_t ofs, size_t len,
   return librbd::read_iterate(ictx, ofs, len, cb, arg);
 }
 
+extern "C" int rbd_diff_iterate(rbd_image_t image,
+				const char *fromsnapname,
+				uint64_t ofs, uint64_t len,
+				int (*cb)(uint64_t, size_t, int, void *),
+				void *arg)
+{
+  librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
+  return librbd::diff_iterate(ictx, fromsnapname, ofs, len, cb, arg);
+}
+
 extern "C" ssize_t rbd_write(rbd_image_t image, uint64_t ofs, size_t len,
 			     const char *buf)
 {
@@ -913,7 +1032,7 @@ extern "C" int rbd_aio_write(rbd_image_t image, uint64_t off, size_t len,
 {
   librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
   librbd::RBD::AioCompletion *comp = (librbd::RBD::AioCompletion *)c;
-  return librbd::aio_write(ictx, off, len, buf,
+  return librbd::qos_aio_write(ictx, off, len, buf,
 			   (librbd::AioCompletion *)comp->pc);
 }
 
@@ -922,7 +1041,7 @@ extern "C" int rbd_aio_discard(rbd_image_t image, uint64_t off, uint64_t len,
 {
   librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
   librbd::RBD::AioCompletion *comp = (librbd::RBD::AioCompletion *)c;
-  return librbd::aio_discard(ictx, off, len, (librbd::AioCompletion *)comp->pc);
+  return librbd::qos_aio_discard(ictx, off, len, (librbd::AioCompletion *)comp->pc);
 }
 
 extern "C" int rbd_aio_read(rbd_image_t image, uint64_t off, size_t len,
@@ -930,7 +1049,7 @@ extern "C" int rbd_aio_read(rbd_image_t image, uint64_t off, size_t len,
 {
   librbd::ImageCtx *ictx = (librbd::ImageCtx *)image;
   librbd::RBD::AioCompletion *comp = (librbd::RBD::AioCompletion *)c;
-  return librbd::aio_read(ictx, off, len, buf,
+  return librbd::qos_aio_read(ictx, off, len, buf,
 			  (librbd::AioCompletion *)comp->pc);
 }
 
@@ -0,0 +1,114 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MOSDOPBATCH_H
+#define CEPH_MOSDOPBATCH_H
+
+#include "msg/Message.h"
+#include "MOSDOp.h"
+
+/*
+ * several independent client ops to the same osd, sent as one message.
+ *
+ * each op keeps its own header and front; their data sections are
+ * concatenated into ours.  the whole thing is covered by a single set
+ * of crcs, so the inner ops carry none.  the osd unpacks the ops and
+ * handles (and replies to) each one as if it had arrived on its own.
+ */
+class MOSDOpBatch : public Message {
+  static const int HEAD_VERSION = 1;
+  static const int COMPAT_VERSION = 1;
+
+public:
+  vector<MOSDOp*> ops;
+
+  MOSDOpBatch()
+    : Message(CEPH_MSG_OSD_OP_BATCH, HEAD_VERSION, COMPAT_VERSION) { }
+private:
+  ~MOSDOpBatch() {
+    for (vector<MOSDOp*>::iterator p = ops.begin(); p != ops.end(); ++p)
+      (*p)->put();
+  }
+
+public:
+  void encode_payload(uint64_t features) {
+    __u32 n = ops.size();
+    ::encode(n, payload);
+    for (vector<MOSDOp*>::iterator p = ops.begin(); p != ops.end(); ++p) {
+      MOSDOp *m = *p;
+      if (m->empty_payload())
+	m->encode_payload(features);
+      ::encode(m->get_header(), payload);
+      ::encode(m->get_payload(), payload);
+      __u32 len = m->get_data().length();
+      ::encode(len, payload);
+      data.claim_append(m->get_data());
+    }
+  }
+
+  void decode_payload() {
+    bufferlist::iterator p = payload.begin();
+    __u32 n;
+    ::decode(n, p);
+    unsigned off = 0;
+    while (n--) {
+      ceph_msg_header h;
+      bufferlist front, d;
+      __u32 len;
+      ::decode(h, p);
+      ::decode(front, p);
+      ::decode(len, p);
+      d.substr_of(data, off, len);
+      off += len;
+
+      h.src = header.src;
+      MOSDOp *m = new MOSDOp;
+      m->set_header(h);
+      m->set_payload(front);
+      m->set_data(d);
+      ops.push_back(m);
+      m->decode_payload();
+    }
+  }
+
+  /**
+   * take the ops out of the batch, as if each had arrived on its own
+   * over the same connection.  each op is charged its share of the
+   * batch's message throttle, and holds it until it is done with,
+   * so that releasing the batch doesn't release the bytes the ops
+   * still reference.
+   */
+  void claim_ops(vector<MOSDOp*> *out) {
+    out->swap(ops);
+    for (vector<MOSDOp*>::iterator p = out->begin(); p != out->end(); ++p) {
+      MOSDOp *m = *p;
+      if (throttler) {
+	throttler->take(m->get_payload().length() + m->get_middle().length() +
+			m->get_data().length());
+	m->set_throttler(throttler);
+      }
+      if (connection)
+	m->set_connection(connection->get());
+      m->set_recv_stamp(get_recv_stamp());
+      m->set_throttle_stamp(get_throttle_stamp());
+      m->set_recv_complete_stamp(get_recv_complete_stamp());
+      m->set_dispatch_stamp(get_dispatch_stamp());
+    }
+  }
+
+  const char *get_type_name() const { return "osd_op_batch"; }
+  void print(ostream& out) const {
+    out << "osd_op_batch(" << ops.size() << " ops)";
+  }
+};
+
+#endif
@@ -2647,7 +2647,8 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	  const pg_pool_t *p = osdmap.get_pg_pool(pool);
 	  const char *start = m->cmd[5].c_str();
 	  char *end = (char *)start;
-	  unsigned n = strtol(start, &end, 10);
+	  long v = strtol(start, &end, 10);
+	  unsigned n = v;
 	  if (*end == '\0') {
 	    if (m->cmd[4] == "size") {
 	      if (pending_inc.new_pools.count(pool) == 0)
@@ -2666,6 +2667,31 @@ bool OSDMonitor::prepare_command(MMonCommand *m)
 	      getline(ss, rs);
 	      paxos->wait_for_commit(new Monitor::C_Command(mon, m, 0, rs, paxos->get_version()));
 	      return true;
+	    } else if (m->cmd[4] == "qos_reservation" ||
+		       m->cmd[4] == "qos_weight" ||
+		       m->cmd[4] == "qos_limit") {
+	      if (v < 0) {
+		ss << m->cmd[4] << " must be >= 0";
+		err = -EINVAL;
+		goto out;
+	      }
+	      if (m->cmd[4] == "qos_weight" && n == 0) {
+		ss << "qos_weight must be > 0";
+		err = -EINVAL;
+		goto out;
+	      }
+	      if (pending_inc.new_pools.count(pool) == 0)
+		pending_inc.new_pools[pool] = *p;
+	      if (m->cmd[4] == "qos_reservation")
+		pending_inc.new_pools[pool].qos_reservation = n;
+	      else if (m->cmd[4] == "qos_weight")
+		pending_inc.new_pools[pool].qos_weight = n;
+	      else
+		pending_inc.new_pools[pool].qos_limit = n;
+	      ss << "set pool " << pool << " " << m->cmd[4] << " to " << n;
+	      getline(ss, rs);
+	      paxos->wait_for_commit(new Monitor::C_Command(mon, m, 0, rs, paxos->get_version()));
+	      return true;
 	    } else if (m->cmd[4] == "pg_num") {
 	      if (true) {
 		// ** DISABLE THIS FOR NOW **
@@ -55,6 +55,7 @@ using namespace std;
 #include "messages/MOSDFailure.h"
 #include "messages/MOSDPing.h"
 #include "messages/MOSDOp.h"
+#include "messages/MOSDOpBatch.h"
 #include "messages/MOSDOpReply.h"
 #include "messages/MOSDSubOp.h"
 #include "messages/MOSDSubOpReply.h"
@@ -366,6 +367,9 @@ Message *decode_message(CephContext *cct, ceph_msg_header& header, ceph_msg_foot
   case CEPH_MSG_OSD_OP:
     m = new MOSDOp();
     break;
+  case CEPH_MSG_OSD_OP_BATCH:
+    m = new MOSDOpBatch();
+    break;
   case CEPH_MSG_OSD_OPREPLY:
     m = new MOSDOpReply();
     break;
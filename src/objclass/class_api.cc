@@ -220,15 +220,22 @@ int cls_cxx_stat(cls_method_context_t hctx, uint64_t *size, time_t *mtime)
 int cls_cxx_read(cls_method_context_t hctx, int ofs, int len, bufferlist *outbl)
 {
   ReplicatedPG::OpContext **pctx = (ReplicatedPG::OpContext **)hctx;
-  vector<OSDOp> ops(1);
-  int ret;
-  ops[0].op.op = CEPH_OSD_OP_READ;
-  ops[0].op.extent.offset = ofs;
-  ops[0].op.extent.length = len;
-  ret = (*pctx)->pg->do_osd_ops(*pctx, ops);
-  if (ret < 0)
-    return ret;
-  outbl->claim(ops[0].outdata);
+  ClsReadCache::result_t *p = (*pctx)->cls_cache.find_data(ofs, len);
+  if (!p) {
+    vector<OSDOp> ops(1);
+    ops[0].op.op = CEPH_OSD_OP_READ;
+    ops[0].op.extent.offset = ofs;
+    ops[0].op.extent.length = len;
+    int ret = (*pctx)->pg->do_osd_ops(*pctx, ops);
+    if (ret < 0)
+      return ret;
+    p = (*pctx)->cls_cache.add_data(ofs, len, ret, ops[0].outdata);
+  } else {
+    // account for it as do_osd_ops would have
+    (*pctx)->delta_stats.num_rd_kb += SHIFT_ROUND_UP(p->second.length(), 10);
+    (*pctx)->delta_stats.num_rd++;
+  }
+  *outbl = p->second;
   return outbl->length();
 }
 
@@ -272,19 +279,25 @@ int cls_cxx_getxattr(cls_method_context_t hctx, const char *name,
                      bufferlist *outbl)
 {
   ReplicatedPG::OpContext **pctx = (ReplicatedPG::OpContext **)hctx;
-  bufferlist name_data;
-  vector<OSDOp> nops(1);
-  OSDOp& op = nops[0];
-  int r;
-
-  op.op.op = CEPH_OSD_OP_GETXATTR;
-  op.indata.append(name);
-  op.op.xattr.name_len = strlen(name);
-  r = (*pctx)->pg->do_osd_ops(*pctx, nops);
-  if (r < 0)
-    return r;
+  ClsReadCache::result_t *p = (*pctx)->cls_cache.find_xattr(name);
+  if (!p) {
+    vector<OSDOp> nops(1);
+    OSDOp& op = nops[0];
+
+    op.op.op = CEPH_OSD_OP_GETXATTR;
+    op.indata.append(name);
+    op.op.xattr.name_len = strlen(name);
+    int r = (*pctx)->pg->do_osd_ops(*pctx, nops);
+    if (r < 0 && r != -ENOENT && r != -ENODATA)
+      return r;
+    p = (*pctx)->cls_cache.add_xattr(name, r, op.outdata);
+  } else {
+    (*pctx)->delta_stats.num_rd++;
+  }
+  if (p->first < 0)
+    return p->first;
 
-  outbl->claim(op.outdata);
+  *outbl = p->second;
   return outbl->length();
 }
 
@@ -427,15 +440,18 @@ int cls_cxx_map_get_vals(cls_method_context_t hctx, const string &start_obj,
 int cls_cxx_map_read_header(cls_method_context_t hctx, bufferlist *outbl)
 {
   ReplicatedPG::OpContext **pctx = (ReplicatedPG::OpContext **)hctx;
-  vector<OSDOp> ops(1);
-  OSDOp& op = ops[0];
-  int ret;
-  op.op.op = CEPH_OSD_OP_OMAPGETHEADER;
-  ret = (*pctx)->pg->do_osd_ops(*pctx, ops);
-  if (ret < 0)
-    return ret;
+  bufferlist *header = (*pctx)->cls_cache.find_omap_header();
+  if (!header) {
+    vector<OSDOp> ops(1);
+    OSDOp& op = ops[0];
+    op.op.op = CEPH_OSD_OP_OMAPGETHEADER;
+    int ret = (*pctx)->pg->do_osd_ops(*pctx, ops);
+    if (ret < 0)
+      return ret;
+    header = (*pctx)->cls_cache.add_omap_header(op.outdata);
+  }
 
-  outbl->claim(op.outdata);
+  *outbl = *header;
 
   return 0;
 }
@@ -444,32 +460,42 @@ int cls_cxx_map_get_val(cls_method_context_t hctx, const string &key,
 			bufferlist *outbl)
 {
   ReplicatedPG::OpContext **pctx = (ReplicatedPG::OpContext **)hctx;
-  vector<OSDOp> ops(1);
-  OSDOp& op = ops[0];
-  int ret;
-
-  set<string> k;
-  k.insert(key);
-  ::encode(k, op.indata);
-
-  op.op.op = CEPH_OSD_OP_OMAPGETVALSBYKEYS;
-  ret = (*pctx)->pg->do_osd_ops(*pctx, ops);
-  if (ret < 0)
-    return ret;
-
-  bufferlist::iterator iter = op.outdata.begin();
-  try {
-    map<string, bufferlist> m;
-
-    ::decode(m, iter);
-    map<string, bufferlist>::iterator iter = m.begin();
-    if (iter == m.end())
-      return -ENOENT;
-
-    *outbl = iter->second;
-  } catch (buffer::error& e) {
-    return -EIO;
+  ClsReadCache::result_t *p = (*pctx)->cls_cache.find_omap_val(key);
+  if (!p) {
+    vector<OSDOp> ops(1);
+    OSDOp& op = ops[0];
+    int ret;
+
+    set<string> k;
+    k.insert(key);
+    ::encode(k, op.indata);
+
+    op.op.op = CEPH_OSD_OP_OMAPGETVALSBYKEYS;
+    ret = (*pctx)->pg->do_osd_ops(*pctx, ops);
+    if (ret < 0)
+      return ret;
+
+    bufferlist::iterator iter = op.outdata.begin();
+    int r = 0;
+    bufferlist val;
+    try {
+      map<string, bufferlist> m;
+
+      ::decode(m, iter);
+      map<string, bufferlist>::iterator iter = m.begin();
+      if (iter == m.end())
+	r = -ENOENT;
+      else
+	val.claim(iter->second);
+    } catch (buffer::error& e) {
+      return -EIO;
+    }
+    p = (*pctx)->cls_cache.add_omap_val(key, r, val);
   }
+  if (p->first < 0)
+    return p->first;
+
+  *outbl = p->second;
   return 0;
 }
 
@@ -31,6 +31,26 @@ int ClassHandler::open_class(const string& cname, ClassData **pcls)
   return 0;
 }
 
+/*
+ * Resolve cname.mname with a single pass under the handler lock,
+ * loading the class on first use.  *pmethod is NULL if the class is
+ * open but has no such method.
+ */
+int ClassHandler::open_method(const string& cname, const string& mname,
+			      ClassMethod **pmethod)
+{
+  Mutex::Locker lock(mutex);
+  ClassData *cls = _get_class(cname);
+  if (cls->status != ClassData::CLASS_OPEN) {
+    int r = _load_class(cls);
+    if (r)
+      return r;
+  }
+  hash_map<string, ClassMethod*>::iterator p = cls->method_table.find(mname);
+  *pmethod = (p == cls->method_table.end()) ? NULL : p->second;
+  return 0;
+}
+
 ClassHandler::ClassData *ClassHandler::_get_class(const string& cname)
 {
   ClassData *cls;
@@ -143,6 +163,7 @@ ClassHandler::ClassMethod *ClassHandler::ClassData::register_method(const char *
   method.name = mname;
   method.flags = flags;
   method.cls = this;
+  method_table[mname] = &method;
   return &method;
 }
 
@@ -157,15 +178,16 @@ ClassHandler::ClassMethod *ClassHandler::ClassData::register_cxx_method(const ch
   method.name = mname;
   method.flags = flags;
   method.cls = this;
+  method_table[mname] = &method;
   return &method;
 }
 
 ClassHandler::ClassMethod *ClassHandler::ClassData::_get_method(const char *mname)
 {
-  map<string, ClassHandler::ClassMethod>::iterator iter = methods_map.find(mname);
-  if (iter == methods_map.end())
+  hash_map<string, ClassHandler::ClassMethod*>::iterator iter = method_table.find(mname);
+  if (iter == method_table.end())
     return NULL;
-  return &(iter->second);
+  return iter->second;
 }
 
 int ClassHandler::ClassData::get_method_flags(const char *mname)
@@ -183,6 +205,7 @@ void ClassHandler::ClassData::unregister_method(ClassHandler::ClassMethod *metho
    map<string, ClassMethod>::iterator iter = methods_map.find(method->name);
    if (iter == methods_map.end())
      return;
+   method_table.erase(method->name);
    methods_map.erase(iter);
 }
 
@@ -46,6 +46,8 @@ public:
     void *handle;
 
     map<string, ClassMethod> methods_map;
+    // name -> method, for the per-call lookup from the op path
+    hash_map<string, ClassMethod*> method_table;
 
     set<ClassData *> dependencies;         /* our dependencies */
     set<ClassData *> missing_dependencies; /* only missing dependencies */
@@ -79,6 +81,8 @@ public:
   ClassHandler() : mutex("ClassHandler") {}
   
   int open_class(const string& cname, ClassData **pcls);
+  int open_method(const string& cname, const string& mname,
+		  ClassMethod **pmethod);
   
   ClassData *register_class(const char *cname);
   void unregister_class(ClassData *cls);
@@ -0,0 +1,106 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_CLSREADCACHE_H
+#define CEPH_OSD_CLSREADCACHE_H
+
+#include "include/types.h"
+#include "include/rados.h"
+
+/**
+ * ClsReadCache - results of reads issued by object class methods
+ * (cls_cxx_*) on behalf of one op
+ *
+ * A method that re-reads the same data, xattr, omap key or omap
+ * header (or a later CALL in the same op vector) is served from here
+ * instead of the ObjectStore.  Failed lookups (ENOENT/ENODATA) are
+ * cached too.  Reads never see the op's pending transaction, so
+ * everything is dropped whenever a modifying op is applied, to keep
+ * the semantics unchanged.
+ */
+struct ClsReadCache {
+  typedef pair<int, bufferlist> result_t;  // return value, data
+
+  map<pair<uint64_t, uint64_t>, result_t> data;
+  map<string, result_t> xattrs;
+  map<string, result_t> omap_vals;
+  bool have_omap_header;
+  bufferlist omap_header;
+  unsigned hits;  // lookups served from the cache
+
+  ClsReadCache() : have_omap_header(false), hits(0) {}
+
+  void clear() {
+    data.clear();
+    xattrs.clear();
+    omap_vals.clear();
+    have_omap_header = false;
+    omap_header.clear();
+  }
+
+  /// called for every op applied on behalf of the op
+  void note_op(const ceph_osd_op& op) {
+    if (ceph_osd_op_mode_modify(op.op))
+      clear();
+  }
+
+  /// @returns the cached result, counting a hit, or NULL
+  result_t *find_data(uint64_t off, uint64_t len) {
+    return _find(data, make_pair(off, len));
+  }
+  result_t *find_xattr(const string& name) {
+    return _find(xattrs, name);
+  }
+  result_t *find_omap_val(const string& key) {
+    return _find(omap_vals, key);
+  }
+  bufferlist *find_omap_header() {
+    if (!have_omap_header)
+      return NULL;
+    hits++;
+    return &omap_header;
+  }
+
+  result_t *add_data(uint64_t off, uint64_t len, int r, bufferlist& bl) {
+    return _add(data, make_pair(off, len), r, bl);
+  }
+  result_t *add_xattr(const string& name, int r, bufferlist& bl) {
+    return _add(xattrs, name, r, bl);
+  }
+  result_t *add_omap_val(const string& key, int r, bufferlist& bl) {
+    return _add(omap_vals, key, r, bl);
+  }
+  bufferlist *add_omap_header(bufferlist& bl) {
+    omap_header.claim(bl);
+    have_omap_header = true;
+    return &omap_header;
+  }
+
+private:
+  template <typename K>
+  result_t *_find(map<K, result_t>& m, const K& k) {
+    typename map<K, result_t>::iterator p = m.find(k);
+    if (p == m.end())
+      return NULL;
+    hits++;
+    return &p->second;
+  }
+  template <typename K>
+  result_t *_add(map<K, result_t>& m, const K& k, int r, bufferlist& bl) {
+    result_t& e = m[k];
+    e.first = r;
+    e.second.claim(bl);
+    return &e;
+  }
+};
+
+#endif
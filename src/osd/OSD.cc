@@ -54,6 +54,7 @@
 #include "messages/MOSDPing.h"
 #include "messages/MOSDFailure.h"
 #include "messages/MOSDOp.h"
+#include "messages/MOSDOpBatch.h"
 #include "messages/MOSDOpReply.h"
 #include "messages/MOSDSubOp.h"
 #include "messages/MOSDSubOpReply.h"
@@ -87,6 +88,8 @@
 
 #include "messages/MWatchNotify.h"
 
+#include "osdc/Objecter.h"
+
 #include "common/perf_counters.h"
 #include "common/Timer.h"
 #include "common/LogClient.h"
@@ -146,6 +149,7 @@ OSDService::OSDService(OSD *osd) :
   pg_recovery_stats(osd->pg_recovery_stats),
   cluster_messenger(osd->cluster_messenger),
   client_messenger(osd->client_messenger),
+  objecter_messenger(osd->objecter_messenger),
   logger(osd->logger),
   monc(osd->monc),
   op_wq(osd->op_wq),
@@ -157,6 +161,7 @@ OSDService::OSDService(OSD *osd) :
   rep_scrub_wq(osd->rep_scrub_wq),
   class_handler(osd->class_handler),
   publish_lock("OSDService::publish_lock"),
+  heat_lock("OSDService::heat_lock"),
   sched_scrub_lock("OSDService::sched_scrub_lock"), scrubs_pending(0),
   scrubs_active(0),
   watch_lock("OSD::watch_lock"),
@@ -166,6 +171,12 @@ OSDService::OSDService(OSD *osd) :
   backfill_request_timer(g_ceph_context, backfill_request_lock, false),
   last_tid(0),
   tid_lock("OSDService::tid_lock"),
+  objecter_lock("OSDService::objecter_lock"),
+  objecter_timer(osd->client_messenger->cct, objecter_lock),
+  objecter(new Objecter(osd->client_messenger->cct, osd->objecter_messenger,
+			osd->monc, &objecter_osdmap, objecter_lock,
+			objecter_timer)),
+  objecter_finisher(osd->client_messenger->cct),
   reserver_finisher(g_ceph_context),
   local_reserver(&reserver_finisher, g_conf->osd_max_backfills),
   remote_reserver(&reserver_finisher, g_conf->osd_max_backfills),
@@ -176,6 +187,11 @@ OSDService::OSDService(OSD *osd) :
   map_bl_inc_cache(g_conf->osd_map_cache_size)
 {}
 
+OSDService::~OSDService()
+{
+  delete objecter;
+}
+
 void OSDService::need_heartbeat_peer_update()
 {
   osd->need_heartbeat_peer_update();
@@ -193,6 +209,12 @@ void OSDService::pg_stat_queue_dequeue(PG *pg)
 
 void OSDService::shutdown()
 {
+  objecter_lock.Lock();
+  objecter->shutdown();
+  objecter_timer.shutdown();
+  objecter_lock.Unlock();
+  objecter_finisher.stop();
+
   reserver_finisher.stop();
   watch_lock.Lock();
   watch_timer.shutdown();
@@ -206,6 +228,13 @@ void OSDService::init()
   reserver_finisher.start();
   watch_timer.init();
   watch = new Watch();
+
+  objecter_finisher.start();
+  objecter_lock.Lock();
+  objecter_timer.init();
+  objecter->set_client_incarnation(0);
+  objecter->init();
+  objecter_lock.Unlock();
 }
 
 ObjectStore *OSD::create_object_store(const std::string &dev, const std::string &jdev)
@@ -688,7 +717,8 @@ int OSD::peek_journal_fsid(string path, uuid_d& fsid)
 // cons/des
 
 OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
-	 Messenger *hbclientm, Messenger *hbserverm, MonClient *mc,
+	 Messenger *hbclientm, Messenger *hbserverm, Messenger *objecterm,
+	 MonClient *mc,
 	 const std::string &dev, const std::string &jdev) :
   Dispatcher(external_messenger->cct),
   osd_lock("OSD::osd_lock"),
@@ -703,6 +733,7 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
 								      cct->_conf->auth_supported)),
   cluster_messenger(internal_messenger),
   client_messenger(external_messenger),
+  objecter_messenger(objecterm),
   monc(mc),
   logger(NULL),
   store(NULL),
@@ -723,13 +754,16 @@ OSD::OSD(int id, Messenger *internal_messenger, Messenger *external_messenger,
   hbserver_messenger(hbserverm),
   heartbeat_thread(this),
   heartbeat_dispatcher(this),
+  objecter_dispatcher(this),
   stat_lock("OSD::stat_lock"),
   finished_lock("OSD::finished_lock"),
   admin_ops_hook(NULL),
   historic_ops_hook(NULL),
-  op_queue_len(0),
+  hot_objects_hook(NULL),
+  pg_memory_hook(NULL),
   op_wq(this, g_conf->osd_op_thread_timeout, &op_tp),
-  peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp, 200),
+  peering_wq(this, g_conf->osd_op_thread_timeout, &op_tp,
+	     g_conf->osd_peering_wq_batch_size),
   map_lock("OSD::map_lock"),
   peer_map_epoch_lock("OSD::peer_map_epoch_lock"),
   debug_drop_pg_create_probability(g_conf->osd_debug_drop_pg_create_probability),
@@ -819,6 +853,44 @@ public:
   }
 };
 
+class HotObjectsSocketHook : public AdminSocketHook {
+  OSDService *service;
+public:
+  HotObjectsSocketHook(OSDService *s) : service(s) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    unsigned n = g_conf->osd_heat_top_n;
+    if (args.length())
+      n = atoi(args.c_str());
+    JSONFormatter jf(true);
+    service->dump_heat(&jf, n);
+    stringstream ss;
+    jf.flush(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
+class PgMemorySocketHook : public AdminSocketHook {
+  OSD *osd;
+public:
+  PgMemorySocketHook(OSD *o) : osd(o) {}
+  bool call(std::string command, std::string args, bufferlist& out) {
+    // we are called under the admin socket's lock, which shutdown()
+    // takes with osd_lock held: don't wait for osd_lock here
+    if (!osd->osd_lock.TryLock()) {
+      out.append("osd busy, try again\n");
+      return true;
+    }
+    JSONFormatter jf(true);
+    osd->dump_pg_memory(&jf);
+    osd->osd_lock.Unlock();
+    stringstream ss;
+    jf.flush(ss);
+    out.append(ss);
+    return true;
+  }
+};
+
 int OSD::init()
 {
   Mutex::Locker lock(osd_lock);
@@ -913,6 +985,10 @@ int OSD::init()
 
   monc->wait_auth_rotating(30.0);
 
+  // our objecter talks to other osds as a client, under our global id
+  objecter_messenger->set_myname(entity_name_t::CLIENT(monc->get_global_id()));
+  objecter_messenger->add_dispatcher_head(&objecter_dispatcher);
+
   osd_lock.Lock();
 
   op_tp.start();
@@ -939,10 +1015,27 @@ int OSD::init()
   AdminSocket *admin_socket = cct->get_admin_socket();
   r = admin_socket->register_command("dump_ops_in_flight", admin_ops_hook,
                                          "show the ops currently in flight");
+  assert(r == 0);
   historic_ops_hook = new HistoricOpsSocketHook(this);
   r = admin_socket->register_command("dump_historic_ops", historic_ops_hook,
                                          "show slowest recent ops");
   assert(r == 0);
+  hot_objects_hook = new HotObjectsSocketHook(&service);
+  r = admin_socket->register_command("dump_hot_objects", hot_objects_hook,
+				     "show the most frequently accessed objects");
+  assert(r == 0);
+  pg_memory_hook = new PgMemorySocketHook(this);
+  r = admin_socket->register_command("dump_pg_memory", pg_memory_hook,
+				     "show the memory held by each pg's log and missing set");
+  assert(r == 0);
+
+  // start the objecter out on our current map, so that it doesn't go
+  // asking the monitor for one
+  {
+    bufferlist bl;
+    if (get_map_bl(osdmap->get_epoch(), bl))
+      service.objecter_osdmap.decode(bl);
+  }
 
   service.init();
   service.publish_map(osdmap);
@@ -957,6 +1050,9 @@ void OSD::create_logger()
   PerfCountersBuilder osd_plb(g_ceph_context, "osd", l_osd_first, l_osd_last);
 
   osd_plb.add_u64(l_osd_opq, "opq");       // op queue length (waiting to be processed yet)
+  osd_plb.add_fl_avg(l_osd_opq_res_lat, "opq_reservation_latency"); // queue time, served by reservation
+  osd_plb.add_fl_avg(l_osd_opq_wgt_lat, "opq_weight_latency");      // queue time, served by weight
+  osd_plb.add_fl_avg(l_osd_opq_lb_lat, "opq_limit_break_latency");  // queue time, served over limit
   osd_plb.add_u64(l_osd_op_wip, "op_wip");   // rep ops currently being processed (primary)
 
   osd_plb.add_u64_counter(l_osd_op,       "op");           // client ops
@@ -967,6 +1063,8 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_op_r,      "op_r");        // client reads
   osd_plb.add_u64_counter(l_osd_op_r_outb, "op_r_out_bytes");   // client read out bytes
   osd_plb.add_fl_avg(l_osd_op_r_lat,  "op_r_latency");    // client read latency
+  osd_plb.add_u64_counter(l_osd_op_r_replica, "op_r_replica");  // client reads served as a replica
+  osd_plb.add_u64_counter(l_osd_op_r_replica_eagain, "op_r_replica_eagain");  // ... sent back to the primary
   osd_plb.add_u64_counter(l_osd_op_w,      "op_w");        // client writes
   osd_plb.add_u64_counter(l_osd_op_w_inb,  "op_w_in_bytes");    // client write in bytes
   osd_plb.add_fl_avg(l_osd_op_w_rlat, "op_w_rlat");   // client write readable/applied latency
@@ -1012,6 +1110,12 @@ void OSD::create_logger()
   osd_plb.add_u64_counter(l_osd_mape, "map_message_epochs");         // osdmap epochs
   osd_plb.add_u64_counter(l_osd_mape_dup, "map_message_epoch_dups"); // dup osdmap epochs
 
+  osd_plb.add_u64_counter(l_osd_peering_evt, "peering_events");   // pg peering events handled
+  osd_plb.add_u64_avg(l_osd_peering_batch, "peering_batch_pgs");  // pgs per peering batch
+  osd_plb.add_fl_avg(l_osd_peering_lat, "peering_latency");       // per-pg advance+event time
+
+  osd_plb.add_u64_counter(l_osd_cls_cache_hit, "cls_read_cache_hits"); // cls reads served from op cache
+
   logger = osd_plb.create_perf_counters();
   g_ceph_context->get_perfcounters_collection()->add(logger);
 }
@@ -1074,10 +1178,16 @@ int OSD::shutdown()
   dout(10) << "no ops" << dendl;
 
   cct->get_admin_socket()->unregister_command("dump_ops_in_flight");
+  cct->get_admin_socket()->unregister_command("dump_hot_objects");
+  cct->get_admin_socket()->unregister_command("dump_pg_memory");
   delete admin_ops_hook;
   delete historic_ops_hook;
+  delete hot_objects_hook;
+  delete pg_memory_hook;
   admin_ops_hook = NULL;
   historic_ops_hook = NULL;
+  hot_objects_hook = NULL;
+  pg_memory_hook = NULL;
 
   recovery_tp.stop();
   dout(10) << "recovery tp stopped" << dendl;
@@ -1159,6 +1269,7 @@ int OSD::shutdown()
   cluster_messenger->shutdown();
   hbclient_messenger->shutdown();
   hbserver_messenger->shutdown();
+  objecter_messenger->shutdown();
 
   monc->shutdown();
 
@@ -1582,8 +1693,14 @@ void OSD::build_past_intervals_parallel()
  * look up a pg.  if we have it, great.  if not, consider creating it IF the pg mapping
  * hasn't changed since the given epoch and we are the primary.
  */
+/*
+ * On creation, the new pg's transaction is queued immediately but any
+ * peering messages are left in rctx so the caller can send them for
+ * all pgs named in a message at once.
+ */
 PG *OSD::get_or_create_pg(const pg_info_t& info, pg_interval_map_t& pi,
-			  epoch_t epoch, int from, int& created, bool primary)
+			  epoch_t epoch, int from, int& created, bool primary,
+			  PG::RecoveryCtx *rctx)
 {
   PG *pg;
 
@@ -1628,14 +1745,13 @@ PG *OSD::get_or_create_pg(const pg_info_t& info, pg_interval_map_t& pi,
     }
 
     // ok, create PG locally using provided Info and History
-    PG::RecoveryCtx rctx = create_context();
     pg = _create_lock_pg(
       get_map(epoch),
       info.pgid, create, false, role, up, acting, history, pi,
-      *rctx.transaction);
-    pg->handle_create(&rctx);
-    pg->write_if_dirty(*rctx.transaction);
-    dispatch_context(rctx, pg, osdmap);
+      *rctx->transaction);
+    pg->handle_create(rctx);
+    pg->write_if_dirty(*rctx->transaction);
+    dispatch_context_transaction(*rctx, pg);
       
     created++;
     dout(10) << *pg << " is new" << dendl;
@@ -2676,6 +2792,35 @@ void OSD::handle_command(MCommand *m)
   m->put();
 }
 
+size_t OSD::dump_pg_memory(Formatter *f)
+{
+  assert(osd_lock.is_locked());
+  size_t total = 0;
+  f->open_object_section("pg_memory");
+  f->open_array_section("pgs");
+  for (hash_map<pg_t, PG*>::iterator p = pg_map.begin();
+       p != pg_map.end();
+       ++p) {
+    PG *pg = p->second;
+    pg->lock();
+    f->open_object_section("pg");
+    f->dump_stream("pgid") << pg->info.pgid;
+    pg->dump_memory_usage(f);
+    total += pg->log.approx_mem_usage() + pg->missing.approx_mem_usage();
+    for (map<int,pg_missing_t>::iterator q = pg->peer_missing.begin();
+	 q != pg->peer_missing.end();
+	 ++q)
+      total += q->second.approx_mem_usage();
+    f->close_section();
+    pg->unlock();
+  }
+  f->close_section();
+  f->dump_unsigned("num_pgs", pg_map.size());
+  f->dump_unsigned("total_bytes", total);
+  f->close_section();
+  return total;
+}
+
 void OSD::do_command(Connection *con, tid_t tid, vector<string>& cmd, bufferlist& data)
 {
   int r = 0;
@@ -2845,6 +2990,15 @@ void OSD::do_command(Connection *con, tid_t tid, vector<string>& cmd, bufferlist
     pg_recovery_stats.reset();
   }
 
+  else if (cmd[0] == "dump_pg_memory") {
+    JSONFormatter jf(true);
+    size_t total = dump_pg_memory(&jf);
+    stringstream dss;
+    jf.flush(dss);
+    odata.append(dss);
+    ss << "dump pg memory: " << pg_map.size() << " pgs, " << total << " bytes";
+  }
+
   else {
     ss << "unrecognized command! " << cmd;
     r = -EINVAL;
@@ -3256,6 +3410,10 @@ void OSD::_dispatch(Message *m)
     handle_rep_scrub((MOSDRepScrub*)m);
     break;    
 
+  case CEPH_MSG_OSD_OP_BATCH:
+    handle_op_batch((MOSDOpBatch*)m);
+    break;
+
     // -- need OSDMap --
 
   default:
@@ -3278,6 +3436,21 @@ void OSD::_dispatch(Message *m)
 
 }
 
+/*
+ * a client packed several ops into one message.  unpack them and
+ * handle each as if it had arrived on its own; they reply
+ * individually over the same connection.
+ */
+void OSD::handle_op_batch(MOSDOpBatch *m)
+{
+  dout(10) << "handle_op_batch " << *m << " from " << m->get_source() << dendl;
+  vector<MOSDOp*> ops;
+  m->claim_ops(&ops);
+  for (vector<MOSDOp*>::iterator p = ops.begin(); p != ops.end(); ++p)
+    _dispatch(*p);
+  m->put();
+}
+
 void OSD::handle_rep_scrub(MOSDRepScrub *m)
 {
   dout(10) << "queueing MOSDRepScrub " << *m << dendl;
@@ -3335,6 +3508,40 @@ void OSD::handle_scrub(MOSDScrub *m)
   m->put();
 }
 
+struct hotter_t {
+  bool operator()(const pair<hobject_t, ObjectHeat::entry_t> &l,
+		  const pair<hobject_t, ObjectHeat::entry_t> &r) const {
+    return l.second.heat() > r.second.heat();
+  }
+};
+
+void OSDService::dump_heat(Formatter *f, unsigned n)
+{
+  vector<pair<hobject_t, ObjectHeat::entry_t> > v;
+  {
+    Mutex::Locker l(heat_lock);
+    for (map<pg_t, list<pair<hobject_t, ObjectHeat::entry_t> > >::iterator p = pg_heat.begin();
+	 p != pg_heat.end();
+	 ++p)
+      v.insert(v.end(), p->second.begin(), p->second.end());
+  }
+  sort(v.begin(), v.end(), hotter_t());
+  if (v.size() > n)
+    v.resize(n);
+
+  f->open_array_section("hot_objects");
+  for (unsigned i = 0; i < v.size(); ++i) {
+    f->open_object_section("object");
+    f->dump_int("pool", v[i].first.pool);
+    f->dump_string("oid", v[i].first.oid.name);
+    if (v[i].first.get_key().length())
+      f->dump_string("key", v[i].first.get_key());
+    v[i].second.dump(f);
+    f->close_section();
+  }
+  f->close_section();
+}
+
 bool OSDService::scrub_should_schedule()
 {
   double loadavgs[1];
@@ -3570,10 +3777,8 @@ void OSD::handle_osd_map(MOSDMap *m)
 
       OSDMap *o = new OSDMap;
       if (e > 1) {
-	bufferlist obl;
 	OSDMapRef prev = get_map(e - 1);
-	prev->encode(obl);
-	o->decode(obl);
+	o->deepish_copy_from(*prev);
       }
 
       OSDMap::Incremental inc;
@@ -3930,6 +4135,8 @@ void OSD::activate_map()
   to_remove.clear();
 
   service.publish_map(osdmap);
+  share_map_with_objecter();
+  update_op_qos();
 
   // scan pg's
   for (hash_map<pg_t,PG*>::iterator it = pg_map.begin();
@@ -3999,6 +4206,61 @@ MOSDMap *OSD::build_incremental_map_msg(epoch_t since, epoch_t to)
   return m;
 }
 
+void OSD::share_map_with_objecter()
+{
+  Mutex::Locker l(service.objecter_lock);
+  epoch_t have = service.objecter_osdmap.get_epoch();
+  epoch_t e = osdmap->get_epoch();
+  if (have >= e)
+    return;
+  dout(15) << "share_map_with_objecter " << have << " -> " << e << dendl;
+  MOSDMap *m;
+  if (have) {
+    m = build_incremental_map_msg(have, e);
+  } else {
+    m = new MOSDMap(monc->get_fsid());
+    m->oldest_map = superblock.oldest_map;
+    m->newest_map = superblock.newest_map;
+    get_map_bl(e, m->maps[e]);
+  }
+  service.objecter->handle_osd_map(m);
+}
+
+bool OSD::ObjecterDispatcher::ms_dispatch(Message *m)
+{
+  switch (m->get_type()) {
+  case CEPH_MSG_OSD_OPREPLY:
+    // the objecter does its own locking for replies
+    osd->service.objecter->handle_osd_op_reply((MOSDOpReply*)m);
+    return true;
+  case CEPH_MSG_OSD_MAP:
+    // other osds share newer maps with their clients; we only move the
+    // objecter along as we ourselves catch up (see activate_map)
+    m->put();
+    return true;
+  }
+  return false;
+}
+
+void OSD::ObjecterDispatcher::ms_handle_connect(Connection *con)
+{
+  Mutex::Locker l(osd->service.objecter_lock);
+  osd->service.objecter->ms_handle_connect(con);
+}
+
+bool OSD::ObjecterDispatcher::ms_handle_reset(Connection *con)
+{
+  Mutex::Locker l(osd->service.objecter_lock);
+  osd->service.objecter->ms_handle_reset(con);
+  return false;
+}
+
+void OSD::ObjecterDispatcher::ms_handle_remote_reset(Connection *con)
+{
+  Mutex::Locker l(osd->service.objecter_lock);
+  osd->service.objecter->ms_handle_remote_reset(con);
+}
+
 void OSD::send_map(MOSDMap *m, const entity_inst_t& inst, bool lazy)
 {
   Messenger *msgr = client_messenger;
@@ -4418,6 +4680,7 @@ void OSD::handle_pg_create(OpRequestRef op)
 
   int num_created = 0;
 
+  PG::RecoveryCtx rctx = create_context();
   for (map<pg_t,pg_create_t>::iterator p = m->mkpg.begin();
        p != m->mkpg.end();
        p++) {
@@ -4482,7 +4745,6 @@ void OSD::handle_pg_create(OpRequestRef op)
     calc_priors_during(pgid, created, history.same_interval_since, 
 		       creating_pgs[pgid].prior);
 
-    PG::RecoveryCtx rctx = create_context();
     // poll priors
     set<int>& pset = creating_pgs[pgid].prior;
     dout(10) << "mkpg " << pgid << " e" << created
@@ -4505,12 +4767,13 @@ void OSD::handle_pg_create(OpRequestRef op)
       wake_pg_waiters(pg->info.pgid);
       pg->handle_create(&rctx);
       pg->write_if_dirty(*rctx.transaction);
+      dispatch_context_transaction(rctx, pg);
       pg->update_stats();
       pg->unlock();
       num_created++;
     }
-    dispatch_context(rctx, pg, osdmap);
   }
+  dispatch_context(rctx, 0, osdmap);
 
   maybe_update_heartbeat_peers();
 }
@@ -4709,6 +4972,7 @@ void OSD::handle_pg_notify(OpRequestRef op)
 
   op->mark_started();
 
+  PG::RecoveryCtx rctx = create_context();
   for (vector<pair<pg_notify_t, pg_interval_map_t> >::iterator it = m->get_pg_list().begin();
        it != m->get_pg_list().end();
        it++) {
@@ -4721,12 +4985,13 @@ void OSD::handle_pg_notify(OpRequestRef op)
 
     int created = 0;
     pg = get_or_create_pg(it->first.info, it->second,
-			  it->first.query_epoch, from, created, true);
+			  it->first.query_epoch, from, created, true, &rctx);
     if (!pg)
       continue;
     pg->queue_notify(it->first.epoch_sent, it->first.query_epoch, from, it->first);
     pg->unlock();
   }
+  dispatch_context(rctx, 0, osdmap);
 }
 
 void OSD::handle_pg_log(OpRequestRef op)
@@ -4747,13 +5012,15 @@ void OSD::handle_pg_log(OpRequestRef op)
   }
 
   int created = 0;
+  PG::RecoveryCtx rctx = create_context();
   PG *pg = get_or_create_pg(m->info, m->past_intervals, m->get_epoch(), 
-			    from, created, false);
-  if (!pg)
-    return;
-  op->mark_started();
-  pg->queue_log(m->get_epoch(), m->get_query_epoch(), from, m);
-  pg->unlock();
+			    from, created, false, &rctx);
+  if (pg) {
+    op->mark_started();
+    pg->queue_log(m->get_epoch(), m->get_query_epoch(), from, m);
+    pg->unlock();
+  }
+  dispatch_context(rctx, 0, osdmap);
 }
 
 void OSD::handle_pg_info(OpRequestRef op)
@@ -4772,6 +5039,7 @@ void OSD::handle_pg_info(OpRequestRef op)
 
   int created = 0;
 
+  PG::RecoveryCtx rctx = create_context();
   for (vector<pair<pg_notify_t,pg_interval_map_t> >::iterator p = m->pg_list.begin();
        p != m->pg_list.end();
        ++p) {
@@ -4781,13 +5049,14 @@ void OSD::handle_pg_info(OpRequestRef op)
     }
 
     PG *pg = get_or_create_pg(p->first.info, p->second, p->first.epoch_sent,
-			      from, created, false);
+			      from, created, false, &rctx);
     if (!pg)
       continue;
     pg->queue_info(p->first.epoch_sent, p->first.query_epoch, from,
 		   p->first.info);
     pg->unlock();
   }
+  dispatch_context(rctx, 0, osdmap);
 }
 
 void OSD::handle_pg_trim(OpRequestRef op)
@@ -5135,6 +5404,7 @@ void OSD::_remove_pg(PG *pg)
   pg->put(); // since we've taken it out of map
 
   service.unreg_last_pg_scrub(pg->info.pgid, pg->info.history.last_scrub_stamp);
+  service.clear_heat(pg->info.pgid);
 }
 
 
@@ -5557,23 +5827,67 @@ void OSD::enqueue_op(PG *pg, OpRequestRef op)
 bool OSD::OpWQ::_enqueue(PG *pg)
 {
   pg->get();
-  osd->op_queue.push_back(pg);
-  osd->op_queue_len++;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
+  int64_t pool = g_conf->osd_op_queue_qos ? pg->info.pgid.pool() : -1;
+  osd->op_queue.enqueue(pool, pg, (double)ceph_clock_now(g_ceph_context));
+  osd->logger->set(l_osd_opq, osd->op_queue.length());
   return true;
 }
 
+void OSD::OpWQ::_dequeue(PG *pg)
+{
+  list<PG*> removed;
+  osd->op_queue.remove(pg, &removed);
+  for (list<PG*>::iterator i = removed.begin(); i != removed.end(); ++i)
+    (*i)->put();
+  osd->logger->set(l_osd_opq, osd->op_queue.length());
+}
+
 PG *OSD::OpWQ::_dequeue()
 {
-  if (osd->op_queue.empty())
+  utime_t now = ceph_clock_now(g_ceph_context);
+  PG *pg;
+  mClockQueue<PG*, int64_t>::phase_t phase;
+  double arrival;
+  if (!osd->op_queue.dequeue((double)now, &pg, &phase, &arrival))
     return NULL;
-  PG *pg = osd->op_queue.front();
-  osd->op_queue.pop_front();
-  osd->op_queue_len--;
-  osd->logger->set(l_osd_opq, osd->op_queue_len);
+  osd->logger->set(l_osd_opq, osd->op_queue.length());
+  double lat = (double)now - arrival;
+  switch (phase) {
+  case mClockQueue<PG*, int64_t>::PHASE_RESERVATION:
+    osd->logger->finc(l_osd_opq_res_lat, lat);
+    break;
+  case mClockQueue<PG*, int64_t>::PHASE_WEIGHT:
+    osd->logger->finc(l_osd_opq_wgt_lat, lat);
+    break;
+  case mClockQueue<PG*, int64_t>::PHASE_LIMIT_BREAK:
+    osd->logger->finc(l_osd_opq_lb_lat, lat);
+    break;
+  }
   return pg;
 }
 
+/*
+ * push the pools' qos settings from the current map into the op
+ * queue.  called with osd_lock held.
+ */
+void OSD::update_op_qos()
+{
+  set<int64_t> pools;
+  op_wq.lock();
+  const map<int64_t,pg_pool_t> &pm = osdmap->get_pools();
+  for (map<int64_t,pg_pool_t>::const_iterator p = pm.begin();
+       p != pm.end();
+       ++p) {
+    const pg_pool_t &pi = p->second;
+    op_queue.set_client_info(p->first, pi.qos_reservation, pi.qos_weight,
+			     pi.qos_limit);
+    pools.insert(p->first);
+  }
+  pools.insert(-1);  // osd_op_queue_qos = false
+  op_queue.trim_clients(pools);
+  op_wq.unlock();
+}
+
 void OSDService::queue_for_peering(PG *pg)
 {
   peering_wq.queue(pg);
@@ -5590,11 +5904,13 @@ void OSD::process_peering_events(const list<PG*> &pgs)
   epoch_t same_interval_since = 0;
   OSDMapRef curmap = service.get_osdmap();
   PG::RecoveryCtx rctx = create_context();
+  logger->inc(l_osd_peering_batch, pgs.size());
   for (list<PG*>::const_iterator i = pgs.begin();
        i != pgs.end();
        ++i) {
     PG *pg = *i;
     pg->lock();
+    utime_t start = ceph_clock_now(g_ceph_context);
     curmap = service.get_osdmap();
     if (pg->deleting) {
       pg->unlock();
@@ -5605,6 +5921,7 @@ void OSD::process_peering_events(const list<PG*> &pgs)
       PG::CephPeeringEvtRef evt = pg->peering_queue.front();
       pg->peering_queue.pop_front();
       pg->handle_peering_event(evt, &rctx);
+      logger->inc(l_osd_peering_evt);
     }
     need_up_thru = pg->need_up_thru || need_up_thru;
     same_interval_since = MAX(pg->info.history.same_interval_since,
@@ -5612,9 +5929,13 @@ void OSD::process_peering_events(const list<PG*> &pgs)
     pg->write_if_dirty(*rctx.transaction);
     dispatch_context_transaction(rctx, pg);
     pg->unlock();
+    logger->finc(l_osd_peering_lat,
+		 (double)(ceph_clock_now(g_ceph_context) - start));
   }
   if (need_up_thru)
     queue_want_up_thru(same_interval_since);
+  // notifies/queries/infos for the whole batch go out here, one
+  // message per peer, rather than one per pg
   dispatch_context(rctx, 0, curmap);
 
   service.send_pg_temp();
@@ -5691,11 +6012,11 @@ int OSD::init_op_flags(MOSDOp *op)
 	bp.copy(iter->op.cls.class_len, cname);
 	bp.copy(iter->op.cls.method_len, mname);
 
-	ClassHandler::ClassData *cls;
-	int r = class_handler->open_class(cname, &cls);
+	ClassHandler::ClassMethod *method;
+	int r = class_handler->open_method(cname, mname, &method);
 	if (r)
 	  return r;
-	int flags = cls->get_method_flags(mname.c_str());
+	int flags = method ? method->get_flags() : 0;
 	is_read = flags & CLS_METHOD_RD;
 	is_write = flags & CLS_METHOD_WR;
 
@@ -53,6 +53,7 @@ using namespace __gnu_cxx;
 #include "common/shared_cache.hpp"
 #include "common/simple_cache.hpp"
 #include "common/sharedptr_registry.hpp"
+#include "common/mClockQueue.h"
 
 #define CEPH_OSD_PROTOCOL    10 /* cluster internal */
 
@@ -60,6 +61,9 @@ using namespace __gnu_cxx;
 enum {
   l_osd_first = 10000,
   l_osd_opq,
+  l_osd_opq_res_lat,
+  l_osd_opq_wgt_lat,
+  l_osd_opq_lb_lat,
   l_osd_op_wip,
   l_osd_op,
   l_osd_op_inb,
@@ -68,6 +72,8 @@ enum {
   l_osd_op_r,
   l_osd_op_r_outb,
   l_osd_op_r_lat,
+  l_osd_op_r_replica,
+  l_osd_op_r_replica_eagain,
   l_osd_op_w,
   l_osd_op_w_inb,
   l_osd_op_w_rlat,
@@ -112,6 +118,12 @@ enum {
   l_osd_mape,
   l_osd_mape_dup,
 
+  l_osd_peering_evt,
+  l_osd_peering_batch,
+  l_osd_peering_lat,
+
+  l_osd_cls_cache_hit,
+
   l_osd_last,
 };
 
@@ -124,6 +136,7 @@ class OSDMap;
 class MLog;
 class MClass;
 class MOSDPGMissing;
+class Objecter;
 
 class Watch;
 class Notification;
@@ -132,7 +145,9 @@ class ReplicatedPG;
 class AuthAuthorizeHandlerRegistry;
 
 class OpsFlightSocketHook;
+class HotObjectsSocketHook;
 class HistoricOpsSocketHook;
+class PgMemorySocketHook;
 
 extern const coll_t meta_coll;
 
@@ -170,6 +185,7 @@ public:
   PGRecoveryStats &pg_recovery_stats;
   Messenger *&cluster_messenger;
   Messenger *&client_messenger;
+  Messenger *&objecter_messenger;
   PerfCounters *&logger;
   MonClient   *&monc;
   ThreadPool::WorkQueue<PG> &op_wq;
@@ -204,6 +220,25 @@ public:
 
   int get_nodeid() const { return whoami; }
 
+  // -- object heat --
+  /// each pg's hottest objects as of its last persist, for reporting
+  /// without taking osd_lock or any pg lock
+  Mutex heat_lock;
+  map<pg_t, list<pair<hobject_t, ObjectHeat::entry_t> > > pg_heat;
+
+  void publish_heat(pg_t pgid, const list<pair<hobject_t, ObjectHeat::entry_t> > &top) {
+    Mutex::Locker l(heat_lock);
+    if (top.empty())
+      pg_heat.erase(pgid);
+    else
+      pg_heat[pgid] = top;
+  }
+  void clear_heat(pg_t pgid) {
+    Mutex::Locker l(heat_lock);
+    pg_heat.erase(pgid);
+  }
+  void dump_heat(Formatter *f, unsigned n);
+
   // -- scrub scheduling --
   Mutex sched_scrub_lock;
   int scrubs_pending;
@@ -263,6 +298,19 @@ public:
     return t;
   }
 
+  // -- objecter --
+  /*
+   * for ops we send to other osds as if we were a client (copy-from).
+   * it is kept on our own map by OSD::share_map_with_objecter(), and
+   * completions go through objecter_finisher so that they are free to
+   * take pg locks.  lock order: osd_lock, then objecter_lock.
+   */
+  Mutex objecter_lock;
+  SafeTimer objecter_timer;
+  OSDMap objecter_osdmap;
+  Objecter *objecter;
+  Finisher objecter_finisher;
+
   // -- backfill_reservation --
   Finisher reserver_finisher;
   AsyncReserver<pg_t> local_reserver;
@@ -332,6 +380,7 @@ public:
   void shutdown();
 
   OSDService(OSD *osd);
+  ~OSDService();
 };
 class OSD : public Dispatcher {
   /** OSD **/
@@ -344,6 +393,7 @@ protected:
 
   Messenger   *cluster_messenger;
   Messenger   *client_messenger;
+  Messenger   *objecter_messenger;
   MonClient   *monc;
   PerfCounters      *logger;
   ObjectStore *store;
@@ -526,6 +576,25 @@ public:
     }
   } heartbeat_dispatcher;
 
+  struct ObjecterDispatcher : public Dispatcher {
+  private:
+    bool ms_dispatch(Message *m);
+    void ms_handle_connect(Connection *con);
+    bool ms_handle_reset(Connection *con);
+    void ms_handle_remote_reset(Connection *con);
+    bool ms_get_authorizer(int dest_type, AuthAuthorizer **a, bool force_new) {
+      return osd->ms_get_authorizer(dest_type, a, force_new);
+    }
+  public:
+    OSD *osd;
+    ObjecterDispatcher(OSD *o)
+      : Dispatcher(g_ceph_context), osd(o)
+    {
+    }
+  } objecter_dispatcher;
+
+  void share_map_with_objecter();
+
 
 private:
   // -- stats --
@@ -559,12 +628,22 @@ private:
   }
   friend class OpsFlightSocketHook;
   friend class HistoricOpsSocketHook;
+  friend class PgMemorySocketHook;
   OpsFlightSocketHook *admin_ops_hook;
   HistoricOpsSocketHook *historic_ops_hook;
+  HotObjectsSocketHook *hot_objects_hook;
+  PgMemorySocketHook *pg_memory_hook;
+
+  /// per-pg log/missing memory; returns the total.  osd_lock held.
+  size_t dump_pg_memory(Formatter *f);
 
   // -- op queue --
-  list<PG*> op_queue;
-  int op_queue_len;
+  /*
+   * One entry per queued op, keyed by pool, so that pools share the op
+   * threads according to their qos_reservation/weight/limit.  The ops
+   * themselves stay in each PG's own FIFO.
+   */
+  mClockQueue<PG*, int64_t> op_queue;
 
   struct OpWQ : public ThreadPool::WorkQueue<PG> {
     OSD *osd;
@@ -572,18 +651,7 @@ private:
       : ThreadPool::WorkQueue<PG>("OSD::OpWQ", ti, ti*10, tp), osd(o) {}
 
     bool _enqueue(PG *pg);
-    void _dequeue(PG *pg) {
-      for (list<PG*>::iterator i = osd->op_queue.begin();
-	   i != osd->op_queue.end();
-	   ) {
-	if (*i == pg) {
-	  osd->op_queue.erase(i++);
-	  pg->put();
-	} else {
-	  ++i;
-	}
-      }
-    }
+    void _dequeue(PG *pg);
     bool _empty() {
       return osd->op_queue.empty();
     }
@@ -597,6 +665,7 @@ private:
   } op_wq;
 
   void enqueue_op(PG *pg, OpRequestRef op);
+  void update_op_qos();
   void dequeue_op(PG *pg);
   static void static_dequeueop(OSD *o, PG *pg) {
     o->dequeue_op(pg);
@@ -637,7 +706,9 @@ private:
       for (list<PG*>::iterator i = peering_queue.begin();
 	   i != peering_queue.end() && out->size() < batch_size;
 	   ) {
-	if (in_use.count(*i)) {
+	if (in_use.count(*i) || got.count(*i)) {
+	  // another worker (or this batch) already owns the pg; its
+	  // remaining events stay queued so they are handled in order
 	  ++i;
 	} else {
 	  out->push_back(*i);
@@ -767,7 +838,7 @@ protected:
   PG *get_or_create_pg(const pg_info_t& info,
 		       pg_interval_map_t& pi,
 		       epoch_t epoch, int from, int& pcreated,
-		       bool primary);
+		       bool primary, PG::RecoveryCtx *rctx);
   
   void load_pgs();
   void build_past_intervals_parallel();
@@ -1287,6 +1358,7 @@ protected:
   /* internal and external can point to the same messenger, they will still
    * be cleaned up properly*/
   OSD(int id, Messenger *internal, Messenger *external, Messenger *hbmin, Messenger *hbmout,
+      Messenger *objecterm,
       MonClient *mc, const std::string &dev, const std::string &jdev);
   ~OSD();
 
@@ -1338,6 +1410,7 @@ public:
   void handle_scrub(class MOSDScrub *m);
   void handle_osd_ping(class MOSDPing *m);
   void handle_op(OpRequestRef op);
+  void handle_op_batch(class MOSDOpBatch *m);
   void handle_sub_op(OpRequestRef op);
   void handle_sub_op_reply(OpRequestRef op);
 
@@ -652,6 +652,14 @@ bool OSDMap::find_osd_on_ip(const entity_addr_t& ip) const
   return -1;
 }
 
+void OSDMap::deepish_copy_from(const OSDMap& o)
+{
+  *this = o;
+  osd_addrs.reset(new addrs_s(*o.osd_addrs));
+  pg_temp.reset(new map<pg_t,vector<int> >(*o.pg_temp));
+  osd_uuid.reset(new vector<uuid_d>(*o.osd_uuid));
+}
+
 void OSDMap::dedup(const OSDMap *o, OSDMap *n)
 {
   if (o->epoch == n->epoch)
@@ -684,12 +692,14 @@ void OSDMap::dedup(const OSDMap *o, OSDMap *n)
     n->osd_addrs = o->osd_addrs;
   }
 
-  // does crush match?
-  bufferlist oc, nc;
-  ::encode(*o->crush, oc);
-  ::encode(*n->crush, nc);
-  if (oc.contents_equal(nc)) {
-    n->crush = o->crush;
+  // does crush match?  (it is already shared if n was copied from o)
+  if (n->crush != o->crush) {
+    bufferlist oc, nc;
+    ::encode(*o->crush, oc);
+    ::encode(*n->crush, nc);
+    if (oc.contents_equal(nc)) {
+      n->crush = o->crush;
+    }
   }
 
   // does pg_temp match?
@@ -1179,10 +1189,12 @@ void OSDMap::decode(bufferlist::iterator& p)
     ::decode(*pg_temp, p);
   }
 
-  // crush
+  // crush; a fresh one, since a deepish copy shares its crush map with
+  // the map it was copied from
   bufferlist cbl;
   ::decode(cbl, p);
   bufferlist::iterator cblp = cbl.begin();
+  crush.reset(new CrushWrapper);
   crush->decode(cblp);
 
   // extended
@@ -390,6 +390,16 @@ private:
 
   int apply_incremental(Incremental &inc);
 
+  /**
+   * make this a copy of o that apply_incremental() can safely modify.
+   *
+   * the parts that are shared between cached maps (see dedup()) and
+   * modified in place by apply_incremental() are copied; the rest,
+   * including crush, which is only ever replaced, stays shared.  much
+   * cheaper than an encode/decode round trip.
+   */
+  void deepish_copy_from(const OSDMap& o);
+
   /// try to re-use/reference addrs in oldmap from newmap
   static void dedup(const OSDMap *oldmap, OSDMap *newmap);
 
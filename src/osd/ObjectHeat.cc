@@ -0,0 +1,267 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "ObjectHeat.h"
+#include "common/Formatter.h"
+#include "include/encoding.h"
+#include "include/hash.h"
+
+// -- ObjectHeat::entry_t --
+
+void ObjectHeat::entry_t::encode(bufferlist &bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(reads, bl);
+  ::encode(writes, bl);
+  ENCODE_FINISH(bl);
+}
+
+void ObjectHeat::entry_t::decode(bufferlist::iterator &bl)
+{
+  DECODE_START(1, bl);
+  ::decode(reads, bl);
+  ::decode(writes, bl);
+  DECODE_FINISH(bl);
+}
+
+void ObjectHeat::entry_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("reads", reads);
+  f->dump_unsigned("writes", writes);
+}
+
+// -- ObjectHeat --
+
+void ObjectHeat::configure(uint32_t w, uint32_t n, double hl)
+{
+  if (w != width) {
+    width = w;
+    clear();
+  }
+  top_n = n;
+  half_life = hl;
+  while (top.size() > top_n) {
+    map<hobject_t, entry_t>::iterator coldest = top.begin();
+    for (map<hobject_t, entry_t>::iterator p = top.begin(); p != top.end(); ++p)
+      if (p->second.heat() < coldest->second.heat())
+	coldest = p;
+    top.erase(coldest);
+  }
+  recalc_top_min();
+}
+
+void ObjectHeat::clear()
+{
+  rd.assign((size_t)width * DEPTH, 0);
+  wr.assign((size_t)width * DEPTH, 0);
+  top.clear();
+  top_min = 0;
+}
+
+/*
+ * one counter per row, by double hashing: row i uses h1 + i*h2.  h2 is
+ * forced odd so that rows never collapse onto the same slot.
+ */
+void ObjectHeat::hash(const hobject_t &o, uint32_t *idx) const
+{
+  uint64_t h1 = rjhash64(__gnu_cxx::hash<hobject_t>()(o) ^ o.hash);
+  uint64_t h2 = rjhash64(h1) | 1;
+  for (unsigned i = 0; i < DEPTH; i++)
+    idx[i] = i * width + (uint32_t)((h1 + i * h2) % width);
+}
+
+void ObjectHeat::recalc_top_min()
+{
+  top_min = 0;
+  if (top.size() < top_n)
+    return;
+  map<hobject_t, entry_t>::iterator p = top.begin();
+  if (p == top.end())
+    return;
+  top_min = p->second.heat();
+  for (++p; p != top.end(); ++p)
+    if (p->second.heat() < top_min)
+      top_min = p->second.heat();
+}
+
+void ObjectHeat::record(const hobject_t &o, bool read, bool write, utime_t now)
+{
+  if (!width)
+    return;
+  decay(now);
+
+  uint32_t idx[DEPTH];
+  hash(o, idx);
+  entry_t e;
+  e.reads = e.writes = (uint32_t)-1;
+  for (unsigned i = 0; i < DEPTH; i++) {
+    uint32_t &r = rd[idx[i]];
+    uint32_t &w = wr[idx[i]];
+    if (read && r != (uint32_t)-1)
+      r++;
+    if (write && w != (uint32_t)-1)
+      w++;
+    e.reads = MIN(e.reads, r);
+    e.writes = MIN(e.writes, w);
+  }
+
+  if (!top_n)
+    return;
+  map<hobject_t, entry_t>::iterator p = top.find(o);
+  if (p != top.end()) {
+    bool was_min = p->second.heat() == top_min;
+    p->second = e;
+    if (was_min)
+      recalc_top_min();
+    return;
+  }
+  if (top.size() < top_n) {
+    top[o] = e;
+    recalc_top_min();
+    return;
+  }
+  if (e.heat() <= top_min)
+    return;
+
+  // displace the coldest
+  for (p = top.begin(); p != top.end(); ++p) {
+    if (p->second.heat() == top_min) {
+      top.erase(p);
+      break;
+    }
+  }
+  top[o] = e;
+  recalc_top_min();
+}
+
+void ObjectHeat::decay(utime_t now)
+{
+  if (half_life <= 0)
+    return;
+  if (last_decay == utime_t()) {
+    last_decay = now;
+    return;
+  }
+  double elapsed = (double)now - (double)last_decay;
+  if (elapsed < half_life)
+    return;
+  unsigned n = (unsigned)(elapsed / half_life);
+  last_decay += half_life * n;
+  if (n >= 32) {
+    clear();
+    return;
+  }
+  for (vector<uint32_t>::iterator p = rd.begin(); p != rd.end(); ++p)
+    *p >>= n;
+  for (vector<uint32_t>::iterator p = wr.begin(); p != wr.end(); ++p)
+    *p >>= n;
+  map<hobject_t, entry_t>::iterator p = top.begin();
+  while (p != top.end()) {
+    p->second.reads >>= n;
+    p->second.writes >>= n;
+    if (p->second.heat() == 0)
+      top.erase(p++);
+    else
+      ++p;
+  }
+  recalc_top_min();
+}
+
+ObjectHeat::entry_t ObjectHeat::estimate(const hobject_t &o) const
+{
+  entry_t e;
+  if (!width)
+    return e;
+  uint32_t idx[DEPTH];
+  hash(o, idx);
+  e.reads = e.writes = (uint32_t)-1;
+  for (unsigned i = 0; i < DEPTH; i++) {
+    e.reads = MIN(e.reads, rd[idx[i]]);
+    e.writes = MIN(e.writes, wr[idx[i]]);
+  }
+  return e;
+}
+
+struct heat_cmp {
+  bool operator()(const pair<hobject_t, ObjectHeat::entry_t> &l,
+		  const pair<hobject_t, ObjectHeat::entry_t> &r) const {
+    return l.second.heat() > r.second.heat();
+  }
+};
+
+void ObjectHeat::get_top(unsigned n, list<pair<hobject_t, entry_t> > *out) const
+{
+  vector<pair<hobject_t, entry_t> > v(top.begin(), top.end());
+  sort(v.begin(), v.end(), heat_cmp());
+  if (v.size() > n)
+    v.resize(n);
+  out->insert(out->end(), v.begin(), v.end());
+}
+
+size_t ObjectHeat::get_mem_usage() const
+{
+  return (rd.capacity() + wr.capacity()) * sizeof(uint32_t) +
+    top.size() * (sizeof(hobject_t) + sizeof(entry_t) + 4 * sizeof(void*));
+}
+
+void ObjectHeat::encode(bufferlist &bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(width, bl);
+  ::encode(rd, bl);
+  ::encode(wr, bl);
+  ::encode(top, bl);
+  ::encode(last_decay, bl);
+  ENCODE_FINISH(bl);
+}
+
+void ObjectHeat::decode(bufferlist::iterator &bl)
+{
+  DECODE_START(1, bl);
+  ::decode(width, bl);
+  ::decode(rd, bl);
+  ::decode(wr, bl);
+  ::decode(top, bl);
+  ::decode(last_decay, bl);
+  DECODE_FINISH(bl);
+  recalc_top_min();
+}
+
+void ObjectHeat::dump(Formatter *f) const
+{
+  f->dump_unsigned("width", width);
+  f->dump_unsigned("depth", DEPTH);
+  f->dump_float("half_life", half_life);
+  f->dump_stream("last_decay") << last_decay;
+  f->dump_unsigned("mem_usage", get_mem_usage());
+  list<pair<hobject_t, entry_t> > ls;
+  get_top(top.size(), &ls);
+  f->open_array_section("top");
+  for (list<pair<hobject_t, entry_t> >::iterator p = ls.begin(); p != ls.end(); ++p) {
+    f->open_object_section("object");
+    f->dump_stream("oid") << p->first;
+    p->second.dump(f);
+    f->close_section();
+  }
+  f->close_section();
+}
+
+void ObjectHeat::generate_test_instances(list<ObjectHeat*>& o)
+{
+  o.push_back(new ObjectHeat);
+  o.push_back(new ObjectHeat);
+  o.back()->configure(8, 2, 0);
+  o.back()->record(hobject_t(object_t("foo"), "", CEPH_NOSNAP, 1, 0),
+		   true, false, utime_t(1, 0));
+  o.back()->record(hobject_t(object_t("bar"), "", CEPH_NOSNAP, 2, 0),
+		   false, true, utime_t(1, 0));
+}
@@ -0,0 +1,90 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_OSD_OBJECTHEAT_H
+#define CEPH_OSD_OBJECTHEAT_H
+
+#include "include/types.h"
+#include "include/utime.h"
+#include "os/hobject.h"
+
+namespace ceph {
+  class Formatter;
+}
+
+/**
+ * ObjectHeat - bounded-memory estimate of per-object access frequency
+ *
+ * Reads and writes are counted in a pair of count-min sketches
+ * (DEPTH rows of `width` counters each), so memory does not grow with
+ * the number of objects touched, and estimates only ever err high.
+ * Alongside the sketch we keep the `top_n` hottest objects seen so
+ * far by estimated reads+writes.
+ *
+ * Counts decay: every `half_life` seconds all counters are halved, so
+ * the numbers reflect recent activity rather than the lifetime of the
+ * pg.
+ */
+class ObjectHeat {
+public:
+  static const unsigned DEPTH = 4;
+
+  struct entry_t {
+    uint32_t reads, writes;
+    entry_t() : reads(0), writes(0) {}
+    uint64_t heat() const {
+      return (uint64_t)reads + writes;
+    }
+    void encode(bufferlist &bl) const;
+    void decode(bufferlist::iterator &bl);
+    void dump(Formatter *f) const;
+  };
+
+private:
+  uint32_t width;
+  vector<uint32_t> rd, wr;   ///< DEPTH * width counters each
+  map<hobject_t, entry_t> top;
+  uint32_t top_n;
+  uint64_t top_min;          ///< coldest heat in top, if full
+  double half_life;
+  utime_t last_decay;
+
+  void hash(const hobject_t &o, uint32_t *idx) const;
+  void recalc_top_min();
+
+public:
+  ObjectHeat() : width(0), top_n(0), top_min(0), half_life(0) {}
+
+  /// (re)size; drops all state if the sketch width changes
+  void configure(uint32_t width, uint32_t top_n, double half_life);
+  bool enabled() const {
+    return width > 0;
+  }
+  void clear();
+
+  void record(const hobject_t &o, bool read, bool write, utime_t now);
+  void decay(utime_t now);
+  entry_t estimate(const hobject_t &o) const;
+  /// up to n hottest objects, hottest first
+  void get_top(unsigned n, list<pair<hobject_t, entry_t> > *out) const;
+
+  size_t get_mem_usage() const;
+
+  void encode(bufferlist &bl) const;
+  void decode(bufferlist::iterator &bl);
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<ObjectHeat*>& o);
+};
+WRITE_CLASS_ENCODER(ObjectHeat::entry_t)
+WRITE_CLASS_ENCODER(ObjectHeat)
+
+#endif
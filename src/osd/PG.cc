@@ -18,6 +18,7 @@
 #include "OpRequest.h"
 
 #include "common/Timer.h"
+#include "common/perf_counters.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDPGNotify.h"
@@ -85,6 +86,8 @@ PG::PG(OSDService *o, OSDMapRef curmap,
   active_pushes(0),
   recovery_state(this)
 {
+  heat.configure(g_conf->osd_heat_sketch_width, g_conf->osd_heat_top_n,
+		 g_conf->osd_heat_half_life);
 }
 
 PG::~PG()
@@ -159,6 +162,45 @@ void PG::IndexedLog::trim(ObjectStore::Transaction& t, eversion_t s)
     tail = s;
 }
 
+void PG::IndexedLog::rewind_divergent(eversion_t newhead,
+				      list<pg_log_entry_t> *divergent)
+{
+  list<pg_log_entry_t>::iterator p = log.end();
+  while (true) {
+    if (p == log.begin()) {
+      // yikes, the whole thing is divergent!
+      divergent->swap(log);
+      break;
+    }
+    --p;
+    if (p->version == newhead) {
+      ++p;
+      divergent->splice(divergent->begin(), log, p, log.end());
+      break;
+    }
+    assert(p->version > newhead);
+    generic_dout(10) << "rewind_divergent_log future divergent " << *p << dendl;
+    unindex(*p);
+  }
+
+  head = newhead;
+}
+
+size_t PG::IndexedLog::approx_mem_usage() const
+{
+  // list node: prev/next + entry; the index keys share the entry's
+  // soid/reqid, so each index slot is just a hash node (next, key, value)
+  size_t r = 0;
+  for (list<pg_log_entry_t>::const_iterator p = log.begin();
+       p != log.end();
+       ++p)
+    r += 2 * sizeof(void*) + sizeof(*p) + hobject_heap_bytes(p->soid) +
+      p->snaps.length();
+  r += (objects.size() + caller_ops.size()) * 3 * sizeof(void*);
+  r += (objects.bucket_count() + caller_ops.bucket_count()) * sizeof(void*);
+  return r;
+}
+
 /********* PG **********/
 
 void PG::proc_master_log(ObjectStore::Transaction& t, pg_info_t &oinfo, pg_log_t &olog, pg_missing_t& omissing, int from)
@@ -216,13 +258,13 @@ void PG::proc_replica_log(ObjectStore::Transaction& t,
     if (oe.version <= log.tail)
       break;
 
-    if (!log.objects.count(oe.soid)) {
+    if (!log.logged_object(oe.soid)) {
       dout(10) << " had " << oe << " new dne : divergent, ignoring" << dendl;
       ++pp;
       continue;
     }
       
-    pg_log_entry_t& ne = *log.objects[oe.soid];
+    pg_log_entry_t& ne = *log.get_object_entry(oe.soid);
     if (ne.version == oe.version) {
       dout(10) << " had " << oe << " new " << ne << " : match, stopping" << dendl;
       lu = pp->version;
@@ -334,8 +376,8 @@ bool PG::merge_old_entry(ObjectStore::Transaction& t, pg_log_entry_t& oe)
     dout(20) << "merge_old_entry  had " << oe << " : beyond last_backfill" << dendl;
     return false;
   }
-  if (log.objects.count(oe.soid)) {
-    pg_log_entry_t &ne = *log.objects[oe.soid];  // new(er?) entry
+  if (log.logged_object(oe.soid)) {
+    pg_log_entry_t &ne = *log.get_object_entry(oe.soid);  // new(er?) entry
     
     if (ne.version > oe.version) {
       dout(20) << "merge_old_entry  had " << oe << " new " << ne << " : older, missing" << dendl;
@@ -411,26 +453,9 @@ void PG::rewind_divergent_log(ObjectStore::Transaction& t, eversion_t newhead)
   dout(10) << "rewind_divergent_log truncate divergent future " << newhead << dendl;
   assert(newhead > log.tail);
 
-  list<pg_log_entry_t>::iterator p = log.log.end();
   list<pg_log_entry_t> divergent;
-  while (true) {
-    if (p == log.log.begin()) {
-      // yikes, the whole thing is divergent!
-      divergent.swap(log.log);
-      break;
-    }
-    --p;
-    if (p->version == newhead) {
-      ++p;
-      divergent.splice(divergent.begin(), log.log, p, log.log.end());
-      break;
-    }
-    assert(p->version > newhead);
-    dout(10) << "rewind_divergent_log future divergent " << *p << dendl;
-    log.unindex(*p);
-  }
+  log.rewind_divergent(newhead, &divergent);
 
-  log.head = newhead;
   info.last_update = newhead;
   if (info.last_complete > newhead)
     info.last_complete = newhead;
@@ -1387,7 +1412,7 @@ void PG::activate(ObjectStore::Transaction& t,
     dout(10) << "activate - not complete, " << missing << dendl;
     log.complete_to = log.log.begin();
     while (log.complete_to->version <
-	   missing.missing[missing.rmissing.begin()->second].need)
+	   missing.missing[*missing.rmissing.begin()->second].need)
       log.complete_to++;
     assert(log.complete_to != log.log.end());
     if (log.complete_to == log.log.begin()) {
@@ -1609,6 +1634,12 @@ void PG::do_request(OpRequestRef op)
   switch (op->request->get_type()) {
   case CEPH_MSG_OSD_OP:
     if (is_replay() || !is_active()) {
+      if (!is_primary() && is_replica_read((MOSDOp*)op->request)) {
+	// don't hold up a read the primary could answer now
+	osd->logger->inc(l_osd_op_r_replica_eagain);
+	osd->reply_op_error(op, -EAGAIN);
+	return;
+      }
       waiting_for_active.push_back(op);
       return;
     }
@@ -2599,6 +2630,21 @@ void PG::read_state(ObjectStore *store)
     info.stats.stats.clear();
   }
 
+  // object heat, if we have any
+  bl.clear();
+  if (store->collection_getattr(coll, "heat", bl) > 0) {
+    try {
+      p = bl.begin();
+      ::decode(heat, p);
+      heat.configure(g_conf->osd_heat_sketch_width, g_conf->osd_heat_top_n,
+		     g_conf->osd_heat_half_life);
+    }
+    catch (const buffer::error &e) {
+      dout(0) << "unable to decode heat attr, discarding: " << e.what() << dendl;
+      heat.clear();
+    }
+  }
+
   // log any weirdness
   log_weirdness();
 }
@@ -4522,6 +4568,12 @@ ostream& operator<<(ostream& out, const PG& pg)
   return out;
 }
 
+bool PG::is_replica_read(MOSDOp *m)
+{
+  return m->get_flags() & (CEPH_OSD_FLAG_BALANCE_READS |
+			   CEPH_OSD_FLAG_LOCALIZE_READS);
+}
+
 bool PG::can_discard_op(OpRequestRef op)
 {
   MOSDOp *m = (MOSDOp*)op->request;
@@ -4530,6 +4582,14 @@ bool PG::can_discard_op(OpRequestRef op)
   } else if (m->may_write() &&
 	     (!is_primary() ||
 	      !same_for_modify_since(m->get_map_epoch()))) {
+    if (!is_primary() && is_replica_read(m) &&
+	same_for_read_since(m->get_map_epoch())) {
+      // the client took it for a read (a class method that writes,
+      // say); it can retry on the primary
+      osd->logger->inc(l_osd_op_r_replica_eagain);
+      osd->reply_op_error(op, -EAGAIN);
+      return true;
+    }
     osd->handle_misdirected_op(this, op);
     return true;
   } else if (m->may_read() &&
@@ -4784,6 +4844,68 @@ void PG::handle_query_state(Formatter *f)
   recovery_state.handle_event(q, 0);
 }
 
+void PG::dump_memory_usage(Formatter *f) const
+{
+  f->dump_unsigned("log_entries", log.log.size());
+  f->dump_unsigned("log_bytes", log.approx_mem_usage());
+  f->dump_unsigned("missing", missing.num_missing());
+  f->dump_unsigned("missing_bytes", missing.approx_mem_usage());
+  unsigned peer_num = 0;
+  size_t peer_bytes = 0;
+  for (map<int,pg_missing_t>::const_iterator p = peer_missing.begin();
+       p != peer_missing.end();
+       ++p) {
+    peer_num += p->second.num_missing();
+    peer_bytes += p->second.approx_mem_usage();
+  }
+  f->dump_unsigned("peer_missing", peer_num);
+  f->dump_unsigned("peer_missing_bytes", peer_bytes);
+  f->dump_unsigned("heat_bytes", heat.get_mem_usage());
+}
+
+void PG::dump_heat(Formatter *f) const
+{
+  heat.dump(f);
+}
+
+void PG::record_heat(const hobject_t &soid, bool read, bool write)
+{
+  if (!heat.enabled())
+    return;
+  utime_t now = ceph_clock_now(g_ceph_context);
+  heat.record(soid, read, write, now);
+  if (heat_last_persist == utime_t())
+    heat_last_persist = now;
+  else if (now - heat_last_persist >= g_conf->osd_heat_persist_interval)
+    persist_heat();
+}
+
+/*
+ * Write the sketch out on its own transaction; losing the last
+ * interval's worth of counts on a crash is fine.  Also picks up any
+ * config changes and refreshes the OSD-wide summary.
+ */
+void PG::persist_heat()
+{
+  heat_last_persist = ceph_clock_now(g_ceph_context);
+  heat.configure(g_conf->osd_heat_sketch_width, g_conf->osd_heat_top_n,
+		 g_conf->osd_heat_half_life);
+  heat.decay(heat_last_persist);
+
+  list<pair<hobject_t, ObjectHeat::entry_t> > top;
+  heat.get_top(g_conf->osd_heat_top_n, &top);
+  osd->publish_heat(info.pgid, top);
+
+  bufferlist bl;
+  ::encode(heat, bl);
+  dout(15) << "persist_heat " << bl.length() << " bytes, " << top.size()
+	   << " hot objects" << dendl;
+  ObjectStore::Transaction *t = new ObjectStore::Transaction;
+  t->collection_setattr(coll, "heat", bl);
+  osd->store->queue_transaction(osr.get(), t,
+				new ObjectStore::C_DeleteTransaction(t));
+}
+
 
 
 std::ostream& operator<<(std::ostream& oss,
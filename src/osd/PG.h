@@ -43,6 +43,7 @@
 #include "messages/MOSDPGLog.h"
 
 #include "common/DecayCounter.h"
+#include "ObjectHeat.h"
 
 #include <list>
 #include <memory>
@@ -163,8 +164,32 @@ public:
    * plus some methods to manipulate it all.
    */
   struct IndexedLog : public pg_log_t {
-    hash_map<hobject_t,pg_log_entry_t*> objects;  // ptrs into log.  be careful!
-    hash_map<osd_reqid_t,pg_log_entry_t*> caller_ops;
+    /*
+     * The index keys point at the soid/reqid stored in the indexed log
+     * entry itself rather than holding a second copy of each object
+     * name.  A key is therefore only valid as long as its entry is in
+     * the log; always re-key (erase + insert) when the entry an index
+     * slot refers to changes.
+     */
+    template <typename T>
+    struct deref_hash {
+      size_t operator()(const T *p) const {
+	return __gnu_cxx::hash<T>()(*p);
+      }
+    };
+    template <typename T>
+    struct deref_equal {
+      bool operator()(const T *l, const T *r) const {
+	return *l == *r;
+      }
+    };
+    typedef hash_map<const hobject_t*, pg_log_entry_t*,
+		     deref_hash<hobject_t>, deref_equal<hobject_t> > object_index_t;
+    typedef hash_map<const osd_reqid_t*, pg_log_entry_t*,
+		     deref_hash<osd_reqid_t>, deref_equal<osd_reqid_t> > reqid_index_t;
+
+    object_index_t objects;  // ptrs into log.  be careful!
+    reqid_index_t caller_ops;
 
     // recovery pointers
     list<pg_log_entry_t>::iterator complete_to;  // not inclusive of referenced item
@@ -174,6 +199,7 @@ public:
     IndexedLog() : last_requested(0) {}
 
     void claim_log(const pg_log_t& o) {
+      unindex();
       log = o.log;
       head = o.head;
       tail = o.tail;
@@ -191,39 +217,57 @@ public:
     }
 
     bool logged_object(const hobject_t& oid) const {
-      return objects.count(oid);
+      return objects.count(&oid);
     }
     bool logged_req(const osd_reqid_t &r) const {
-      return caller_ops.count(r);
+      return caller_ops.count(&r);
     }
     eversion_t get_request_version(const osd_reqid_t &r) const {
-      hash_map<osd_reqid_t,pg_log_entry_t*>::const_iterator p = caller_ops.find(r);
+      reqid_index_t::const_iterator p = caller_ops.find(&r);
       if (p == caller_ops.end())
 	return eversion_t();
       return p->second->version;    
     }
+    /// newest indexed entry for oid, or NULL
+    pg_log_entry_t *get_object_entry(const hobject_t& oid) const {
+      object_index_t::const_iterator p = objects.find(&oid);
+      if (p == objects.end())
+	return 0;
+      return p->second;
+    }
+
+  private:
+    void _index_object(pg_log_entry_t *e) {
+      objects.erase(&e->soid);
+      objects.insert(make_pair(&e->soid, e));
+    }
+    void _index_req(pg_log_entry_t *e) {
+      caller_ops.erase(&e->reqid);
+      caller_ops.insert(make_pair(&e->reqid, e));
+    }
 
+  public:
     void index() {
       objects.clear();
       caller_ops.clear();
       for (list<pg_log_entry_t>::iterator i = log.begin();
            i != log.end();
            i++) {
-        objects[i->soid] = &(*i);
+        _index_object(&(*i));
 	if (i->reqid_is_indexed()) {
 	  //assert(caller_ops.count(i->reqid) == 0);  // divergent merge_log indexes new before unindexing old
-	  caller_ops[i->reqid] = &(*i);
+	  _index_req(&(*i));
 	}
       }
     }
 
     void index(pg_log_entry_t& e) {
-      if (objects.count(e.soid) == 0 || 
-          objects[e.soid]->version < e.version)
-        objects[e.soid] = &e;
+      pg_log_entry_t *cur = get_object_entry(e.soid);
+      if (!cur || cur->version < e.version)
+        _index_object(&e);
       if (e.reqid_is_indexed()) {
 	//assert(caller_ops.count(i->reqid) == 0);  // divergent merge_log indexes new before unindexing old
-	caller_ops[e.reqid] = &e;
+	_index_req(&e);
       }
     }
     void unindex() {
@@ -232,22 +276,27 @@ public:
     }
     void unindex(pg_log_entry_t& e) {
       // NOTE: this only works if we remove from the _tail_ of the log!
-      if (objects.count(e.soid) && objects[e.soid]->version == e.version)
-        objects.erase(e.soid);
-      if (e.reqid_is_indexed() &&
-	  caller_ops.count(e.reqid) &&  // divergent merge_log indexes new before unindexing old
-	  caller_ops[e.reqid] == &e)
-	caller_ops.erase(e.reqid);
+      object_index_t::iterator p = objects.find(&e.soid);
+      if (p != objects.end() && p->second->version == e.version)
+        objects.erase(p);
+      if (e.reqid_is_indexed()) {
+	reqid_index_t::iterator q = caller_ops.find(&e.reqid);
+	if (q != caller_ops.end() &&  // divergent merge_log indexes new before unindexing old
+	    q->second == &e)
+	  caller_ops.erase(q);
+      }
     }
 
 
     // accessors
     pg_log_entry_t *is_updated(const hobject_t& oid) {
-      if (objects.count(oid) && objects[oid]->is_update()) return objects[oid];
+      pg_log_entry_t *e = get_object_entry(oid);
+      if (e && e->is_update()) return e;
       return 0;
     }
     pg_log_entry_t *is_deleted(const hobject_t& oid) {
-      if (objects.count(oid) && objects[oid]->is_delete()) return objects[oid];
+      pg_log_entry_t *e = get_object_entry(oid);
+      if (e && e->is_delete()) return e;
       return 0;
     }
     
@@ -260,11 +309,21 @@ public:
       head = e.version;
 
       // to our index
-      objects[e.soid] = &(log.back());
-      caller_ops[e.reqid] = &(log.back());
+      _index_object(&(log.back()));
+      if (e.reqid_is_indexed())
+	_index_req(&(log.back()));
     }
 
+    /// approximate heap bytes held by the log entries and both indexes
+    size_t approx_mem_usage() const;
+
     void trim(ObjectStore::Transaction &t, eversion_t s);
+    /**
+     * drop the entries newer than newhead, unindexing them, and move
+     * them to the front of divergent, oldest first
+     */
+    void rewind_divergent(eversion_t newhead,
+			  list<pg_log_entry_t> *divergent);
 
     ostream& print(ostream& out) const;
   };
@@ -424,6 +483,13 @@ public:
 
   interval_set<snapid_t> snap_trimq;
 
+  // per-object access frequency; primary only, persisted in the
+  // "heat" collection attr every osd_heat_persist_interval
+  ObjectHeat heat;
+  utime_t heat_last_persist;
+  void record_heat(const hobject_t &soid, bool read, bool write);
+  void persist_heat();
+
   /* You should not use these items without taking their respective queue locks
    * (if they have one) */
   xlist<PG*>::item recovery_item, scrub_item, scrub_finalize_item, snap_trim_item, stat_queue_item;
@@ -1634,6 +1700,8 @@ public:
   bool acting_up_affected(const vector<int>& newup, const vector<int>& newacting);
 
   // OpRequest queueing
+  /// true if the client will take m from a replica
+  static bool is_replica_read(MOSDOp *m);
   bool can_discard_op(OpRequestRef op);
   bool can_discard_scan(OpRequestRef op);
   bool can_discard_subop(OpRequestRef op);
@@ -1676,6 +1744,8 @@ public:
   void handle_create(RecoveryCtx *rctx);
   void handle_loaded(RecoveryCtx *rctx);
   void handle_query_state(Formatter *f);
+  void dump_memory_usage(Formatter *f) const;
+  void dump_heat(Formatter *f) const;
 
   virtual void on_removal() = 0;
 
@@ -18,6 +18,9 @@
 
 #include "common/errno.h"
 #include "common/perf_counters.h"
+#include "common/Finisher.h"
+
+#include "osdc/Objecter.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
@@ -546,6 +549,20 @@ void ReplicatedPG::do_pg_op(OpRequestRef op)
       }
       break;
 
+    case CEPH_OSD_OP_PGHOT:
+      if (m->get_pg() != info.pgid) {
+        dout(10) << " pghot pg=" << m->get_pg() << " != " << info.pgid << dendl;
+	result = 0;
+      } else {
+	list<pair<hobject_t, ObjectHeat::entry_t> > top;
+	heat.decay(ceph_clock_now(g_ceph_context));
+	heat.get_top(MIN(g_conf->osd_heat_top_n, p->op.pgls.count), &top);
+	::encode(top, outdata);
+	dout(10) << " pghot pg=" << m->get_pg() << " " << top.size()
+		 << " objects" << dendl;
+      }
+      break;
+
     default:
       result = -EINVAL;
       break;
@@ -606,6 +623,17 @@ void ReplicatedPG::get_src_oloc(const object_t& oid, const object_locator_t& olo
     src_oloc.key = oid.name;
 }
 
+// whether m came from another osd, as its session authenticated it
+static bool sent_by_osd(MOSDOp *m)
+{
+  OSD::Session *session = (OSD::Session *)m->get_connection()->get_priv();
+  if (!session)
+    return false;
+  bool osd = session->entity_name.is_osd();
+  session->put();
+  return osd;
+}
+
 /** do_op - do an op
  * pg lock will be held (if multithreaded)
  * osd_lock NOT held.
@@ -628,6 +656,45 @@ void ReplicatedPG::do_op(OpRequestRef op)
 		 CEPH_NOSNAP, m->get_pg().ps(),
 		 info.pgid.pool());
 
+  // a read that came to us as a replica.  anything we can't answer
+  // right away goes back to the client, which will ask the primary.
+  if (!is_primary() && !can_serve_replica_read(m, head)) {
+    dout(10) << "do_op can't serve " << *m << " as a replica" << dendl;
+    osd->logger->inc(l_osd_op_r_replica_eagain);
+    osd->reply_op_error(op, -EAGAIN);
+    return;
+  }
+
+  // copy-from into this object in progress?  reads done on behalf of a
+  // copy don't wait, or two objects being copied into each other (or
+  // one into itself) would wait on each other forever.  only another
+  // osd's pure reads get to skip the wait; the flag means nothing from
+  // a client, or on anything that writes.
+  CopyOpRef cop;
+  map<hobject_t, CopyOpRef>::iterator cp = copy_ops.find(head);
+  if (cp != copy_ops.end() &&
+      !((m->get_flags() & CEPH_OSD_FLAG_COPY_SOURCE) && !m->may_write() &&
+	sent_by_osd(m))) {
+    if (cp->second->op == op) {
+      // ours; the source is all here (or the copy failed)
+      assert(cp->second->done);
+      cop = cp->second;
+      copy_ops.erase(cp);
+      requeue_ops(cop->waiting);
+    } else if (cp->second->done &&
+	       OSD::op_is_discardable((MOSDOp*)cp->second->op->request)) {
+      dout(10) << "do_op dropping finished copy-from into " << head
+	       << ", its client went away" << dendl;
+      requeue_ops(cp->second->waiting);
+      copy_ops.erase(cp);
+    } else {
+      dout(10) << "do_op waiting for copy-from into " << head << dendl;
+      cp->second->waiting.push_back(op);
+      op->mark_delayed();
+      return;
+    }
+  }
+
   if (scrubber.block_writes && m->may_write()) {
     // classic (non chunk) scrubs block all writes
     // chunky scrubs only block writes to a range
@@ -681,9 +748,9 @@ void ReplicatedPG::do_op(OpRequestRef op)
   if (r) {
     if (r == -EAGAIN) {
       // If we're not the primary of this OSD, and we have
-      // CEPH_OSD_FLAG_LOCALIZE_READS set, we just return -EAGAIN. Otherwise,
-      // we have to wait for the object.
-      if (is_primary() || (!(m->get_flags() & CEPH_OSD_FLAG_LOCALIZE_READS))) {
+      // CEPH_OSD_FLAG_LOCALIZE_READS or BALANCE_READS set, we just return
+      // -EAGAIN. Otherwise, we have to wait for the object.
+      if (is_primary() || !is_replica_read(m)) {
 	// missing the specific snap we need; requeue and wait.
 	assert(!can_create); // only happens on a read
 	hobject_t soid(m->get_oid(), m->get_object_locator().key,
@@ -745,6 +812,8 @@ void ReplicatedPG::do_op(OpRequestRef op)
 
   dout(10) << "do_op mode now " << mode << dendl;
 
+  record_heat(head, m->may_read(), m->may_write());
+
   // are writes blocked by another object?
   if (obc->blocked_by) {
     dout(10) << "do_op writes for " << obc->obs.oi.soid << " blocked by "
@@ -823,6 +892,37 @@ void ReplicatedPG::do_op(OpRequestRef op)
     return;
   }
 
+  // LIST_SNAPS reports each clone's snaps, which are in its own
+  // object_info; have them all at hand
+  if (m->get_snapid() == CEPH_SNAPDIR) {
+    for (vector<snapid_t>::iterator p = obc->ssc->snapset.clones.begin();
+	 p != obc->ssc->snapset.clones.end();
+	 ++p) {
+      hobject_t clone_oid = obc->obs.oi.soid;
+      clone_oid.snap = *p;
+      if (src_obc.count(clone_oid))
+	continue;
+      if (is_missing_object(clone_oid)) {
+	wait_for_missing_object(clone_oid, op);
+	put_object_contexts(src_obc);
+	put_object_context(obc);
+	return;
+      }
+      ObjectContext *sobc = get_object_context(clone_oid,
+					       m->get_object_locator(), false);
+      if (!sobc) {
+	osd->clog.error() << info.pgid << " " << obc->obs.oi.soid
+			  << " snapset lists clone " << *p
+			  << " which does not exist\n";
+	osd->reply_op_error(op, -EIO);
+	put_object_contexts(src_obc);
+	put_object_context(obc);
+	return;
+      }
+      src_obc[clone_oid] = sobc;
+    }
+  }
+
   op->mark_started();
 
   const hobject_t& soid = obc->obs.oi.soid;
@@ -831,6 +931,7 @@ void ReplicatedPG::do_op(OpRequestRef op)
 				 this);
   ctx->obc = obc;
   ctx->src_obc = src_obc;
+  ctx->copy_op = cop;
 
   if (m->may_write()) {
     // snap
@@ -1007,6 +1108,39 @@ void ReplicatedPG::do_op(OpRequestRef op)
 }
 
 
+/*
+ * a replica can answer a read on its own only if it has the object
+ * and isn't partway through applying an update to it, and the read
+ * doesn't need anything only the primary has (watchers, other
+ * objects' contexts).
+ */
+bool ReplicatedPG::can_serve_replica_read(MOSDOp *m, const hobject_t& head)
+{
+  for (vector<OSDOp>::iterator p = m->ops.begin(); p != m->ops.end(); ++p) {
+    switch (p->op.op) {
+    case CEPH_OSD_OP_NOTIFY:
+    case CEPH_OSD_OP_NOTIFY_ACK:
+    case CEPH_OSD_OP_WATCH:
+      return false;
+    }
+    if (ceph_osd_op_type_multi(p->op.op))
+      return false;
+  }
+
+  hobject_t snapdir = head;
+  snapdir.snap = CEPH_SNAPDIR;
+  if (is_missing_object(head) || is_missing_object(snapdir))
+    return false;
+
+  pg_log_entry_t *e = log.get_object_entry(head);
+  if (e && e->version > last_update_applied) {
+    dout(20) << "can_serve_replica_read " << head << " " << e->version
+	     << " not yet applied (" << last_update_applied << ")" << dendl;
+    return false;
+  }
+  return true;
+}
+
 void ReplicatedPG::log_op_stats(OpContext *ctx)
 {
   MOSDOp *m = (MOSDOp*)ctx->op->request;
@@ -1029,6 +1163,8 @@ void ReplicatedPG::log_op_stats(OpContext *ctx)
   osd->logger->inc(l_osd_op_outb, outb);
   osd->logger->inc(l_osd_op_inb, inb);
   osd->logger->finc(l_osd_op_lat, latency);
+  if (ctx->cls_cache.hits)
+    osd->logger->inc(l_osd_cls_cache_hit, ctx->cls_cache.hits);
 
   if (m->may_read() && m->may_write()) {
     osd->logger->inc(l_osd_op_rw);
@@ -1040,6 +1176,8 @@ void ReplicatedPG::log_op_stats(OpContext *ctx)
     osd->logger->inc(l_osd_op_r);
     osd->logger->inc(l_osd_op_r_outb, outb);
     osd->logger->finc(l_osd_op_r_lat, latency);
+    if (!is_primary())
+      osd->logger->inc(l_osd_op_r_replica);
   } else if (m->may_write()) {
     osd->logger->inc(l_osd_op_w);
     osd->logger->inc(l_osd_op_w_inb, inb);
@@ -1671,6 +1809,9 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	ctx->user_modify = true;
     }
 
+    // don't let reads by cls methods outlive a modification
+    ctx->cls_cache.note_op(op);
+
     ObjectContext *src_obc = 0;
     if (ceph_osd_op_type_multi(op.op)) {
       object_locator_t src_oloc;
@@ -1855,11 +1996,10 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
 	  break;
 	}
 
-	ClassHandler::ClassData *cls;
-	result = osd->class_handler->open_class(cname, &cls);
+	ClassHandler::ClassMethod *method;
+	result = osd->class_handler->open_method(cname, mname, &method);
 	assert(result == 0);   // init_op_flags() already verified this works.
 
-	ClassHandler::ClassMethod *method = cls->get_method(mname.c_str());
 	if (!method) {
 	  dout(10) << "call method " << cname << "." << mname << " does not exist" << dendl;
 	  result = -EINVAL;
@@ -1897,6 +2037,63 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
       }
       break;
 
+    case CEPH_OSD_OP_LIST_SNAPS:
+      {
+	if (soid.snap != CEPH_NOSNAP && soid.snap != CEPH_SNAPDIR) {
+	  // only makes sense read at the snapdir
+	  result = -EINVAL;
+	  break;
+	}
+	assert(ssc);
+	obj_list_snap_response_t resp;
+	resp.clones.reserve(ssc->snapset.clones.size() + 1);
+	for (vector<snapid_t>::const_iterator p = ssc->snapset.clones.begin();
+	     p != ssc->snapset.clones.end();
+	     ++p) {
+	  hobject_t clone_oid = soid;
+	  clone_oid.snap = *p;
+	  map<hobject_t,ObjectContext*>::iterator c = ctx->src_obc.find(clone_oid);
+	  map<snapid_t, interval_set<uint64_t> >::const_iterator o =
+	    ssc->snapset.clone_overlap.find(*p);
+	  map<snapid_t, uint64_t>::const_iterator s =
+	    ssc->snapset.clone_size.find(*p);
+	  if (c == ctx->src_obc.end() ||
+	      o == ssc->snapset.clone_overlap.end() ||
+	      s == ssc->snapset.clone_size.end()) {
+	    osd->clog.error() << info.pgid << " " << soid
+			      << " inconsistent snapset at clone " << *p << "\n";
+	    result = -EIO;
+	    break;
+	  }
+
+	  clone_info ci;
+	  ci.cloneid = *p;
+	  // object_info_t keeps them descending
+	  const vector<snapid_t>& snaps = c->second->obs.oi.snaps;
+	  ci.snaps.assign(snaps.rbegin(), snaps.rend());
+	  for (interval_set<uint64_t>::const_iterator q = o->second.begin();
+	       q != o->second.end();
+	       ++q)
+	    ci.overlap.push_back(make_pair(q.get_start(), q.get_len()));
+	  ci.size = s->second;
+	  resp.clones.push_back(ci);
+	}
+	if (result < 0)
+	  break;
+	if (ssc->snapset.head_exists) {
+	  clone_info ci;
+	  ci.cloneid = CEPH_NOSNAP;
+	  ci.size = oi.size;
+	  resp.clones.push_back(ci);
+	}
+	resp.seq = ssc->snapset.seq;
+	dout(20) << " list_snaps seq " << resp.seq << " clones "
+		 << ssc->snapset.clones << dendl;
+	::encode(resp, osd_op.outdata);
+	ctx->delta_stats.num_rd++;
+      }
+      break;
+
     case CEPH_OSD_OP_GETXATTR:
       {
 	string aname;
@@ -2137,6 +2334,40 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
       result = _rollback_to(ctx, op);
       break;
 
+    case CEPH_OSD_OP_COPY_FROM:
+      {
+	object_t src;
+	object_locator_t src_oloc;
+	try {
+	  ::decode(src, bp);
+	  ::decode(src_oloc, bp);
+	}
+	catch (buffer::error& e) {
+	  result = -EINVAL;
+	  goto fail;
+	}
+	snapid_t snapid = (uint64_t)op.copy_from.snapid;
+	CopyOpRef cop = ctx->copy_op;
+	if (!cop) {
+	  // go get it; we'll be back when we have it
+	  result = start_copy(ctx, src, src_oloc, snapid,
+			      op.copy_from.src_version, op.copy_from.flags);
+	  break;
+	}
+	if (cop->src != src || !(cop->oloc == src_oloc) ||
+	    cop->snapid != snapid) {
+	  dout(10) << " only one copy-from per op" << dendl;
+	  result = -EINVAL;
+	  break;
+	}
+	if (cop->rval < 0) {
+	  result = cop->rval;
+	  break;
+	}
+	result = _apply_copy(ctx, cop);
+      }
+      break;
+
     case CEPH_OSD_OP_ZERO:
       { // zero
 	assert(op.extent.length);
@@ -2884,7 +3115,8 @@ int ReplicatedPG::do_osd_ops(OpContext *ctx, vector<OSDOp>& ops)
     ctx->bytes_read += osd_op.outdata.length();
 
   fail:
-    if (result < 0 && (op.flags & CEPH_OSD_OP_FLAG_FAILOK))
+    if (result < 0 && result != -EAGAIN &&
+	(op.flags & CEPH_OSD_OP_FLAG_FAILOK))
       result = 0;
 
     if (result < 0)
@@ -3062,6 +3294,228 @@ int ReplicatedPG::_rollback_to(OpContext *ctx, ceph_osd_op& op)
   return ret;
 }
 
+// ========================================================================
+// copy-from
+
+// omap keys to fetch per round trip
+static const uint64_t COPY_FROM_OMAP_PAGE = 1024;
+
+int ReplicatedPG::start_copy(OpContext *ctx, const object_t& src,
+			     const object_locator_t& oloc, snapid_t snapid,
+			     version_t src_version, unsigned flags)
+{
+  MOSDOp *m = (MOSDOp*)ctx->op->request;
+  hobject_t head(m->get_oid(), m->get_object_locator().key,
+		 CEPH_NOSNAP, m->get_pg().ps(), info.pgid.pool());
+  if (copy_ops.count(head)) {
+    // do_op holds everything else back while a copy is in progress
+    dout(10) << "start_copy " << head << " already has a copy in progress"
+	     << dendl;
+    return -EBUSY;
+  }
+
+  OSDMapRef osdmap = get_osdmap();
+  const pg_pool_t *spool = osdmap->get_pg_pool(oloc.pool);
+  if (!spool) {
+    dout(10) << "start_copy source pool " << oloc.pool << " dne" << dendl;
+    return -ENOENT;
+  }
+
+  // the client has to be allowed to read the source, not just us
+  OSD::Session *session = (OSD::Session *)m->get_connection()->get_priv();
+  if (!session)
+    return -EPERM;
+  bool cap = session->caps.is_capable(osdmap->get_pool_name(oloc.pool),
+				      spool->auid,
+				      oloc.key.length() ? oloc.key : src.name,
+				      true, false, false, false);
+  session->put();
+  if (!cap) {
+    dout(10) << "start_copy client may not read " << src << " " << oloc << dendl;
+    return -EPERM;
+  }
+
+  CopyOpRef cop(new CopyOp(ctx->op, head, src, oloc, snapid, src_version,
+			   flags, get_last_peering_reset()));
+  if (flags & CEPH_OSD_COPY_FROM_FLAG_DATA_ONLY)
+    cop->omap_complete = true;
+  copy_ops[head] = cop;
+  dout(10) << "start_copy " << head << " from " << src << " " << oloc
+	   << " snap " << snapid << dendl;
+  ctx->op->mark_delayed();
+  _copy_some(cop);
+  return -EAGAIN;
+}
+
+void ReplicatedPG::_copy_some(CopyOpRef cop)
+{
+  dout(10) << "_copy_some " << cop->target << " from " << cop->src
+	   << " v" << cop->version << " have " << cop->data.length()
+	   << "/" << cop->size << " bytes, " << cop->omap.size() << " keys"
+	   << dendl;
+  ObjectOperation op;
+  if (cop->version) {
+    // the rest has to come from the version we started with
+    op.assert_version(cop->version);
+  } else {
+    if (cop->src_version)
+      op.assert_version(cop->src_version);
+    op.stat(&cop->r_size, (utime_t *)NULL, NULL);
+    if (!(cop->flags & CEPH_OSD_COPY_FROM_FLAG_DATA_ONLY)) {
+      op.getxattrs(&cop->r_attrs, NULL);
+      op.omap_get_header(&cop->r_omap_header, NULL);
+    }
+  }
+  if (!cop->data_complete)
+    op.read(cop->data.length(), g_conf->osd_copyfrom_max_chunk,
+	    &cop->r_data, NULL);
+  if (!cop->omap_complete)
+    op.omap_get_vals(cop->omap.empty() ? string() : cop->omap.rbegin()->first,
+		     string(), COPY_FROM_OMAP_PAGE, &cop->r_omap, NULL);
+
+  Context *onack = new C_OnFinisher(new C_CopyFrom(this, cop),
+				    &osd->objecter_finisher);
+  osd->objecter->read(cop->src, cop->oloc, op, cop->snapid, NULL,
+		      CEPH_OSD_FLAG_COPY_SOURCE, onack, &cop->r_version);
+}
+
+void ReplicatedPG::process_copy_chunk(CopyOpRef cop, int r)
+{
+  if (cop->canceled || cop->started != get_last_peering_reset()) {
+    dout(10) << "process_copy_chunk " << cop->target << " canceled" << dendl;
+    return;
+  }
+  dout(10) << "process_copy_chunk " << cop->target << " r = " << r << dendl;
+
+  if (r >= 0) {
+    if (!cop->version) {
+      cop->version = cop->r_version.version;
+      cop->size = cop->r_size;
+      cop->attrs.swap(cop->r_attrs);
+      cop->omap_header.claim(cop->r_omap_header);
+    }
+    if (!cop->data_complete) {
+      // a short read means we hit the end
+      if (cop->r_data.length() < g_conf->osd_copyfrom_max_chunk)
+	cop->data_complete = true;
+      cop->data.claim_append(cop->r_data);
+      if (cop->data.length() >= cop->size)
+	cop->data_complete = true;
+    }
+    // all of it is held in memory until it is applied
+    uint64_t max = g_conf->osd_copyfrom_max_size;
+    if (max && (cop->size > max || cop->data.length() > max)) {
+      dout(10) << "process_copy_chunk " << cop->src << " is " << cop->size
+	       << " bytes, more than osd_copyfrom_max_size " << max << dendl;
+      cop->data.clear();
+      r = -EFBIG;
+    }
+    if (!cop->omap_complete) {
+      if (cop->r_omap.size() < COPY_FROM_OMAP_PAGE)
+	cop->omap_complete = true;
+      cop->omap.insert(cop->r_omap.begin(), cop->r_omap.end());
+      cop->r_omap.clear();
+    }
+    if (r >= 0 && (!cop->data_complete || !cop->omap_complete)) {
+      _copy_some(cop);
+      return;
+    }
+  } else if ((r == -ERANGE || r == -EOVERFLOW) && cop->version) {
+    // the source was modified between chunks; start over
+    cop->r_data.clear();
+    cop->r_omap.clear();
+    if (++cop->attempts < 3) {
+      dout(10) << "process_copy_chunk " << cop->src << " changed from v"
+	       << cop->version << ", restarting" << dendl;
+      cop->reset();
+      if (cop->flags & CEPH_OSD_COPY_FROM_FLAG_DATA_ONLY)
+	cop->omap_complete = true;
+      _copy_some(cop);
+      return;
+    }
+    r = -EBUSY;
+  }
+
+  if (r < 0)
+    cop->rval = r;
+  cop->done = true;
+
+  // run the op again to apply the copy (or report the error); anything
+  // else waiting on the object goes right behind it
+  list<OpRequestRef> ls;
+  ls.push_back(cop->op);
+  ls.insert(ls.end(), cop->waiting.begin(), cop->waiting.end());
+  cop->waiting.clear();
+  requeue_ops(ls);
+}
+
+int ReplicatedPG::_apply_copy(OpContext *ctx, CopyOpRef cop)
+{
+  ObjectState& obs = ctx->new_obs;
+  const hobject_t& soid = obs.oi.soid;
+  ObjectStore::Transaction& t = ctx->op_t;
+  bool existed = obs.exists;
+
+  dout(10) << "_apply_copy " << soid << " from " << cop->src << " v"
+	   << cop->version << " " << cop->data.length() << " bytes, "
+	   << cop->attrs.size() << " xattrs, " << cop->omap.size()
+	   << " keys" << dendl;
+
+  // the data goes in exactly as a WRITEFULL would put it
+  vector<OSDOp> nops(1);
+  OSDOp& newop = nops[0];
+  newop.op.op = CEPH_OSD_OP_WRITEFULL;
+  newop.op.extent.offset = 0;
+  newop.op.extent.length = cop->data.length();
+  newop.indata = cop->data;
+  int r = do_osd_ops(ctx, nops);
+  if (r < 0)
+    return r;
+
+  if (cop->flags & CEPH_OSD_COPY_FROM_FLAG_DATA_ONLY)
+    return 0;
+
+  // replace the user xattrs
+  if (existed) {
+    map<string, bufferptr> old;
+    osd->store->getattrs(coll, soid, old, true);
+    for (map<string, bufferptr>::iterator p = old.begin(); p != old.end(); ++p)
+      if (!cop->attrs.count(p->first))
+	t.rmattr(coll, soid, "_" + p->first);
+  }
+  for (map<string, bufferlist>::iterator p = cop->attrs.begin();
+       p != cop->attrs.end();
+       ++p)
+    t.setattr(coll, soid, "_" + p->first, p->second);
+
+  // and the omap
+  if (existed)
+    t.omap_clear(coll, soid);
+  if (cop->omap_header.length())
+    t.omap_setheader(coll, soid, cop->omap_header);
+  if (!cop->omap.empty())
+    t.omap_setkeys(coll, soid, cop->omap);
+  return 0;
+}
+
+void ReplicatedPG::cancel_copy_ops(bool requeue)
+{
+  dout(10) << "cancel_copy_ops" << dendl;
+  list<OpRequestRef> ls;
+  for (map<hobject_t, CopyOpRef>::iterator p = copy_ops.begin();
+       p != copy_ops.end();
+       ++p) {
+    CopyOpRef cop = p->second;
+    cop->canceled = true;
+    if (!cop->done)
+      ls.push_back(cop->op);  // otherwise it is already queued
+    ls.splice(ls.end(), cop->waiting);
+  }
+  copy_ops.clear();
+  if (requeue)
+    requeue_ops(ls);
+}
+
 void ReplicatedPG::_make_clone(ObjectStore::Transaction& t,
 			       const hobject_t& head, const hobject_t& coid,
 			       object_info_t *poi)
@@ -4170,6 +4624,30 @@ int ReplicatedPG::find_object_context(const hobject_t& oid,
     return 0;
   }
 
+  // want the snapdir?  (for LIST_SNAPS) use the head or the snapdir,
+  // whichever exists
+  if (oid.snap == CEPH_SNAPDIR) {
+    ObjectContext *obc = get_object_context(head, oloc, false);
+    if (obc && !obc->obs.exists) {
+      put_object_context(obc);
+      obc = NULL;
+    }
+    if (!obc) {
+      hobject_t snapdir(oid.oid, oid.get_key(), CEPH_SNAPDIR, oid.hash,
+			info.pgid.pool());
+      obc = get_object_context(snapdir, oloc, false);
+    }
+    if (!obc)
+      return -ENOENT;
+    dout(10) << "find_object_context " << oid << " @" << oid.snap
+	     << " -> " << obc->obs.oi.soid << dendl;
+    *pobc = obc;
+
+    if (!obc->ssc)
+      obc->ssc = get_snapset_context(oid.oid, oid.get_key(), oid.hash, true);
+    return 0;
+  }
+
   // we want a snap
   SnapSetContext *ssc = get_snapset_context(oid.oid, oid.get_key(), oid.hash, can_create);
   if (!ssc)
@@ -5055,7 +5533,7 @@ void ReplicatedPG::submit_push_complete(ObjectRecoveryInfo &recovery_info,
   if (missing.is_missing(recovery_info.soid) &&
       missing.missing[recovery_info.soid].need > recovery_info.version) {
     assert(is_primary());
-    pg_log_entry_t *latest = log.objects[recovery_info.soid];
+    pg_log_entry_t *latest = log.get_object_entry(recovery_info.soid);
     if (latest->op == pg_log_entry_t::LOST_REVERT &&
 	latest->prior_version == recovery_info.version) {
       dout(10) << " got old revert version " << recovery_info.version
@@ -5597,7 +6075,7 @@ void ReplicatedPG::recover_got(hobject_t oid, eversion_t v)
       info.last_complete = info.last_update;
     }
     while (log.complete_to != log.log.end()) {
-      if (missing.missing[missing.rmissing.begin()->second].need <=
+      if (missing.missing[*missing.rmissing.begin()->second].need <=
 	  log.complete_to->version)
 	break;
       if (info.last_complete < log.complete_to->version)
@@ -5962,6 +6440,7 @@ void ReplicatedPG::on_removal()
 void ReplicatedPG::on_shutdown()
 {
   dout(10) << "on_shutdown" << dendl;
+  cancel_copy_ops(false);
   apply_and_flush_repops(false);
   remove_watchers_and_notifies();
 }
@@ -5993,6 +6472,7 @@ void ReplicatedPG::on_change()
   context_registry_on_change();
 
   // requeue object waiters
+  cancel_copy_ops(true);
   requeue_ops(waiting_for_backfill_pos);
   requeue_object_waiters(waiting_for_missing_object);
   for (map<hobject_t,list<OpRequestRef> >::iterator p = waiting_for_degraded_object.begin();
@@ -6021,6 +6501,8 @@ void ReplicatedPG::on_change()
 void ReplicatedPG::on_role_change()
 {
   dout(10) << "on_role_change" << dendl;
+  if (!is_primary())
+    osd->clear_heat(info.pgid);
 }
 
 
@@ -6224,20 +6706,20 @@ int ReplicatedPG::recover_primary(int max)
   int started = 0;
   int skipped = 0;
 
-  map<version_t, hobject_t>::iterator p = missing.rmissing.lower_bound(log.last_requested);
+  map<version_t, const hobject_t*>::iterator p =
+    missing.rmissing.lower_bound(log.last_requested);
   while (p != missing.rmissing.end()) {
     hobject_t soid;
     version_t v = p->first;
 
-    if (log.objects.count(p->second)) {
-      latest = log.objects[p->second];
+    latest = log.get_object_entry(*p->second);
+    if (latest) {
       assert(latest->is_update());
       soid = latest->soid;
     } else {
-      latest = 0;
-      soid = p->second;
+      soid = *p->second;
     }
-    pg_missing_t::item& item = missing.missing[p->second];
+    pg_missing_t::item& item = missing.missing[soid];
     p++;
 
     hobject_t head = soid;
@@ -6429,10 +6911,10 @@ int ReplicatedPG::recover_replicas(int max)
 
     // oldest first!
     const pg_missing_t &m(pm->second);
-    for (map<version_t, hobject_t>::const_iterator p = m.rmissing.begin();
+    for (map<version_t, const hobject_t*>::const_iterator p = m.rmissing.begin();
 	   p != m.rmissing.end() && started < max;
 	   ++p) {
-      const hobject_t soid(p->second);
+      const hobject_t soid(*p->second);
 
       if (pushing.count(soid)) {
 	dout(10) << __func__ << ": already pushing " << soid << dendl;
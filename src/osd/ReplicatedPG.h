@@ -19,6 +19,7 @@
 #include "OSD.h"
 #include "Watch.h"
 #include "OpRequest.h"
+#include "ClsReadCache.h"
 
 #include "messages/MOSDOp.h"
 #include "messages/MOSDOpReply.h"
@@ -329,6 +330,66 @@ public:
   };
 
 
+  /*
+   * A copy-from in progress.  The target's primary pulls the source
+   * (usually in some other pg) with the osd's objecter, a chunk per
+   * round trip, and keeps it in memory until it has all of it.  The op
+   * that asked for it then runs again and writes the whole copy in one
+   * transaction, which is replicated like any other write.  Meanwhile
+   * other ops on the target wait here, behind it.
+   */
+  struct CopyOp {
+    OpRequestRef op;            ///< the copy-from op itself
+    hobject_t target;
+    object_t src;
+    object_locator_t oloc;
+    snapid_t snapid;
+    version_t src_version;      ///< required source version, or 0
+    unsigned flags;             ///< CEPH_OSD_COPY_FROM_FLAG_*
+    epoch_t started;            ///< last_peering_reset when we began
+
+    // what we have of the source so far
+    version_t version;          ///< 0 until the first chunk is in
+    uint64_t size;
+    bufferlist data;
+    map<string,bufferlist> attrs;
+    bufferlist omap_header;
+    map<string,bufferlist> omap;
+    bool data_complete, omap_complete;
+
+    // filled in by the read in flight
+    eversion_t r_version;
+    uint64_t r_size;
+    bufferlist r_data;
+    map<string,bufferlist> r_attrs;
+    bufferlist r_omap_header;
+    map<string,bufferlist> r_omap;
+
+    int attempts;               ///< restarts because the source changed
+    int rval;
+    bool done, canceled;
+    list<OpRequestRef> waiting; ///< other ops on the target
+
+    CopyOp(OpRequestRef o, const hobject_t& t, const object_t& s,
+	   const object_locator_t& l, snapid_t sn, version_t sv,
+	   unsigned f, epoch_t e)
+      : op(o), target(t), src(s), oloc(l), snapid(sn), src_version(sv),
+	flags(f), started(e), version(0), size(0),
+	data_complete(false), omap_complete(false), r_size(0),
+	attempts(0), rval(0), done(false), canceled(false) {}
+
+    void reset() {
+      version = 0;
+      size = 0;
+      data.clear();
+      attrs.clear();
+      omap_header.clear();
+      omap.clear();
+      data_complete = omap_complete = false;
+    }
+  };
+  typedef std::tr1::shared_ptr<CopyOp> CopyOpRef;
+
   /*
    * Capture all object state associated with an in-progress read or write.
    */
@@ -377,6 +438,10 @@ public:
     utime_t readable_stamp;  // when applied on all replicas
     ReplicatedPG *pg;
 
+    CopyOpRef copy_op;  // a finished copy-from, for this op to apply
+
+    ClsReadCache cls_cache;  // reads by cls methods on behalf of this op
+
     OpContext(const OpContext& other);
     const OpContext& operator=(const OpContext& other);
 
@@ -733,6 +798,11 @@ protected:
       }
       f->close_section();
     }
+    {
+      f->open_object_section("memory");
+      dump_memory_usage(f);
+      f->close_section();
+    }
   }
 
   /// leading edge of backfill
@@ -774,6 +844,7 @@ protected:
 		   object_info_t *poi);
   void make_writeable(OpContext *ctx);
   void log_op_stats(OpContext *ctx);
+  bool can_serve_replica_read(MOSDOp *m, const hobject_t& head);
 
   void write_update_size_and_usage(object_stat_sum_t& stats, object_info_t& oi,
 				   SnapSet& ss, interval_set<uint64_t>& modified,
@@ -1031,6 +1102,30 @@ private:
   int _copy_up_tmap(OpContext *ctx);
   int _delete_head(OpContext *ctx);
   int _rollback_to(OpContext *ctx, ceph_osd_op& op);
+
+  // -- copy-from --
+  map<hobject_t, CopyOpRef> copy_ops;  // by target
+
+  struct C_CopyFrom : public Context {
+    ReplicatedPG *pg;
+    CopyOpRef cop;
+    C_CopyFrom(ReplicatedPG *p, CopyOpRef c) : pg(p), cop(c) {
+      pg->get();
+    }
+    void finish(int r) {
+      pg->lock();
+      pg->process_copy_chunk(cop, r);
+      pg->unlock();
+      pg->put();
+    }
+  };
+  int start_copy(OpContext *ctx, const object_t& src,
+		 const object_locator_t& oloc, snapid_t snapid,
+		 version_t src_version, unsigned flags);
+  void _copy_some(CopyOpRef cop);
+  void process_copy_chunk(CopyOpRef cop, int r);
+  int _apply_copy(OpContext *ctx, CopyOpRef cop);
+  void cancel_copy_ops(bool requeue);
 public:
   bool same_for_read_since(epoch_t e);
   bool same_for_modify_since(epoch_t e);
@@ -483,6 +483,9 @@ void pg_pool_t::dump(Formatter *f) const
   f->dump_int("pg_num", get_pg_num());
   f->dump_int("pg_placement_num", get_pgp_num());
   f->dump_unsigned("crash_replay_interval", get_crash_replay_interval());
+  f->dump_unsigned("qos_reservation", get_qos_reservation());
+  f->dump_unsigned("qos_weight", get_qos_weight());
+  f->dump_unsigned("qos_limit", get_qos_limit());
   f->dump_stream("last_change") << get_last_change();
   f->dump_unsigned("auid", get_auid());
   f->dump_string("snap_mode", is_pool_snaps_mode() ? "pool" : "selfmanaged");
@@ -687,7 +690,7 @@ void pg_pool_t::encode(bufferlist& bl, uint64_t features) const
     return;
   }
 
-  ENCODE_START(6, 5, bl);
+  ENCODE_START(7, 5, bl);
   ::encode(type, bl);
   ::encode(size, bl);
   ::encode(crush_ruleset, bl);
@@ -705,12 +708,15 @@ void pg_pool_t::encode(bufferlist& bl, uint64_t features) const
   ::encode(auid, bl);
   ::encode(flags, bl);
   ::encode(crash_replay_interval, bl);
+  ::encode(qos_reservation, bl);
+  ::encode(qos_weight, bl);
+  ::encode(qos_limit, bl);
   ENCODE_FINISH(bl);
 }
 
 void pg_pool_t::decode(bufferlist::iterator& bl)
 {
-  DECODE_START_LEGACY_COMPAT_LEN(6, 5, 5, bl);
+  DECODE_START_LEGACY_COMPAT_LEN(7, 5, 5, bl);
   ::decode(type, bl);
   ::decode(size, bl);
   ::decode(crush_ruleset, bl);
@@ -754,6 +760,15 @@ void pg_pool_t::decode(bufferlist::iterator& bl)
     else
       crash_replay_interval = 0;
   }
+  if (struct_v >= 7) {
+    ::decode(qos_reservation, bl);
+    ::decode(qos_weight, bl);
+    ::decode(qos_limit, bl);
+  } else {
+    qos_reservation = 0;
+    qos_weight = 1;
+    qos_limit = 0;
+  }
   DECODE_FINISH(bl);
   calc_pg_masks();
 }
@@ -776,6 +791,11 @@ void pg_pool_t::generate_test_instances(list<pg_pool_t*>& o)
   a.crash_replay_interval = 13;
   o.push_back(new pg_pool_t(a));
 
+  a.qos_reservation = 100;
+  a.qos_weight = 3;
+  a.qos_limit = 1000;
+  o.push_back(new pg_pool_t(a));
+
   a.snaps[3].name = "asdf";
   a.snaps[3].snapid = 3;
   a.snaps[3].stamp = utime_t(123, 4);
@@ -802,6 +822,9 @@ ostream& operator<<(ostream& out, const pg_pool_t& p)
     out << " flags " << p.flags;
   if (p.crash_replay_interval)
     out << " crash_replay_interval " << p.crash_replay_interval;
+  if (p.qos_reservation || p.qos_weight != 1 || p.qos_limit)
+    out << " qos " << p.qos_reservation << "/" << p.qos_weight
+	<< "/" << p.qos_limit;
   return out;
 }
 
@@ -1777,6 +1800,7 @@ void pg_missing_t::encode(bufferlist &bl) const
 
 void pg_missing_t::decode(bufferlist::iterator &bl, int64_t pool)
 {
+  rmissing.clear();
   DECODE_START_LEGACY_COMPAT_LEN(3, 2, 2, bl);
   ::decode(missing, bl);
   DECODE_FINISH(bl);
@@ -1799,10 +1823,27 @@ void pg_missing_t::decode(bufferlist::iterator &bl, int64_t pool)
     missing.insert(tmp.begin(), tmp.end());
   }
 
+  rebuild_rmissing();
+}
+
+void pg_missing_t::rebuild_rmissing()
+{
+  rmissing.clear();
   for (map<hobject_t,item>::iterator it = missing.begin();
        it != missing.end();
        ++it)
-    rmissing[it->second.need.version] = it->first;
+    rmissing[it->second.need.version] = &it->first;
+}
+
+size_t pg_missing_t::approx_mem_usage() const
+{
+  size_t r = rmissing.size() *
+    (STL_TREE_NODE_OVERHEAD + sizeof(pair<version_t, const hobject_t*>));
+  for (map<hobject_t,item>::const_iterator p = missing.begin();
+       p != missing.end();
+       ++p)
+    r += STL_TREE_NODE_OVERHEAD + sizeof(*p) + hobject_heap_bytes(p->first);
+  return r;
 }
 
 void pg_missing_t::dump(Formatter *f) const
@@ -1907,20 +1948,21 @@ void pg_missing_t::add_next_event(const pg_log_entry_t& e)
       // not missing, we must have prior_version (if any)
       missing[e.soid] = item(e.version, e.prior_version);
     }
-    rmissing[e.version.version] = e.soid;
+    rmissing[e.version.version] = &missing.find(e.soid)->first;
   } else
     rm(e.soid, e.version);
 }
 
 void pg_missing_t::revise_need(hobject_t oid, eversion_t need)
 {
-  if (missing.count(oid)) {
-    rmissing.erase(missing[oid].need.version);
-    missing[oid].need = need;            // no not adjust .have
+  map<hobject_t, item>::iterator p = missing.find(oid);
+  if (p != missing.end()) {
+    rmissing.erase(p->second.need.version);
+    p->second.need = need;            // no not adjust .have
   } else {
-    missing[oid] = item(need, eversion_t());
+    p = missing.insert(make_pair(oid, item(need, eversion_t()))).first;
   }
-  rmissing[need.version] = oid;
+  rmissing[need.version] = &p->first;
 }
 
 void pg_missing_t::revise_have(hobject_t oid, eversion_t have)
@@ -1932,8 +1974,14 @@ void pg_missing_t::revise_have(hobject_t oid, eversion_t have)
 
 void pg_missing_t::add(const hobject_t& oid, eversion_t need, eversion_t have)
 {
-  missing[oid] = item(need, have);
-  rmissing[need.version] = oid;
+  map<hobject_t, item>::iterator p = missing.find(oid);
+  if (p != missing.end()) {
+    rmissing.erase(p->second.need.version);
+    p->second = item(need, have);
+  } else {
+    p = missing.insert(make_pair(oid, item(need, have))).first;
+  }
+  rmissing[need.version] = &p->first;
 }
 
 void pg_missing_t::rm(const hobject_t& oid, eversion_t v)
@@ -2174,6 +2222,105 @@ ostream& operator<<(ostream& out, const SnapSet& cs)
 	     << (cs.head_exists ? "+head":"");
 }
 
+// -- clone_info --
+
+void clone_info::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(cloneid, bl);
+  ::encode(snaps, bl);
+  ::encode(overlap, bl);
+  ::encode(size, bl);
+  ENCODE_FINISH(bl);
+}
+
+void clone_info::decode(bufferlist::iterator& bl)
+{
+  DECODE_START(1, bl);
+  ::decode(cloneid, bl);
+  ::decode(snaps, bl);
+  ::decode(overlap, bl);
+  ::decode(size, bl);
+  DECODE_FINISH(bl);
+}
+
+void clone_info::dump(Formatter *f) const
+{
+  if (cloneid == CEPH_NOSNAP)
+    f->dump_string("cloneid", "HEAD");
+  else
+    f->dump_unsigned("cloneid", cloneid.val);
+  f->open_array_section("snapshots");
+  for (vector<snapid_t>::const_iterator p = snaps.begin(); p != snaps.end(); ++p)
+    f->dump_unsigned("snap", *p);
+  f->close_section();
+  f->open_array_section("overlaps");
+  for (vector< pair<uint64_t,uint64_t> >::const_iterator p = overlap.begin();
+       p != overlap.end(); ++p) {
+    f->open_object_section("overlap");
+    f->dump_unsigned("offset", p->first);
+    f->dump_unsigned("length", p->second);
+    f->close_section();
+  }
+  f->close_section();
+  f->dump_unsigned("size", size);
+}
+
+void clone_info::generate_test_instances(list<clone_info*>& o)
+{
+  o.push_back(new clone_info);
+  o.push_back(new clone_info);
+  o.back()->cloneid = 12;
+  o.back()->snaps.push_back(10);
+  o.back()->snaps.push_back(12);
+  o.back()->overlap.push_back(make_pair(0, 4096));
+  o.back()->overlap.push_back(make_pair(8192, 4096));
+  o.back()->size = 16384;
+}
+
+// -- obj_list_snap_response_t --
+
+void obj_list_snap_response_t::encode(bufferlist& bl) const
+{
+  ENCODE_START(1, 1, bl);
+  ::encode(clones, bl);
+  ::encode(seq, bl);
+  ENCODE_FINISH(bl);
+}
+
+void obj_list_snap_response_t::decode(bufferlist::iterator& bl)
+{
+  DECODE_START(1, bl);
+  ::decode(clones, bl);
+  ::decode(seq, bl);
+  DECODE_FINISH(bl);
+}
+
+void obj_list_snap_response_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("seq", seq);
+  f->open_array_section("clones");
+  for (vector<clone_info>::const_iterator p = clones.begin(); p != clones.end(); ++p) {
+    f->open_object_section("clone");
+    p->dump(f);
+    f->close_section();
+  }
+  f->close_section();
+}
+
+void obj_list_snap_response_t::generate_test_instances(list<obj_list_snap_response_t*>& o)
+{
+  o.push_back(new obj_list_snap_response_t);
+  o.push_back(new obj_list_snap_response_t);
+  o.back()->seq = 12;
+  o.back()->clones.push_back(clone_info());
+  o.back()->clones.back().cloneid = 12;
+  o.back()->clones.back().snaps.push_back(12);
+  o.back()->clones.back().size = 4096;
+  o.back()->clones.push_back(clone_info());
+  o.back()->clones.back().size = 8192;
+}
+
 // -- watch_info_t --
 
 void watch_info_t::encode(bufferlist& bl) const
@@ -2689,6 +2836,15 @@ ostream& operator<<(ostream& out, const OSDOp& op)
     case CEPH_OSD_OP_ROLLBACK:
       out << " " << snapid_t(op.op.snap.snapid);
       break;
+    case CEPH_OSD_OP_LIST_SNAPS:
+      break;
+    case CEPH_OSD_OP_COPY_FROM:
+      out << " snap " << snapid_t(op.op.copy_from.snapid);
+      if (op.op.copy_from.src_version)
+	out << " v" << op.op.copy_from.src_version;
+      if (op.op.copy_from.flags & CEPH_OSD_COPY_FROM_FLAG_DATA_ONLY)
+	out << " data_only";
+      break;
     default:
       out << " " << op.op.extent.offset << "~" << op.op.extent.length;
       if (op.op.extent.truncate_seq)
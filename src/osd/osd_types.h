@@ -634,6 +634,15 @@ public:
   uint64_t auid;            /// who owns the pg
   __u32 crash_replay_interval; /// seconds to allow clients to replay ACKed but unCOMMITted requests
 
+  /*
+   * Share of each OSD's op threads given to client ops on this pool;
+   * see OSD::op_queue.  Reservation and limit are ops/sec per osd (0 ==
+   * none); weight divides the remaining capacity between pools.
+   */
+  __u32 qos_reservation;
+  __u32 qos_weight;
+  __u32 qos_limit;
+
   /*
    * Pool snaps (global to this pool).  These define a SnapContext for
    * the pool, unless the client manually specifies an alternate
@@ -657,6 +666,7 @@ public:
       snap_seq(0), snap_epoch(0),
       auid(0),
       crash_replay_interval(0),
+      qos_reservation(0), qos_weight(1), qos_limit(0),
       pg_num_mask(0), pgp_num_mask(0) { }
 
   void dump(Formatter *f) const;
@@ -674,6 +684,9 @@ public:
   snapid_t get_snap_seq() const { return snap_seq; }
   uint64_t get_auid() const { return auid; }
   unsigned get_crash_replay_interval() const { return crash_replay_interval; }
+  unsigned get_qos_reservation() const { return qos_reservation; }
+  unsigned get_qos_weight() const { return qos_weight; }
+  unsigned get_qos_limit() const { return qos_limit; }
 
   void set_snap_seq(snapid_t s) { snap_seq = s; }
   void set_snap_epoch(epoch_t e) { snap_epoch = e; }
@@ -1428,7 +1441,17 @@ struct pg_missing_t {
   WRITE_CLASS_ENCODER(item)
 
   map<hobject_t, item> missing;         // oid -> (need v, have v)
-  map<version_t, hobject_t> rmissing;  // v -> oid
+  map<version_t, const hobject_t*> rmissing;  // v -> oid (key in missing)
+
+  pg_missing_t() {}
+  pg_missing_t(const pg_missing_t& o) : missing(o.missing) {
+    rebuild_rmissing();
+  }
+  pg_missing_t& operator=(const pg_missing_t& o) {
+    missing = o.missing;
+    rebuild_rmissing();
+    return *this;
+  }
 
   unsigned int num_missing() const;
   bool have_missing() const;
@@ -1450,6 +1473,13 @@ struct pg_missing_t {
     rmissing.clear();
   }
 
+  /// approximate heap bytes held by missing and rmissing
+  size_t approx_mem_usage() const;
+
+private:
+  void rebuild_rmissing();
+
+public:
   void encode(bufferlist &bl) const;
   void decode(bufferlist::iterator &bl, int64_t pool = -1);
   void dump(Formatter *f) const;
@@ -1461,6 +1491,14 @@ WRITE_CLASS_ENCODER(pg_missing_t)
 ostream& operator<<(ostream& out, const pg_missing_t::item& i);
 ostream& operator<<(ostream& out, const pg_missing_t& missing);
 
+/// approximate heap bytes owned by the strings in an hobject_t
+inline size_t hobject_heap_bytes(const hobject_t& o) {
+  return o.oid.name.capacity() + o.get_key().capacity() + o.nspace.capacity();
+}
+
+/// per-node overhead of a std::map/std::set (color, parent, left, right)
+static const size_t STL_TREE_NODE_OVERHEAD = 4 * sizeof(void*);
+
 /**
  * pg list objects response format
  *
@@ -1648,6 +1686,37 @@ WRITE_CLASS_ENCODER(SnapSet)
 ostream& operator<<(ostream& out, const SnapSet& cs);
 
 
+/*
+ * reply to CEPH_OSD_OP_LIST_SNAPS: each clone of an object, plus the
+ * head if it exists (cloneid CEPH_NOSNAP, no snaps, no overlap)
+ */
+struct clone_info {
+  snapid_t cloneid;
+  vector<snapid_t> snaps;  // ascending
+  vector< pair<uint64_t,uint64_t> > overlap;  // with next newest
+  uint64_t size;
+
+  clone_info() : cloneid(CEPH_NOSNAP), size(0) {}
+
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& bl);
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<clone_info*>& o);
+};
+WRITE_CLASS_ENCODER(clone_info)
+
+struct obj_list_snap_response_t {
+  vector<clone_info> clones;  // ascending
+  snapid_t seq;
+
+  void encode(bufferlist& bl) const;
+  void decode(bufferlist::iterator& bl);
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<obj_list_snap_response_t*>& o);
+};
+WRITE_CLASS_ENCODER(obj_list_snap_response_t)
+
+
 
 #define OI_ATTR "_"
 #define SS_ATTR "snapset"
@@ -429,8 +429,9 @@ ObjectCacher::ObjectCacher(CephContext *cct_, string name, WritebackHandler& wb,
   : perfcounter(NULL),
     cct(cct_), writeback_handler(wb), name(name), lock(l),
     max_dirty(max_dirty), target_dirty(target_dirty), max_size(max_size),
+    max_flush_in_flight(0),
     flush_set_callback(flush_callback), flush_set_callback_arg(flush_callback_arg),
-    flusher_stop(false), flusher_thread(this),
+    flusher_stop(false), flusher_waiting_for_tx(false), flusher_thread(this),
     stat_clean(0), stat_dirty(0), stat_rx(0), stat_tx(0), stat_missing(0),
     stat_error(0), stat_dirty_waiting(0)
 {
@@ -468,6 +469,16 @@ void ObjectCacher::perf_start()
   plb.add_u64_counter(l_objectcacher_write_ops_blocked, "write_ops_blocked");
   plb.add_u64_counter(l_objectcacher_write_bytes_blocked, "write_bytes_blocked");
   plb.add_fl(l_objectcacher_write_time_blocked, "write_time_blocked");
+  plb.add_u64_counter(l_objectcacher_flush_ops, "flush_ops");
+  plb.add_u64_avg(l_objectcacher_flush_size, "flush_size");
+  plb.add_u64_counter(l_objectcacher_flush_bhs_coalesced, "flush_bhs_coalesced");
+  plb.add_u64_counter(l_objectcacher_flush_ops_4k, "flush_ops_le_4k");
+  plb.add_u64_counter(l_objectcacher_flush_ops_16k, "flush_ops_le_16k");
+  plb.add_u64_counter(l_objectcacher_flush_ops_64k, "flush_ops_le_64k");
+  plb.add_u64_counter(l_objectcacher_flush_ops_256k, "flush_ops_le_256k");
+  plb.add_u64_counter(l_objectcacher_flush_ops_1m, "flush_ops_le_1m");
+  plb.add_u64_counter(l_objectcacher_flush_ops_large, "flush_ops_gt_1m");
+  plb.add_u64_counter(l_objectcacher_flusher_window_full, "flusher_window_full");
 
   perfcounter = plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(perfcounter);
@@ -614,33 +625,106 @@ void ObjectCacher::bh_read_finish(int64_t poolid, sobject_t oid, loff_t start,
 }
 
 
-void ObjectCacher::bh_write(BufferHead *bh)
+static bool same_snapc(const SnapContext& a, const SnapContext& b)
+{
+  return a.seq == b.seq && a.snaps == b.snaps;
+}
+
+/*
+ * can right be sent in the same write as left, which is just before it?
+ */
+static bool can_coalesce(ObjectCacher::BufferHead *left,
+			 ObjectCacher::BufferHead *right)
+{
+  return left->is_dirty() && right->is_dirty() &&
+    left->end() == right->start() &&
+    same_snapc(left->snapc, right->snapc);
+}
+
+/*
+ * write bh, along with any dirty bhs either side of it that it can be
+ * merged with, as one write.  returns the number of bytes sent.
+ */
+loff_t ObjectCacher::bh_write(BufferHead *bh)
 {
   ldout(cct, 7) << "bh_write " << *bh << dendl;
-  
+
+  Object *ob = bh->ob;
+  map<loff_t, BufferHead*>::iterator first = ob->data.find(bh->start());
+  assert(first != ob->data.end() && first->second == bh);
+  map<loff_t, BufferHead*>::iterator last = first;
+  while (first != ob->data.begin()) {
+    map<loff_t, BufferHead*>::iterator prev = first;
+    --prev;
+    if (!can_coalesce(prev->second, first->second))
+      break;
+    first = prev;
+  }
+  while (true) {
+    map<loff_t, BufferHead*>::iterator next = last;
+    ++next;
+    if (next == ob->data.end() || !can_coalesce(last->second, next->second))
+      break;
+    last = next;
+  }
+  ++last;
+
+  loff_t start = first->second->start();
+  bufferlist bl;
+  utime_t last_write;
+  int count = 0;
+  for (map<loff_t, BufferHead*>::iterator p = first; p != last; ++p) {
+    bl.append(p->second->bl);
+    if (p->second->last_write > last_write)
+      last_write = p->second->last_write;
+    count++;
+  }
+  if (count > 1)
+    ldout(cct, 10) << "bh_write coalesced " << count << " bhs into "
+		   << start << "~" << bl.length() << dendl;
+
   // finishers
-  C_WriteCommit *oncommit = new C_WriteCommit(this, bh->ob->oloc.pool,
-                                              bh->ob->get_soid(), bh->start(), bh->length());
+  C_WriteCommit *oncommit = new C_WriteCommit(this, ob->oloc.pool,
+                                              ob->get_soid(), start, bl.length());
 
-  ObjectSet *oset = bh->ob->oset;
+  ObjectSet *oset = ob->oset;
 
   // go
-  tid_t tid = writeback_handler.write(bh->ob->get_oid(), bh->ob->get_oloc(),
-				      bh->start(), bh->length(),
-				      bh->snapc, bh->bl, bh->last_write,
+  tid_t tid = writeback_handler.write(ob->get_oid(), ob->get_oloc(),
+				      start, bl.length(),
+				      bh->snapc, bl, last_write,
 				      oset->truncate_size, oset->truncate_seq,
 				      oncommit);
 
   // set bh last_write_tid
   oncommit->tid = tid;
-  bh->ob->last_write_tid = tid;
-  bh->last_write_tid = tid;
-
-  if (perfcounter) {
-    perfcounter->inc(l_objectcacher_data_flushed, bh->length());
+  ob->last_write_tid = tid;
+  for (map<loff_t, BufferHead*>::iterator p = first; p != last; ++p) {
+    p->second->last_write_tid = tid;
+    mark_tx(p->second);
   }
 
-  mark_tx(bh);
+  if (perfcounter) {
+    uint64_t len = bl.length();
+    perfcounter->inc(l_objectcacher_data_flushed, len);
+    perfcounter->inc(l_objectcacher_flush_ops);
+    perfcounter->inc(l_objectcacher_flush_size, len);
+    perfcounter->inc(l_objectcacher_flush_bhs_coalesced, count - 1);
+    if (len <= 4096)
+      perfcounter->inc(l_objectcacher_flush_ops_4k);
+    else if (len <= 16384)
+      perfcounter->inc(l_objectcacher_flush_ops_16k);
+    else if (len <= 65536)
+      perfcounter->inc(l_objectcacher_flush_ops_64k);
+    else if (len <= 262144)
+      perfcounter->inc(l_objectcacher_flush_ops_256k);
+    else if (len <= 1048576)
+      perfcounter->inc(l_objectcacher_flush_ops_1m);
+    else
+      perfcounter->inc(l_objectcacher_flush_ops_large);
+  }
+
+  return bl.length();
 }
 
 void ObjectCacher::lock_ack(int64_t poolid, list<sobject_t>& oids, tid_t tid)
@@ -765,6 +849,12 @@ void ObjectCacher::bh_write_commit(int64_t poolid, sobject_t oid, loff_t start,
     assert(ob->last_commit_tid < tid);
     ob->last_commit_tid = tid;
 
+    // room in the flusher's window?
+    if (flusher_waiting_for_tx && !flusher_window_full()) {
+      flusher_waiting_for_tx = false;
+      flusher_cond.Signal();
+    }
+
     // waiters?
     if (ob->waitfor_commit.count(tid)) {
       list<Context*> ls;
@@ -799,15 +889,27 @@ void ObjectCacher::flush(loff_t amount)
    */
   loff_t did = 0;
   while (amount == 0 || did < amount) {
+    if (flusher_window_full())
+      break;
     BufferHead *bh = (BufferHead*) lru_dirty.lru_get_next_expire();
     if (!bh) break;
     if (bh->last_write > cutoff) break;
 
-    did += bh->length();
-    bh_write(bh);
+    did += bh_write(bh);
   }    
 }
 
+/*
+ * the flusher's writes are limited to max_flush_in_flight bytes at a
+ * time, so the oldest dirty data goes first rather than all of it
+ * queueing up behind the same slow osds.  flushes that are waited for
+ * aren't limited.
+ */
+bool ObjectCacher::flusher_window_full()
+{
+  return max_flush_in_flight > 0 && get_stat_tx() >= max_flush_in_flight;
+}
+
 
 void ObjectCacher::trim(loff_t max)
 {
@@ -1209,7 +1311,8 @@ void ObjectCacher::flusher_entry()
       utime_t cutoff = ceph_clock_now(cct);
       cutoff -= max_dirty_age;
       BufferHead *bh = 0;
-      while ((bh = (BufferHead*)lru_dirty.lru_get_next_expire()) != 0 &&
+      while (!flusher_window_full() &&
+	     (bh = (BufferHead*)lru_dirty.lru_get_next_expire()) != 0 &&
 	     bh->last_write < cutoff) {
 	ldout(cct, 10) << "flusher flushing aged dirty bh " << *bh << dendl;
 	bh_write(bh);
@@ -1217,6 +1320,14 @@ void ObjectCacher::flusher_entry()
     }
     if (flusher_stop)
       break;
+    if (flusher_window_full() && get_stat_dirty() > 0) {
+      // carry on as soon as a write commits, not in a second's time
+      ldout(cct, 10) << "flusher " << get_stat_tx() << " tx >= window "
+		     << max_flush_in_flight << ", waiting" << dendl;
+      if (perfcounter)
+	perfcounter->inc(l_objectcacher_flusher_window_full);
+      flusher_waiting_for_tx = true;
+    }
     flusher_cond.WaitInterval(cct, lock, utime_t(1,0));
   }
   lock.Unlock();
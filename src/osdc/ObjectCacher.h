@@ -36,6 +36,17 @@ enum {
   l_objectcacher_write_bytes_blocked, // total number of write bytes we delayed due to dirty limits
   l_objectcacher_write_time_blocked, // total time in seconds spent blocking a write due to dirty limits
 
+  l_objectcacher_flush_ops, // writes sent to the WritebackHandler
+  l_objectcacher_flush_size, // bytes per write sent to the WritebackHandler
+  l_objectcacher_flush_bhs_coalesced, // extra dirty bhs merged into those writes
+  l_objectcacher_flush_ops_4k, // histogram of write sizes: <= 4k,
+  l_objectcacher_flush_ops_16k, // <= 16k,
+  l_objectcacher_flush_ops_64k, // <= 64k,
+  l_objectcacher_flush_ops_256k, // <= 256k,
+  l_objectcacher_flush_ops_1m, // <= 1m,
+  l_objectcacher_flush_ops_large, // and bigger
+  l_objectcacher_flusher_window_full, // times the flusher waited for writes in flight
+
   l_objectcacher_last,
 };
 
@@ -303,6 +314,7 @@ class ObjectCacher {
   
   int64_t max_dirty, target_dirty, max_size;
   utime_t max_dirty_age;
+  int64_t max_flush_in_flight; // bytes the flusher keeps in flight; 0 is unlimited
 
   flush_set_callback_t flush_set_callback;
   void *flush_set_callback_arg;
@@ -314,6 +326,8 @@ class ObjectCacher {
 
   Cond flusher_cond;
   bool flusher_stop;
+  bool flusher_waiting_for_tx; // wake the flusher when a write commits
+  bool flusher_window_full();
   void flusher_entry();
   class FlusherThread : public Thread {
     ObjectCacher *oc;
@@ -389,7 +403,7 @@ class ObjectCacher {
 
   // io
   void bh_read(BufferHead *bh);
-  void bh_write(BufferHead *bh);
+  loff_t bh_write(BufferHead *bh);
 
   void trim(loff_t max=-1);
   void flush(loff_t amount=0);
@@ -558,6 +572,9 @@ public:
   void set_max_dirty_age(double a) {
     max_dirty_age.set_from_double(a);
   }
+  void set_max_flush_in_flight(int64_t v) {
+    max_flush_in_flight = v;
+  }
 
   // file functions
 
@@ -22,6 +22,7 @@
 
 #include "messages/MPing.h"
 #include "messages/MOSDOp.h"
+#include "messages/MOSDOpBatch.h"
 #include "messages/MOSDOpReply.h"
 #include "messages/MOSDMap.h"
 
@@ -53,8 +54,12 @@ enum {
   l_osdc_op_send,
   l_osdc_op_send_bytes,
   l_osdc_op_resend,
+  l_osdc_op_batch,
+  l_osdc_op_replica,
+  l_osdc_op_replica_eagain,
   l_osdc_op_ack,
   l_osdc_op_commit,
+  l_osdc_op_reply_bytes,
 
   l_osdc_op,
   l_osdc_op_r,
@@ -133,8 +138,12 @@ void Objecter::init()
     pcb.add_u64_counter(l_osdc_op_send, "op_send");
     pcb.add_u64_counter(l_osdc_op_send_bytes, "op_send_bytes");
     pcb.add_u64_counter(l_osdc_op_resend, "op_resend");
+    pcb.add_u64_counter(l_osdc_op_batch, "op_batch");  // batch messages sent
+    pcb.add_u64_counter(l_osdc_op_replica, "op_replica");  // reads sent to a replica
+    pcb.add_u64_counter(l_osdc_op_replica_eagain, "op_replica_eagain");  // ... and bounced to the primary
     pcb.add_u64_counter(l_osdc_op_ack, "op_ack");
     pcb.add_u64_counter(l_osdc_op_commit, "op_commit");
+    pcb.add_u64_counter(l_osdc_op_reply_bytes, "op_reply_bytes");
 
     pcb.add_u64_counter(l_osdc_op, "op");
     pcb.add_u64_counter(l_osdc_op_r, "op_r");
@@ -208,17 +217,40 @@ void Objecter::init()
     lderr(cct) << "error registering admin socket command: "
 	       << cpp_strerror(-ret) << dendl;
   }
+  ret = admin_socket->register_command("objecter_inflight",
+				       m_request_state_hook,
+				       "show in-flight op and byte budget, per osd");
+  if (ret < 0) {
+    lderr(cct) << "error registering admin socket command: "
+	       << cpp_strerror(-ret) << dendl;
+  }
 
   schedule_tick();
   maybe_request_map();
 
+  batch_lock.Lock();
+  batch_stop = false;
+  batch_lock.Unlock();
+
+  rwlock.get_write();
   initialized = true;
+  rwlock.unlock();
 }
 
 void Objecter::shutdown() 
 {
   assert(client_lock.is_locked());
   assert(initialized);
+
+  batch_lock.Lock();
+  batch_stop = true;
+  batch_cond.Signal();
+  bool batching = batch_thread.is_started();
+  batch_lock.Unlock();
+  if (batching)
+    batch_thread.join();
+
+  rwlock.get_write();
   initialized = false;
 
   map<int,OSDSession*>::iterator p;
@@ -226,15 +258,48 @@ void Objecter::shutdown()
     p = osd_sessions.begin();
     close_session(p->second);
   }
+  rwlock.unlock();
 
   if (tick_event) {
     timer.cancel_event(tick_event);
     tick_event = NULL;
   }
 
+  // drop anything still waiting for budget, as op_cancel would
+  throttle_lock.Lock();
+  while (!throttle_waiting.empty()) {
+    Op *op = throttle_waiting.front();
+    throttle_waiting.pop_front();
+    num_throttle_waiting.dec();
+    delete op->onack;
+    delete op->oncommit;
+    delete op;
+  }
+  throttle_waiting_bytes = 0;
+  throttle_lock.Unlock();
+
+  // listings waiting for a pgls slot will never get one
+  map<int, list<Op*> > pgls_parked;
+  pgls_lock.Lock();
+  pgls_parked.swap(pgls_waiting);
+  pgls_lock.Unlock();
+  for (map<int, list<Op*> >::iterator i = pgls_parked.begin();
+       i != pgls_parked.end(); ++i) {
+    for (list<Op*>::iterator j = i->second.begin(); j != i->second.end(); ++j) {
+      Op *op = *j;
+      op->onack->complete(-ESHUTDOWN);
+      delete op->oncommit;
+      delete op;
+    }
+  }
+  pgls_lock.Lock();
+  pgls_in_flight.clear();
+  pgls_lock.Unlock();
+
   if (m_request_state_hook) {
     AdminSocket* admin_socket = cct->get_admin_socket();
     admin_socket->unregister_command("objecter_requests");
+    admin_socket->unregister_command("objecter_inflight");
     delete m_request_state_hook;
     m_request_state_hook = NULL;
   }
@@ -246,6 +311,7 @@ void Objecter::shutdown()
   }
 }
 
+// rwlock held for write
 void Objecter::send_linger(LingerOp *info)
 {
   ldout(cct, 15) << "send_linger " << info->linger_id << dendl;
@@ -261,7 +327,7 @@ void Objecter::send_linger(LingerOp *info)
   o->should_resend = false;
 
   if (info->session) {
-    int r = recalc_op_target(o);
+    int r = recalc_op_target(o, true);
     if (r == RECALC_OP_TARGET_POOL_DNE) {
       linger_check_for_latest_map(info);
     }
@@ -269,17 +335,19 @@ void Objecter::send_linger(LingerOp *info)
 
   if (info->register_tid) {
     // repeat send.  cancel old registeration op, if any.
-    if (ops.count(info->register_tid)) {
-      Op *o = ops[info->register_tid];
-      cancel_op(o);
-    }
-    info->register_tid = _op_submit(o);
-  } else {
-    // first send
-    info->register_tid = op_submit(o);
+    Op *old = _find_op(info->register_tid);
+    if (old)
+      cancel_op(old);
   }
 
-  OSDSession *s = o->session;
+  // registrations are not budgeted; we hold rwlock for write and
+  // can't block on the throttle here.
+  o->tid = last_tid.inc();
+  info->register_tid = o->tid;
+  _op_submit_locked(o, true);
+
+  // no reply can be handled until we drop rwlock, so o is still valid
+  OSDSession *s = o->session->is_homeless() ? NULL : o->session;
   if (info->session != s) {
     info->session_item.remove_myself();
     info->session = s;
@@ -293,28 +361,42 @@ void Objecter::send_linger(LingerOp *info)
 void Objecter::_linger_ack(LingerOp *info, int r) 
 {
   ldout(cct, 10) << "_linger_ack " << info->linger_id << dendl;
-  if (info->on_reg_ack) {
-    info->on_reg_ack->finish(r);
-    delete info->on_reg_ack;
-    info->on_reg_ack = NULL;
+  rwlock.get_write();
+  Context *onack = info->on_reg_ack;
+  info->on_reg_ack = NULL;
+  rwlock.unlock();
+
+  if (onack) {
+    onack->finish(r);
+    delete onack;
   }
 }
 
 void Objecter::_linger_commit(LingerOp *info, int r) 
 {
   ldout(cct, 10) << "_linger_commit " << info->linger_id << dendl;
-  if (info->on_reg_commit) {
-    info->on_reg_commit->finish(r);
-    delete info->on_reg_commit;
-    info->on_reg_commit = NULL;
-  }
+  rwlock.get_write();
+  Context *oncommit = info->on_reg_commit;
+  info->on_reg_commit = NULL;
 
   // only tell the user the first time we do this
   info->registered = true;
   info->pobjver = NULL;
+  rwlock.unlock();
+
+  if (oncommit) {
+    oncommit->finish(r);
+    delete oncommit;
+  }
 }
 
 void Objecter::unregister_linger(uint64_t linger_id)
+{
+  RWLock::WLocker wl(rwlock);
+  _unregister_linger(linger_id);
+}
+
+void Objecter::_unregister_linger(uint64_t linger_id)
 {
   map<uint64_t, LingerOp*>::iterator iter = linger_ops.find(linger_id);
   if (iter != linger_ops.end()) {
@@ -346,6 +428,7 @@ tid_t Objecter::linger(const object_t& oid, const object_locator_t& oloc,
   info->on_reg_ack = onack;
   info->on_reg_commit = onfinish;
 
+  RWLock::WLocker wl(rwlock);
   info->linger_id = ++max_linger_id;
   linger_ops[info->linger_id] = info;
 
@@ -385,9 +468,63 @@ void Objecter::dispatch(Message *m)
   }
 }
 
+void Objecter::MapChurn::watch(pg_t pgid, const vector<int>& acting)
+{
+  pair<map<pg_t, vector<int> >::iterator, bool> r =
+    watched.insert(make_pair(pgid, acting));
+  // ops targeted against different epochs; one of them is stale
+  if (!r.second && r.first->second != acting)
+    moved.insert(pgid);
+}
+
+/// osdmap is the map inc was just applied to.  rwlock held for write
+void Objecter::MapChurn::add(const OSDMap::Incremental& inc,
+			     const OSDMap *osdmap)
+{
+  for (map<int32_t,uint8_t>::const_iterator p = inc.new_state.begin();
+       p != inc.new_state.end();
+       ++p)
+    osds.insert(p->first);
+  for (map<pg_t,vector<int32_t> >::const_iterator p = inc.new_pg_temp.begin();
+       p != inc.new_pg_temp.end();
+       ++p)
+    pg_temp.insert(p->first);
+
+  // a down osd only drops out of the pgs it was in, but one coming up
+  // or in can take over any pg it hashes to; see which of ours it did
+  if (inc.new_up_client.empty() && inc.new_weight.empty() &&
+      inc.new_max_osd < 0 && !inc.crush.length() && !inc.fullmap.length())
+    return;
+  for (map<pg_t, vector<int> >::const_iterator p = watched.begin();
+       p != watched.end();
+       ++p) {
+    if (moved.count(p->first) || !osdmap->have_pg_pool(p->first.pool()))
+      continue;
+    vector<int> acting;
+    osdmap->pg_to_acting_osds(p->first, acting);
+    if (acting != p->second)
+      moved.insert(p->first);
+  }
+}
+
+bool Objecter::MapChurn::touches(const OSDMap *osdmap, pg_t pgid,
+				 const vector<int>& acting) const
+{
+  if (moved.count(pgid))
+    return true;
+  for (vector<int>::const_iterator p = acting.begin(); p != acting.end(); ++p)
+    if (osds.count(*p))
+      return true;
+  if (!pg_temp.empty() && osdmap->have_pg_pool(pgid.pool()) &&
+      pg_temp.count(osdmap->raw_pg_to_pg(pgid)))
+    return true;
+  return false;
+}
+
 void Objecter::scan_requests(bool skipped_map,
 			     map<tid_t, Op*>& need_resend,
-			     list<LingerOp*>& need_resend_linger)
+			     list<LingerOp*>& need_resend_linger,
+			     const MapChurn *churn)
 {
   // check for changed linger mappings (_before_ regular ops)
   for (map<tid_t,LingerOp*>::iterator p = linger_ops.begin();
@@ -395,11 +532,12 @@ void Objecter::scan_requests(bool skipped_map,
        p++) {
     LingerOp *op = p->second;
     ldout(cct, 10) << " checking linger op " << op->linger_id << dendl;
+    bool churned = churn && churn->touches(osdmap, op->pgid, op->acting);
     int r = recalc_linger_op_target(op);
     switch (r) {
     case RECALC_OP_TARGET_NO_ACTION:
       // resend if skipped map; otherwise do nothing.
-      if (!skipped_map)
+      if (!skipped_map && !churned)
 	break;
       // -- fall-thru --
     case RECALC_OP_TARGET_NEED_RESEND:
@@ -412,17 +550,19 @@ void Objecter::scan_requests(bool skipped_map,
     }
   }
 
-  // check for changed request mappings
-  for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-       p != ops.end();
-       ++p) {
-    Op *op = p->second;
+  // check for changed request mappings.  retargeting moves ops between
+  // sessions, so collect them all first.
+  list<Op*> ls;
+  _get_ops(ls);
+  for (list<Op*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    Op *op = *p;
     ldout(cct, 10) << " checking op " << op->tid << dendl;
-    int r = recalc_op_target(op);
+    bool churned = churn && churn->touches(osdmap, op->pgid, op->acting);
+    int r = recalc_op_target(op, true);
     switch (r) {
     case RECALC_OP_TARGET_NO_ACTION:
       // resend if skipped map; otherwise do nothing.
-      if (!skipped_map)
+      if (!skipped_map && !churned)
 	break;
       // -- fall-thru --
     case RECALC_OP_TARGET_NEED_RESEND:
@@ -448,6 +588,8 @@ void Objecter::handle_osd_map(MOSDMap *m)
     return;
   }
 
+  rwlock.get_write();
+
   bool was_pauserd = osdmap->test_flag(CEPH_OSDMAP_PAUSERD);
   bool was_pausewr = osdmap->test_flag(CEPH_OSDMAP_PAUSEWR) || osdmap->test_flag(CEPH_OSDMAP_FULL);
   
@@ -468,7 +610,22 @@ void Objecter::handle_osd_map(MOSDMap *m)
             << dendl;
 
     if (osdmap->get_epoch()) {
-      // we want incrementals
+      // we want incrementals.  apply the whole run, then look at
+      // sessions and retarget ops once against the newest map.
+      MapChurn churn;
+      if (m->get_last() > osdmap->get_epoch() + 1) {
+	// note where everything in flight maps now, so the run can tell
+	// which of those pgs move along the way
+	for (map<tid_t,LingerOp*>::iterator p = linger_ops.begin();
+	     p != linger_ops.end();
+	     ++p)
+	  churn.watch(p->second->pgid, p->second->acting);
+	list<Op*> ls;
+	_get_ops(ls);
+	for (list<Op*>::iterator p = ls.begin(); p != ls.end(); ++p)
+	  churn.watch((*p)->pgid, (*p)->acting);
+      }
+      bool advanced = false;
       for (epoch_t e = osdmap->get_epoch() + 1;
 	   e <= m->get_last();
 	   e++) {
@@ -479,6 +636,9 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  OSDMap::Incremental inc(m->incremental_maps[e]);
 	  osdmap->apply_incremental(inc);
 	  logger->inc(l_osdc_map_inc);
+	  // the newest epoch's changes show up in the retargeting itself
+	  if (e < m->get_last())
+	    churn.add(inc, osdmap);
 	}
 	else if (m->maps.count(e)) {
 	  ldout(cct, 3) << "handle_osd_map decoding full epoch " << e << dendl;
@@ -497,24 +657,30 @@ void Objecter::handle_osd_map(MOSDMap *m)
 	  skipped_map = true;
 	  continue;
 	}
+	assert(e == osdmap->get_epoch());
+	advanced = true;
+      }
+
+      if (advanced) {
 	logger->set(l_osdc_map_epoch, osdmap->get_epoch());
-	
-	scan_requests(skipped_map, need_resend, need_resend_linger);
 
-	// osd addr changes?
+	// osd addr changes?  do this first, so that the ops parked by
+	// close_session() are retargeted by the scan below.  an osd that
+	// went down and came back along the way has lost our ops too.
 	for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
 	     p != osd_sessions.end(); ) {
 	  OSDSession *s = p->second;
 	  p++;
 	  if (osdmap->is_up(s->osd)) {
-	    if (s->con && s->con->get_peer_addr() != osdmap->get_inst(s->osd).addr)
+	    if ((s->con && s->con->get_peer_addr() != osdmap->get_inst(s->osd).addr) ||
+		churn.osds.count(s->osd))
 	      close_session(s);
 	  } else {
 	    close_session(s);
 	  }
 	}
 
-	assert(e == osdmap->get_epoch());
+	scan_requests(skipped_map, need_resend, need_resend_linger, &churn);
       }
       
     } else {
@@ -541,24 +707,28 @@ void Objecter::handle_osd_map(MOSDMap *m)
   
   // unpause requests?
   if ((was_pauserd && !pauserd) ||
-      (was_pausewr && !pausewr))
-    for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-	 p != ops.end();
-	 p++) {
-      Op *op = p->second;
+      (was_pausewr && !pausewr)) {
+    list<Op*> ls;
+    _get_ops(ls);
+    for (list<Op*>::iterator p = ls.begin(); p != ls.end(); p++) {
+      Op *op = *p;
       if (op->paused &&
 	  !((op->flags & CEPH_OSD_FLAG_READ) && pauserd) &&   // not still paused as a read
 	  !((op->flags & CEPH_OSD_FLAG_WRITE) && pausewr))    // not still paused as a write
 	need_resend[op->tid] = op;
     }
+  }
 
   // resend requests
   for (map<tid_t, Op*>::iterator p = need_resend.begin(); p != need_resend.end(); p++) {
     Op *op = p->second;
     if (op->should_resend) {
-      if (op->session) {
+      OSDSession *s = op->session;
+      if (!s->is_homeless()) {
 	logger->inc(l_osdc_op_resend);
+	s->lock.Lock();
 	send_op(op);
+	s->lock.Unlock();
       }
     } else {
       cancel_op(op);
@@ -572,28 +742,33 @@ void Objecter::handle_osd_map(MOSDMap *m)
     }
   }
 
-  dump_active();
+  _dump_active();
   
-  // finish any Contexts that were waiting on a map update
+  // collect any Contexts that were waiting on a map update; they are
+  // called once we drop rwlock
+  list<pair<Context*, int> > waiters;
   map<epoch_t,list< pair< Context*, int > > >::iterator p =
     waiting_for_map.begin();
   while (p != waiting_for_map.end() &&
 	 p->first <= osdmap->get_epoch()) {
-    //go through the list and call the onfinish methods
-    for (list<pair<Context*, int> >::iterator i = p->second.begin();
-	 i != p->second.end(); ++i) {
-      i->first->finish(i->second);
-      delete i->first;
-    }
+    waiters.splice(waiters.end(), p->second);
     waiting_for_map.erase(p++);
   }
 
-  m->put();
-
   monc->sub_got("osdmap", osdmap->get_epoch());
 
   if (!waiting_for_map.empty())
     maybe_request_map();
+
+  rwlock.unlock();
+
+  for (list<pair<Context*, int> >::iterator i = waiters.begin();
+       i != waiters.end(); ++i) {
+    i->first->finish(i->second);
+    delete i->first;
+  }
+
+  m->put();
 }
 
 void Objecter::C_Op_Map_Latest::finish(int r)
@@ -604,26 +779,37 @@ void Objecter::C_Op_Map_Latest::finish(int r)
   }
 
   Mutex::Locker l(objecter->client_lock);
+  objecter->rwlock.get_write();
 
   map<tid_t, Op*>::iterator iter =
     objecter->check_latest_map_ops.find(tid);
   if (iter == objecter->check_latest_map_ops.end()) {
+    objecter->rwlock.unlock();
     return;
   }
 
   Op *op = iter->second;
   objecter->check_latest_map_ops.erase(iter);
 
+  Context *onack = NULL, *oncommit = NULL;
   if (r == 0) { // we had the latest map
-    if (op->onack) {
-      op->onack->complete(-ENOENT);
-    }
-    if (op->oncommit) {
-      op->oncommit->complete(-ENOENT);
-    }
-    op->session_item.remove_myself();
-    objecter->ops.erase(op->tid);
-    delete op;
+    onack = op->onack;
+    oncommit = op->oncommit;
+    op->onack = op->oncommit = NULL;
+    if (onack)
+      objecter->num_unacked.dec();
+    if (oncommit)
+      objecter->num_uncommitted.dec();
+    objecter->finish_op(op);
+  }
+  objecter->rwlock.unlock();
+  objecter->kick_throttle_waiting();
+
+  if (onack) {
+    onack->complete(-ENOENT);
+  }
+  if (oncommit) {
+    oncommit->complete(-ENOENT);
   }
 }
 
@@ -635,24 +821,32 @@ void Objecter::C_Linger_Map_Latest::finish(int r)
   }
 
   Mutex::Locker l(objecter->client_lock);
+  objecter->rwlock.get_write();
 
   map<uint64_t, LingerOp*>::iterator iter =
     objecter->check_latest_map_lingers.find(linger_id);
   if (iter == objecter->check_latest_map_lingers.end()) {
+    objecter->rwlock.unlock();
     return;
   }
 
   LingerOp *op = iter->second;
   objecter->check_latest_map_lingers.erase(iter);
 
+  Context *onack = NULL, *oncommit = NULL;
   if (r == 0) { // we had the latest map
-    if (op->on_reg_ack) {
-      op->on_reg_ack->complete(-ENOENT);
-    }
-    if (op->on_reg_commit) {
-      op->on_reg_commit->complete(-ENOENT);
-    }
-    objecter->unregister_linger(op->linger_id);
+    onack = op->on_reg_ack;
+    oncommit = op->on_reg_commit;
+    op->on_reg_ack = op->on_reg_commit = NULL;
+    objecter->_unregister_linger(op->linger_id);
+  }
+  objecter->rwlock.unlock();
+
+  if (onack) {
+    onack->complete(-ENOENT);
+  }
+  if (oncommit) {
+    oncommit->complete(-ENOENT);
   }
   op->put();
 }
@@ -727,8 +921,24 @@ void Objecter::close_session(OSDSession *s)
     s->con->put();
     logger->inc(l_osdc_osd_session_close);
   }
-  s->ops.clear();
-  s->linger_ops.clear();
+
+  // park its ops until they are retargeted
+  s->lock.Lock();
+  map<tid_t,Op*> ls;
+  ls.swap(s->ops);
+  s->batch.clear();
+  s->lock.Unlock();
+  for (map<tid_t,Op*>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    p->second->session = NULL;
+    p->second->batched = false;
+    _session_op_assign(homeless_session, p->second);
+  }
+  while (!s->linger_ops.empty()) {
+    LingerOp *op = s->linger_ops.front();
+    op->session = NULL;
+    op->session_item.remove_myself();
+  }
+
   osd_sessions.erase(s->osd);
   delete s;
 
@@ -737,13 +947,18 @@ void Objecter::close_session(OSDSession *s)
 
 void Objecter::wait_for_osd_map()
 {
-  if (osdmap->get_epoch()) return;
+  rwlock.get_write();
+  if (osdmap->get_epoch()) {
+    rwlock.unlock();
+    return;
+  }
   Mutex lock("");
   Cond cond;
   bool done;
   lock.Lock();
   C_SafeCond *context = new C_SafeCond(&lock, &cond, &done, NULL);
   waiting_for_map[0].push_back(pair<Context*, int>(context, 0));
+  rwlock.unlock();
   while (!done)
     cond.Wait(lock);
   lock.Unlock();
@@ -766,30 +981,31 @@ void Objecter::maybe_request_map()
 
 void Objecter::wait_for_new_map(Context *c, epoch_t epoch, int err)
 {
+  RWLock::WLocker wl(rwlock);
   waiting_for_map[epoch].push_back(pair<Context *, int>(c, err));
   maybe_request_map();
 }
 
+// rwlock held for write
 void Objecter::kick_requests(OSDSession *session)
 {
   ldout(cct, 10) << "kick_requests for osd." << session->osd << dendl;
 
-  // resend ops
-  map<tid_t,Op*> resend;  // resend in tid order
-  for (xlist<Op*>::iterator p = session->ops.begin(); !p.end();) {
-    Op *op = *p;
-    ++p;
+  // resend ops, in tid order
+  session->lock.Lock();
+  map<tid_t,Op*> resend = session->ops;
+  session->lock.Unlock();
+  for (map<tid_t,Op*>::iterator p = resend.begin(); p != resend.end(); ++p) {
+    Op *op = p->second;
     logger->inc(l_osdc_op_resend);
     if (op->should_resend) {
-      resend[op->tid] = op;
+      session->lock.Lock();
+      send_op(op);
+      session->lock.Unlock();
     } else {
       cancel_op(op);
     }
   }
-  while (!resend.empty()) {
-    send_op(resend.begin()->second);
-    resend.erase(resend.begin());
-  }
 
   // resend lingers
   map<uint64_t, LingerOp*> lresend;  // resend in order
@@ -826,16 +1042,25 @@ void Objecter::tick()
   utime_t cutoff = ceph_clock_now(cct);
   cutoff -= cct->_conf->objecter_timeout;  // timeout
 
+  rwlock.get_read();
+
   unsigned laggy_ops = 0;
-  for (hash_map<tid_t,Op*>::iterator p = ops.begin();
-       p != ops.end();
-       p++) {
-    Op *op = p->second;
-    if (op->session && op->stamp < cutoff) {
-      ldout(cct, 2) << " tid " << p->first << " on osd." << op->session->osd << " is laggy" << dendl;
-      toping.insert(op->session);
-      ++laggy_ops;
+  for (map<int,OSDSession*>::iterator siter = osd_sessions.begin();
+       siter != osd_sessions.end();
+       ++siter) {
+    OSDSession *s = siter->second;
+    s->lock.Lock();
+    for (map<tid_t,Op*>::iterator p = s->ops.begin();
+	 p != s->ops.end();
+	 p++) {
+      Op *op = p->second;
+      if (op->stamp < cutoff) {
+	ldout(cct, 2) << " tid " << p->first << " on osd." << s->osd << " is laggy" << dendl;
+	toping.insert(s);
+	++laggy_ops;
+      }
     }
+    s->lock.Unlock();
   }
   for (map<uint64_t,LingerOp*>::iterator p = linger_ops.begin();
        p != linger_ops.end();
@@ -851,7 +1076,11 @@ void Objecter::tick()
   logger->set(l_osdc_op_laggy, laggy_ops);
   logger->set(l_osdc_osd_laggy, toping.size());
 
-  if (num_homeless_ops || !toping.empty())
+  homeless_session->lock.Lock();
+  bool homeless = !homeless_session->ops.empty();
+  homeless_session->lock.Unlock();
+
+  if (homeless || !toping.empty())
     maybe_request_map();
 
   if (!toping.empty()) {
@@ -863,6 +1092,11 @@ void Objecter::tick()
       messenger->send_message(new MPing, (*i)->con);
     }
   }
+
+  rwlock.unlock();
+
+  // in case budget came back some way other than an op reply
+  kick_throttle_waiting();
     
   // reschedule
   schedule_tick();
@@ -887,6 +1121,7 @@ void Objecter::resend_mon_ops()
     logger->inc(l_osdc_poolop_resend);
   }
 
+  RWLock::RLocker rl(rwlock);
   for (map<tid_t, Op*>::iterator p = check_latest_map_ops.begin();
        p != check_latest_map_ops.end();
        ++p) {
@@ -908,13 +1143,33 @@ void Objecter::resend_mon_ops()
 
 tid_t Objecter::op_submit(Op *op)
 {
-  assert(client_lock.is_locked());
   assert(initialized);
 
   assert(op->ops.size() == op->out_bl.size());
   assert(op->ops.size() == op->out_rval.size());
   assert(op->ops.size() == op->out_handler.size());
 
+  op->submitted = ceph_clock_now(cct);
+
+  if ((op->flags & CEPH_OSD_FLAG_OBJECTER_NOBLOCK) && keep_balanced_budget) {
+    // don't block; if it doesn't fit, or others are already waiting
+    // their turn, it waits its own in line
+    throttle_lock.Lock();
+    if (!throttle_waiting.empty() || !try_take_op_budget(op)) {
+      op->budget = calc_op_budget(op);
+      throttle_waiting.push_back(op);
+      throttle_waiting_bytes += op->budget;
+      num_throttle_waiting.inc();
+      ldout(cct, 10) << "op_submit parked " << op->oid << ", "
+		     << throttle_waiting.size() << " ops waiting for budget"
+		     << dendl;
+      throttle_lock.Unlock();
+      return 0;
+    }
+    throttle_lock.Unlock();
+    return _op_submit(op);
+  }
+
   // throttle.  before we look at any state, because
   // take_op_budget() may drop our lock while it blocks.
   take_op_budget(op);
@@ -922,33 +1177,83 @@ tid_t Objecter::op_submit(Op *op)
   return _op_submit(op);
 }
 
+/// send parked ops, in order, for as long as they fit.  no locks held.
+void Objecter::kick_throttle_waiting()
+{
+  if (!num_throttle_waiting.read())
+    return;
+
+  list<Op*> ready;
+  throttle_lock.Lock();
+  while (!throttle_waiting.empty()) {
+    Op *op = throttle_waiting.front();
+    uint64_t budget = op->budget;
+    if (!try_take_op_budget(op))
+      break;
+    throttle_waiting.pop_front();
+    throttle_waiting_bytes -= budget;
+    num_throttle_waiting.dec();
+    ready.push_back(op);
+  }
+  throttle_lock.Unlock();
+
+  while (!ready.empty()) {
+    _op_submit(ready.front());
+    ready.pop_front();
+  }
+}
+
 tid_t Objecter::_op_submit(Op *op)
 {
-  // pick tid
-  tid_t mytid = ++last_tid;
-  op->tid = mytid;
+  // pick tid.  the op may be replied to and freed as soon as it is
+  // sent, so remember it.
+  tid_t tid = last_tid.inc();
+  op->tid = tid;
+
+  rwlock.get_read();
+  int r = _op_submit_locked(op, false);
+  rwlock.unlock();
+  if (r == -EAGAIN) {
+    // we need to open a session or look up the pool; try again with
+    // rwlock held for write.
+    rwlock.get_write();
+    r = _op_submit_locked(op, true);
+    rwlock.unlock();
+  }
+  assert(r == 0);
+  return tid;
+}
+
+/*
+ * rwlock held for read or write.  returns -EAGAIN, having changed
+ * nothing, if the op can't be submitted without the write lock.
+ */
+int Objecter::_op_submit_locked(Op *op, bool wlocked)
+{
   assert(client_inc >= 0);
 
   // pick target
-  bool check_for_latest_map = false;
-  num_homeless_ops++;  // initially; recalc_op_target() will decrement if it finds a target
-  int r = recalc_op_target(op);
-  check_for_latest_map = (r == RECALC_OP_TARGET_POOL_DNE);
+  int r = recalc_op_target(op, wlocked);
+  if (r == RECALC_OP_TARGET_NEED_SESSION ||
+      (r == RECALC_OP_TARGET_POOL_DNE && !wlocked))
+    return -EAGAIN;
+  if (!op->session)
+    _session_op_assign(homeless_session, op);
+  OSDSession *s = op->session;
 
   // add to gather set(s)
   if (op->onack) {
-    ++num_unacked;
+    num_unacked.inc();
   } else {
     ldout(cct, 20) << " note: not requesting ack" << dendl;
   }
   if (op->oncommit) {
-    ++num_uncommitted;
+    num_uncommitted.inc();
   } else {
     ldout(cct, 20) << " note: not requesting commit" << dendl;
   }
-  ops[op->tid] = op;
 
-  logger->set(l_osdc_op_active, ops.size());
+  logger->set(l_osdc_op_active, num_in_flight.inc());
 
   logger->inc(l_osdc_op);
   if ((op->flags & (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE)) == (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE))
@@ -997,39 +1302,42 @@ tid_t Objecter::_op_submit(Op *op)
   ldout(cct, 10) << "op_submit oid " << op->oid
            << " " << op->oloc 
 	   << " " << op->ops << " tid " << op->tid
-           << " osd." << (op->session ? op->session->osd : -1)
+           << " osd." << s->osd
            << dendl;
 
   assert(op->flags & (CEPH_OSD_FLAG_READ|CEPH_OSD_FLAG_WRITE));
 
+  if (r == RECALC_OP_TARGET_POOL_DNE) {
+    op_check_for_latest_map(op);
+  }
+
   if ((op->flags & CEPH_OSD_FLAG_WRITE) &&
       osdmap->test_flag(CEPH_OSDMAP_PAUSEWR)) {
-    ldout(cct, 10) << " paused modify " << op << " tid " << last_tid << dendl;
+    ldout(cct, 10) << " paused modify " << op << " tid " << op->tid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if ((op->flags & CEPH_OSD_FLAG_READ) &&
 	     osdmap->test_flag(CEPH_OSDMAP_PAUSERD)) {
-    ldout(cct, 10) << " paused read " << op << " tid " << last_tid << dendl;
+    ldout(cct, 10) << " paused read " << op << " tid " << op->tid << dendl;
     op->paused = true;
     maybe_request_map();
   } else if ((op->flags & CEPH_OSD_FLAG_WRITE) &&
 	     osdmap->test_flag(CEPH_OSDMAP_FULL)) {
-    ldout(cct, 0) << " FULL, paused modify " << op << " tid " << last_tid << dendl;
+    ldout(cct, 0) << " FULL, paused modify " << op << " tid " << op->tid << dendl;
     op->paused = true;
     maybe_request_map();
-  } else if (op->session) {
+  } else if (!s->is_homeless()) {
+    // don't touch op after this; the reply may already be in
+    s->lock.Lock();
     send_op(op);
+    s->lock.Unlock();
   } else {
     maybe_request_map();
   }
 
-  if (check_for_latest_map) {
-    op_check_for_latest_map(op);
-  }
-
-  ldout(cct, 5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
+  ldout(cct, 5) << num_unacked.read() << " unacked, " << num_uncommitted.read() << " uncommitted" << dendl;
   
-  return op->tid;
+  return 0;
 }
 
 bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
@@ -1045,7 +1353,12 @@ bool Objecter::is_pg_changed(vector<int>& o, vector<int>& n, bool any_change)
   return false;      // same primary (tho replicas may have changed)
 }
 
-int Objecter::recalc_op_target(Op *op)
+/*
+ * rwlock held.  with only the read lock we can't open a new session;
+ * in that case return RECALC_OP_TARGET_NEED_SESSION without touching
+ * the op, and let the caller retry with the write lock.
+ */
+int Objecter::recalc_op_target(Op *op, bool wlocked)
 {
   vector<int> acting;
   pg_t pgid = op->pgid;
@@ -1056,21 +1369,42 @@ int Objecter::recalc_op_target(Op *op)
   }
   osdmap->pg_to_acting_osds(pgid, acting);
 
-  if (op->pgid != pgid || is_pg_changed(op->acting, acting, op->used_replica)) {
-    op->pgid = pgid;
-    op->acting = acting;
-    ldout(cct, 10) << "recalc_op_target tid " << op->tid
-	     << " pgid " << pgid << " acting " << acting << dendl;
-
-    OSDSession *s = NULL;
-    op->used_replica = false;
+  // an op parked in the homeless session goes out as soon as there is
+  // somewhere to send it
+  bool homeless = !op->session || op->session->is_homeless();
+  if (op->pgid != pgid || is_pg_changed(op->acting, acting, op->used_replica) ||
+      (homeless && !acting.empty())) {
+    int osd = -1;
+    bool used_replica = false;
     if (acting.size()) {
-      int osd;
-      bool read = (op->flags & CEPH_OSD_FLAG_READ) && (op->flags & CEPH_OSD_FLAG_WRITE) == 0;
-      if (read && (op->flags & CEPH_OSD_FLAG_BALANCE_READS)) {
+      bool read = (op->flags & CEPH_OSD_FLAG_READ) &&
+	(op->flags & (CEPH_OSD_FLAG_WRITE | CEPH_OSD_FLAG_PGOP)) == 0;
+      if (read && (op->flags & CEPH_OSD_FLAG_OBJECTER_LEAST_LOADED)) {
+	// fewest ops in flight from us; ties go to the primary
+	unsigned best = 0;
+	size_t best_ops = 0;
+	for (unsigned i = 0; i < acting.size(); ++i) {
+	  size_t n = 0;
+	  map<int,OSDSession*>::iterator p = osd_sessions.find(acting[i]);
+	  if (p != osd_sessions.end()) {
+	    p->second->lock.Lock();
+	    n = p->second->ops.size();
+	    p->second->lock.Unlock();
+	  }
+	  if (i == 0 || n < best_ops) {
+	    best = i;
+	    best_ops = n;
+	  }
+	}
+	if (best)
+	  used_replica = true;
+	osd = acting[best];
+	ldout(cct, 10) << " chose least loaded osd." << osd << " (" << best_ops
+		       << " ops) of " << acting << dendl;
+      } else if (read && (op->flags & CEPH_OSD_FLAG_BALANCE_READS)) {
 	int p = rand() % acting.size();
 	if (p)
-	  op->used_replica = true;
+	  used_replica = true;
 	osd = acting[p];
 	ldout(cct, 10) << " chose random osd." << osd << " of " << acting << dendl;
       } else if (read && (op->flags & CEPH_OSD_FLAG_LOCALIZE_READS)) {
@@ -1082,7 +1416,7 @@ int Objecter::recalc_op_target(Op *op)
          * order.) */
 	for (i = acting.size()-1; i > 0; --i) {
 	  if (osdmap->get_addr(acting[i]).is_same_host(messenger->get_myaddr())) {
-	    op->used_replica = true;
+	    used_replica = true;
 	    ldout(cct, 10) << " chose local osd." << acting[i] << " of " << acting << dendl;
 	    break;
 	  }
@@ -1090,18 +1424,31 @@ int Objecter::recalc_op_target(Op *op)
 	osd = acting[i];
       } else
 	osd = acting[0];
-      s = get_session(osd);
     }
 
-    if (op->session != s) {
-      if (!op->session)
-	num_homeless_ops--;
-      op->session_item.remove_myself();
-      op->session = s;
-      if (s)
-	s->ops.push_back(&op->session_item);
+    OSDSession *s = homeless_session;
+    if (osd >= 0) {
+      map<int,OSDSession*>::iterator p = osd_sessions.find(osd);
+      if (p != osd_sessions.end())
+	s = p->second;
+      else if (wlocked)
+	s = get_session(osd);
       else
-	num_homeless_ops++;
+	return RECALC_OP_TARGET_NEED_SESSION;
+    }
+
+    op->pgid = pgid;
+    op->acting = acting;
+    op->used_replica = used_replica;
+    if (used_replica)
+      logger->inc(l_osdc_op_replica);
+    ldout(cct, 10) << "recalc_op_target tid " << op->tid
+	     << " pgid " << pgid << " acting " << acting << dendl;
+
+    if (op->session != s) {
+      if (op->session)
+	_session_op_remove(op);
+      _session_op_assign(s, op);
     }
     return RECALC_OP_TARGET_NEED_RESEND;
   }
@@ -1118,7 +1465,8 @@ bool Objecter::recalc_linger_op_target(LingerOp *linger_op)
   }
   osdmap->pg_to_acting_osds(pgid, acting);
 
-  if (pgid != linger_op->pgid || is_pg_changed(linger_op->acting, acting, true)) {
+  if (pgid != linger_op->pgid || is_pg_changed(linger_op->acting, acting, true) ||
+      (!linger_op->session && !acting.empty())) {
     linger_op->pgid = pgid;
     linger_op->acting = acting;
     ldout(cct, 10) << "recalc_linger_op_target tid " << linger_op->linger_id
@@ -1150,33 +1498,132 @@ void Objecter::cancel_op(Op *op)
 }
 
 void Objecter::finish_op(Op *op)
+{
+  OSDSession *s = op->session;
+  s->lock.Lock();
+  _finish_op(op);
+  s->lock.Unlock();
+}
+
+// op->session->lock held
+void Objecter::_finish_op(Op *op)
 {
   ldout(cct, 15) << "finish_op " << op->tid << dendl;
+  assert(op->session->lock.is_locked());
 
-  op->session_item.remove_myself();
+  op->session->ops.erase(op->tid);
   if (op->budgeted)
     put_op_budget(op);
   if (op->con)
     op->con->put();
 
-  ops.erase(op->tid);
-  logger->set(l_osdc_op_active, ops.size());
+  logger->set(l_osdc_op_active, num_in_flight.dec());
 
   delete op;
 }
 
+void Objecter::_session_op_assign(OSDSession *s, Op *op)
+{
+  assert(!op->session);
+  s->lock.Lock();
+  op->session = s;
+  s->ops[op->tid] = op;
+  s->lock.Unlock();
+}
+
+void Objecter::_session_op_remove(Op *op)
+{
+  OSDSession *s = op->session;
+  s->lock.Lock();
+  s->ops.erase(op->tid);
+  if (op->batched) {
+    s->batch.remove(op->tid);
+    op->batched = false;
+  }
+  op->session = NULL;
+  s->lock.Unlock();
+}
+
+// rwlock held
+Objecter::Op *Objecter::_find_op(tid_t tid)
+{
+  list<OSDSession*> sessions;
+  for (map<int,OSDSession*>::iterator p = osd_sessions.begin(); p != osd_sessions.end(); ++p)
+    sessions.push_back(p->second);
+  sessions.push_back(homeless_session);
+
+  for (list<OSDSession*>::iterator p = sessions.begin(); p != sessions.end(); ++p) {
+    Mutex::Locker l((*p)->lock);
+    map<tid_t,Op*>::iterator q = (*p)->ops.find(tid);
+    if (q != (*p)->ops.end())
+      return q->second;
+  }
+  return NULL;
+}
+
+/*
+ * rwlock held for write.  the ops can't go away until we drop it, so
+ * it is safe to look at them after dropping the session locks.
+ */
+void Objecter::_get_ops(list<Op*>& ls)
+{
+  list<OSDSession*> sessions;
+  for (map<int,OSDSession*>::iterator p = osd_sessions.begin(); p != osd_sessions.end(); ++p)
+    sessions.push_back(p->second);
+  sessions.push_back(homeless_session);
+
+  for (list<OSDSession*>::iterator p = sessions.begin(); p != sessions.end(); ++p) {
+    Mutex::Locker l((*p)->lock);
+    for (map<tid_t,Op*>::iterator q = (*p)->ops.begin(); q != (*p)->ops.end(); ++q)
+      ls.push_back(q->second);
+  }
+}
+
+// op->session->lock held
 void Objecter::send_op(Op *op)
 {
-  ldout(cct, 15) << "send_op " << op->tid << " to osd." << op->session->osd << dendl;
+  OSDSession *s = op->session;
+  ldout(cct, 15) << "send_op " << op->tid << " to osd." << s->osd << dendl;
+  assert(s->lock.is_locked());
+  assert(s->con);
+
+  if ((op->flags & CEPH_OSD_FLAG_OBJECTER_BATCH) &&
+      cct->_conf->objecter_batch_max_ops > 1 &&
+      s->con->has_feature(CEPH_FEATURE_OSD_OP_BATCH)) {
+    op->stamp = ceph_clock_now(cct);
+    if (!op->batched) {
+      op->batched = true;
+      s->batch.push_back(op->tid);
+    }
+    if (s->batch.size() >= (unsigned)cct->_conf->objecter_batch_max_ops) {
+      _flush_batch(s);
+    } else if (s->batch.size() == 1) {
+      Mutex::Locker l(batch_lock);
+      if (!batch_stop && !batch_thread.is_started())
+	batch_thread.create();
+      if (batch_pending.empty())
+	batch_cond.Signal();
+      batch_pending.insert(s->osd);
+    }
+    return;
+  }
+
+  messenger->send_message(_prepare_osd_op(op), s->con);
+}
 
-  int flags = op->flags;
+// op->session->lock held
+MOSDOp *Objecter::_prepare_osd_op(Op *op)
+{
+  int flags = op->flags & ~(CEPH_OSD_FLAG_OBJECTER_BATCH |
+			    CEPH_OSD_FLAG_OBJECTER_LEAST_LOADED |
+			    CEPH_OSD_FLAG_OBJECTER_NOBLOCK);
+  if (op->flags & CEPH_OSD_FLAG_OBJECTER_LEAST_LOADED)
+    flags |= CEPH_OSD_FLAG_BALANCE_READS;
   if (op->oncommit)
     flags |= CEPH_OSD_FLAG_ONDISK;
   if (op->onack)
     flags |= CEPH_OSD_FLAG_ACK;
 
-  assert(op->session->con);
-
   // preallocated rx buffer?
   if (op->con) {
     ldout(cct, 20) << " revoking rx buffer for " << op->tid << " on " << op->con << dendl;
@@ -1214,7 +1661,78 @@ void Objecter::send_op(Op *op)
   logger->inc(l_osdc_op_send);
   logger->inc(l_osdc_op_send_bytes, m->get_data().length());
 
-  messenger->send_message(m, op->session->con);
+  return m;
+}
+
+/*
+ * send everything queued in s->batch.  ops that finished or moved to
+ * another session since they were queued are skipped.
+ */
+void Objecter::_flush_batch(OSDSession *s)
+{
+  assert(s->lock.is_locked());
+  list<tid_t> ls;
+  ls.swap(s->batch);
+
+  vector<MOSDOp*> msgs;
+  for (list<tid_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
+    map<tid_t,Op*>::iterator q = s->ops.find(*p);
+    if (q == s->ops.end())
+      continue;
+    q->second->batched = false;
+    msgs.push_back(_prepare_osd_op(q->second));
+  }
+  if (msgs.empty())
+    return;
+
+  if (msgs.size() == 1) {
+    messenger->send_message(msgs[0], s->con);
+    return;
+  }
+  ldout(cct, 15) << "flush_batch " << msgs.size() << " ops to osd." << s->osd << dendl;
+  MOSDOpBatch *m = new MOSDOpBatch;
+  m->ops.swap(msgs);
+  logger->inc(l_osdc_op_batch);
+  messenger->send_message(m, s->con);
+}
+
+/*
+ * the first op queued for a batch wakes us; wait out the batch window
+ * so that others can join it, then send whatever we have.
+ */
+void Objecter::batch_entry()
+{
+  ldout(cct, 10) << "batch_entry start" << dendl;
+  batch_lock.Lock();
+  while (!batch_stop) {
+    if (batch_pending.empty()) {
+      batch_cond.Wait(batch_lock);
+      continue;
+    }
+    utime_t window;
+    window.set_from_double(cct->_conf->objecter_batch_window);
+    batch_cond.WaitInterval(cct, batch_lock, window);
+
+    set<int> ls;
+    ls.swap(batch_pending);
+    batch_lock.Unlock();
+
+    rwlock.get_read();
+    for (set<int>::iterator p = ls.begin(); p != ls.end(); ++p) {
+      map<int,OSDSession*>::iterator q = osd_sessions.find(*p);
+      if (q == osd_sessions.end())
+	continue;
+      OSDSession *s = q->second;
+      s->lock.Lock();
+      _flush_batch(s);
+      s->lock.Unlock();
+    }
+    rwlock.unlock();
+
+    batch_lock.Lock();
+  }
+  batch_lock.Unlock();
+  ldout(cct, 10) << "batch_entry finish" << dendl;
 }
 
 int Objecter::calc_op_budget(Op *op)
@@ -1237,36 +1755,77 @@ int Objecter::calc_op_budget(Op *op)
   return op_budget;
 }
 
+bool Objecter::try_take_op_budget(Op *op)
+{
+  int op_budget = calc_op_budget(op);
+  if (!op_throttle_ops.get_or_fail(1))
+    return false;
+  if (!op_throttle_bytes.get_or_fail(op_budget)) {
+    op_throttle_ops.put(1);
+    return false;
+  }
+  op->budget = op_budget;
+  op->budgeted = true;
+  return true;
+}
+
 void Objecter::throttle_op(Op *op, int op_budget)
 {
   if (!op_budget)
     op_budget = calc_op_budget(op);
+  // librados submits without client_lock; others still hold it
+  bool locked = client_lock.is_locked_by_me();
   if (!op_throttle_bytes.get_or_fail(op_budget)) { //couldn't take right now
-    client_lock.Unlock();
+    if (locked)
+      client_lock.Unlock();
     op_throttle_bytes.get(op_budget);
-    client_lock.Lock();
+    if (locked)
+      client_lock.Lock();
   }
   if (!op_throttle_ops.get_or_fail(1)) { //couldn't take right now
-    client_lock.Unlock();
+    if (locked)
+      client_lock.Unlock();
     op_throttle_ops.get(1);
-    client_lock.Lock();
+    if (locked)
+      client_lock.Lock();
   }
 }
 
 /* This function DOES put the passed message before returning */
 void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 {
-  assert(client_lock.is_locked());
-  assert(initialized);
   ldout(cct, 10) << "in handle_osd_op_reply" << dendl;
 
   // get pio
   tid_t tid = m->get_tid();
 
-  if (ops.count(tid) == 0) {
+  rwlock.get_read();
+  if (!initialized) {
+    rwlock.unlock();
+    m->put();
+    return;
+  }
+
+  logger->inc(l_osdc_op_reply_bytes, m->get_data().length());
+
+  // the op lives in the session of the osd we sent it to
+  OSDSession *s = NULL;
+  Op *op = NULL;
+  map<int,OSDSession*>::iterator siter = osd_sessions.find(m->get_source().num());
+  if (siter != osd_sessions.end()) {
+    s = siter->second;
+    s->lock.Lock();
+    map<tid_t,Op*>::iterator p = s->ops.find(tid);
+    if (p != s->ops.end())
+      op = p->second;
+    else
+      s->lock.Unlock();
+  }
+  if (!op) {
     ldout(cct, 7) << "handle_osd_op_reply " << tid
 	    << (m->is_ondisk() ? " ondisk":(m->is_onnvram() ? " onnvram":" ack"))
 	    << " ... stray" << dendl;
+    rwlock.unlock();
     m->put();
     return;
   }
@@ -1276,14 +1835,15 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 		<< " v " << m->get_version() << " in " << m->get_pg()
 		<< " attempt " << m->get_retry_attempt()
 		<< dendl;
-  Op *op = ops[tid];
 
   if (m->get_retry_attempt() >= 0) {
     if (m->get_retry_attempt() != (op->attempts - 1)) {
       ldout(cct, 7) << " ignoring reply from attempt " << m->get_retry_attempt()
 		    << " from " << m->get_source_inst()
 		    << "; last attempt " << (op->attempts - 1) << " sent to "
-		    << op->session->con->get_peer_addr() << dendl;
+		    << s->con->get_peer_addr() << dendl;
+      s->lock.Unlock();
+      rwlock.unlock();
       m->put();
       return;
     }
@@ -1300,11 +1860,34 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
 
   if (rc == -EAGAIN) {
     ldout(cct, 7) << " got -EAGAIN, resubmitting" << dendl;
+    if (op->used_replica) {
+      // the replica can't answer (it's behind, or the op needs the
+      // primary); this time go to the primary
+      ldout(cct, 7) << " replica bounced tid " << op->tid
+		    << ", sending to primary" << dendl;
+      logger->inc(l_osdc_op_replica_eagain);
+      op->flags &= ~CEPH_OSD_FLAG_REPLICA_READS;
+    }
     if (op->onack)
-      num_unacked--;
+      num_unacked.dec();
     if (op->oncommit)
-      num_uncommitted--;
-    op_submit(op);
+      num_uncommitted.dec();
+    num_in_flight.dec();
+
+    // it goes out again under a new tid; take it out of the session
+    // and drop the rx buffer posted for the old one
+    if (op->con) {
+      op->con->revoke_rx_buffer(op->tid);
+      op->con->put();
+      op->con = NULL;
+    }
+    s->ops.erase(op->tid);
+    op->session = NULL;
+    s->lock.Unlock();
+    rwlock.unlock();
+
+    // it keeps the budget it already has
+    _op_submit(op);
     m->put();
     return;
   }
@@ -1350,14 +1933,14 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
     op->version = m->get_version();
     onack = op->onack;
     op->onack = 0;  // only do callback once
-    num_unacked--;
+    num_unacked.dec();
     logger->inc(l_osdc_op_ack);
   }
   if (op->oncommit && (m->is_ondisk() || rc)) {
     ldout(cct, 15) << "handle_osd_op_reply safe" << dendl;
     oncommit = op->oncommit;
     op->oncommit = 0;
-    num_uncommitted--;
+    num_uncommitted.dec();
     logger->inc(l_osdc_op_commit);
   }
 
@@ -1372,10 +1955,12 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
   // done with this tid?
   if (!op->onack && !op->oncommit) {
     ldout(cct, 15) << "handle_osd_op_reply completed tid " << tid << dendl;
-    finish_op(op);
+    _finish_op(op);
   }
+  s->lock.Unlock();
+  rwlock.unlock();
   
-  ldout(cct, 5) << num_unacked << " unacked, " << num_uncommitted << " uncommitted" << dendl;
+  ldout(cct, 5) << num_unacked.read() << " unacked, " << num_uncommitted.read() << " uncommitted" << dendl;
 
   // do callbacks
   if (onack) {
@@ -1388,6 +1973,8 @@ void Objecter::handle_osd_op_reply(MOSDOpReply *m)
   }
 
   m->put();
+
+  kick_throttle_waiting();
 }
 
 
@@ -1408,22 +1995,29 @@ void Objecter::list_objects(ListContext *list_context, Context *onfinish) {
     return;
   }
 
+  rwlock.get_read();
   const pg_pool_t *pool = osdmap->get_pg_pool(list_context->pool_id);
   int pg_num = pool->get_pg_num();
+  rwlock.unlock();
 
   if (list_context->starting_pg_num == 0) {     // there can't be zero pgs!
     list_context->starting_pg_num = pg_num;
-    ldout(cct, 20) << pg_num << " placement groups" << dendl;
+    list_context->current_pg = list_context->begin_pg();
+    ldout(cct, 20) << pg_num << " placement groups, listing "
+		   << list_context->begin_pg() << " to " << list_context->end_pg()
+		   << dendl;
   }
   if (list_context->starting_pg_num != pg_num) {
     // start reading from the beginning; the pgs have changed
     ldout(cct, 10) << "The placement groups have changed, restarting with " << pg_num << dendl;
-    list_context->current_pg = 0;
+    list_context->starting_pg_num = pg_num;
+    list_context->current_pg = list_context->begin_pg();
     list_context->cookie = collection_list_handle_t();
     list_context->current_pg_epoch = 0;
-    list_context->starting_pg_num = pg_num;
   }
-  if (list_context->current_pg == pg_num){ //this context got all the way through
+  if (list_context->current_pg >= list_context->end_pg()) {
+    //this context got all the way through
+    list_context->at_end = true;
     onfinish->finish(0);
     delete onfinish;
     return;
@@ -1449,9 +2043,54 @@ void Objecter::list_objects(ListContext *list_context, Context *onfinish) {
   o->pgid = pg_t(list_context->current_pg, list_context->pool_id, -1);
   o->precalc_pgid = true;
 
+  rwlock.get_read();
+  vector<int> acting;
+  osdmap->pg_to_acting_osds(o->pgid, acting);
+  rwlock.unlock();
+  onack->osd = acting.empty() ? -1 : acting[0];
+  _pgls_submit(o, onack->osd);
+}
+
+/*
+ * a pool listing can have many cursors going at once; keep the number
+ * of pgls ops each osd sees from us bounded.  the osd is worked out
+ * when the op is queued, so this is only approximate across map
+ * changes.
+ */
+void Objecter::_pgls_submit(Op *o, int osd)
+{
+  int max = cct->_conf->objecter_pgls_per_osd;
+  pgls_lock.Lock();
+  if (max > 0 && pgls_in_flight[osd] >= max) {
+    ldout(cct, 20) << "_pgls_submit osd." << osd << " has " << pgls_in_flight[osd]
+		   << " in flight, waiting" << dendl;
+    pgls_waiting[osd].push_back(o);
+    pgls_lock.Unlock();
+    return;
+  }
+  pgls_in_flight[osd]++;
+  pgls_lock.Unlock();
   op_submit(o);
 }
 
+void Objecter::_pgls_finish(int osd)
+{
+  Op *next = NULL;
+  pgls_lock.Lock();
+  map<int, list<Op*> >::iterator p = pgls_waiting.find(osd);
+  if (p != pgls_waiting.end()) {
+    next = p->second.front();
+    p->second.pop_front();
+    if (p->second.empty())
+      pgls_waiting.erase(p);
+  } else if (--pgls_in_flight[osd] == 0) {
+    pgls_in_flight.erase(osd);
+  }
+  pgls_lock.Unlock();
+  if (next)
+    op_submit(next);
+}
+
 void Objecter::_list_reply(ListContext *list_context, int r, bufferlist *bl,
 			   Context *final_finish, epoch_t reply_epoch)
 {
@@ -1502,7 +2141,7 @@ void Objecter::_list_reply(ListContext *list_context, int r, bufferlist *bl,
   ++list_context->current_pg;
   list_context->current_pg_epoch = 0;
   ldout(cct, 20) << "emptied current pg, moving on to next one:" << list_context->current_pg << dendl;
-  if (list_context->current_pg < list_context->starting_pg_num){ // we have more pgs to go through
+  if (list_context->current_pg < list_context->end_pg()) { // we have more pgs to go through
     list_context->cookie = collection_list_handle_t();
     delete bl;
     list_objects(list_context, final_finish);
@@ -1534,7 +2173,7 @@ int Objecter::create_pool_snap(int64_t pool, string& snap_name, Context *onfinis
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = snap_name;
   op->onfinish = onfinish;
@@ -1567,7 +2206,7 @@ int Objecter::allocate_selfmanaged_snap(int64_t pool, snapid_t *psnapid,
   ldout(cct, 10) << "allocate_selfmanaged_snap; pool: " << pool << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   C_SelfmanagedSnap *fin = new C_SelfmanagedSnap(psnapid, onfinish);
   op->onfinish = fin;
@@ -1592,7 +2231,7 @@ int Objecter::delete_pool_snap(int64_t pool, string& snap_name, Context *onfinis
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = snap_name;
   op->onfinish = onfinish;
@@ -1610,7 +2249,7 @@ int Objecter::delete_selfmanaged_snap(int64_t pool, snapid_t snap,
 	   << snap << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->onfinish = onfinish;
   op->pool_op = POOL_OP_DELETE_UNMANAGED_SNAP;
@@ -1633,7 +2272,7 @@ int Objecter::create_pool(string& name, Context *onfinish, uint64_t auid,
   PoolOp *op = new PoolOp;
   if (!op)
     return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = 0;
   op->name = name;
   op->onfinish = onfinish;
@@ -1656,7 +2295,7 @@ int Objecter::delete_pool(int64_t pool, Context *onfinish)
 
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = "delete";
   op->onfinish = onfinish;
@@ -1679,7 +2318,7 @@ int Objecter::change_pool_auid(int64_t pool, Context *onfinish, uint64_t auid)
   ldout(cct, 10) << "change_pool_auid " << pool << " to " << auid << dendl;
   PoolOp *op = new PoolOp;
   if (!op) return -ENOMEM;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pool = pool;
   op->name = "change_pool_auid";
   op->onfinish = onfinish;
@@ -1757,7 +2396,7 @@ void Objecter::get_pool_stats(list<string>& pools, map<string,pool_stat_t> *resu
   ldout(cct, 10) << "get_pool_stats " << pools << dendl;
 
   PoolStatOp *op = new PoolStatOp;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->pools = pools;
   op->pool_stats = result;
   op->onfinish = onfinish;
@@ -1810,7 +2449,7 @@ void Objecter::get_fs_stats(ceph_statfs& result, Context *onfinish)
   ldout(cct, 10) << "get_fs_stats" << dendl;
 
   StatfsOp *op = new StatfsOp;
-  op->tid = ++last_tid;
+  op->tid = last_tid.inc();
   op->stats = &result;
   op->onfinish = onfinish;
   statfs_ops[op->tid] = op;
@@ -1982,6 +2621,7 @@ void Objecter::ms_handle_reset(Connection *con)
 {
   if (con->get_peer_type() == CEPH_ENTITY_TYPE_OSD) {
     //
+    RWLock::WLocker wl(rwlock);
     int osd = osdmap->identify_osd(con->get_peer_addr());
     if (osd >= 0) {
       ldout(cct, 1) << "ms_handle_reset on osd." << osd << dendl;
@@ -2009,10 +2649,19 @@ void Objecter::ms_handle_remote_reset(Connection *con)
 
 void Objecter::dump_active()
 {
-  ldout(cct, 20) << "dump_active .. " << num_homeless_ops << " homeless" << dendl;
-  for (hash_map<tid_t,Op*>::iterator p = ops.begin(); p != ops.end(); p++) {
-    Op *op = p->second;
-    ldout(cct, 20) << op->tid << "\t" << op->pgid << "\tosd." << (op->session ? op->session->osd : -1)
+  RWLock::WLocker wl(rwlock);
+  _dump_active();
+}
+
+// rwlock held for write
+void Objecter::_dump_active()
+{
+  list<Op*> ls;
+  _get_ops(ls);
+  ldout(cct, 20) << "dump_active .. " << homeless_session->ops.size() << " homeless" << dendl;
+  for (list<Op*>::iterator p = ls.begin(); p != ls.end(); p++) {
+    Op *op = *p;
+    ldout(cct, 20) << op->tid << "\t" << op->pgid << "\tosd." << op->session->osd
 	    << "\t" << op->oid << "\t" << op->ops << dendl;
   }
 }
@@ -2020,6 +2669,7 @@ void Objecter::dump_active()
 void Objecter::dump_requests(Formatter& fmt) const
 {
   assert(client_lock.is_locked());
+  RWLock::RLocker rl(rwlock);
 
   fmt.open_object_section("requests");
   dump_ops(fmt);
@@ -2030,17 +2680,84 @@ void Objecter::dump_requests(Formatter& fmt) const
   fmt.close_section(); // requests object
 }
 
+/*
+ * the throttle state, and for each osd session how much we have in
+ * flight there and for how long the oldest op has been waiting on it.
+ * no client_lock needed.
+ */
+void Objecter::dump_inflight(Formatter& fmt)
+{
+  utime_t now = ceph_clock_now(cct);
+
+  fmt.open_object_section("inflight");
+  fmt.dump_int("ops", op_throttle_ops.get_current());
+  fmt.dump_int("max_ops", op_throttle_ops.get_max());
+  fmt.dump_int("bytes", op_throttle_bytes.get_current());
+  fmt.dump_int("max_bytes", op_throttle_bytes.get_max());
+  throttle_lock.Lock();
+  fmt.dump_unsigned("throttled_ops", throttle_waiting.size());
+  fmt.dump_unsigned("throttled_bytes", throttle_waiting_bytes);
+  if (!throttle_waiting.empty())
+    fmt.dump_float("oldest_throttled_age",
+		   now - throttle_waiting.front()->submitted);
+  throttle_lock.Unlock();
+
+  RWLock::RLocker rl(rwlock);
+  list<OSDSession*> sessions;
+  for (map<int,OSDSession*>::iterator p = osd_sessions.begin();
+       p != osd_sessions.end();
+       ++p)
+    sessions.push_back(p->second);
+  sessions.push_back(homeless_session);
+
+  fmt.open_array_section("sessions");
+  for (list<OSDSession*>::iterator p = sessions.begin();
+       p != sessions.end();
+       ++p) {
+    OSDSession *s = *p;
+    Mutex::Locker l(s->lock);
+    if (s->ops.empty() && !s->con)
+      continue;
+    uint64_t bytes = 0;
+    utime_t oldest;
+    for (map<tid_t,Op*>::iterator q = s->ops.begin(); q != s->ops.end(); ++q) {
+      bytes += q->second->budget;
+      if (oldest == utime_t() || q->second->submitted < oldest)
+	oldest = q->second->submitted;
+    }
+    fmt.open_object_section("session");
+    fmt.dump_int("osd", s->osd);
+    fmt.dump_unsigned("ops", s->ops.size());
+    fmt.dump_unsigned("bytes", bytes);
+    fmt.dump_float("oldest_op_age", s->ops.empty() ? 0.0 : (double)(now - oldest));
+    fmt.close_section();
+  }
+  fmt.close_section(); // sessions array
+  fmt.close_section(); // inflight object
+}
+
 void Objecter::dump_ops(Formatter& fmt) const
 {
   fmt.open_array_section("ops");
-  for (hash_map<tid_t,Op*>::const_iterator p = ops.begin();
-       p != ops.end();
+  for (map<int,OSDSession*>::const_iterator p = osd_sessions.begin();
+       p != osd_sessions.end();
+       ++p)
+    dump_session_ops(p->second, fmt);
+  dump_session_ops(homeless_session, fmt);
+  fmt.close_section(); // ops array
+}
+
+void Objecter::dump_session_ops(OSDSession *s, Formatter& fmt) const
+{
+  Mutex::Locker l(s->lock);
+  for (map<tid_t,Op*>::const_iterator p = s->ops.begin();
+       p != s->ops.end();
        ++p) {
     Op *op = p->second;
     fmt.open_object_section("op");
     fmt.dump_unsigned("tid", op->tid);
     fmt.dump_stream("pg") << op->pgid;
-    fmt.dump_int("osd", op->session ? op->session->osd : -1);
+    fmt.dump_int("osd", s->osd);
     fmt.dump_stream("last_sent") << op->stamp;
     fmt.dump_int("attempts", op->attempts);
     fmt.dump_stream("object_id") << op->oid;
@@ -2059,7 +2776,6 @@ void Objecter::dump_ops(Formatter& fmt) const
 
     fmt.close_section(); // op object
   }
-  fmt.close_section(); // ops array
 }
 
 void Objecter::dump_linger_ops(Formatter& fmt) const
@@ -2152,9 +2868,13 @@ bool Objecter::RequestStateHook::call(std::string command, std::string args, buf
 {
   stringstream ss;
   JSONFormatter formatter(true);
-  m_objecter->client_lock.Lock();
-  m_objecter->dump_requests(formatter);
-  m_objecter->client_lock.Unlock();
+  if (command == "objecter_inflight") {
+    m_objecter->dump_inflight(formatter);
+  } else {
+    m_objecter->client_lock.Lock();
+    m_objecter->dump_requests(formatter);
+    m_objecter->client_lock.Unlock();
+  }
   formatter.flush(ss);
   out.append(ss);
   return true;
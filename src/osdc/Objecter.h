@@ -18,12 +18,17 @@
 #include "include/types.h"
 #include "include/buffer.h"
 #include "include/xlist.h"
+#include "include/rados/rados_types.hpp"
 
 #include "osd/OSDMap.h"
 #include "messages/MOSDOp.h"
 
 #include "common/admin_socket.h"
+#include "common/Cond.h"
+#include "common/Thread.h"
 #include "common/Timer.h"
+#include "common/RWLock.h"
+#include "include/atomic.h"
 
 #include <list>
 #include <map>
@@ -45,6 +50,32 @@ class MStatfsReply;
 
 class PerfCounters;
 
+/*
+ * client-side op flag: the op may wait briefly in the objecter so it
+ * can share an MOSDOpBatch with other ops headed to the same osd.  it
+ * is stripped before the op goes on the wire.
+ */
+#define CEPH_OSD_FLAG_OBJECTER_BATCH  0x40000000
+
+/*
+ * client-side op flag: send a read to whichever osd in the acting set
+ * we have the fewest ops outstanding to.  it goes on the wire as
+ * CEPH_OSD_FLAG_BALANCE_READS.
+ */
+#define CEPH_OSD_FLAG_OBJECTER_LEAST_LOADED  0x20000000
+
+/*
+ * client-side op flag: never block the submitter on the in-flight
+ * throttle.  an op that doesn't fit is parked and sent, in order, as
+ * earlier ops complete.  stripped before the op goes on the wire.
+ */
+#define CEPH_OSD_FLAG_OBJECTER_NOBLOCK  0x10000000
+
+/// flags that say a read may be served by a replica
+#define CEPH_OSD_FLAG_REPLICA_READS (CEPH_OSD_FLAG_BALANCE_READS |	\
+				     CEPH_OSD_FLAG_LOCALIZE_READS |	\
+				     CEPH_OSD_FLAG_OBJECTER_LEAST_LOADED)
+
 // -----------------------------------------
 
 struct ObjectOperation {
@@ -162,6 +193,11 @@ struct ObjectOperation {
       add_pgls_filter(CEPH_OSD_OP_PGLS_FILTER, count, filter, cookie, start_epoch);
     flags |= CEPH_OSD_FLAG_PGOP;
   }
+  void pg_hot(uint64_t count) {
+    OSDOp& osd_op = add_op(CEPH_OSD_OP_PGHOT);
+    osd_op.op.pgls.count = count;
+    flags |= CEPH_OSD_FLAG_PGOP;
+  }
 
   void create(bool excl) {
     OSDOp& o = add_op(CEPH_OSD_OP_CREATE);
@@ -246,6 +282,10 @@ struct ObjectOperation {
     bufferlist bl;
     add_data(CEPH_OSD_OP_DELETE, 0, 0, bl);
   }
+  void rollback(snapid_t snapid) {
+    OSDOp& osd_op = add_op(CEPH_OSD_OP_ROLLBACK);
+    osd_op.op.snap.snapid = snapid;
+  }
   void mapext(uint64_t off, uint64_t len) {
     bufferlist bl;
     add_data(CEPH_OSD_OP_MAPEXT, off, len, bl);
@@ -259,6 +299,19 @@ struct ObjectOperation {
     add_clone_range(CEPH_OSD_OP_CLONERANGE, dst_offset, len, src_oid, src_offset, CEPH_NOSNAP);
   }
 
+  // have the osd pull src (which may live in another pg or pool) into
+  // this object itself, so the data never passes through us
+  void copy_from(const object_t& src, snapid_t snapid,
+		 const object_locator_t& src_oloc, version_t src_version,
+		 unsigned copy_flags) {
+    OSDOp& osd_op = add_op(CEPH_OSD_OP_COPY_FROM);
+    osd_op.op.copy_from.snapid = snapid;
+    osd_op.op.copy_from.src_version = src_version;
+    osd_op.op.copy_from.flags = copy_flags;
+    ::encode(src, osd_op.indata);
+    ::encode(src_oloc, osd_op.indata);
+  }
+
   // object attrs
   void getxattr(const char *name, bufferlist *pbl, int *prval) {
     bufferlist bl;
@@ -307,6 +360,40 @@ struct ObjectOperation {
       }	
     }
   };
+  struct C_ObjectOperation_decodesnaps : public Context {
+    bufferlist bl;
+    librados::snap_set_t *psnaps;
+    int *prval;
+    C_ObjectOperation_decodesnaps(librados::snap_set_t *ps, int *pr)
+      : psnaps(ps), prval(pr) {}
+    void finish(int r) {
+      if (r >= 0) {
+	bufferlist::iterator p = bl.begin();
+	try {
+	  obj_list_snap_response_t resp;
+	  ::decode(resp, p);
+	  if (psnaps) {
+	    psnaps->clones.clear();
+	    for (vector<clone_info>::iterator ci = resp.clones.begin();
+		 ci != resp.clones.end();
+		 ++ci) {
+	      librados::clone_info_t clone;
+	      clone.cloneid = ci->cloneid;
+	      clone.snaps.assign(ci->snaps.begin(), ci->snaps.end());
+	      clone.overlap = ci->overlap;
+	      clone.size = ci->size;
+	      psnaps->clones.push_back(clone);
+	    }
+	    psnaps->seq = resp.seq;
+	  }
+	}
+	catch (buffer::error& e) {
+	  if (prval)
+	    *prval = -EIO;
+	}
+      }
+    }
+  };
   void getxattrs(std::map<std::string,bufferlist> *pattrs, int *prval) {
     add_op(CEPH_OSD_OP_GETXATTRS);
     if (pattrs || prval) {
@@ -317,6 +404,18 @@ struct ObjectOperation {
       out_rval[p] = prval;
     }
   }
+  // must be sent at CEPH_SNAPDIR
+  void list_snaps(librados::snap_set_t *psnaps, int *prval) {
+    add_op(CEPH_OSD_OP_LIST_SNAPS);
+    if (psnaps || prval) {
+      unsigned p = ops.size() - 1;
+      C_ObjectOperation_decodesnaps *h =
+	new C_ObjectOperation_decodesnaps(psnaps, prval);
+      out_handler[p] = h;
+      out_bl[p] = &h->bl;
+      out_rval[p] = prval;
+    }
+  }
   void setxattr(const char *name, const bufferlist& bl) {
     add_xattr(CEPH_OSD_OP_SETXATTR, name, bl);
   }
@@ -472,6 +571,15 @@ struct ObjectOperation {
     add_call(CEPH_OSD_OP_CALL, cname, method, indata);
   }
 
+  void call(const char *cname, const char *method, bufferlist &indata,
+	    bufferlist *outdata, Context *ctx, int *prval) {
+    add_call(CEPH_OSD_OP_CALL, cname, method, indata);
+    unsigned p = ops.size() - 1;
+    out_handler[p] = ctx;
+    out_bl[p] = outdata;
+    out_rval[p] = prval;
+  }
+
   // watch/notify
   void watch(uint64_t cookie, uint64_t ver, bool set) {
     bufferlist inbl;
@@ -520,6 +628,30 @@ struct ObjectOperation {
 // ----------------
 
 
+/*
+ * Locking:
+ *
+ * The Objecter no longer relies on the caller's client_lock to
+ * protect the read/write path.  Instead,
+ *
+ *  - rwlock protects the osdmap, the set of OSDSessions, the linger
+ *    ops and the map-check state.  The op submission and reply paths
+ *    take it for read; anything that changes the map, opens or closes
+ *    sessions or moves ops between sessions takes it for write.
+ *  - each OSDSession::lock protects that session's ops and the
+ *    in-flight state of those ops, including the pending batch.
+ *  - batch_lock protects the set of sessions with a pending batch.
+ *  - pgls_lock protects the per-osd listing throttle; nothing else is
+ *    taken while it is held.
+ *  - tids and op counts are atomics.
+ *
+ * Lock order is client_lock -> rwlock -> OSDSession::lock ->
+ * batch_lock.  Only one
+ * session lock is held at a time, and no callbacks are made with
+ * rwlock or a session lock held.  Map handling, linger, pool and
+ * statfs ops still expect the caller to hold client_lock, as before;
+ * op_submit() and handle_osd_op_reply() do not.
+ */
 class Objecter {
  public:  
   Messenger *messenger;
@@ -530,11 +662,12 @@ class Objecter {
   bool initialized;
  
  private:
-  tid_t last_tid;
+  atomic_t last_tid;
   int client_inc;
   uint64_t max_linger_id;
-  int num_unacked;
-  int num_uncommitted;
+  atomic_t num_unacked;
+  atomic_t num_uncommitted;
+  atomic_t num_in_flight;
   int global_op_flags; // flags which are applied to each IO op
   bool keep_balanced_budget;
   bool honor_osdmap_full;
@@ -545,6 +678,7 @@ class Objecter {
   version_t last_seen_pgmap_version;
 
   Mutex &client_lock;
+  mutable RWLock rwlock;
   SafeTimer &timer;
 
   PerfCounters *logger;
@@ -559,6 +693,24 @@ class Objecter {
   void schedule_tick();
   void tick();
 
+  // op batching
+  Mutex batch_lock;        ///< protects batch_pending, batch_stop
+  Cond batch_cond;
+  set<int> batch_pending;  ///< osds with a partial batch queued
+  bool batch_stop;
+
+  class BatchThread : public Thread {
+    Objecter *objecter;
+  public:
+    BatchThread(Objecter *o) : objecter(o) {}
+    void *entry() {
+      objecter->batch_entry();
+      return 0;
+    }
+  } batch_thread;
+
+  void batch_entry();
+
   class RequestStateHook : public AdminSocketHook {
     Objecter *m_objecter;
   public:
@@ -577,7 +729,6 @@ public:
 
   struct Op {
     OSDSession *session;
-    xlist<Op*>::item session_item;
     int incarnation;
     
     object_t oid;
@@ -613,17 +764,22 @@ public:
     epoch_t *reply_epoch;
 
     utime_t stamp;
+    utime_t submitted;  ///< when the caller handed it to us
 
     bool precalc_pgid;
 
     bool budgeted;
+    int budget;  ///< bytes taken from op_throttle_bytes
 
     /// true if we should resend this message on failure
     bool should_resend;
 
+    /// queued in session->batch, waiting to go out
+    bool batched;
+
     Op(const object_t& o, const object_locator_t& ol, vector<OSDOp>& op,
        int f, Context *ac, Context *co, eversion_t *ov) :
-      session(NULL), session_item(this), incarnation(0),
+      session(NULL), incarnation(0),
       oid(o), oloc(ol),
       used_replica(false), con(NULL),
       snapid(CEPH_NOSNAP),
@@ -631,8 +787,8 @@ public:
       flags(f), priority(0), onack(ac), oncommit(co),
       tid(0), attempts(0),
       paused(false), objver(ov), reply_epoch(NULL), precalc_pgid(false),
-      budgeted(false),
-      should_resend(true) {
+      budgeted(false), budget(0),
+      should_resend(true), batched(false) {
       ops.swap(op);
       
       /* initialize out_* to match op vector */
@@ -702,6 +858,11 @@ public:
 
 
   // Pools and statistics 
+  /*
+   * a cursor over the objects in a pool, or in part @a part of
+   * @a num_parts of it.  parts are ranges of pgs, so several cursors
+   * over different parts of the same pool can run concurrently.
+   */
   struct ListContext {
     int current_pg;
     collection_list_handle_t cookie;
@@ -718,9 +879,20 @@ public:
 
     bufferlist extra_info;
 
+    uint32_t part, num_parts;
+
     ListContext() : current_pg(0), current_pg_epoch(0), starting_pg_num(0),
 		    at_end(false), pool_id(0),
-		    pool_snap_seq(0), max_entries(0) {}
+		    pool_snap_seq(0), max_entries(0),
+		    part(0), num_parts(1) {}
+
+    /// this cursor covers pgs [begin_pg(), end_pg())
+    int begin_pg() const {
+      return (uint64_t)starting_pg_num * part / num_parts;
+    }
+    int end_pg() const {
+      return (uint64_t)starting_pg_num * (part + 1) / num_parts;
+    }
   };
 
   struct C_List : public Context {
@@ -729,9 +901,12 @@ public:
     bufferlist *bl;
     Objecter *objecter;
     epoch_t epoch;
+    int osd;  ///< where we counted this op against the pgls throttle
     C_List(ListContext *lc, Context * finish, bufferlist *b, Objecter *ob) :
-      list_context(lc), final_finish(finish), bl(b), objecter(ob), epoch(0) {}
+      list_context(lc), final_finish(finish), bl(b), objecter(ob), epoch(0),
+      osd(-1) {}
     void finish(int r) {
+      objecter->_pgls_finish(osd);
       if (r >= 0) {
         objecter->_list_reply(list_context, r, bl, final_finish, epoch);
       } else {
@@ -852,21 +1027,28 @@ public:
 
   // -- osd sessions --
   struct OSDSession {
-    xlist<Op*> ops;
+    Mutex lock;                ///< protects ops
+    map<tid_t,Op*> ops;
+    list<tid_t> batch;         ///< ops waiting to share a message
     xlist<LingerOp*> linger_ops;
     int osd;
     int incarnation;
     Connection *con;
 
-    OSDSession(int o) : osd(o), incarnation(0), con(NULL) {}
+    OSDSession(int o) :
+      lock("Objecter::OSDSession::lock"),
+      osd(o), incarnation(0), con(NULL) {}
+    bool is_homeless() const {
+      return osd < 0;
+    }
   };
   map<int,OSDSession*> osd_sessions;
 
 
  private:
-  // pending ops
-  hash_map<tid_t,Op*>       ops;
-  int                       num_homeless_ops;
+  // pending ops.  every op in flight lives in exactly one session;
+  // those we have no osd for are parked in the homeless session.
+  OSDSession               *homeless_session;
   map<uint64_t, LingerOp*>  linger_ops;
   map<tid_t,PoolStatOp*>    poolstat_ops;
   map<tid_t,StatfsOp*>      statfs_ops;
@@ -880,20 +1062,29 @@ public:
   map<epoch_t,list< pair<Context*, int> > > waiting_for_map;
 
   void send_op(Op *op);
+  MOSDOp *_prepare_osd_op(Op *op);
+  void _flush_batch(OSDSession *s);
   void cancel_op(Op *op);
   void finish_op(Op *op);
+  void _finish_op(Op *op);
+  void _session_op_assign(OSDSession *s, Op *op);
+  void _session_op_remove(Op *op);
+  Op *_find_op(tid_t tid);
+  void _get_ops(list<Op*>& ls);
   bool is_pg_changed(vector<int>& a, vector<int>& b, bool any_change=false);
   enum recalc_op_target_result {
     RECALC_OP_TARGET_NO_ACTION = 0,
     RECALC_OP_TARGET_NEED_RESEND,
     RECALC_OP_TARGET_POOL_DNE,
+    RECALC_OP_TARGET_NEED_SESSION,
   };
-  int recalc_op_target(Op *op);
+  int recalc_op_target(Op *op, bool wlocked);
   bool recalc_linger_op_target(LingerOp *op);
 
   void send_linger(LingerOp *info);
   void _linger_ack(LingerOp *info, int r);
   void _linger_commit(LingerOp *info, int r);
+  void _unregister_linger(uint64_t linger_id);
 
   void op_check_for_latest_map(Op *op);
   void op_cancel_map_check(Op *op);
@@ -909,13 +1100,21 @@ public:
   void _list_reply(ListContext *list_context, int r, bufferlist *bl, Context *final_finish,
 		   epoch_t reply_epoch);
 
+  // object listing throttle
+  Mutex pgls_lock;
+  map<int, int> pgls_in_flight;      ///< osd -> pgls ops sent
+  map<int, list<Op*> > pgls_waiting; ///< osd -> pgls ops waiting for a slot
+  void _pgls_submit(Op *o, int osd);
+  void _pgls_finish(int osd);
+
   void resend_mon_ops();
 
   /**
    * handle a budget for in-flight ops
    * budget is taken whenever an op goes into the ops map
    * and returned whenever an op is removed from the map
-   * If throttle_op needs to throttle it will unlock client_lock.
+   * If throttle_op needs to throttle it will unlock client_lock,
+   * if the caller holds it.  Never call it with rwlock held.
    */
   int calc_op_budget(Op *op);
   void throttle_op(Op *op, int op_size=0);
@@ -927,38 +1126,51 @@ public:
       op_throttle_bytes.take(op_budget);
       op_throttle_ops.take(1);
     }
+    op->budget = op_budget;
     op->budgeted = true;
   }
+  bool try_take_op_budget(Op *op);
   void put_op_budget(Op *op) {
     assert(op->budgeted);
-    int op_budget = calc_op_budget(op);
-    op_throttle_bytes.put(op_budget);
+    op_throttle_bytes.put(op->budget);
     op_throttle_ops.put(1);
   }
   Throttle op_throttle_bytes, op_throttle_ops;
 
+  // CEPH_OSD_FLAG_OBJECTER_NOBLOCK ops that didn't fit under the
+  // throttle.  they have no tid or session until they go out.
+  Mutex throttle_lock;       ///< protects throttle_waiting*
+  list<Op*> throttle_waiting;
+  uint64_t throttle_waiting_bytes;
+  atomic_t num_throttle_waiting;
+  void kick_throttle_waiting();
+
  public:
   Objecter(CephContext *cct_, Messenger *m, MonClient *mc,
 	   OSDMap *om, Mutex& l, SafeTimer& t) : 
     messenger(m), monc(mc), osdmap(om), cct(cct_),
     initialized(false),
     last_tid(0), client_inc(-1), max_linger_id(0),
-    num_unacked(0), num_uncommitted(0),
+    num_unacked(0), num_uncommitted(0), num_in_flight(0),
     global_op_flags(0),
     keep_balanced_budget(false), honor_osdmap_full(true),
     last_seen_osdmap_version(0),
     last_seen_pgmap_version(0),
-    client_lock(l), timer(t),
+    client_lock(l), rwlock("Objecter::rwlock"), timer(t),
     logger(NULL), tick_event(NULL),
+    batch_lock("Objecter::batch_lock"), batch_stop(false), batch_thread(this),
     m_request_state_hook(NULL),
-    num_homeless_ops(0),
+    homeless_session(new OSDSession(-1)),
+    pgls_lock("Objecter::pgls_lock"),
     op_throttle_bytes(cct, "objecter_bytes", cct->_conf->objecter_inflight_op_bytes),
-    op_throttle_ops(cct, "objecter_ops", cct->_conf->objecter_inflight_ops)
+    op_throttle_ops(cct, "objecter_ops", cct->_conf->objecter_inflight_ops),
+    throttle_lock("Objecter::throttle_lock"), throttle_waiting_bytes(0)
   { }
   ~Objecter() {
     assert(!tick_event);
     assert(!m_request_state_hook);
     assert(!logger);
+    delete homeless_session;
   }
 
   void init();
@@ -977,9 +1189,29 @@ public:
   void set_honor_osdmap_full() { honor_osdmap_full = true; }
   void unset_honor_osdmap_full() { honor_osdmap_full = false; }
 
+  /*
+   * what a run of incrementals touched on the way to the newest epoch.
+   * we only retarget against the newest map, so an op whose osd or pg
+   * changed and then changed back in between is still resent: the osd
+   * will have dropped it on the interval change.
+   */
+  struct MapChurn {
+    set<int> osds;      ///< marked down (or otherwise changed state) along the way
+    set<pg_t> pg_temp;  ///< pg_temp set or cleared along the way
+    map<pg_t, vector<int> > watched;  ///< pgs with ops in flight, and where
+                                      ///  they mapped at the start of the run
+    set<pg_t> moved;    ///< watched pgs that mapped elsewhere along the way
+
+    void watch(pg_t pgid, const vector<int>& acting);
+    void add(const OSDMap::Incremental& inc, const OSDMap *osdmap);
+    bool touches(const OSDMap *osdmap, pg_t pgid,
+		 const vector<int>& acting) const;
+  };
+
   void scan_requests(bool skipped_map,
 		     map<tid_t, Op*>& need_resend,
-		     list<LingerOp*>& need_resend_linger);
+		     list<LingerOp*>& need_resend_linger,
+		     const MapChurn *churn = NULL);
 
   // messages
  public:
@@ -990,21 +1222,33 @@ public:
 
 private:
   // low-level
+  /**
+   * send an op, or, for a CEPH_OSD_FLAG_OBJECTER_NOBLOCK op that does
+   * not fit in the inflight throttles, park it for
+   * kick_throttle_waiting() to send once it does.
+   *
+   * @returns the op's tid, or 0 if it was parked and has none yet
+   */
   tid_t op_submit(Op *op);
   tid_t _op_submit(Op *op);
+  int _op_submit_locked(Op *op, bool wlocked);
 
   // public interface
  public:
   bool is_active() {
-    return !(ops.empty() && linger_ops.empty() && poolstat_ops.empty() && statfs_ops.empty());
+    return !(num_in_flight.read() == 0 && linger_ops.empty() &&
+	     poolstat_ops.empty() && statfs_ops.empty());
   }
 
   /**
    * Output in-flight requests
    */
   void dump_active();
+  void _dump_active();
   void dump_requests(Formatter& fmt) const;
+  void dump_inflight(Formatter& fmt);
   void dump_ops(Formatter& fmt) const;
+  void dump_session_ops(OSDSession *s, Formatter& fmt) const;
   void dump_linger_ops(Formatter& fmt) const;
   void dump_pool_ops(Formatter& fmt) const;
   void dump_pool_stat_ops(Formatter& fmt) const;
@@ -1031,6 +1275,9 @@ private:
     o->priority = op.priority;
     o->mtime = mtime;
     o->snapc = snapc;
+    // per-op return values only; writes are replied to more than once,
+    // so they can't carry output buffers or handlers
+    o->out_rval.swap(op.out_rval);
     return op_submit(o);
   }
   tid_t read(const object_t& oid, const object_locator_t& oloc,
@@ -1046,6 +1293,18 @@ private:
     o->out_rval.swap(op.out_rval);
     return op_submit(o);
   }
+  /// send a pg op to the pg with seed @a hash in pool oloc.pool
+  tid_t pg_read(uint32_t hash, const object_locator_t& oloc,
+		ObjectOperation& op, bufferlist *pbl, int flags,
+		Context *onack) {
+    Op *o = new Op(object_t(), oloc, op.ops, flags | global_op_flags | CEPH_OSD_FLAG_READ, onack, NULL, NULL);
+    o->priority = op.priority;
+    o->snapid = CEPH_NOSNAP;
+    o->outbl = pbl;
+    o->pgid = pg_t(hash, oloc.pool, -1);
+    o->precalc_pgid = true;
+    return op_submit(o);
+  }
   tid_t linger(const object_t& oid, const object_locator_t& oloc, 
 	       ObjectOperation& op,
 	       snapid_t snap, bufferlist& inbl, bufferlist *poutbl, int flags,
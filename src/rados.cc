@@ -24,6 +24,7 @@ using namespace librados;
 #include "common/ceph_argparse.h"
 #include "global/global_init.h"
 #include "common/Cond.h"
+#include "common/Thread.h"
 #include "common/debug.h"
 #include "common/errno.h"
 #include "common/Formatter.h"
@@ -64,7 +65,9 @@ void usage(ostream& out)
 "   cppool <pool-name> <dest-pool>   copy content of a pool\n"
 "   rmpool <pool-name>               remove pool <pool-name>'\n"
 "   df                               show per-pool and total usage\n"
-"   ls                               list objects in pool\n\n"
+"   ls [--parallel N]                list objects in pool, optionally as\n"
+"                                    N concurrent listings of its pgs\n"
+"   hot-objects [n]                  show the n most accessed objects in pool\n\n"
 "   chown 123                        change the pool owner to auid 123\n"
 "\n"
 "OBJECT COMMANDS\n"
@@ -84,9 +87,11 @@ void usage(ostream& out)
 "   rmsnap <snap-name>               remove snap <snap-name>\n"
 "   rollback <obj-name> <snap-name>  roll back object to snap <snap-name>\n"
 "\n"
-"   bench <seconds> write|seq|rand [-t concurrent_operations] [--no-cleanup]\n"
+"   bench <seconds> write|seq|rand|small [-t concurrent_operations] [--no-cleanup]\n"
 "                                    default is 16 concurrent IOs and 4 MB ops\n"
 "                                    default is to clean up after write benchmark\n"
+"                                    small runs -t threads, each with one\n"
+"                                    synchronous op (default 4 KB) in flight\n"
 "   cleanup <prefix>                 clean up a previous benchmark operation\n"
 "   load-gen [options]               generate load on the cluster\n"
 "   listomapkeys <obj-name>          list the keys in the object map\n"
@@ -146,6 +151,8 @@ void usage(ostream& out)
 "        specify input or output file (for certain commands)\n"
 "   --create\n"
 "        create the pool or directory that was specified\n"
+"   --parallel N\n"
+"        split ls into N listings that run concurrently\n"
 "\n"
 "BENCH OPTIONS:\n"
 "   -t N\n"
@@ -153,6 +160,10 @@ void usage(ostream& out)
 "        Set number of concurrent I/O operations\n"
 "   --show-time\n"
 "        prefix output with date/time\n"
+"   --batch\n"
+"        let small ops to the same osd share a message\n"
+"   --read-policy primary|balance|localize|least-loaded\n"
+"        where reads go; anything but primary lets replicas serve them\n"
 "\n"
 "LOAD GEN OPTIONS:\n"
 "   --num-objects                    total number of objects\n"
@@ -1001,6 +1012,56 @@ static int do_lock_cmd(std::vector<const char*> &nargs,
   return 0;
 }
 
+/*
+ * lists one part of a pool for ls --parallel.  output is buffered
+ * and written out a chunk at a time so lines from different parts
+ * don't interleave.
+ */
+class ListPartThread : public Thread {
+  librados::IoCtx& io_ctx;
+  uint32_t part, num_parts;
+  ostream *out;
+  Mutex *out_lock;
+public:
+  int r;
+
+  ListPartThread(librados::IoCtx& ioctx, uint32_t p, uint32_t n,
+		 ostream *o, Mutex *l)
+    : io_ctx(ioctx), part(p), num_parts(n), out(o), out_lock(l), r(0) {}
+
+  void *entry() {
+    ostringstream ss;
+    int lines = 0;
+    try {
+      librados::ObjectIterator i = io_ctx.objects_begin(part, num_parts);
+      librados::ObjectIterator i_end = io_ctx.objects_end();
+      for (; i != i_end; ++i) {
+	if (i->second.size())
+	  ss << i->first << "\t" << i->second << "\n";
+	else
+	  ss << i->first << "\n";
+	if (++lines == 1000) {
+	  flush(ss);
+	  lines = 0;
+	}
+      }
+    }
+    catch (const std::runtime_error& e) {
+      Mutex::Locker l(*out_lock);
+      cerr << e.what() << std::endl;
+      r = -EIO;
+    }
+    flush(ss);
+    return NULL;
+  }
+
+  void flush(ostringstream& ss) {
+    Mutex::Locker l(*out_lock);
+    *out << ss.str() << std::flush;
+    ss.str("");
+  }
+};
+
 /**********************************************
 
 **********************************************/
@@ -1032,6 +1093,9 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
   int run_length = 0;
 
   bool show_time = false;
+  bool batch = false;
+  int read_policy = LIBRADOS_READ_PRIMARY;
+  int parallel = 0;
 
   Formatter *formatter = NULL;
   bool pretty_format = false;
@@ -1124,6 +1188,29 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
   if (i != opts.end()) {
     cleanup = false;
   }
+  i = opts.find("batch");
+  if (i != opts.end()) {
+    batch = true;
+  }
+  i = opts.find("read-policy");
+  if (i != opts.end()) {
+    if (i->second == "primary")
+      read_policy = LIBRADOS_READ_PRIMARY;
+    else if (i->second == "balance")
+      read_policy = LIBRADOS_READ_BALANCE;
+    else if (i->second == "localize")
+      read_policy = LIBRADOS_READ_LOCALIZE;
+    else if (i->second == "least-loaded")
+      read_policy = LIBRADOS_READ_LEAST_LOADED;
+    else {
+      cerr << "unknown read policy '" << i->second << "'" << std::endl;
+      return -EINVAL;
+    }
+  }
+  i = opts.find("parallel");
+  if (i != opts.end()) {
+    parallel = strtol(i->second.c_str(), NULL, 10);
+  }
   i = opts.find("pretty-format");
   if (i != opts.end()) {
     pretty_format = true;
@@ -1193,6 +1280,12 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
   if (oloc.size()) {
     io_ctx.locator_set_key(oloc);
   }
+  if (batch) {
+    io_ctx.set_op_batching(true);
+  }
+  if (read_policy != LIBRADOS_READ_PRIMARY) {
+    io_ctx.set_read_policy(read_policy);
+  }
   if (snapid != CEPH_NOSNAP) {
     string name;
     ret = io_ctx.snap_get_name(snapid, &name);
@@ -1331,7 +1424,28 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
     else
       outstream = new ofstream(nargs[1]);
 
-    {
+    if (parallel > 1) {
+      Mutex out_lock("rados ls");
+      vector<ListPartThread*> threads;
+      for (int p = 0; p < parallel; p++) {
+	threads.push_back(new ListPartThread(io_ctx, p, parallel,
+					     outstream, &out_lock));
+	threads.back()->create();
+      }
+      int r = 0;
+      for (vector<ListPartThread*>::iterator p = threads.begin();
+	   p != threads.end(); ++p) {
+	(*p)->join();
+	if ((*p)->r < 0)
+	  r = (*p)->r;
+	delete *p;
+      }
+      if (r < 0) {
+	if (!stdout)
+	  delete outstream;
+	return 1;
+      }
+    } else {
       try {
 	librados::ObjectIterator i = io_ctx.objects_begin();
 	librados::ObjectIterator i_end = io_ctx.objects_end();
@@ -1350,6 +1464,30 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
     if (!stdout)
       delete outstream;
   }
+  else if (strcmp(nargs[0], "hot-objects") == 0) {
+    if (!pool_name) {
+      cerr << "pool name was not specified" << std::endl;
+      return 1;
+    }
+    unsigned max = 10;
+    if (nargs.size() > 1)
+      max = strtol(nargs[1], 0, 10);
+    list<librados::object_heat_t> ls;
+    ret = io_ctx.hot_objects(max, &ls);
+    if (ret < 0) {
+      cerr << "error getting hot objects in pool " << pool_name << ": "
+	   << strerror_r(-ret, buf, sizeof(buf)) << std::endl;
+      return 1;
+    }
+    printf("%-40s %12s %12s\n", "object", "reads", "writes");
+    for (list<librados::object_heat_t>::iterator p = ls.begin(); p != ls.end(); ++p) {
+      string name = p->oid;
+      if (p->locator.length())
+	name += "\t" + p->locator;
+      printf("%-40s %12lld %12lld\n", name.c_str(),
+	     (long long)p->reads, (long long)p->writes);
+    }
+  }
   else if (strcmp(nargs[0], "chown") == 0) {
     if (!pool_name || nargs.size() < 2)
       usage_exit();
@@ -1857,7 +1995,11 @@ static int rados_tool_common(const std::map < std::string, std::string > &opts,
       operation = OP_SEQ_READ;
     else if (strcmp(nargs[2], "rand") == 0)
       operation = OP_RAND_READ;
-    else
+    else if (strcmp(nargs[2], "small") == 0) {
+      operation = OP_SMALL;
+      if (opts.find("block-size") == opts.end())
+	op_size = 4096;
+    } else
       usage_exit();
     RadosBencher bencher(rados, io_ctx);
     bencher.set_show_time(show_time);
@@ -2002,6 +2144,12 @@ int main(int argc, const char **argv)
       opts["show-time"] = "true";
     } else if (ceph_argparse_flag(args, i, "--no-cleanup", (char*)NULL)) {
       opts["no-cleanup"] = "true";
+    } else if (ceph_argparse_flag(args, i, "--batch", (char*)NULL)) {
+      opts["batch"] = "true";
+    } else if (ceph_argparse_witharg(args, i, &val, "--read-policy", (char*)NULL)) {
+      opts["read-policy"] = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--parallel", (char*)NULL)) {
+      opts["parallel"] = val;
     } else if (ceph_argparse_witharg(args, i, &val, "-p", "--pool", (char*)NULL)) {
       opts["pool"] = val;
     } else if (ceph_argparse_witharg(args, i, &val, "--target-pool", (char*)NULL)) {
@@ -80,11 +80,18 @@ void usage()
 "  flatten <image-name>                        fill clone with parent data\n"
 "                                              (make it independent)\n"
 "  resize --size <MB> <image-name>             resize (expand or contract) image\n"
+"  du <image-name>                             show how much of an image or\n"
+"                                              snapshot has been written to\n"
 "  rm <image-name>                             delete an image\n"
 "  export <image-name> <path>                  export image to file\n"
 "  import <path> <image-name>                  import image from file\n"
 "                                              (dest defaults)\n"
 "                                              as the filename part of file)\n"
+"  export-diff <image-name> <path> [--from-snap <snap-name>]\n"
+"                                              export an incremental diff to\n"
+"                                              path, or \"-\" for stdout\n"
+"  import-diff <path> <image-name>             apply an incremental diff to\n"
+"                                              image-name\n"
 "  (cp | copy) <src> <dest>                    copy src image to dest\n"
 "  (mv | rename) <src> <dest>                  rename src image to dest\n"
 "  snap ls <image-name>                        dump list of image snapshots\n"
@@ -104,6 +111,10 @@ void usage()
 "  lock list <image-name>                      show locks held on an image\n"
 "  lock add <image-name> <id> [--shared <tag>] take a lock called id on an image\n"
 "  lock remove <image-name> <id> <locker>      release a lock on an image\n"
+"  object-map check <image-name>               compare an image's object map\n"
+"                                              with its objects\n"
+"  object-map rebuild <image-name>             regenerate an image's object\n"
+"                                              map (image must not be in use)\n"
 "\n"
 "<image-name>, <snap-name> are [pool/]name[@snap], or you may specify\n"
 "individual pieces of names with -p/--pool, --image, and/or --snap.\n"
@@ -115,12 +126,15 @@ void usage()
 "  --snap <snap-name>           snapshot name\n"
 "  --dest-pool <name>           destination pool name\n"
 "  --path <path-name>           path name for import/export\n"
+"  --from-snap <snap-name>      snapshot starting point for export-diff\n"
 "  --size <size in MB>          size of image for create and resize\n"
 "  --order <bits>               the object size in bits; object size will be\n"
 "                               (1 << order) bytes. Default is 22 (4 MB).\n"
 "  --format <format-number>     format to use when creating an image\n"
 "                               format 1 is the original format (default)\n"
 "                               format 2 supports cloning\n"
+"  --object-map                 keep track of which objects exist when\n"
+"                               creating a format 2 image\n"
 "  --id <username>              rados user (without 'client.' prefix) to authenticate as\n"
 "  --keyfile <path>             file containing secret key for use with cephx\n"
 "  --shared <tag>               take a shared (rather than exclusive) lock\n";
@@ -132,6 +146,11 @@ static string feature_str(uint64_t features)
 
   if (features & RBD_FEATURE_LAYERING)
     s += "layering";
+  if (features & RBD_FEATURE_OBJECT_MAP) {
+    if (!s.empty())
+      s += ", ";
+    s += "object map";
+  }
   return s;
 }
 
@@ -296,6 +315,53 @@ static int do_flatten(librbd::Image& image)
   return 0;
 }
 
+static int do_du(librbd::Image& image)
+{
+  uint64_t used, size;
+  int r = image.used_size(&used);
+  if (r < 0)
+    return r;
+  r = image.size(&size);
+  if (r < 0)
+    return r;
+  cout << prettybyte_t(used) << " used of " << prettybyte_t(size)
+       << std::endl;
+  return 0;
+}
+
+static int do_object_map_check(librbd::Image& image)
+{
+  MyProgressContext pc("Checking object map");
+  uint64_t missing, stale;
+  int r = image.object_map_check_with_progress(&missing, &stale, pc);
+  if (r < 0) {
+    pc.fail();
+    return r;
+  }
+  pc.finish();
+  cout << missing << " objects missing from the object map, "
+       << stale << " in it that don't exist" << std::endl;
+  if (missing) {
+    cerr << "reads of the missing objects return zeroes; "
+	 << "run 'rbd object-map rebuild' while the image is not in use"
+	 << std::endl;
+    return -EIO;
+  }
+  return 0;
+}
+
+static int do_object_map_rebuild(librbd::Image& image)
+{
+  MyProgressContext pc("Rebuilding object map");
+  int r = image.object_map_rebuild_with_progress(pc);
+  if (r < 0) {
+    pc.fail();
+    return r;
+  }
+  pc.finish();
+  return 0;
+}
+
 static int do_rename(librbd::RBD &rbd, librados::IoCtx& io_ctx,
 		     const char *imgname, const char *destname)
 {
@@ -599,6 +665,299 @@ static int do_export(librbd::Image& image, const char *path)
   return r;
 }
 
+/*
+ * export-diff stream: the banner, then a series of records each
+ * starting with a one-byte tag, all integers little-endian:
+ *
+ *   'f' <le32 len> <name>        snapshot the diff starts from (optional)
+ *   't' <le32 len> <name>        snapshot the diff ends at (optional)
+ *   's' <le64 size>              image size at the end of the diff
+ *   'w' <le64 off> <le64 len> <data>   updated data
+ *   'z' <le64 off> <le64 len>    zeroed or discarded extent
+ *   'e'                          end of the diff
+ */
+static const char RBD_DIFF_BANNER[] = "rbd diff v1\n";
+
+struct ExportDiffContext {
+  librbd::Image *image;
+  int fd;
+  uint64_t totalsize;
+  bool show_progress;
+  MyProgressContext pc;
+
+  ExportDiffContext(librbd::Image *i, int f, uint64_t t, bool p) :
+    image(i), fd(f), totalsize(t), show_progress(p), pc("Exporting image") {}
+};
+
+static int export_diff_cb(uint64_t ofs, size_t _len, int exists, void *arg)
+{
+  ExportDiffContext *edc = (ExportDiffContext *)arg;
+  uint64_t len = _len;
+  bufferlist bl, data;
+
+  if (exists) {
+    int r = edc->image->read(ofs, len, data);
+    if (r < 0)
+      return r;
+    // an unallocated extent in an object that exists reads as zeroes;
+    // no need to ship those
+    if (data.is_zero())
+      exists = false;
+  }
+  if (exists) {
+    ::encode('w', bl);
+    ::encode(ofs, bl);
+    ::encode(len, bl);
+    bl.claim_append(data);
+  } else {
+    ::encode('z', bl);
+    ::encode(ofs, bl);
+    ::encode(len, bl);
+  }
+  int r = bl.write_fd(edc->fd);
+  if (r < 0)
+    return r;
+
+  if (edc->show_progress)
+    edc->pc.update_progress(ofs, edc->totalsize);
+  return 0;
+}
+
+static int do_export_diff(librbd::Image& image, const char *fromsnapname,
+			  const char *endsnapname, const char *path)
+{
+  int r;
+  librbd::image_info_t info;
+  int fd;
+  bool to_stdout = strcmp(path, "-") == 0;
+
+  r = image.stat(info, sizeof(info));
+  if (r < 0)
+    return r;
+
+  if (to_stdout)
+    fd = 1;
+  else
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return -errno;
+
+  {
+    bufferlist bl;
+    bl.append(RBD_DIFF_BANNER, strlen(RBD_DIFF_BANNER));
+    if (fromsnapname) {
+      ::encode('f', bl);
+      ::encode(string(fromsnapname), bl);
+    }
+    if (endsnapname) {
+      ::encode('t', bl);
+      ::encode(string(endsnapname), bl);
+    }
+    ::encode('s', bl);
+    ::encode(info.size, bl);
+    r = bl.write_fd(fd);
+    if (r < 0)
+      goto out;
+  }
+
+  {
+    // progress goes to stdout, so not when that is where the diff goes
+    ExportDiffContext edc(&image, fd, info.size, !to_stdout);
+    r = image.diff_iterate(fromsnapname, 0, info.size, export_diff_cb,
+			   (void *)&edc);
+    if (r >= 0) {
+      bufferlist bl;
+      ::encode('e', bl);
+      r = bl.write_fd(fd);
+    }
+    if (edc.show_progress) {
+      if (r < 0)
+	edc.pc.fail();
+      else
+	edc.pc.finish();
+    }
+  }
+
+ out:
+  if (!to_stdout)
+    close(fd);
+  return r;
+}
+
+static int read_diff_field(int fd, size_t len, bufferlist::iterator *p,
+			   bufferlist *bl)
+{
+  bl->clear();
+  bufferptr bp(len);
+  int r = safe_read_exact(fd, bp.c_str(), len);
+  if (r < 0)
+    return r;
+  bl->append(bp);
+  *p = bl->begin();
+  return 0;
+}
+
+static int read_diff_string(int fd, string *s)
+{
+  bufferlist bl;
+  bufferlist::iterator p;
+  int r = read_diff_field(fd, sizeof(__u32), &p, &bl);
+  if (r < 0)
+    return r;
+  __u32 len;
+  ::decode(len, p);
+  if (len > 4096)
+    return -EINVAL;
+  r = read_diff_field(fd, len, &p, &bl);
+  if (r < 0)
+    return r;
+  s->assign(bl.c_str(), len);
+  return 0;
+}
+
+static bool snap_exists(librbd::Image& image, const string& name)
+{
+  std::vector<librbd::snap_info_t> snaps;
+  if (image.snap_list(snaps) < 0)
+    return false;
+  for (std::vector<librbd::snap_info_t>::iterator it = snaps.begin();
+       it != snaps.end(); ++it) {
+    if (it->name == name)
+      return true;
+  }
+  return false;
+}
+
+static int do_import_diff(librbd::Image& image, const char *path)
+{
+  int fd, r;
+  struct stat stat_buf;
+  MyProgressContext pc("Importing image diff");
+  uint64_t size = 0;
+  string from, to;
+  bufferlist bl;
+  bufferlist::iterator p;
+
+  if (strcmp(path, "-") == 0) {
+    fd = 0;
+  } else {
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      r = -errno;
+      cerr << "error opening " << path << std::endl;
+      return r;
+    }
+    r = fstat(fd, &stat_buf);
+    if (r < 0) {
+      r = -errno;
+      cerr << "stat error " << path << std::endl;
+      goto done;
+    }
+    size = (uint64_t)stat_buf.st_size;
+  }
+
+  r = read_diff_field(fd, strlen(RBD_DIFF_BANNER), &p, &bl);
+  if (r < 0 ||
+      memcmp(bl.c_str(), RBD_DIFF_BANNER, strlen(RBD_DIFF_BANNER)) != 0) {
+    cerr << "invalid banner '" << string(bl.c_str(), bl.length())
+	 << "', expected '" << RBD_DIFF_BANNER << "'" << std::endl;
+    r = -EINVAL;
+    goto done;
+  }
+
+  while (true) {
+    char tag;
+    r = read_diff_field(fd, 1, &p, &bl);
+    if (r < 0)
+      goto done;
+    ::decode(tag, p);
+
+    if (tag == 'e')
+      break;
+
+    if (tag == 'f') {
+      r = read_diff_string(fd, &from);
+      if (r < 0)
+	goto done;
+      if (!snap_exists(image, from)) {
+	cerr << "start snapshot '" << from
+	     << "' does not exist in the image, aborting" << std::endl;
+	r = -EINVAL;
+	goto done;
+      }
+    } else if (tag == 't') {
+      r = read_diff_string(fd, &to);
+      if (r < 0)
+	goto done;
+      if (snap_exists(image, to)) {
+	cerr << "end snapshot '" << to
+	     << "' already exists, aborting" << std::endl;
+	r = -EEXIST;
+	goto done;
+      }
+    } else if (tag == 's') {
+      uint64_t end_size;
+      r = read_diff_field(fd, sizeof(end_size), &p, &bl);
+      if (r < 0)
+	goto done;
+      ::decode(end_size, p);
+      librbd::image_info_t info;
+      r = image.stat(info, sizeof(info));
+      if (r < 0)
+	goto done;
+      if (info.size != end_size) {
+	r = image.resize(end_size);
+	if (r < 0)
+	  goto done;
+      }
+    } else if (tag == 'w' || tag == 'z') {
+      uint64_t off, len;
+      r = read_diff_field(fd, 2 * sizeof(uint64_t), &p, &bl);
+      if (r < 0)
+	goto done;
+      ::decode(off, p);
+      ::decode(len, p);
+
+      if (tag == 'w') {
+	bufferlist data;
+	r = read_diff_field(fd, len, &p, &data);
+	if (r < 0)
+	  goto done;
+	r = image.write(off, len, data);
+      } else {
+	r = image.discard(off, len);
+      }
+      if (r < 0)
+	goto done;
+    } else {
+      cerr << "unrecognized tag byte " << (int)tag
+	   << " in stream; aborting" << std::endl;
+      r = -EINVAL;
+      goto done;
+    }
+
+    if (size) {
+      off_t pos = lseek(fd, 0, SEEK_CUR);
+      if (pos > 0)
+	pc.update_progress(pos, size);
+    }
+  }
+
+  // only now that all of the diff has been applied does the end
+  // snapshot exist, so a failed import can simply be retried
+  if (!to.empty())
+    r = image.snap_create(to.c_str());
+
+ done:
+  if (fd != 0)
+    close(fd);
+  if (r < 0)
+    pc.fail();
+  else
+    pc.finish();
+  return r;
+}
+
 static const char *imgname_from_path(const char *path)
 {
   const char *imgname;
@@ -1149,6 +1508,8 @@ enum {
   OPT_RM,
   OPT_EXPORT,
   OPT_IMPORT,
+  OPT_EXPORT_DIFF,
+  OPT_IMPORT_DIFF,
   OPT_COPY,
   OPT_RENAME,
   OPT_SNAP_CREATE,
@@ -1165,11 +1526,15 @@ enum {
   OPT_LOCK_LIST,
   OPT_LOCK_ADD,
   OPT_LOCK_REMOVE,
+  OPT_DU,
+  OPT_OBJECT_MAP_CHECK,
+  OPT_OBJECT_MAP_REBUILD,
 };
 
-static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd)
+static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd,
+		   bool objmapcmd)
 {
-  if (!snapcmd && !lockcmd) {
+  if (!snapcmd && !lockcmd && !objmapcmd) {
     if (strcmp(cmd, "ls") == 0 ||
         strcmp(cmd, "list") == 0)
       return OPT_LIST;
@@ -1191,6 +1556,10 @@ static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd)
       return OPT_EXPORT;
     if (strcmp(cmd, "import") == 0)
       return OPT_IMPORT;
+    if (strcmp(cmd, "export-diff") == 0)
+      return OPT_EXPORT_DIFF;
+    if (strcmp(cmd, "import-diff") == 0)
+      return OPT_IMPORT_DIFF;
     if (strcmp(cmd, "copy") == 0 ||
         strcmp(cmd, "cp") == 0)
       return OPT_COPY;
@@ -1224,7 +1593,7 @@ static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd)
       return OPT_SNAP_PROTECT;
     if (strcmp(cmd, "unprotect") == 0)
       return OPT_SNAP_UNPROTECT;
-  } else {
+  } else if (lockcmd) {
     if (strcmp(cmd, "ls") == 0 ||
         strcmp(cmd, "list") == 0)
       return OPT_LOCK_LIST;
@@ -1233,6 +1602,11 @@ static int get_cmd(const char *cmd, bool snapcmd, bool lockcmd)
     if (strcmp(cmd, "remove") == 0 ||
 	strcmp(cmd, "rm") == 0)
       return OPT_LOCK_REMOVE;
+  } else {
+    if (strcmp(cmd, "check") == 0)
+      return OPT_OBJECT_MAP_CHECK;
+    if (strcmp(cmd, "rebuild") == 0)
+      return OPT_OBJECT_MAP_REBUILD;
   }
 
   return OPT_NO_CMD;
@@ -1282,7 +1656,7 @@ int main(int argc, const char **argv)
   const char *imgname = NULL, *snapname = NULL, *destname = NULL,
     *dest_poolname = NULL, *dest_snapname = NULL, *path = NULL,
     *devpath = NULL, *lock_cookie = NULL, *lock_client = NULL,
-    *lock_tag = NULL;
+    *lock_tag = NULL, *fromsnapname = NULL;
   bool lflag = false;
 
   std::string val;
@@ -1308,6 +1682,8 @@ int main(int argc, const char **argv)
 	return EXIT_FAILURE;
       }
       format_specified = true;
+    } else if (ceph_argparse_flag(args, i, "--object-map", (char*)NULL)) {
+      features |= RBD_FEATURE_OBJECT_MAP;
     } else if (ceph_argparse_witharg(args, i, &val, "-p", "--pool", (char*)NULL)) {
       poolname = strdup(val.c_str());
     } else if (ceph_argparse_witharg(args, i, &val, "--dest-pool", (char*)NULL)) {
@@ -1331,6 +1707,8 @@ int main(int argc, const char **argv)
       }
     } else if (ceph_argparse_witharg(args, i, &val, "--path", (char*)NULL)) {
       path = strdup(val.c_str());
+    } else if (ceph_argparse_witharg(args, i, &val, "--from-snap", (char*)NULL)) {
+      fromsnapname = strdup(val.c_str());
     } else if (ceph_argparse_witharg(args, i, &val, "--dest", (char*)NULL)) {
       destname = strdup(val.c_str());
     } else if (ceph_argparse_witharg(args, i, &val, "--parent", (char *)NULL)) {
@@ -1356,7 +1734,7 @@ int main(int argc, const char **argv)
       usage();
       return EXIT_FAILURE;
     }
-    opt_cmd = get_cmd(*i, true, false);
+    opt_cmd = get_cmd(*i, true, false, false);
   } else if (strcmp(*i, "lock") == 0) {
     i = args.erase(i);
     if (i == args.end()) {
@@ -1364,9 +1742,17 @@ int main(int argc, const char **argv)
       usage();
       return EXIT_FAILURE;
     }
-    opt_cmd = get_cmd(*i, false, true);
+    opt_cmd = get_cmd(*i, false, true, false);
+  } else if (strcmp(*i, "object-map") == 0) {
+    i = args.erase(i);
+    if (i == args.end()) {
+      cerr << "which object-map command do you want?" << std::endl;
+      usage();
+      return EXIT_FAILURE;
+    }
+    opt_cmd = get_cmd(*i, false, false, true);
   } else {
-    opt_cmd = get_cmd(*i, false, false);
+    opt_cmd = get_cmd(*i, false, false, false);
   }
   if (opt_cmd == OPT_NO_CMD) {
     cerr << "error parsing command '" << *i << "'" << std::endl;
@@ -1406,17 +1792,24 @@ if (!set_conf_param(v, p1, p2, p3)) { \
       case OPT_WATCH:
       case OPT_MAP:
       case OPT_LOCK_LIST:
+      case OPT_DU:
+      case OPT_OBJECT_MAP_CHECK:
+      case OPT_OBJECT_MAP_REBUILD:
 	SET_CONF_PARAM(v, &imgname, NULL, NULL);
 	break;
       case OPT_UNMAP:
 	SET_CONF_PARAM(v, &devpath, NULL, NULL);
 	break;
       case OPT_EXPORT:
+      case OPT_EXPORT_DIFF:
 	SET_CONF_PARAM(v, &imgname, &path, NULL);
 	break;
       case OPT_IMPORT:
 	SET_CONF_PARAM(v, &path, &destname, NULL);
 	break;
+      case OPT_IMPORT_DIFF:
+	SET_CONF_PARAM(v, &path, &imgname, NULL);
+	break;
       case OPT_COPY:
       case OPT_RENAME:
       case OPT_CLONE:
@@ -1461,7 +1854,7 @@ if (!set_conf_param(v, p1, p2, p3)) { \
     return EXIT_FAILURE;
   }
 
-  if (opt_cmd == OPT_IMPORT && !path) {
+  if ((opt_cmd == OPT_IMPORT || opt_cmd == OPT_IMPORT_DIFF) && !path) {
     cerr << "error: path was not specified" << std::endl;
     usage();
     return EXIT_FAILURE;
@@ -1473,6 +1866,13 @@ if (!set_conf_param(v, p1, p2, p3)) { \
       destname = imgname_from_path(path);
   }
 
+  if (opt_cmd != OPT_EXPORT_DIFF && fromsnapname) {
+    cerr << "error: only the export-diff command uses the --from-snap option"
+	 << std::endl;
+    usage();
+    return EXIT_FAILURE;
+  }
+
   if (opt_cmd != OPT_LOCK_ADD && lock_tag) {
     cerr << "error: only the lock add command uses the --shared option"
 	 << std::endl;
@@ -1506,10 +1906,10 @@ if (!set_conf_param(v, p1, p2, p3)) { \
 		      (char **)&imgname, (char **)&snapname);
   if (snapname && opt_cmd != OPT_SNAP_CREATE && opt_cmd != OPT_SNAP_ROLLBACK &&
       opt_cmd != OPT_SNAP_REMOVE && opt_cmd != OPT_INFO &&
-      opt_cmd != OPT_EXPORT && opt_cmd != OPT_COPY &&
-      opt_cmd != OPT_MAP && opt_cmd != OPT_CLONE &&
+      opt_cmd != OPT_EXPORT && opt_cmd != OPT_EXPORT_DIFF &&
+      opt_cmd != OPT_COPY && opt_cmd != OPT_MAP && opt_cmd != OPT_CLONE &&
       opt_cmd != OPT_SNAP_PROTECT && opt_cmd != OPT_SNAP_UNPROTECT &&
-      opt_cmd != OPT_CHILDREN) {
+      opt_cmd != OPT_CHILDREN && opt_cmd != OPT_DU) {
     cerr << "error: snapname specified for a command that doesn't use it" << std::endl;
     usage();
     return EXIT_FAILURE;
@@ -1533,6 +1933,12 @@ if (!set_conf_param(v, p1, p2, p3)) { \
   if (opt_cmd == OPT_EXPORT && !path)
     path = imgname;
 
+  if (opt_cmd == OPT_EXPORT_DIFF && !path) {
+    cerr << "error: path was not specified" << std::endl;
+    usage();
+    return EXIT_FAILURE;
+  }
+
   if ((opt_cmd == OPT_COPY || opt_cmd == OPT_CLONE) && !destname ) {
     cerr << "error: destination image name was not specified" << std::endl;
     usage();
@@ -1589,7 +1995,9 @@ if (!set_conf_param(v, p1, p2, p3)) { \
        opt_cmd == OPT_WATCH || opt_cmd == OPT_COPY ||
        opt_cmd == OPT_FLATTEN || opt_cmd == OPT_CHILDREN ||
        opt_cmd == OPT_LOCK_LIST || opt_cmd == OPT_LOCK_ADD ||
-       opt_cmd == OPT_LOCK_REMOVE)) {
+       opt_cmd == OPT_LOCK_REMOVE || opt_cmd == OPT_DU ||
+       opt_cmd == OPT_OBJECT_MAP_CHECK || opt_cmd == OPT_OBJECT_MAP_REBUILD ||
+       opt_cmd == OPT_EXPORT_DIFF || opt_cmd == OPT_IMPORT_DIFF)) {
     r = rbd.open(io_ctx, image, imgname);
     if (r < 0) {
       cerr << "error opening image " << imgname << ": " << cpp_strerror(-r) << std::endl;
@@ -1599,7 +2007,8 @@ if (!set_conf_param(v, p1, p2, p3)) { \
 
   if (snapname && talk_to_cluster &&
       (opt_cmd == OPT_INFO || opt_cmd == OPT_EXPORT || opt_cmd == OPT_COPY ||
-       opt_cmd == OPT_CHILDREN)) {
+       opt_cmd == OPT_CHILDREN || opt_cmd == OPT_DU ||
+       opt_cmd == OPT_EXPORT_DIFF)) {
     r = image.snap_set(snapname);
     if (r < 0) {
       cerr << "error setting snapshot context: " << cpp_strerror(-r) << std::endl;
@@ -1716,6 +2125,32 @@ if (!set_conf_param(v, p1, p2, p3)) { \
     }
     break;
 
+  case OPT_DU:
+    r = do_du(image);
+    if (r < 0) {
+      cerr << "du error: " << cpp_strerror(-r) << std::endl;
+      return EXIT_FAILURE;
+    }
+    break;
+
+  case OPT_OBJECT_MAP_CHECK:
+    r = do_object_map_check(image);
+    if (r == -EIO)
+      return EXIT_FAILURE;
+    if (r < 0) {
+      cerr << "object map check error: " << cpp_strerror(-r) << std::endl;
+      return EXIT_FAILURE;
+    }
+    break;
+
+  case OPT_OBJECT_MAP_REBUILD:
+    r = do_object_map_rebuild(image);
+    if (r < 0) {
+      cerr << "object map rebuild error: " << cpp_strerror(-r) << std::endl;
+      return EXIT_FAILURE;
+    }
+    break;
+
   case OPT_SNAP_LIST:
     if (!imgname) {
       usage();
@@ -1837,6 +2272,22 @@ if (!set_conf_param(v, p1, p2, p3)) { \
     }
     break;
 
+  case OPT_EXPORT_DIFF:
+    r = do_export_diff(image, fromsnapname, snapname, path);
+    if (r < 0) {
+      cerr << "export-diff error: " << cpp_strerror(-r) << std::endl;
+      return EXIT_FAILURE;
+    }
+    break;
+
+  case OPT_IMPORT_DIFF:
+    r = do_import_diff(image, path);
+    if (r < 0) {
+      cerr << "import-diff failed: " << cpp_strerror(-r) << std::endl;
+      return EXIT_FAILURE;
+    }
+    break;
+
   case OPT_COPY:
     r = do_copy(image, dest_io_ctx, destname);
     if (r < 0) {
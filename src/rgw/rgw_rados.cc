@@ -987,6 +987,9 @@ int RGWRados::create_pools(vector<string>& names, vector<int>& retcodes)
  * mtime: if non-NULL, writes the given mtime to the bucket storage
  * attrs: all the given attrs are written to bucket storage for the given object
  * exclusive: create object exclusively
+ * copy_src: if non-NULL (and data is NULL), the object's data is copied
+ *   from copy_src's head object by the osd, without passing through us;
+ *   the copy fails if the head is no longer at copy_src_ver (if non-zero)
  * Returns: 0 on success, -ERR# otherwise.
  */
 int RGWRados::put_obj_meta(void *ctx, rgw_obj& obj,  uint64_t size,
@@ -995,7 +998,9 @@ int RGWRados::put_obj_meta(void *ctx, rgw_obj& obj,  uint64_t size,
                   map<string, bufferlist>* rmattrs,
                   const bufferlist *data,
                   RGWObjManifest *manifest,
-		  const string *ptag)
+		  const string *ptag,
+		  rgw_obj *copy_src,
+		  uint64_t copy_src_ver)
 {
   rgw_bucket bucket;
   std::string oid, key;
@@ -1026,6 +1031,17 @@ int RGWRados::put_obj_meta(void *ctx, rgw_obj& obj,  uint64_t size,
     /* if we want to overwrite the data, we also want to overwrite the
        xattrs, so just remove the object */
     op.write_full(*data);
+  } else if (copy_src) {
+    rgw_bucket src_bucket;
+    string src_oid, src_key;
+    get_obj_bucket_and_oid_key(*copy_src, src_bucket, src_oid, src_key);
+    librados::IoCtx src_ctx;
+    r = open_bucket_ctx(src_bucket, src_ctx);
+    if (r < 0)
+      return r;
+    src_ctx.locator_set_key(src_key);
+    /* our own xattrs are set below; only take the data */
+    op.copy_from(src_oid, src_ctx, copy_src_ver, LIBRADOS_COPY_FROM_DATA_ONLY);
   }
 
   string etag;
@@ -1303,19 +1319,30 @@ int RGWRados::copy_obj(void *ctx,
   }
 
   if (copy_first) {
-    ret = get_obj(ctx, &handle, src_obj, first_chunk, 0, RGW_MAX_CHUNK_SIZE);
-    if (ret < 0)
-      goto done_ret;
-
+    /* the first chunk lives in the head; have the osd copy it over */
     first_part = &manifest.objs[0];
     first_part->loc = dest_obj;
     first_part->loc_ofs = 0;
-    first_part->size = first_chunk.length();
+    first_part->size = astate->manifest.objs.begin()->second.size;
   }
 
   manifest.obj_size = total_len;
 
-  ret = put_obj_meta(ctx, dest_obj, end + 1, NULL, attrset, category, false, NULL, &first_chunk, &manifest, &tag);
+  ret = put_obj_meta(ctx, dest_obj, end + 1, NULL, attrset, category, false, NULL,
+                     (copy_first ? NULL : &first_chunk), &manifest, &tag,
+                     (copy_first ? &src_obj : NULL), astate->epoch);
+  if (ret == -EOPNOTSUPP && copy_first) {
+    /* the osds can't copy-from; read the first chunk and write it ourselves */
+    ldout(cct, 10) << "osds can't copy-from, copying the head through us" << dendl;
+    ret = get_obj(ctx, &handle, src_obj, first_chunk, 0, RGW_MAX_CHUNK_SIZE);
+    if (ret < 0)
+      goto done_ret;
+    first_part->size = first_chunk.length();
+    ret = put_obj_meta(ctx, dest_obj, end + 1, NULL, attrset, category, false, NULL,
+                       &first_chunk, &manifest, &tag);
+  }
+  if (ret < 0)
+    goto done_ret;
   if (mtime)
     obj_stat(ctx, dest_obj, NULL, mtime, NULL, NULL, NULL);
 
@@ -0,0 +1,188 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Keep a large number of aio writes in flight from a single event
+ * loop and report ops/s, reaping completions two ways:
+ *
+ *  - callback: the complete callback writes the completion to a pipe
+ *    that the loop polls, which is what event-loop users had to do
+ *    before completion queues
+ *  - cq: completions are posted to a rados_completion_queue_t and
+ *    reaped in batches when its fd polls readable
+ */
+
+#include "include/rados/librados.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static const int num_objects = 1024;
+static int pipefd[2];
+
+static void pipe_cb(rados_completion_t c, void *arg)
+{
+  int r = write(pipefd[1], &c, sizeof(c));
+  if (r != sizeof(c))
+    abort();
+}
+
+struct Bench {
+  rados_ioctx_t io;
+  rados_completion_queue_t cq;
+  int ops, outstanding;
+  vector<string> oids;
+  string data;
+  int started, finished, errors;
+
+  Bench(rados_ioctx_t i, int o, int out, int size)
+    : io(i), cq(NULL), ops(o), outstanding(out), data(size, 'x'),
+      started(0), finished(0), errors(0) {
+    for (int n = 0; n < num_objects; n++) {
+      std::ostringstream ss;
+      ss << "bench_aio_cq_" << n;
+      oids.push_back(ss.str());
+    }
+  }
+
+  void start_one() {
+    rados_completion_t c;
+    if (cq)
+      rados_aio_create_completion_cq(NULL, cq, &c);
+    else
+      rados_aio_create_completion(NULL, pipe_cb, NULL, &c);
+    int r = rados_aio_write(io, oids[started % num_objects].c_str(), c,
+			    data.c_str(), data.size(), 0);
+    if (r < 0) {
+      std::cerr << "rados_aio_write: " << strerror(-r) << std::endl;
+      exit(1);
+    }
+    started++;
+  }
+
+  void finish(rados_completion_t c) {
+    if (rados_aio_get_return_value(c) < 0)
+      errors++;
+    rados_aio_release(c);
+    finished++;
+    if (started < ops)
+      start_one();
+  }
+
+  double run() {
+    double start = now();
+    while (started < outstanding && started < ops)
+      start_one();
+
+    struct pollfd pfd;
+    pfd.fd = cq ? rados_completion_queue_get_fd(cq) : pipefd[0];
+    pfd.events = POLLIN;
+    rados_completion_t batch[256];
+    while (finished < ops) {
+      if (poll(&pfd, 1, -1) < 0) {
+	if (errno == EINTR)
+	  continue;
+	perror("poll");
+	exit(1);
+      }
+      int n;
+      if (cq) {
+	n = rados_completion_queue_reap(cq, batch, 256);
+      } else {
+	n = read(pipefd[0], batch, sizeof(batch));
+	if (n < 0) {
+	  perror("read");
+	  exit(1);
+	}
+	n /= sizeof(batch[0]);
+      }
+      for (int i = 0; i < n; i++)
+	finish(batch[i]);
+    }
+    return now() - start;
+  }
+};
+
+int main(int argc, const char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0]
+	      << " pool [ops (100000)] [outstanding (10000)] [size (4096)]"
+	      << std::endl;
+    return 1;
+  }
+  const char *pool = argv[1];
+  int ops = argc > 2 ? atoi(argv[2]) : 100000;
+  int outstanding = argc > 3 ? atoi(argv[3]) : 10000;
+  int size = argc > 4 ? atoi(argv[4]) : 4096;
+
+  rados_t cluster;
+  int r = rados_create(&cluster, getenv("CEPH_CLIENT_ID"));
+  if (r == 0)
+    r = rados_conf_read_file(cluster, NULL);
+  if (r == 0)
+    r = rados_conf_parse_env(cluster, NULL);
+  if (r == 0)
+    r = rados_connect(cluster);
+  if (r < 0) {
+    std::cerr << "failed to connect: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  rados_ioctx_t io;
+  r = rados_ioctx_create(cluster, pool, &io);
+  if (r < 0) {
+    std::cerr << "failed to open pool " << pool << ": " << strerror(-r) << std::endl;
+    rados_shutdown(cluster);
+    return 1;
+  }
+
+  if (pipe(pipefd) < 0) {
+    perror("pipe");
+    return 1;
+  }
+
+  std::cout << ops << " writes of " << size << " bytes, "
+	    << outstanding << " outstanding" << std::endl;
+
+  Bench cb(io, ops, outstanding, size);
+  double t = cb.run();
+  std::cout << "callback+pipe: " << ops / t << " ops/s"
+	    << " (" << cb.errors << " errors)" << std::endl;
+
+  Bench q(io, ops, outstanding, size);
+  r = rados_completion_queue_create(&q.cq);
+  if (r < 0) {
+    std::cerr << "rados_completion_queue_create: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  t = q.run();
+  std::cout << "completion queue: " << ops / t << " ops/s"
+	    << " (" << q.errors << " errors)" << std::endl;
+  rados_completion_queue_destroy(q.cq);
+
+  for (int n = 0; n < num_objects; n++)
+    rados_remove(io, q.oids[n].c_str());
+  rados_ioctx_destroy(io);
+  rados_shutdown(cluster);
+  close(pipefd[0]);
+  close(pipefd[1]);
+  return 0;
+}
@@ -0,0 +1,148 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Copy a set of objects two ways and report the time taken and the
+ * bytes that crossed the client's links:
+ *
+ *  - client: read each object and write_full it back out, which is
+ *    what rgw copy and rbd flatten did before copy-from
+ *  - copy-from: have the target's osd fetch the object from the
+ *    source's osd directly
+ *
+ * The bytes are the data the client's objecter sent and got back in
+ * replies (its op_send_bytes and op_reply_bytes perf counters) over
+ * each run.
+ */
+
+#include "include/rados/librados.h"
+#include "common/ceph_context.h"
+#include "common/perf_counters.h"
+#include "json_spirit/json_spirit_value.h"
+#include "json_spirit/json_spirit_reader.h"
+#include "json_spirit/json_spirit_utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static string name(const char *prefix, int n)
+{
+  std::ostringstream ss;
+  ss << "bench_copy_from_" << prefix << "_" << n;
+  return ss.str();
+}
+
+static uint64_t client_bytes(rados_t cluster)
+{
+  CephContext *cct = (CephContext *)rados_cct(cluster);
+  bufferlist bl;
+  cct->get_perfcounters_collection()->write_json_to_buf(bl, false);
+  json_spirit::Value v;
+  if (!json_spirit::read(string(bl.c_str(), bl.length()), v)) {
+    std::cerr << "can't parse perf counters" << std::endl;
+    exit(1);
+  }
+  const json_spirit::Object& objecter =
+    json_spirit::find_value(v.get_obj(), string("objecter")).get_obj();
+  return json_spirit::find_value(objecter, string("op_send_bytes")).get_uint64() +
+    json_spirit::find_value(objecter, string("op_reply_bytes")).get_uint64();
+}
+
+static void check(int r, const char *what)
+{
+  if (r < 0) {
+    std::cerr << what << ": " << strerror(-r) << std::endl;
+    exit(1);
+  }
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0]
+	      << " pool [objects (64)] [size (4194304)]" << std::endl;
+    return 1;
+  }
+  const char *pool = argv[1];
+  int num = argc > 2 ? atoi(argv[2]) : 64;
+  int size = argc > 3 ? atoi(argv[3]) : 4 << 20;
+
+  rados_t cluster;
+  int r = rados_create(&cluster, getenv("CEPH_CLIENT_ID"));
+  if (r == 0)
+    r = rados_conf_read_file(cluster, NULL);
+  if (r == 0)
+    r = rados_conf_parse_env(cluster, NULL);
+  if (r == 0)
+    r = rados_connect(cluster);
+  if (r < 0) {
+    std::cerr << "failed to connect: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  rados_ioctx_t io;
+  r = rados_ioctx_create(cluster, pool, &io);
+  if (r < 0) {
+    std::cerr << "failed to open pool " << pool << ": " << strerror(-r) << std::endl;
+    rados_shutdown(cluster);
+    return 1;
+  }
+
+  vector<char> buf(size, 'x');
+  for (int n = 0; n < num; n++)
+    check(rados_write_full(io, name("src", n).c_str(), &buf[0], size),
+	  "rados_write_full");
+
+  std::cout << "copying " << num << " objects of " << size << " bytes"
+	    << std::endl;
+
+  uint64_t bytes = client_bytes(cluster);
+  double start = now();
+  for (int n = 0; n < num; n++) {
+    r = rados_read(io, name("src", n).c_str(), &buf[0], size, 0);
+    check(r, "rados_read");
+    check(rados_write_full(io, name("client", n).c_str(), &buf[0], r),
+	  "rados_write_full");
+  }
+  double t = now() - start;
+  bytes = client_bytes(cluster) - bytes;
+  std::cout << "client:    " << t << " s, " << bytes
+	    << " bytes through the client" << std::endl;
+
+  bytes = client_bytes(cluster);
+  start = now();
+  for (int n = 0; n < num; n++) {
+    rados_write_op_t op = rados_create_write_op();
+    rados_write_op_copy_from(op, io, name("src", n).c_str(), 0, 0);
+    r = rados_write_op_operate(op, io, name("osd", n).c_str(), NULL);
+    rados_release_write_op(op);
+    check(r, "copy-from");
+  }
+  t = now() - start;
+  bytes = client_bytes(cluster) - bytes;
+  std::cout << "copy-from: " << t << " s, " << bytes
+	    << " bytes through the client" << std::endl;
+
+  for (int n = 0; n < num; n++) {
+    rados_remove(io, name("src", n).c_str());
+    rados_remove(io, name("client", n).c_str());
+    rados_remove(io, name("osd", n).c_str());
+  }
+  rados_ioctx_destroy(io);
+  rados_shutdown(cluster);
+  return 0;
+}
@@ -0,0 +1,133 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Cost of submitting an rbd aio, against its size: the time spent in
+ * rbd_aio_write() and rbd_aio_read() themselves, not waiting for the
+ * result, for ios spanning more and more objects.  The image uses
+ * small objects so that even modest ios are split many ways; the
+ * cache is off so every piece goes to the osds.
+ */
+
+#include "include/rados/librados.h"
+#include "include/rbd/librbd.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <iostream>
+#include <string>
+
+using std::string;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int connect(rados_t *cluster)
+{
+  int r = rados_create(cluster, getenv("CEPH_CLIENT_ID"));
+  if (r == 0)
+    r = rados_conf_read_file(*cluster, NULL);
+  if (r == 0)
+    r = rados_conf_parse_env(*cluster, NULL);
+  if (r == 0)
+    r = rados_conf_set(*cluster, "rbd_cache", "false");
+  if (r == 0)
+    r = rados_connect(*cluster);
+  return r;
+}
+
+// mean microseconds spent submitting each of count ios of len bytes
+static double run(rbd_image_t image, uint64_t size, size_t len, int count,
+		  bool write)
+{
+  string buf(len, 'a');
+  double submit = 0;
+  for (int i = 0; i < count; i++) {
+    // start at an odd offset so each io touches a partial object at
+    // both ends
+    uint64_t off = ((uint64_t)i * len + 512) % (size - len);
+    rbd_completion_t c;
+    rbd_aio_create_completion(NULL, NULL, &c);
+    double start = now();
+    int r;
+    if (write)
+      r = rbd_aio_write(image, off, len, buf.c_str(), c);
+    else
+      r = rbd_aio_read(image, off, len, &buf[0], c);
+    submit += now() - start;
+    if (r < 0) {
+      std::cerr << (write ? "rbd_aio_write" : "rbd_aio_read") << " at "
+		<< off << ": " << strerror(-r) << std::endl;
+      exit(1);
+    }
+    rbd_aio_wait_for_complete(c);
+    r = rbd_aio_get_return_value(c);
+    rbd_aio_release(c);
+    if (r < 0) {
+      std::cerr << (write ? "write" : "read") << " at " << off << ": "
+		<< strerror(-r) << std::endl;
+      exit(1);
+    }
+  }
+  return submit / count * 1000000;
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " pool [count (100)] [order (16)]"
+	      << std::endl;
+    return 1;
+  }
+  const char *pool = argv[1];
+  int count = argc > 2 ? atoi(argv[2]) : 100;
+  int order = argc > 3 ? atoi(argv[3]) : 16;
+  const char *name = "bench_rbd_aio_submit";
+  uint64_t size = 256ull << 20;
+
+  rados_t cluster;
+  int r = connect(&cluster);
+  if (r < 0) {
+    std::cerr << "failed to connect: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  rados_ioctx_t io;
+  r = rados_ioctx_create(cluster, pool, &io);
+  if (r < 0) {
+    std::cerr << "failed to open pool " << pool << ": " << strerror(-r) << std::endl;
+    return 1;
+  }
+
+  r = rbd_create(io, name, size, &order);
+  if (r < 0) {
+    std::cerr << "rbd_create: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  rbd_image_t image;
+  r = rbd_open(io, name, &image, NULL);
+  if (r < 0) {
+    std::cerr << "rbd_open: " << strerror(-r) << std::endl;
+    return 1;
+  }
+
+  std::cout << "submission cost, " << count << " ios each, "
+	    << (1 << (order - 10)) << "k objects" << std::endl;
+  for (size_t len = 4096; len <= (16u << 20); len <<= 2) {
+    double wr = run(image, size, len, count, true);
+    double rd = run(image, size, len, count, false);
+    std::cout << (len >> 10) << "k: write " << wr << " us, read " << rd
+	      << " us" << std::endl;
+  }
+
+  rbd_close(image);
+  rbd_remove(io, name);
+  rados_ioctx_destroy(io);
+  rados_shutdown(cluster);
+  return 0;
+}
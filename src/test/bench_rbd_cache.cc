@@ -0,0 +1,177 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Cached small read IOPS through librbd from many threads sharing one
+ * image, the way a guest with several queues does IO.  An image small
+ * enough to fit in the cache is filled and read once to warm it, then
+ * every thread does random 4k reads for a while, with the cache in
+ * one piece and split into as many shards as there are threads.
+ */
+
+#include "include/rados/librados.h"
+#include "include/rbd/librbd.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int connect(const char *shards, rados_t *cluster)
+{
+  int r = rados_create(cluster, getenv("CEPH_CLIENT_ID"));
+  if (r == 0)
+    r = rados_conf_read_file(*cluster, NULL);
+  if (r == 0)
+    r = rados_conf_parse_env(*cluster, NULL);
+  if (r == 0)
+    r = rados_conf_set(*cluster, "rbd_cache", "true");
+  if (r == 0)
+    r = rados_conf_set(*cluster, "rbd_cache_size", "268435456");
+  if (r == 0)
+    r = rados_conf_set(*cluster, "rbd_cache_shards", shards);
+  if (r == 0)
+    r = rados_connect(*cluster);
+  return r;
+}
+
+struct reader_t {
+  rbd_image_t image;
+  uint64_t size;
+  double end;
+  unsigned seed;
+  uint64_t ops;
+};
+
+static void *reader(void *arg)
+{
+  reader_t *rd = (reader_t *)arg;
+  char buf[4096];
+  uint64_t blocks = rd->size / sizeof(buf);
+  rd->ops = 0;
+  while (now() < rd->end) {
+    // check the clock every so often rather than on every read
+    for (int i = 0; i < 256; i++) {
+      uint64_t off = (rand_r(&rd->seed) % blocks) * sizeof(buf);
+      ssize_t n = rbd_read(rd->image, off, sizeof(buf), buf);
+      if (n != (ssize_t)sizeof(buf)) {
+	std::cerr << "rbd_read at " << off << ": " << n << std::endl;
+	exit(1);
+      }
+    }
+    rd->ops += 256;
+  }
+  return NULL;
+}
+
+static double run(rados_ioctx_t io, const char *name, uint64_t size,
+		  int threads, int seconds)
+{
+  rbd_image_t image;
+  int r = rbd_open(io, name, &image, NULL);
+  if (r < 0) {
+    std::cerr << "rbd_open: " << strerror(-r) << std::endl;
+    exit(1);
+  }
+
+  // warm the cache
+  std::vector<char> chunk(4 << 20);
+  for (uint64_t off = 0; off < size; off += chunk.size())
+    rbd_read(image, off, chunk.size(), &chunk[0]);
+
+  std::vector<pthread_t> tids(threads);
+  std::vector<reader_t> readers(threads);
+  double start = now();
+  for (int i = 0; i < threads; i++) {
+    readers[i].image = image;
+    readers[i].size = size;
+    readers[i].end = start + seconds;
+    readers[i].seed = i;
+    pthread_create(&tids[i], NULL, reader, &readers[i]);
+  }
+  uint64_t ops = 0;
+  for (int i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+    ops += readers[i].ops;
+  }
+  double t = now() - start;
+  rbd_close(image);
+  return ops / t;
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " pool [threads (8)] [seconds (10)]"
+	      << std::endl;
+    return 1;
+  }
+  const char *pool = argv[1];
+  int threads = argc > 2 ? atoi(argv[2]) : 8;
+  int seconds = argc > 3 ? atoi(argv[3]) : 10;
+  uint64_t size = 64 << 20;
+  const char *name = "bench_rbd_cache";
+
+  std::ostringstream shards;
+  shards << threads;
+  rados_t one_cluster, many_cluster;
+  int r = connect("1", &one_cluster);
+  if (r == 0)
+    r = connect(shards.str().c_str(), &many_cluster);
+  if (r < 0) {
+    std::cerr << "failed to connect: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  rados_ioctx_t one_io, many_io;
+  r = rados_ioctx_create(one_cluster, pool, &one_io);
+  if (r == 0)
+    r = rados_ioctx_create(many_cluster, pool, &many_io);
+  if (r < 0) {
+    std::cerr << "failed to open pool " << pool << ": " << strerror(-r) << std::endl;
+    return 1;
+  }
+
+  int order = 0;
+  r = rbd_create(one_io, name, size, &order);
+  if (r < 0) {
+    std::cerr << "rbd_create: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  {
+    rbd_image_t image;
+    rbd_open(one_io, name, &image, NULL);
+    string chunk(4 << 20, 'x');
+    for (uint64_t off = 0; off < size; off += chunk.size())
+      rbd_write(image, off, chunk.size(), chunk.c_str());
+    rbd_close(image);
+  }
+
+  std::cout << "random cached 4k reads of " << (size >> 20) << " MB from "
+	    << threads << " threads for " << seconds << "s" << std::endl;
+  double iops_one = run(one_io, name, size, threads, seconds);
+  double iops_many = run(many_io, name, size, threads, seconds);
+  std::cout << "1 shard: " << (uint64_t)iops_one << " IOPS, "
+	    << threads << " shards: " << (uint64_t)iops_many << " IOPS"
+	    << std::endl;
+
+  rbd_remove(one_io, name);
+  rados_ioctx_destroy(one_io);
+  rados_ioctx_destroy(many_io);
+  rados_shutdown(one_cluster);
+  rados_shutdown(many_cluster);
+  return 0;
+}
@@ -0,0 +1,135 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Sequential read throughput through librbd, one read at a time, the
+ * way a booting guest or a dd inside one reads its disk.  An image is
+ * filled once, then read from start to end at each block size, with
+ * the cache on and readahead off and on.  The image is reopened for
+ * every run so nothing is served from a previous run's cache.
+ */
+
+#include "include/rados/librados.h"
+#include "include/rbd/librbd.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int connect(const char *readahead_max, rados_t *cluster)
+{
+  int r = rados_create(cluster, getenv("CEPH_CLIENT_ID"));
+  if (r == 0)
+    r = rados_conf_read_file(*cluster, NULL);
+  if (r == 0)
+    r = rados_conf_parse_env(*cluster, NULL);
+  if (r == 0)
+    r = rados_conf_set(*cluster, "rbd_cache", "true");
+  if (r == 0 && readahead_max)
+    r = rados_conf_set(*cluster, "rbd_readahead_max_bytes", readahead_max);
+  // measure the whole run, not just the start of it
+  if (r == 0)
+    r = rados_conf_set(*cluster, "rbd_readahead_disable_after_bytes", "0");
+  if (r == 0)
+    r = rados_connect(*cluster);
+  return r;
+}
+
+static double run(rados_ioctx_t io, const char *name, uint64_t size,
+		  size_t bs)
+{
+  rbd_image_t image;
+  int r = rbd_open(io, name, &image, NULL);
+  if (r < 0) {
+    std::cerr << "rbd_open: " << strerror(-r) << std::endl;
+    exit(1);
+  }
+  std::vector<char> buf(bs);
+  double start = now();
+  for (uint64_t off = 0; off + bs <= size; off += bs) {
+    ssize_t n = rbd_read(image, off, bs, &buf[0]);
+    if (n != (ssize_t)bs) {
+      std::cerr << "rbd_read at " << off << ": " << n << std::endl;
+      exit(1);
+    }
+  }
+  double t = now() - start;
+  rbd_close(image);
+  return t;
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " pool [size_mb (256)]" << std::endl;
+    return 1;
+  }
+  const char *pool = argv[1];
+  uint64_t size = (argc > 2 ? atoll(argv[2]) : 256) << 20;
+  const char *name = "bench_rbd_seqread";
+
+  rados_t off_cluster, on_cluster;
+  int r = connect("0", &off_cluster);
+  if (r == 0)
+    r = connect(NULL, &on_cluster);
+  if (r < 0) {
+    std::cerr << "failed to connect: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  rados_ioctx_t off_io, on_io;
+  r = rados_ioctx_create(off_cluster, pool, &off_io);
+  if (r == 0)
+    r = rados_ioctx_create(on_cluster, pool, &on_io);
+  if (r < 0) {
+    std::cerr << "failed to open pool " << pool << ": " << strerror(-r) << std::endl;
+    return 1;
+  }
+
+  int order = 0;
+  r = rbd_create(on_io, name, size, &order);
+  if (r < 0) {
+    std::cerr << "rbd_create: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  {
+    rbd_image_t image;
+    rbd_open(on_io, name, &image, NULL);
+    string chunk(4 << 20, 'x');
+    for (uint64_t off = 0; off < size; off += chunk.size())
+      rbd_write(image, off, chunk.size(), chunk.c_str());
+    rbd_close(image);
+  }
+
+  std::cout << "sequential read of " << (size >> 20) << " MB, one read at a time"
+	    << std::endl;
+  size_t sizes[] = { 4096, 16384, 65536, 131072 };
+  for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t bs = sizes[i];
+    double t_off = run(off_io, name, size, bs);
+    double t_on = run(on_io, name, size, bs);
+    std::cout << "bs " << (bs >> 10) << "k: "
+	      << (size >> 20) / t_off << " MB/s without readahead, "
+	      << (size >> 20) / t_on << " MB/s with" << std::endl;
+  }
+
+  rbd_remove(on_io, name);
+  rados_ioctx_destroy(off_io);
+  rados_ioctx_destroy(on_io);
+  rados_shutdown(off_cluster);
+  rados_shutdown(on_cluster);
+  return 0;
+}
@@ -0,0 +1,142 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Writeback throughput through the librbd cache: small writes, one at
+ * a time, sequential and then in random order, timed until they are
+ * all flushed to the osds.  Each run is done with the writeback window
+ * unlimited and limited, so the effect of the window can be compared;
+ * the cache's flush_ops_* perf counters show how the writes to the
+ * osds were sized.
+ */
+
+#include "include/rados/librados.h"
+#include "include/rbd/librbd.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static int connect(const char *window, rados_t *cluster)
+{
+  int r = rados_create(cluster, getenv("CEPH_CLIENT_ID"));
+  if (r == 0)
+    r = rados_conf_read_file(*cluster, NULL);
+  if (r == 0)
+    r = rados_conf_parse_env(*cluster, NULL);
+  if (r == 0)
+    r = rados_conf_set(*cluster, "rbd_cache", "true");
+  if (r == 0)
+    r = rados_conf_set(*cluster, "rbd_cache_writeback_window", window);
+  if (r == 0)
+    r = rados_connect(*cluster);
+  return r;
+}
+
+static double run(rados_ioctx_t io, const char *name, uint64_t size,
+		  size_t bs, bool random)
+{
+  rbd_image_t image;
+  int r = rbd_open(io, name, &image, NULL);
+  if (r < 0) {
+    std::cerr << "rbd_open: " << strerror(-r) << std::endl;
+    exit(1);
+  }
+  uint64_t blocks = size / bs;
+  std::vector<uint64_t> order(blocks);
+  for (uint64_t i = 0; i < blocks; i++)
+    order[i] = i;
+  if (random) {
+    unsigned seed = 0;
+    for (uint64_t i = blocks - 1; i > 0; i--)
+      std::swap(order[i], order[rand_r(&seed) % (i + 1)]);
+  }
+  string buf(bs, 'w');
+  double start = now();
+  for (uint64_t i = 0; i < blocks; i++) {
+    ssize_t n = rbd_write(image, order[i] * bs, bs, buf.c_str());
+    if (n != (ssize_t)bs) {
+      std::cerr << "rbd_write at " << order[i] * bs << ": " << n << std::endl;
+      exit(1);
+    }
+  }
+  rbd_flush(image);
+  double t = now() - start;
+  rbd_close(image);
+  return t;
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " pool [size_mb (256)] [window_bytes (4194304)]"
+	      << std::endl;
+    return 1;
+  }
+  const char *pool = argv[1];
+  uint64_t size = (argc > 2 ? atoll(argv[2]) : 256) << 20;
+  const char *window = argc > 3 ? argv[3] : "4194304";
+  const char *name = "bench_rbd_writeback";
+
+  rados_t unlimited_cluster, window_cluster;
+  int r = connect("0", &unlimited_cluster);
+  if (r == 0)
+    r = connect(window, &window_cluster);
+  if (r < 0) {
+    std::cerr << "failed to connect: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  rados_ioctx_t unlimited_io, window_io;
+  r = rados_ioctx_create(unlimited_cluster, pool, &unlimited_io);
+  if (r == 0)
+    r = rados_ioctx_create(window_cluster, pool, &window_io);
+  if (r < 0) {
+    std::cerr << "failed to open pool " << pool << ": " << strerror(-r) << std::endl;
+    return 1;
+  }
+
+  int order = 0;
+  r = rbd_create(unlimited_io, name, size, &order);
+  if (r < 0) {
+    std::cerr << "rbd_create: " << strerror(-r) << std::endl;
+    return 1;
+  }
+
+  std::cout << "writeback of " << (size >> 20) << " MB, one write at a time"
+	    << std::endl;
+  size_t sizes[] = { 4096, 16384, 65536 };
+  for (int random = 0; random < 2; random++) {
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      size_t bs = sizes[i];
+      double t_unlimited = run(unlimited_io, name, size, bs, random);
+      double t_window = run(window_io, name, size, bs, random);
+      std::cout << (random ? "random" : "sequential") << " bs "
+		<< (bs >> 10) << "k: "
+		<< (size >> 20) / t_unlimited << " MB/s unlimited, "
+		<< (size >> 20) / t_window << " MB/s with a " << window
+		<< " byte window" << std::endl;
+    }
+  }
+
+  rbd_remove(unlimited_io, name);
+  rados_ioctx_destroy(unlimited_io);
+  rados_ioctx_destroy(window_io);
+  rados_shutdown(unlimited_cluster);
+  rados_shutdown(window_cluster);
+  return 0;
+}
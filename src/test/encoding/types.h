@@ -55,12 +55,17 @@ TYPE(pg_create_t)
 TYPE(watch_info_t)
 TYPE(object_info_t)
 TYPE(SnapSet)
+TYPE(clone_info)
+TYPE(obj_list_snap_response_t)
 TYPE(ObjectRecoveryInfo)
 TYPE(ObjectRecoveryProgress)
 TYPE(ScrubMap::object)
 TYPE(ScrubMap)
 TYPE(osd_peer_stat_t)
 
+#include "osd/ObjectHeat.h"
+TYPE(ObjectHeat)
+
 #include "os/ObjectStore.h"
 TYPE(ObjectStore::Transaction)
 
@@ -291,6 +296,8 @@ MESSAGE(MOSDFailure)
 MESSAGE(MOSDMap)
 #include "messages/MOSDOp.h"
 MESSAGE(MOSDOp)
+#include "messages/MOSDOpBatch.h"
+MESSAGE(MOSDOpBatch)
 #include "messages/MOSDOpReply.h"
 MESSAGE(MOSDOpReply)
 #include "messages/MOSDPGBackfill.h"
@@ -0,0 +1,246 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Replay a long run of OSDMap incrementals the way a daemon that has
+ * fallen behind catches up, and time it:
+ *
+ *  - osd: every epoch has to be built and stored as a full map.  the
+ *    old way round-tripped the previous map through encode/decode to
+ *    get a copy to apply to; now it is deepish_copy_from().
+ *  - client: the objecter used to retarget every op after each epoch;
+ *    now it applies the whole run and retargets once, resending
+ *    anything the run touched along the way (Objecter::MapChurn).
+ *
+ * Both are checked: the maps must encode identically, and every op
+ * the per-epoch walk would have resent must be resent by the
+ * coalesced one too.
+ */
+
+#include "include/types.h"
+#include "common/Clock.h"
+#include "common/ceph_argparse.h"
+#include "common/common_init.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "osd/OSDMap.h"
+#include "osdc/Objecter.h"
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <set>
+
+struct FakeOp {
+  pg_t pgid;
+  vector<int> acting;
+};
+
+static void mark_up(int o, int nonce, OSDMap::Incremental *inc)
+{
+  entity_addr_t a;
+  a.set_nonce(nonce);
+  inc->new_up_client[o] = a;
+  inc->new_up_internal[o] = a;
+  inc->new_hb_up[o] = a;
+}
+
+/*
+ * the first incremental marks every osd up and in.  after that, a
+ * flap storm: each epoch fails a random osd, brings back a failed
+ * one, or moves a pg with pg_temp (and later back).
+ */
+static void build_incs(OSDMap *base, int num_osd, int num_epochs,
+		       vector<OSDMap::Incremental> *incs)
+{
+  epoch_t e = base->get_epoch();
+  OSDMap::Incremental up(++e);
+  up.fsid = base->get_fsid();
+  for (int i = 0; i < num_osd; i++) {
+    mark_up(i, i, &up);
+    up.new_weight[i] = CEPH_OSD_IN;
+  }
+  incs->push_back(up);
+
+  const map<int64_t,pg_pool_t> &pools = base->get_pools();
+  int64_t pool = pools.begin()->first;
+  unsigned pg_num = pools.begin()->second.get_pg_num();
+
+  set<int> down;
+  set<pg_t> temp;
+  while ((int)incs->size() < num_epochs + 1) {
+    OSDMap::Incremental inc(++e);
+    inc.fsid = base->get_fsid();
+    int r = rand() % 3;
+    if (r == 0 && (int)down.size() < num_osd / 4) {
+      int o = rand() % num_osd;
+      if (!down.count(o)) {
+	inc.new_state[o] = CEPH_OSD_UP;
+	down.insert(o);
+      }
+    } else if (r == 1 && !down.empty()) {
+      int o = *down.begin();
+      mark_up(o, o + e * num_osd, &inc);
+      down.erase(o);
+    } else {
+      pg_t pgid(rand() % pg_num, pool, -1);
+      if (temp.count(pgid)) {
+	inc.new_pg_temp[pgid] = vector<int32_t>();
+	temp.erase(pgid);
+      } else {
+	vector<int32_t> t;
+	t.push_back(rand() % num_osd);
+	inc.new_pg_temp[pgid] = t;
+	temp.insert(pgid);
+      }
+    }
+    incs->push_back(inc);
+  }
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int num_osd = 200, pg_bits = 6, num_epochs = 1000, num_ops = 10000;
+  std::ostringstream err;
+  for (std::vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_withint(args, i, &num_osd, &err, "--osds", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &pg_bits, &err, "--pg-bits", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &num_epochs, &err, "--epochs", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &num_ops, &err, "--ops", (char*)NULL)) {
+    } else {
+      cout << "usage: bench_osdmap_catchup [--osds N] [--pg-bits B] [--epochs E] [--ops O]\n";
+      return 1;
+    }
+    if (!err.str().empty()) {
+      cerr << err.str() << std::endl;
+      return 1;
+    }
+  }
+  if (num_osd <= 0 || num_epochs <= 0 || num_ops < 0) {
+    cerr << "bad arguments" << std::endl;
+    return 1;
+  }
+
+  uuid_d fsid;
+  fsid.generate_random();
+  OSDMap base;
+  base.build_simple(g_ceph_context, 1, fsid, num_osd, pg_bits, pg_bits);
+  vector<OSDMap::Incremental> incs;
+  build_incs(&base, num_osd, num_epochs, &incs);
+  cout << "osds " << num_osd << ", " << incs.size() << " incrementals, "
+       << num_ops << " ops" << std::endl;
+
+  // -- osd: build and encode a full map for every epoch --
+  utime_t start = ceph_clock_now(g_ceph_context);
+  vector<bufferlist> old_full;
+  std::tr1::shared_ptr<OSDMap> prev(new OSDMap);
+  prev->deepish_copy_from(base);
+  for (unsigned i = 0; i < incs.size(); i++) {
+    OSDMap *o = new OSDMap;
+    bufferlist obl;
+    prev->encode(obl);
+    o->decode(obl);
+    o->apply_incremental(incs[i]);
+    bufferlist fbl;
+    o->encode(fbl);
+    old_full.push_back(fbl);
+    prev.reset(o);
+  }
+  utime_t osd_old = ceph_clock_now(g_ceph_context) - start;
+
+  start = ceph_clock_now(g_ceph_context);
+  prev.reset(new OSDMap);
+  prev->deepish_copy_from(base);
+  for (unsigned i = 0; i < incs.size(); i++) {
+    OSDMap *o = new OSDMap;
+    o->deepish_copy_from(*prev);
+    o->apply_incremental(incs[i]);
+    bufferlist fbl;
+    o->encode(fbl);
+    if (!fbl.contents_equal(old_full[i])) {
+      cerr << "full map for epoch " << o->get_epoch() << " differs!" << std::endl;
+      return 1;
+    }
+    prev.reset(o);
+  }
+  utime_t osd_new = ceph_clock_now(g_ceph_context) - start;
+  cout << "osd encode/decode:   " << osd_old << "s" << std::endl;
+  cout << "osd deepish copy:    " << osd_new << "s" << std::endl;
+
+  // -- client: retarget ops after each epoch, or once --
+  OSDMap cm;
+  cm.deepish_copy_from(base);
+  cm.apply_incremental(incs[0]);
+  vector<FakeOp> ops(num_ops);
+  for (int i = 0; i < num_ops; i++) {
+    std::ostringstream oid;
+    oid << "obj" << i;
+    object_locator_t oloc(cm.get_pools().begin()->first);
+    cm.object_locator_to_pg(object_t(oid.str()), oloc, ops[i].pgid);
+    cm.pg_to_acting_osds(ops[i].pgid, ops[i].acting);
+  }
+
+  OSDMap per_epoch;
+  per_epoch.deepish_copy_from(cm);
+  vector<FakeOp> pe_ops = ops;
+  set<int> pe_resend;
+  unsigned pe_count = 0;
+  start = ceph_clock_now(g_ceph_context);
+  for (unsigned i = 1; i < incs.size(); i++) {
+    per_epoch.apply_incremental(incs[i]);
+    for (int j = 0; j < num_ops; j++) {
+      vector<int> acting;
+      per_epoch.pg_to_acting_osds(pe_ops[j].pgid, acting);
+      if (acting.empty() != pe_ops[j].acting.empty() ||
+	  (!acting.empty() && acting[0] != pe_ops[j].acting[0])) {
+	pe_resend.insert(j);
+	++pe_count;
+      }
+      pe_ops[j].acting.swap(acting);
+    }
+  }
+  utime_t client_old = ceph_clock_now(g_ceph_context) - start;
+
+  OSDMap coalesced;
+  coalesced.deepish_copy_from(cm);
+  set<int> co_resend;
+  start = ceph_clock_now(g_ceph_context);
+  Objecter::MapChurn churn;
+  for (int j = 0; j < num_ops; j++)
+    churn.watch(ops[j].pgid, ops[j].acting);
+  for (unsigned i = 1; i < incs.size(); i++) {
+    coalesced.apply_incremental(incs[i]);
+    if (i + 1 < incs.size())
+      churn.add(incs[i], &coalesced);
+  }
+  for (int j = 0; j < num_ops; j++) {
+    vector<int> acting;
+    coalesced.pg_to_acting_osds(ops[j].pgid, acting);
+    if (acting.empty() != ops[j].acting.empty() ||
+	(!acting.empty() && acting[0] != ops[j].acting[0]) ||
+	churn.touches(&coalesced, ops[j].pgid, ops[j].acting))
+      co_resend.insert(j);
+  }
+  utime_t client_new = ceph_clock_now(g_ceph_context) - start;
+
+  cout << "client per epoch:    " << client_old << "s, " << pe_count
+       << " resends of " << pe_resend.size() << " ops" << std::endl;
+  cout << "client coalesced:    " << client_new << "s, " << co_resend.size()
+       << " resends" << std::endl;
+
+  for (set<int>::iterator p = pe_resend.begin(); p != pe_resend.end(); ++p) {
+    if (!co_resend.count(*p)) {
+      cerr << "op " << *p << " was retargeted per epoch but not coalesced!"
+	   << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,281 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Replay a sequence of OSDMaps against a set of simulated PGs the way
+ * the OSD peering work queue does: every pg walks each new epoch,
+ * recomputes its up/acting sets and closes out past intervals.  The
+ * walk is done once serially and once through a ThreadPool with a
+ * batched work queue so the speedup from processing pgs in parallel
+ * (and the effect of the batch size) can be measured.
+ */
+
+#include "include/types.h"
+#include "common/Clock.h"
+#include "common/Mutex.h"
+#include "common/WorkQueue.h"
+#include "common/ceph_argparse.h"
+#include "common/common_init.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "osd/OSDMap.h"
+#include "osd/osd_types.h"
+
+#include <iostream>
+#include <vector>
+#include <list>
+#include <set>
+
+struct FakePG {
+  pg_t pgid;
+  OSDMapRef lastmap;
+  vector<int> up, acting;
+  epoch_t same_interval_since;
+  map<epoch_t, pg_interval_t> past_intervals;
+
+  FakePG(pg_t p, OSDMapRef m)
+    : pgid(p), lastmap(m), same_interval_since(m->get_epoch()) {
+    m->pg_to_up_acting_osds(pgid, up, acting);
+  }
+
+  /// same loop as OSD::advance_pg
+  unsigned advance(const vector<OSDMapRef> &maps) {
+    unsigned changed = 0;
+    for (epoch_t e = lastmap->get_epoch() + 1; e < maps.size(); ++e) {
+      OSDMapRef nextmap = maps[e];
+      vector<int> newup, newacting;
+      nextmap->pg_to_up_acting_osds(pgid, newup, newacting);
+      if (pg_interval_t::check_new_interval(acting, newacting, up, newup,
+					    same_interval_since, 0,
+					    nextmap, lastmap,
+					    &past_intervals)) {
+	same_interval_since = e;
+	++changed;
+      }
+      up.swap(newup);
+      acting.swap(newacting);
+      lastmap = nextmap;
+    }
+    return changed;
+  }
+};
+
+struct PeeringBenchWQ : public ThreadPool::BatchWorkQueue<FakePG> {
+  list<FakePG*> q;
+  const vector<OSDMapRef> &maps;
+  const size_t batch_size;
+  Mutex lock;
+  unsigned changed;
+  unsigned batches;
+
+  PeeringBenchWQ(ThreadPool *tp, const vector<OSDMapRef> &m, size_t b)
+    : ThreadPool::BatchWorkQueue<FakePG>("PeeringBenchWQ", 60, 0, tp),
+      maps(m), batch_size(b), lock("PeeringBenchWQ::lock"),
+      changed(0), batches(0) {}
+
+  bool _enqueue(FakePG *pg) {
+    q.push_back(pg);
+    return true;
+  }
+  void _dequeue(FakePG *pg) {
+    q.remove(pg);
+  }
+  bool _empty() {
+    return q.empty();
+  }
+  void _dequeue(list<FakePG*> *out) {
+    while (!q.empty() && out->size() < batch_size) {
+      out->push_back(q.front());
+      q.pop_front();
+    }
+  }
+  void _process(const list<FakePG*> &pgs) {
+    unsigned c = 0;
+    for (list<FakePG*>::const_iterator i = pgs.begin(); i != pgs.end(); ++i)
+      c += (*i)->advance(maps);
+    Mutex::Locker l(lock);
+    changed += c;
+    ++batches;
+  }
+  void _clear() {
+    q.clear();
+  }
+};
+
+static OSDMapRef next_map(OSDMapRef prev, OSDMap::Incremental &inc)
+{
+  OSDMap *m = new OSDMap;
+  bufferlist bl;
+  prev->encode(bl);
+  m->decode(bl);
+  inc.fsid = prev->get_fsid();
+  inc.epoch = prev->get_epoch() + 1;
+  m->apply_incremental(inc);
+  return OSDMapRef(m);
+}
+
+/*
+ * epoch 1 is the empty map from build_simple; epoch 2 marks every osd
+ * up and in.  After that, each round fails a "rack" of consecutive
+ * osds, flaps a random osd, and brings the rack back.
+ */
+static void build_maps(int num_osd, int pg_bits, int num_epochs, int rack,
+		       vector<OSDMapRef> *maps)
+{
+  uuid_d fsid;
+  fsid.generate_random();
+  OSDMap *base = new OSDMap;
+  base->build_simple(g_ceph_context, 1, fsid, num_osd, pg_bits, pg_bits);
+  maps->resize(2);
+  (*maps)[1] = OSDMapRef(base);
+
+  OSDMap::Incremental up;
+  for (int i = 0; i < num_osd; i++) {
+    entity_addr_t a;
+    a.set_nonce(i);
+    up.new_up_client[i] = a;
+    up.new_up_internal[i] = a;
+    up.new_hb_up[i] = a;
+    up.new_weight[i] = CEPH_OSD_IN;
+  }
+  maps->push_back(next_map((*maps)[1], up));
+
+  set<int> down;
+  int first = 0;
+  while ((int)maps->size() < num_epochs + 3) {
+    OSDMapRef cur = maps->back();
+    OSDMap::Incremental inc;
+    if (down.empty()) {
+      first = (first + rack) % num_osd;
+      for (int i = 0; i < rack && i < num_osd; i++) {
+	int o = (first + i) % num_osd;
+	inc.new_state[o] = CEPH_OSD_UP;
+	down.insert(o);
+      }
+    } else if (rand() % 2) {
+      int o = rand() % num_osd;
+      if (!down.count(o)) {
+	inc.new_state[o] = CEPH_OSD_UP;
+	down.insert(o);
+      }
+    } else {
+      for (set<int>::iterator p = down.begin(); p != down.end(); ++p) {
+	entity_addr_t a;
+	a.set_nonce(*p + maps->size() * num_osd);
+	inc.new_up_client[*p] = a;
+	inc.new_up_internal[*p] = a;
+	inc.new_hb_up[*p] = a;
+      }
+      down.clear();
+    }
+    maps->push_back(next_map(cur, inc));
+  }
+}
+
+static void make_pgs(const vector<OSDMapRef> &maps, list<FakePG*> *pgs)
+{
+  OSDMapRef start = maps[2];
+  const map<int64_t,pg_pool_t> &pools = start->get_pools();
+  for (map<int64_t,pg_pool_t>::const_iterator p = pools.begin();
+       p != pools.end();
+       ++p) {
+    for (unsigned ps = 0; ps < p->second.get_pg_num(); ++ps)
+      pgs->push_back(new FakePG(pg_t(ps, p->first, -1), start));
+  }
+}
+
+static void clear_pgs(list<FakePG*> *pgs)
+{
+  while (!pgs->empty()) {
+    delete pgs->front();
+    pgs->pop_front();
+  }
+}
+
+static void usage()
+{
+  cout << "usage: bench_peering [--osds N] [--pg-bits B] [--epochs E]\n"
+       << "                     [--rack R] [--threads T] [--batch S]\n"
+       << "\n"
+       << "Replays E osdmap epochs against every pg of a simple map with\n"
+       << "N osds, serially and then with T threads taking S pgs per batch.\n";
+}
+
+int main(int argc, const char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+  env_to_vec(args);
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  int num_osd = 48, pg_bits = 6, num_epochs = 50, rack = 8;
+  int threads = 8, batch = 20;
+  std::ostringstream err;
+  for (std::vector<const char*>::iterator i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_withint(args, i, &num_osd, &err, "--osds", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &pg_bits, &err, "--pg-bits", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &num_epochs, &err, "--epochs", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &rack, &err, "--rack", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &threads, &err, "--threads", (char*)NULL)) {
+    } else if (ceph_argparse_withint(args, i, &batch, &err, "--batch", (char*)NULL)) {
+    } else {
+      usage();
+      return 1;
+    }
+    if (!err.str().empty()) {
+      cerr << err.str() << std::endl;
+      return 1;
+    }
+  }
+  if (num_osd <= 0 || num_epochs <= 0 || threads <= 0 || batch <= 0) {
+    usage();
+    return 1;
+  }
+
+  vector<OSDMapRef> maps;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  build_maps(num_osd, pg_bits, num_epochs, rack, &maps);
+  utime_t build = ceph_clock_now(g_ceph_context) - start;
+
+  list<FakePG*> pgs;
+  make_pgs(maps, &pgs);
+  cout << "osds " << num_osd << " pgs " << pgs.size()
+       << " epochs " << (maps.size() - 3)
+       << " (maps built in " << build << "s)" << std::endl;
+
+  // serial: one thread walks every pg, as with a single batch
+  start = ceph_clock_now(g_ceph_context);
+  unsigned changed = 0;
+  for (list<FakePG*>::iterator p = pgs.begin(); p != pgs.end(); ++p)
+    changed += (*p)->advance(maps);
+  utime_t serial = ceph_clock_now(g_ceph_context) - start;
+  cout << "serial:   " << serial << "s, " << changed
+       << " interval changes" << std::endl;
+  clear_pgs(&pgs);
+
+  // parallel through a batched work queue
+  make_pgs(maps, &pgs);
+  ThreadPool tp(g_ceph_context, "bench_peering_tp", threads, "");
+  PeeringBenchWQ wq(&tp, maps, batch);
+  tp.start();
+  start = ceph_clock_now(g_ceph_context);
+  for (list<FakePG*>::iterator p = pgs.begin(); p != pgs.end(); ++p)
+    wq.queue(*p);
+  wq.drain();
+  utime_t parallel = ceph_clock_now(g_ceph_context) - start;
+  tp.stop();
+  cout << "parallel: " << parallel << "s, " << wq.changed
+       << " interval changes, " << wq.batches << " batches of <= " << batch
+       << " on " << threads << " threads" << std::endl;
+  clear_pgs(&pgs);
+
+  if (wq.changed != changed) {
+    cerr << "interval change count mismatch!" << std::endl;
+    return 1;
+  }
+  if ((double)parallel > 0)
+    cout << "speedup:  " << ((double)serial / (double)parallel) << "x" << std::endl;
+  return 0;
+}
@@ -0,0 +1,95 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "include/types.h"
+#include "osd/ClsReadCache.h"
+#include "gtest/gtest.h"
+
+#include <errno.h>
+
+static ceph_osd_op osd_op(int op)
+{
+  ceph_osd_op o;
+  memset(&o, 0, sizeof(o));
+  o.op = op;
+  return o;
+}
+
+TEST(ClsReadCache, Hits)
+{
+  ClsReadCache c;
+  ASSERT_FALSE(c.find_data(0, 4096));
+  ASSERT_FALSE(c.find_omap_header());
+  ASSERT_EQ(0u, c.hits);
+
+  bufferlist bl;
+  bl.append("data");
+  ASSERT_EQ(4, c.add_data(0, 4096, 4, bl)->first);
+  ClsReadCache::result_t *r = c.find_data(0, 4096);
+  ASSERT_TRUE(r);
+  ASSERT_EQ(4, r->first);
+  ASSERT_EQ(string("data"), string(r->second.c_str(), r->second.length()));
+  ASSERT_EQ(1u, c.hits);
+  // a different extent of the same object is a different read
+  ASSERT_FALSE(c.find_data(0, 8192));
+  ASSERT_FALSE(c.find_data(4096, 4096));
+
+  bufferlist header;
+  header.append("header");
+  c.add_omap_header(header);
+  ASSERT_EQ(6u, c.find_omap_header()->length());
+  ASSERT_EQ(2u, c.hits);
+}
+
+TEST(ClsReadCache, Misses)
+{
+  // that something isn't there is worth remembering too
+  ClsReadCache c;
+  bufferlist empty;
+  c.add_xattr("foo", -ENODATA, empty);
+  c.add_omap_val("bar", -ENOENT, empty);
+  ASSERT_EQ(-ENODATA, c.find_xattr("foo")->first);
+  ASSERT_EQ(-ENOENT, c.find_omap_val("bar")->first);
+  ASSERT_FALSE(c.find_xattr("bar"));
+  ASSERT_FALSE(c.find_omap_val("foo"));
+  ASSERT_EQ(2u, c.hits);
+}
+
+TEST(ClsReadCache, Invalidate)
+{
+  ClsReadCache c;
+  bufferlist bl;
+  bl.append("x");
+  c.add_data(0, 1, 1, bl);
+  bl.append("x");
+  c.add_xattr("foo", 1, bl);
+  bl.append("x");
+  c.add_omap_val("bar", 0, bl);
+  bl.append("x");
+  c.add_omap_header(bl);
+
+  // reads leave it alone...
+  c.note_op(osd_op(CEPH_OSD_OP_READ));
+  c.note_op(osd_op(CEPH_OSD_OP_GETXATTR));
+  c.note_op(osd_op(CEPH_OSD_OP_OMAPGETVALSBYKEYS));
+  c.note_op(osd_op(CEPH_OSD_OP_CALL));
+  ASSERT_TRUE(c.find_data(0, 1));
+  ASSERT_TRUE(c.find_xattr("foo"));
+  ASSERT_TRUE(c.find_omap_val("bar"));
+  ASSERT_TRUE(c.find_omap_header());
+
+  // ...any modification drops everything
+  c.note_op(osd_op(CEPH_OSD_OP_SETXATTR));
+  ASSERT_FALSE(c.find_data(0, 1));
+  ASSERT_FALSE(c.find_xattr("foo"));
+  ASSERT_FALSE(c.find_omap_val("bar"));
+  ASSERT_FALSE(c.find_omap_header());
+  ASSERT_EQ(4u, c.hits);
+
+  c.add_data(0, 1, 1, bl);
+  c.note_op(osd_op(CEPH_OSD_OP_OMAPSETVALS));
+  ASSERT_FALSE(c.find_data(0, 1));
+  c.add_data(0, 1, 1, bl);
+  c.note_op(osd_op(CEPH_OSD_OP_WRITE));
+  ASSERT_FALSE(c.find_data(0, 1));
+}
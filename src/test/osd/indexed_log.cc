@@ -0,0 +1,176 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "include/types.h"
+#include "osd/PG.h"
+#include "gtest/gtest.h"
+
+#include <sstream>
+
+static hobject_t obj(int i)
+{
+  ostringstream ss;
+  ss << "obj" << i;
+  return hobject_t(object_t(ss.str()), "", CEPH_NOSNAP, i, 0);
+}
+
+static pg_log_entry_t entry(int op, int o, version_t v, tid_t tid)
+{
+  return pg_log_entry_t(op, obj(o), eversion_t(1, v), eversion_t(),
+			osd_reqid_t(entity_name_t::CLIENT(1), 0, tid),
+			utime_t());
+}
+
+/*
+ * Every index slot must be keyed by the entry it refers to, and that
+ * entry must still be in the log: anything else is a key pointing at
+ * freed or reused memory.
+ */
+static void check_index(const PG::IndexedLog& log)
+{
+  set<const pg_log_entry_t*> entries;
+  for (list<pg_log_entry_t>::const_iterator p = log.log.begin();
+       p != log.log.end();
+       ++p)
+    entries.insert(&*p);
+  for (PG::IndexedLog::object_index_t::const_iterator p = log.objects.begin();
+       p != log.objects.end();
+       ++p) {
+    ASSERT_TRUE(entries.count(p->second));
+    ASSERT_EQ(&p->second->soid, p->first);
+  }
+  for (PG::IndexedLog::reqid_index_t::const_iterator p = log.caller_ops.begin();
+       p != log.caller_ops.end();
+       ++p) {
+    ASSERT_TRUE(entries.count(p->second));
+    ASSERT_EQ(&p->second->reqid, p->first);
+  }
+}
+
+// obj(o) written at each version in turn, by tid == version
+static void build(PG::IndexedLog *log, const int *objs, int n)
+{
+  for (int i = 0; i < n; i++) {
+    pg_log_entry_t e = entry(pg_log_entry_t::MODIFY, objs[i], i + 1, i + 1);
+    log->add(e);
+  }
+  log->reset_recovery_pointers();
+}
+
+TEST(IndexedLog, Add)
+{
+  PG::IndexedLog log;
+  const int objs[] = { 1, 2, 1, 3, 1 };
+  build(&log, objs, 5);
+  check_index(log);
+  ASSERT_EQ(3u, log.objects.size());
+  ASSERT_EQ(5u, log.caller_ops.size());
+  // a lookup by a name that isn't in any entry still finds it
+  ASSERT_EQ(eversion_t(1, 5), log.get_object_entry(obj(1))->version);
+  ASSERT_EQ(eversion_t(1, 2), log.get_object_entry(obj(2))->version);
+  ASSERT_TRUE(log.logged_req(osd_reqid_t(entity_name_t::CLIENT(1), 0, 3)));
+  ASSERT_FALSE(log.logged_object(obj(4)));
+}
+
+TEST(IndexedLog, Trim)
+{
+  PG::IndexedLog log;
+  const int objs[] = { 1, 2, 1, 3, 2 };
+  build(&log, objs, 5);
+  ObjectStore::Transaction t;
+
+  // obj(1)'s first entry goes, but it is still indexed by its second
+  log.trim(t, eversion_t(1, 1));
+  check_index(log);
+  ASSERT_EQ(eversion_t(1, 3), log.get_object_entry(obj(1))->version);
+  ASSERT_FALSE(log.logged_req(osd_reqid_t(entity_name_t::CLIENT(1), 0, 1)));
+
+  log.trim(t, eversion_t(1, 3));
+  check_index(log);
+  ASSERT_FALSE(log.logged_object(obj(1)));
+  ASSERT_EQ(eversion_t(1, 5), log.get_object_entry(obj(2))->version);
+  ASSERT_EQ(2u, log.objects.size());
+  ASSERT_EQ(2u, log.caller_ops.size());
+
+  log.trim(t, eversion_t(1, 5));
+  check_index(log);
+  ASSERT_TRUE(log.objects.empty());
+  ASSERT_TRUE(log.caller_ops.empty());
+}
+
+TEST(IndexedLog, Rewind)
+{
+  PG::IndexedLog log;
+  const int objs[] = { 1, 2, 1, 3, 2 };
+  build(&log, objs, 5);
+
+  list<pg_log_entry_t> divergent;
+  log.rewind_divergent(eversion_t(1, 2), &divergent);
+  ASSERT_EQ(3u, divergent.size());
+  ASSERT_EQ(eversion_t(1, 3), divergent.front().version);
+  ASSERT_EQ(eversion_t(1, 2), log.head);
+  // the divergent entries are about to be freed: nothing may refer to them
+  divergent.clear();
+  check_index(log);
+  ASSERT_FALSE(log.logged_object(obj(3)));
+  ASSERT_FALSE(log.logged_req(osd_reqid_t(entity_name_t::CLIENT(1), 0, 4)));
+  ASSERT_TRUE(log.logged_req(osd_reqid_t(entity_name_t::CLIENT(1), 0, 1)));
+
+  // all of it
+  log.rewind_divergent(eversion_t(1, 0), &divergent);
+  ASSERT_EQ(2u, divergent.size());
+  divergent.clear();
+  ASSERT_TRUE(log.log.empty());
+  ASSERT_TRUE(log.objects.empty());
+  ASSERT_TRUE(log.caller_ops.empty());
+}
+
+TEST(IndexedLog, Merge)
+{
+  // ours: 3..5; theirs: 1..7
+  PG::IndexedLog log;
+  for (int v = 3; v <= 5; v++) {
+    pg_log_entry_t e = entry(pg_log_entry_t::MODIFY, v % 2, v, v);
+    log.add(e);
+  }
+  log.tail = eversion_t(1, 2);
+  pg_log_t olog;
+  for (int v = 1; v <= 7; v++)
+    olog.log.push_back(entry(pg_log_entry_t::MODIFY, v % 2, v, v));
+  olog.head = eversion_t(1, 7);
+
+  // as merge_log extends the tail: index their older entries where
+  // they are, then splice them in; the keys move with them
+  list<pg_log_entry_t>::iterator to = olog.log.begin();
+  while (to->version <= log.tail)
+    log.index(*to++);
+  log.log.splice(log.log.begin(), olog.log, olog.log.begin(), to);
+  log.tail = eversion_t();
+  check_index(log);
+  ASSERT_EQ(eversion_t(1, 5), log.get_object_entry(obj(1))->version);
+  ASSERT_TRUE(log.logged_req(osd_reqid_t(entity_name_t::CLIENT(1), 0, 1)));
+
+  // ...and the head: drop what they don't have, splice theirs on,
+  // and reindex
+  while (log.log.back().version > eversion_t(1, 4)) {
+    log.unindex(log.log.back());
+    log.log.pop_back();
+  }
+  while (olog.log.front().version <= eversion_t(1, 4))
+    olog.log.pop_front();
+  log.log.splice(log.log.end(), olog.log);
+  log.head = olog.head;
+  log.index();
+  check_index(log);
+  ASSERT_EQ(7u, log.log.size());
+  ASSERT_EQ(7u, log.caller_ops.size());
+  ASSERT_EQ(eversion_t(1, 7), log.get_object_entry(obj(1))->version);
+  ASSERT_EQ(eversion_t(1, 6), log.get_object_entry(obj(0))->version);
+
+  // and the merged log can be copied: the copy is keyed by its own
+  // entries
+  PG::IndexedLog copy;
+  copy.claim_log(log);
+  check_index(copy);
+  ASSERT_NE(log.get_object_entry(obj(1)), copy.get_object_entry(obj(1)));
+}
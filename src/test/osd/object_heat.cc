@@ -0,0 +1,149 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "include/types.h"
+#include "osd/ObjectHeat.h"
+#include "common/Clock.h"
+#include "gtest/gtest.h"
+
+#include <sstream>
+
+static hobject_t obj(int i)
+{
+  ostringstream ss;
+  ss << "obj" << i;
+  return hobject_t(object_t(ss.str()), "", CEPH_NOSNAP, i, 0);
+}
+
+TEST(ObjectHeat, Disabled)
+{
+  ObjectHeat h;
+  ASSERT_FALSE(h.enabled());
+  h.record(obj(1), true, true, utime_t(1, 0));
+  list<pair<hobject_t, ObjectHeat::entry_t> > top;
+  h.get_top(10, &top);
+  ASSERT_TRUE(top.empty());
+  ASSERT_EQ(0u, h.estimate(obj(1)).heat());
+}
+
+TEST(ObjectHeat, Estimate)
+{
+  ObjectHeat h;
+  h.configure(64, 4, 0);
+  for (int i = 0; i < 10; i++)
+    h.record(obj(1), true, false, utime_t(1, 0));
+  for (int i = 0; i < 3; i++)
+    h.record(obj(2), false, true, utime_t(1, 0));
+  // count-min never underestimates
+  ASSERT_GE(h.estimate(obj(1)).reads, 10u);
+  ASSERT_GE(h.estimate(obj(2)).writes, 3u);
+  ASSERT_EQ(10u, h.estimate(obj(1)).reads);
+  ASSERT_EQ(0u, h.estimate(obj(1)).writes);
+}
+
+TEST(ObjectHeat, Top)
+{
+  ObjectHeat h;
+  h.configure(1024, 5, 0);
+  // 1000 objects accessed once, except for the last ten, which are
+  // accessed 50, 100, ..., 500 times
+  for (int i = 1; i <= 1000; i++)
+    for (int j = 0; j < (i > 990 ? (i - 990) * 50 : 1); j++)
+      h.record(obj(i), true, false, utime_t(1, 0));
+
+  list<pair<hobject_t, ObjectHeat::entry_t> > top;
+  h.get_top(5, &top);
+  ASSERT_EQ(5u, top.size());
+  int expect = 1000;
+  for (list<pair<hobject_t, ObjectHeat::entry_t> >::iterator p = top.begin();
+       p != top.end();
+       ++p, --expect) {
+    ASSERT_EQ(obj(expect), p->first);
+    ASSERT_GE(p->second.reads, (unsigned)(expect - 990) * 50);
+  }
+}
+
+TEST(ObjectHeat, Decay)
+{
+  ObjectHeat h;
+  h.configure(64, 4, 10);
+  for (int i = 0; i < 16; i++)
+    h.record(obj(1), true, true, utime_t(100, 0));
+  ASSERT_EQ(16u, h.estimate(obj(1)).reads);
+
+  h.decay(utime_t(105, 0));
+  ASSERT_EQ(16u, h.estimate(obj(1)).reads);
+  h.decay(utime_t(110, 0));
+  ASSERT_EQ(8u, h.estimate(obj(1)).reads);
+  h.decay(utime_t(130, 0));
+  ASSERT_EQ(2u, h.estimate(obj(1)).writes);
+
+  list<pair<hobject_t, ObjectHeat::entry_t> > top;
+  h.get_top(4, &top);
+  ASSERT_EQ(1u, top.size());
+  ASSERT_EQ(2u, top.front().second.reads);
+
+  // cold objects fall out of the top list entirely
+  h.decay(utime_t(1000, 0));
+  top.clear();
+  h.get_top(4, &top);
+  ASSERT_TRUE(top.empty());
+  ASSERT_EQ(0u, h.estimate(obj(1)).heat());
+}
+
+TEST(ObjectHeat, Encode)
+{
+  ObjectHeat h;
+  h.configure(32, 3, 0);
+  for (int i = 0; i < 20; i++)
+    h.record(obj(i % 5), i & 1, !(i & 1), utime_t(1, 0));
+  bufferlist bl;
+  ::encode(h, bl);
+
+  ObjectHeat d;
+  d.configure(32, 3, 0);
+  bufferlist::iterator p = bl.begin();
+  ::decode(d, p);
+  for (int i = 0; i < 5; i++) {
+    ASSERT_EQ(h.estimate(obj(i)).reads, d.estimate(obj(i)).reads);
+    ASSERT_EQ(h.estimate(obj(i)).writes, d.estimate(obj(i)).writes);
+  }
+  list<pair<hobject_t, ObjectHeat::entry_t> > a, b;
+  h.get_top(3, &a);
+  d.get_top(3, &b);
+  ASSERT_EQ(a.size(), b.size());
+  for (list<pair<hobject_t, ObjectHeat::entry_t> >::iterator i = a.begin(), j = b.begin();
+       i != a.end();
+       ++i, ++j)
+    ASSERT_EQ(i->first, j->first);
+}
+
+TEST(ObjectHeat, Resize)
+{
+  ObjectHeat h;
+  h.configure(32, 3, 0);
+  h.record(obj(1), true, false, utime_t(1, 0));
+  h.configure(32, 1, 0);
+  ASSERT_EQ(1u, h.estimate(obj(1)).reads);
+  h.configure(64, 1, 0);
+  ASSERT_EQ(0u, h.estimate(obj(1)).reads);
+}
+
+// record() sits in the op path: report what it costs, without failing
+// on a slow or busy machine
+TEST(ObjectHeat, RecordCost)
+{
+  ObjectHeat h;
+  h.configure(512, 16, 3600);
+  const int n = 1000000;
+  vector<hobject_t> objs;
+  for (int i = 0; i < 1000; i++)
+    objs.push_back(obj(i));
+  utime_t start = ceph_clock_now(NULL);
+  for (int i = 0; i < n; i++)
+    h.record(objs[(i * 7) % objs.size()], true, i & 1, start);
+  utime_t elapsed = ceph_clock_now(NULL) - start;
+  double per = (double)elapsed / n;
+  cout << "record: " << per * 1000000000.0 << " ns/op, "
+       << h.get_mem_usage() << " bytes" << std::endl;
+}
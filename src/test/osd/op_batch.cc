@@ -0,0 +1,111 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "common/Throttle.h"
+#include "messages/MOSDOp.h"
+#include "messages/MOSDOpBatch.h"
+#include "msg/Message.h"
+#include "test/unit.h"
+
+#include <string>
+
+static MOSDOp *make_op(tid_t tid, const char *name, const char *data)
+{
+  object_t oid(name);
+  object_locator_t oloc(3);
+  MOSDOp *m = new MOSDOp(1, tid, oid, oloc, pg_t(7, 3, -1), 10,
+			 CEPH_OSD_FLAG_ACK);
+  if (data) {
+    bufferlist bl;
+    bl.append(data);
+    m->write(0, bl.length(), bl);
+  } else {
+    m->read(0, 4096);
+  }
+  return m;
+}
+
+static MOSDOpBatch *round_trip(MOSDOpBatch *batch)
+{
+  bufferlist bl;
+  encode_message(batch, CEPH_FEATURES_ALL, bl);
+  batch->put();
+  bufferlist::iterator p = bl.begin();
+  Message *m = decode_message(g_ceph_context, p);
+  EXPECT_TRUE(m != NULL);
+  EXPECT_EQ(CEPH_MSG_OSD_OP_BATCH, m->get_type());
+  return static_cast<MOSDOpBatch*>(m);
+}
+
+TEST(MOSDOpBatch, RoundTrip)
+{
+  MOSDOpBatch *batch = new MOSDOpBatch;
+  batch->ops.push_back(make_op(1, "foo", NULL));
+  batch->ops.push_back(make_op(2, "bar", "hello"));
+  batch->ops.push_back(make_op(3, "baz", "world!"));
+
+  batch = round_trip(batch);
+  ASSERT_EQ(3u, batch->ops.size());
+
+  MOSDOp *m = batch->ops[0];
+  ASSERT_EQ(1u, m->get_tid());
+  ASSERT_EQ(object_t("foo"), m->get_oid());
+  ASSERT_EQ(pg_t(7, 3, -1), m->get_pg());
+  ASSERT_EQ(10u, m->get_map_epoch());
+  ASSERT_EQ(1u, m->ops.size());
+  ASSERT_EQ(CEPH_OSD_OP_READ, m->ops[0].op.op);
+  ASSERT_EQ(4096u, m->ops[0].op.extent.length);
+
+  // each op gets its own data back out of the batch's
+  m = batch->ops[1];
+  ASSERT_EQ(2u, m->get_tid());
+  ASSERT_EQ(CEPH_OSD_OP_WRITE, m->ops[0].op.op);
+  ASSERT_EQ(std::string("hello"),
+	    std::string(m->ops[0].indata.c_str(), m->ops[0].indata.length()));
+  m = batch->ops[2];
+  ASSERT_EQ(3u, m->get_tid());
+  ASSERT_EQ(object_t("baz"), m->get_oid());
+  ASSERT_EQ(std::string("world!"),
+	    std::string(m->ops[0].indata.c_str(), m->ops[0].indata.length()));
+
+  batch->put();
+}
+
+TEST(MOSDOpBatch, Empty)
+{
+  MOSDOpBatch *batch = round_trip(new MOSDOpBatch);
+  ASSERT_TRUE(batch->ops.empty());
+  batch->put();
+}
+
+TEST(MOSDOpBatch, ClaimOpsThrottle)
+{
+  MOSDOpBatch *batch = new MOSDOpBatch;
+  batch->ops.push_back(make_op(1, "foo", "some data"));
+  batch->ops.push_back(make_op(2, "bar", "some more data"));
+  batch = round_trip(batch);
+
+  // charged the way the messenger charges what it reads
+  Throttle throttle(g_ceph_context, "op_batch_test");
+  uint64_t size = batch->get_payload().length() + batch->get_data().length();
+  throttle.take(size);
+  batch->set_throttler(&throttle);
+
+  vector<MOSDOp*> ops;
+  batch->claim_ops(&ops);
+  ASSERT_EQ(2u, ops.size());
+  ASSERT_TRUE(batch->ops.empty());
+  batch->put();
+
+  // the ops still hold what they reference until they are done with
+  uint64_t held = 0;
+  for (unsigned i = 0; i < ops.size(); i++) {
+    ASSERT_EQ(&throttle, ops[i]->get_throttler());
+    held += ops[i]->get_payload().length() + ops[i]->get_data().length();
+  }
+  ASSERT_LT(0u, held);
+  ASSERT_EQ((int64_t)held, throttle.get_current());
+  ops[0]->put();
+  ops[1]->put();
+  ASSERT_EQ(0, throttle.get_current());
+}
@@ -0,0 +1,142 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "common/Mutex.h"
+#include "osdc/ObjectCacher.h"
+#include "osdc/WritebackHandler.h"
+#include "test/unit.h"
+
+#include <errno.h>
+
+/*
+ * records what the cache writes back and holds each write's commit
+ * until the test completes it
+ */
+struct FakeWriteback : public WritebackHandler {
+  struct Write {
+    uint64_t off, len;
+    SnapContext snapc;
+    Context *oncommit;
+  };
+  vector<Write> writes;
+  tid_t last_tid;
+
+  FakeWriteback() : last_tid(0) {}
+
+  tid_t read(const object_t& oid, const object_locator_t& oloc,
+	     uint64_t off, uint64_t len, snapid_t snapid,
+	     bufferlist *pbl, uint64_t trunc_size,  __u32 trunc_seq,
+	     Context *onfinish) {
+    assert(0 == "not reached");
+    return 0;
+  }
+  tid_t write(const object_t& oid, const object_locator_t& oloc,
+	      uint64_t off, uint64_t len, const SnapContext& snapc,
+	      const bufferlist &bl, utime_t mtime, uint64_t trunc_size,
+	      __u32 trunc_seq, Context *oncommit) {
+    Write w;
+    w.off = off;
+    w.len = len;
+    w.snapc = snapc;
+    w.oncommit = oncommit;
+    writes.push_back(w);
+    return ++last_tid;
+  }
+
+  /// complete (with the cache lock held) and forget the recorded writes
+  void commit(int r) {
+    for (unsigned i = 0; i < writes.size(); i++)
+      writes[i].oncommit->complete(r);
+    writes.clear();
+  }
+};
+
+class ObjectCacherTest : public ::testing::Test {
+protected:
+  Mutex lock;
+  FakeWriteback wb;
+  ObjectCacher *oc;
+  ObjectCacher::ObjectSet *oset;
+
+  ObjectCacherTest() : lock("ObjectCacherTest::lock") {}
+
+  void SetUp() {
+    // no flusher thread: everything is written back by flush_set()
+    oc = new ObjectCacher(g_ceph_context, "test", wb, lock, NULL, NULL,
+			  1 << 24, 1 << 23, 1 << 23, 60);
+    oset = new ObjectCacher::ObjectSet(NULL, 0, 0);
+  }
+  void TearDown() {
+    lock.Lock();
+    oc->release_set(oset);
+    lock.Unlock();
+    delete oset;
+    delete oc;
+  }
+
+  void write(uint64_t off, uint64_t len, const SnapContext& snapc) {
+    bufferlist bl;
+    bl.append(string(len, 'x'));
+    ObjectCacher::OSDWrite *wr = oc->prepare_write(snapc, bl, utime_t(), 0);
+    ObjectExtent ex(object_t("foo"), off, len);
+    ex.oloc.pool = 0;
+    ex.buffer_extents[0] = len;
+    wr->extents.push_back(ex);
+    ASSERT_EQ(0, oc->writex(wr, oset, lock));
+  }
+
+  /*
+   * leave two adjacent dirty bhs, [0,4096) with snapc a and
+   * [4096,8192) with snapc b: a write that fails is marked dirty again
+   * without being merged with what was written next to it meanwhile
+   */
+  void make_split(const SnapContext& a, const SnapContext& b) {
+    write(0, 4096, a);
+    ASSERT_FALSE(oc->flush_set(oset));
+    ASSERT_EQ(1u, wb.writes.size());
+    write(4096, 4096, b);
+    wb.commit(-EIO);
+  }
+};
+
+TEST_F(ObjectCacherTest, CoalesceSameSnapc)
+{
+  Mutex::Locker l(lock);
+  SnapContext snapc;
+  make_split(snapc, snapc);
+
+  // both go out as one write...
+  ASSERT_FALSE(oc->flush_set(oset));
+  ASSERT_EQ(1u, wb.writes.size());
+  ASSERT_EQ(0u, wb.writes[0].off);
+  ASSERT_EQ(8192u, wb.writes[0].len);
+  ASSERT_TRUE(oc->set_is_dirty_or_committing(oset));
+
+  // ...and its commit cleans both
+  wb.commit(0);
+  ASSERT_FALSE(oc->set_is_dirty_or_committing(oset));
+  ASSERT_TRUE(oc->flush_set(oset));
+  ASSERT_TRUE(wb.writes.empty());
+}
+
+TEST_F(ObjectCacherTest, NoCoalesceDifferentSnapc)
+{
+  Mutex::Locker l(lock);
+  SnapContext a, b;
+  b.seq = 2;
+  b.snaps.push_back(2);
+  make_split(a, b);
+
+  // each is written with its own snap context
+  ASSERT_FALSE(oc->flush_set(oset));
+  ASSERT_EQ(2u, wb.writes.size());
+  ASSERT_EQ(0u, wb.writes[0].off);
+  ASSERT_EQ(4096u, wb.writes[0].len);
+  ASSERT_EQ(0u, wb.writes[0].snapc.seq);
+  ASSERT_EQ(4096u, wb.writes[1].off);
+  ASSERT_EQ(4096u, wb.writes[1].len);
+  ASSERT_EQ(2u, wb.writes[1].snapc.seq);
+
+  wb.commit(0);
+  ASSERT_FALSE(oc->set_is_dirty_or_committing(oset));
+}
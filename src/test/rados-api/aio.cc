@@ -8,6 +8,7 @@
 #include <semaphore.h>
 #include <sstream>
 #include <string>
+#include <sys/time.h>
 #include <boost/scoped_ptr.hpp>
 #include <utility>
 
@@ -717,6 +718,60 @@ TEST(LibRadosAio, RoundTripWriteFull) {
   rados_aio_release(my_completion3);
 }
 
+/*
+ * reads land directly in the caller's buffer.  read a 4 MB object a
+ * few times, checking the data each time, and report the throughput.
+ */
+TEST(LibRadosAio, LargeRead) {
+  AioTestData test_data;
+  ASSERT_EQ("", test_data.init());
+  const size_t len = 4 << 20;
+  const int reps = 16;
+  char *buf = (char *)malloc(len);
+  char *buf2 = (char *)malloc(len);
+  for (size_t i = 0; i < len; i++)
+    buf[i] = i * 7;
+  ASSERT_EQ(0, rados_write_full(test_data.m_ioctx, "foo", buf, len));
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  for (int i = 0; i < reps; i++) {
+    memset(buf2, 0, len);
+    rados_completion_t c;
+    ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &c));
+    ASSERT_EQ(0, rados_aio_read(test_data.m_ioctx, "foo", c, buf2, len, 0));
+    {
+      TestAlarm alarm;
+      ASSERT_EQ(0, rados_aio_wait_for_complete(c));
+    }
+    ASSERT_EQ((int)len, rados_aio_get_return_value(c));
+    rados_aio_release(c);
+    ASSERT_EQ(0, memcmp(buf, buf2, len));
+  }
+  gettimeofday(&end, NULL);
+  double secs = (end.tv_sec - start.tv_sec) +
+    (end.tv_usec - start.tv_usec) / 1000000.0;
+  std::cout << "large aio read: " << (double)len * reps / secs / (1 << 20)
+	    << " MB/s" << std::endl;
+
+  // a short read only fills the front of the buffer
+  memset(buf2, 0xee, len);
+  rados_completion_t c;
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &c));
+  ASSERT_EQ(0, rados_aio_read(test_data.m_ioctx, "foo", c, buf2, len, len - 10));
+  {
+    TestAlarm alarm;
+    ASSERT_EQ(0, rados_aio_wait_for_complete(c));
+  }
+  ASSERT_EQ(10, rados_aio_get_return_value(c));
+  rados_aio_release(c);
+  ASSERT_EQ(0, memcmp(buf + len - 10, buf2, 10));
+  ASSERT_EQ((char)0xee, buf2[10]);
+
+  free(buf);
+  free(buf2);
+}
+
 TEST(LibRadosAio, RoundTripWriteFullPP) {
   AioTestDataPP test_data;
   ASSERT_EQ("", test_data.init());
@@ -912,3 +967,118 @@ TEST(LibRadosAio, OmapPP) {
 
   ioctx.remove("test_obj");
 }
+
+TEST(LibRadosAio, AioLimits) {
+  AioTestData test_data;
+  ASSERT_EQ("", test_data.init());
+  // batched ops wait in the objecter until a second one fills the
+  // batch, so the first stays in flight for as long as we need it to
+  ASSERT_EQ(0, rados_conf_set(test_data.m_cluster, "objecter_batch_window", "600"));
+  ASSERT_EQ(0, rados_conf_set(test_data.m_cluster, "objecter_batch_max_ops", "2"));
+  rados_ioctx_set_op_batching(test_data.m_ioctx, 1);
+  rados_ioctx_set_aio_limits(test_data.m_ioctx, 1, 0);
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+
+  // a lone op always gets in
+  rados_completion_t c1, c2;
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &c1));
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &c2));
+  ASSERT_EQ(0, rados_aio_write(test_data.m_ioctx, "foo",
+			       c1, buf, sizeof(buf), 0));
+  uint64_t ops, bytes;
+  rados_ioctx_get_aio_inflight(test_data.m_ioctx, &ops, &bytes);
+  ASSERT_EQ(1u, ops);
+  ASSERT_EQ((uint64_t)sizeof(buf), bytes);
+
+  // the second is refused while the first is in flight
+  ASSERT_EQ(-EAGAIN, rados_aio_write(test_data.m_ioctx, "foo",
+				     c2, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, rados_aio_is_complete(c1));
+
+  // another io context has no limits; its op fills the batch
+  rados_ioctx_t ioctx2;
+  ASSERT_EQ(0, rados_ioctx_create(test_data.m_cluster,
+				  test_data.m_pool_name.c_str(), &ioctx2));
+  rados_ioctx_set_op_batching(ioctx2, 1);
+  ASSERT_EQ(0, rados_aio_write(ioctx2, "foo", c2, buf, sizeof(buf), 0));
+
+  TestAlarm alarm;
+  ASSERT_EQ(0, rados_aio_wait_for_safe(c1));
+  ASSERT_EQ(0, rados_aio_wait_for_safe(c2));
+  rados_ioctx_get_aio_inflight(test_data.m_ioctx, &ops, &bytes);
+  ASSERT_EQ(0u, ops);
+  ASSERT_EQ(0u, bytes);
+  rados_aio_release(c1);
+  rados_aio_release(c2);
+  rados_ioctx_destroy(ioctx2);
+
+  // reads count too, and nonblocking submission still completes
+  rados_ioctx_set_op_batching(test_data.m_ioctx, 0);
+  rados_ioctx_set_aio_nonblocking(test_data.m_ioctx, 1);
+  char out[128];
+  rados_completion_t c3;
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &c3));
+  ASSERT_EQ(0, rados_aio_read(test_data.m_ioctx, "foo", c3,
+			      out, sizeof(out), 0));
+  ASSERT_EQ(0, rados_aio_wait_for_complete(c3));
+  ASSERT_EQ((int)sizeof(out), rados_aio_get_return_value(c3));
+  ASSERT_EQ(0, memcmp(buf, out, sizeof(out)));
+  rados_aio_release(c3);
+  rados_ioctx_get_aio_inflight(test_data.m_ioctx, &ops, &bytes);
+  ASSERT_EQ(0u, ops);
+}
+
+TEST(LibRadosAio, AioNonblockingParked) {
+  AioTestData test_data;
+  ASSERT_EQ("", test_data.init());
+
+  // a client with room for one op in flight, which it holds for the
+  // batch window
+  rados_t cluster;
+  ASSERT_EQ(0, rados_create(&cluster, NULL));
+  ASSERT_EQ(0, rados_conf_read_file(cluster, NULL));
+  rados_conf_parse_env(cluster, NULL);
+  ASSERT_EQ(0, rados_conf_set(cluster, "objecter_inflight_ops", "1"));
+  ASSERT_EQ(0, rados_conf_set(cluster, "objecter_batch_window", "2"));
+  ASSERT_EQ(0, rados_connect(cluster));
+  rados_ioctx_t ioctx;
+  ASSERT_EQ(0, rados_ioctx_create(cluster, test_data.m_pool_name.c_str(),
+				  &ioctx));
+  rados_ioctx_set_op_batching(ioctx, 1);
+  rados_ioctx_set_aio_nonblocking(ioctx, 1);
+
+  char buf[3][128];
+  rados_completion_t c[3];
+  for (int i = 0; i < 3; i++) {
+    memset(buf[i], 'a' + i, sizeof(buf[i]));
+    ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &c[i]));
+  }
+
+  // the later ops are parked instead of blocking us, and can't be
+  // sent before the first is
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(0, rados_aio_write_full(ioctx, "foo", c[i],
+				      buf[i], sizeof(buf[i])));
+  }
+  ASSERT_EQ(0, rados_aio_is_safe(c[1]));
+  ASSERT_EQ(0, rados_aio_is_safe(c[2]));
+
+  // each reply sends the next parked op, in the order they were made;
+  // those needn't wait out a window of their own
+  ASSERT_EQ(0, rados_conf_set(cluster, "objecter_batch_window", "0"));
+  {
+    TestAlarm alarm;
+    for (int i = 0; i < 3; i++) {
+      ASSERT_EQ(0, rados_aio_wait_for_safe(c[i]));
+      ASSERT_EQ(0, rados_aio_get_return_value(c[i]));
+      rados_aio_release(c[i]);
+    }
+  }
+  char out[128];
+  ASSERT_EQ((int)sizeof(out), rados_read(ioctx, "foo", out, sizeof(out), 0));
+  ASSERT_EQ(0, memcmp(buf[2], out, sizeof(out)));
+
+  rados_ioctx_destroy(ioctx);
+  rados_shutdown(cluster);
+}
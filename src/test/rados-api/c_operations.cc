@@ -0,0 +1,390 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+// Tests for the C API compound operations
+#include "include/rados/librados.h"
+#include "test/rados-api/test.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+#include <iostream>
+#include "gtest/gtest.h"
+
+static const char *obj = "test";
+
+class CReadOpsTest : public ::testing::Test {
+protected:
+  void SetUp() {
+    pool_name = get_temp_pool_name();
+    ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+    ASSERT_EQ(0, rados_ioctx_create(cluster, pool_name.c_str(), &ioctx));
+  }
+  void TearDown() {
+    rados_ioctx_destroy(ioctx);
+    ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+  }
+
+  void write_object() {
+    rados_write_op_t op = rados_create_write_op();
+    ASSERT_TRUE(op);
+    rados_write_op_write_full(op, data, len);
+    rados_write_op_setxattr(op, "attr", data, len);
+    const char *keys[] = { "bar", "foo" };
+    const char *vals[] = { "b", "f" };
+    size_t lens[] = { 1, 1 };
+    rados_write_op_omap_set(op, keys, vals, lens, 2);
+    ASSERT_EQ(0, rados_write_op_operate(op, ioctx, obj, NULL));
+    rados_release_write_op(op);
+  }
+
+  std::string pool_name;
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  static const char data[];
+  static const size_t len;
+};
+
+const char CReadOpsTest::data[] = "string";
+const size_t CReadOpsTest::len = sizeof(data) - 1;
+
+TEST(LibRadosCWriteOps, NewDelete) {
+  rados_write_op_t op = rados_create_write_op();
+  ASSERT_TRUE(op);
+  rados_release_write_op(op);
+
+  // unsent ops clean up after themselves
+  rados_read_op_t rop = rados_create_read_op();
+  ASSERT_TRUE(rop);
+  rados_omap_iter_t iter;
+  rados_read_op_omap_get_vals(rop, NULL, NULL, 10, &iter, NULL);
+  rados_release_read_op(rop);
+  rados_omap_get_end(iter);
+}
+
+TEST(LibRadosCWriteOps, Write) {
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  rados_write_op_t op = rados_create_write_op();
+  ASSERT_TRUE(op);
+  rados_write_op_create(op, 1);
+  rados_write_op_write(op, "four", 4, 0);
+  rados_write_op_append(op, "five!", 5);
+  rados_write_op_setxattr(op, "key", "value", 5);
+  ASSERT_EQ(0, rados_write_op_operate(op, ioctx, obj, NULL));
+  rados_release_write_op(op);
+
+  char buf[16];
+  ASSERT_EQ(9, rados_read(ioctx, obj, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp("fourfive!", buf, 9));
+  ASSERT_EQ(5, rados_getxattr(ioctx, obj, "key", buf, sizeof(buf)));
+  ASSERT_EQ(0, memcmp("value", buf, 5));
+
+  // exclusive create of an existing object fails, and nothing else
+  // in the op is applied
+  op = rados_create_write_op();
+  rados_write_op_create(op, 1);
+  rados_write_op_write_full(op, "gone", 4);
+  ASSERT_EQ(-EEXIST, rados_write_op_operate(op, ioctx, obj, NULL));
+  rados_release_write_op(op);
+  ASSERT_EQ(9, rados_read(ioctx, obj, buf, sizeof(buf), 0));
+
+  op = rados_create_write_op();
+  rados_write_op_truncate(op, 4);
+  rados_write_op_zero(op, 0, 2);
+  rados_write_op_rmxattr(op, "key");
+  ASSERT_EQ(0, rados_write_op_operate(op, ioctx, obj, NULL));
+  rados_release_write_op(op);
+  ASSERT_EQ(4, rados_read(ioctx, obj, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp("\0\0ur", buf, 4));
+  ASSERT_EQ(-ENODATA, rados_getxattr(ioctx, obj, "key", buf, sizeof(buf)));
+
+  op = rados_create_write_op();
+  rados_write_op_remove(op);
+  ASSERT_EQ(0, rados_write_op_operate(op, ioctx, obj, NULL));
+  rados_release_write_op(op);
+  ASSERT_EQ(-ENOENT, rados_read(ioctx, obj, buf, sizeof(buf), 0));
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+TEST(LibRadosCWriteOps, Guards) {
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  ASSERT_EQ(0, rados_write_full(ioctx, obj, "hi", 2));
+  ASSERT_EQ(0, rados_setxattr(ioctx, obj, "state", "a", 1));
+  uint64_t v = rados_get_last_version(ioctx);
+
+  // a failed comparison stops the whole op
+  rados_write_op_t op = rados_create_write_op();
+  rados_write_op_cmpxattr(op, "state", LIBRADOS_CMPXATTR_OP_EQ, "b", 1);
+  rados_write_op_write_full(op, "no", 2);
+  ASSERT_EQ(-ECANCELED, rados_write_op_operate(op, ioctx, obj, NULL));
+  rados_release_write_op(op);
+
+  op = rados_create_write_op();
+  rados_write_op_assert_version(op, v + 1);
+  rados_write_op_write_full(op, "no", 2);
+  ASSERT_GT(0, rados_write_op_operate(op, ioctx, obj, NULL));
+  rados_release_write_op(op);
+
+  char buf[4];
+  ASSERT_EQ(2, rados_read(ioctx, obj, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp("hi", buf, 2));
+
+  op = rados_create_write_op();
+  rados_write_op_assert_version(op, v);
+  rados_write_op_cmpxattr(op, "state", LIBRADOS_CMPXATTR_OP_EQ, "a", 1);
+  rados_write_op_setxattr(op, "state", "b", 1);
+  rados_write_op_write_full(op, "ok", 2);
+  ASSERT_EQ(0, rados_write_op_operate(op, ioctx, obj, NULL));
+  rados_release_write_op(op);
+  ASSERT_EQ(2, rados_read(ioctx, obj, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp("ok", buf, 2));
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+TEST(LibRadosCWriteOps, Omap) {
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+
+  const char *keys[] = { "a", "b", "c" };
+  const char *vals[] = { "1", "22", "333" };
+  size_t lens[] = { 1, 2, 3 };
+  rados_write_op_t op = rados_create_write_op();
+  rados_write_op_create(op, 0);
+  rados_write_op_omap_set(op, keys, vals, lens, 3);
+  rados_write_op_omap_rm_keys(op, keys + 1, 1);
+  ASSERT_EQ(0, rados_write_op_operate(op, ioctx, obj, NULL));
+  rados_release_write_op(op);
+
+  rados_omap_iter_t iter;
+  int rval = 1;
+  rados_read_op_t rop = rados_create_read_op();
+  rados_read_op_omap_get_vals(rop, NULL, NULL, 10, &iter, &rval);
+  ASSERT_EQ(0, rados_read_op_operate(rop, ioctx, obj));
+  rados_release_read_op(rop);
+  ASSERT_EQ(0, rval);
+  char *key, *val;
+  size_t len;
+  ASSERT_EQ(0, rados_omap_get_next(iter, &key, &val, &len));
+  ASSERT_EQ(std::string("a"), key);
+  ASSERT_EQ(std::string("1"), std::string(val, len));
+  ASSERT_EQ(0, rados_omap_get_next(iter, &key, &val, &len));
+  ASSERT_EQ(std::string("c"), key);
+  ASSERT_EQ(std::string("333"), std::string(val, len));
+  ASSERT_EQ(0, rados_omap_get_next(iter, &key, &val, &len));
+  ASSERT_TRUE(key == NULL);
+  rados_omap_get_end(iter);
+
+  op = rados_create_write_op();
+  rados_write_op_omap_clear(op);
+  ASSERT_EQ(0, rados_write_op_operate(op, ioctx, obj, NULL));
+  rados_release_write_op(op);
+
+  rop = rados_create_read_op();
+  rados_read_op_omap_get_keys(rop, NULL, 10, &iter, &rval);
+  ASSERT_EQ(0, rados_read_op_operate(rop, ioctx, obj));
+  rados_release_read_op(rop);
+  ASSERT_EQ(0, rados_omap_get_next(iter, &key, &val, &len));
+  ASSERT_TRUE(key == NULL);
+  rados_omap_get_end(iter);
+
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
+
+TEST_F(CReadOpsTest, Read) {
+  write_object();
+
+  char buf[16];
+  size_t bytes_read = 0;
+  int rval = 1;
+  uint64_t size = 0;
+  time_t mtime = 0;
+  int stat_rval = 1;
+  rados_read_op_t op = rados_create_read_op();
+  rados_read_op_assert_version(op, rados_get_last_version(ioctx));
+  rados_read_op_cmpxattr(op, "attr", LIBRADOS_CMPXATTR_OP_EQ, data, len);
+  rados_read_op_stat(op, &size, &mtime, &stat_rval);
+  rados_read_op_read(op, 0, sizeof(buf), buf, &bytes_read, &rval);
+  ASSERT_EQ(0, rados_read_op_operate(op, ioctx, obj));
+  rados_release_read_op(op);
+  ASSERT_EQ(0, rval);
+  ASSERT_EQ(len, bytes_read);
+  ASSERT_EQ(0, memcmp(data, buf, len));
+  ASSERT_EQ(0, stat_rval);
+  ASSERT_EQ(len, size);
+  ASSERT_NE(0, mtime);
+
+  // a buffer that is too small is reported per op
+  op = rados_create_read_op();
+  rados_read_op_getxattr(op, "attr", buf, 2, &bytes_read, &rval);
+  ASSERT_EQ(0, rados_read_op_operate(op, ioctx, obj));
+  rados_release_read_op(op);
+  ASSERT_EQ(-ERANGE, rval);
+  ASSERT_EQ(len, bytes_read);
+
+  op = rados_create_read_op();
+  rados_read_op_cmpxattr(op, "attr", LIBRADOS_CMPXATTR_OP_EQ, "nope", 4);
+  rados_read_op_read(op, 0, sizeof(buf), buf, NULL, NULL);
+  ASSERT_EQ(-ECANCELED, rados_read_op_operate(op, ioctx, obj));
+  rados_release_read_op(op);
+}
+
+TEST_F(CReadOpsTest, Xattrs) {
+  write_object();
+
+  rados_xattrs_iter_t iter;
+  int rval = 1;
+  rados_read_op_t op = rados_create_read_op();
+  rados_read_op_getxattrs(op, &iter, &rval);
+  ASSERT_EQ(0, rados_read_op_operate(op, ioctx, obj));
+  rados_release_read_op(op);
+  ASSERT_EQ(0, rval);
+  const char *name, *val;
+  size_t vlen;
+  ASSERT_EQ(0, rados_getxattrs_next(iter, &name, &val, &vlen));
+  ASSERT_EQ(std::string("attr"), name);
+  ASSERT_EQ(std::string(data, len), std::string(val, vlen));
+  ASSERT_EQ(0, rados_getxattrs_next(iter, &name, &val, &vlen));
+  ASSERT_TRUE(name == NULL);
+  rados_getxattrs_end(iter);
+}
+
+TEST_F(CReadOpsTest, Omap) {
+  write_object();
+
+  rados_omap_iter_t iter;
+  int rval = 1;
+  const char *keys[] = { "foo", "missing" };
+  rados_read_op_t op = rados_create_read_op();
+  rados_read_op_omap_get_vals_by_keys(op, keys, 2, &iter, &rval);
+  ASSERT_EQ(0, rados_read_op_operate(op, ioctx, obj));
+  rados_release_read_op(op);
+  ASSERT_EQ(0, rval);
+  char *key, *val;
+  size_t vlen;
+  ASSERT_EQ(0, rados_omap_get_next(iter, &key, &val, &vlen));
+  ASSERT_EQ(std::string("foo"), key);
+  ASSERT_EQ(std::string("f"), std::string(val, vlen));
+  ASSERT_EQ(0, rados_omap_get_next(iter, &key, &val, &vlen));
+  ASSERT_TRUE(key == NULL);
+  rados_omap_get_end(iter);
+
+  op = rados_create_read_op();
+  rados_read_op_omap_get_keys(op, "bar", 10, &iter, &rval);
+  ASSERT_EQ(0, rados_read_op_operate(op, ioctx, obj));
+  rados_release_read_op(op);
+  ASSERT_EQ(0, rados_omap_get_next(iter, &key, &val, &vlen));
+  ASSERT_EQ(std::string("foo"), key);
+  ASSERT_EQ(0u, vlen);
+  ASSERT_EQ(0, rados_omap_get_next(iter, &key, &val, &vlen));
+  ASSERT_TRUE(key == NULL);
+  rados_omap_get_end(iter);
+}
+
+TEST_F(CReadOpsTest, Exec) {
+  write_object();
+
+  char out[64];
+  size_t used = 0;
+  int rval = 1;
+  rados_read_op_t op = rados_create_read_op();
+  rados_read_op_exec(op, "rbd", "get_all_features", NULL, 0,
+		     out, sizeof(out), &used, &rval);
+  ASSERT_EQ(0, rados_read_op_operate(op, ioctx, obj));
+  rados_release_read_op(op);
+  ASSERT_EQ(0, rval);
+  ASSERT_LT(0u, used);
+}
+
+TEST_F(CReadOpsTest, Aio) {
+  write_object();
+
+  rados_write_op_t wop = rados_create_write_op();
+  rados_write_op_append(wop, data, len);
+  rados_write_op_setxattr(wop, "attr2", data, len);
+  rados_completion_t c;
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &c));
+  ASSERT_EQ(0, rados_aio_write_op_operate(wop, ioctx, c, obj, NULL));
+  ASSERT_EQ(0, rados_aio_wait_for_safe(c));
+  ASSERT_EQ(0, rados_aio_get_return_value(c));
+  rados_aio_release(c);
+  rados_release_write_op(wop);
+
+  char buf[32];
+  size_t bytes_read = 0;
+  int rval = 1;
+  uint64_t size = 0;
+  rados_read_op_t op = rados_create_read_op();
+  rados_read_op_stat(op, &size, NULL, NULL);
+  rados_read_op_read(op, 0, sizeof(buf), buf, &bytes_read, &rval);
+  ASSERT_EQ(0, rados_aio_create_completion(NULL, NULL, NULL, &c));
+  ASSERT_EQ(0, rados_aio_read_op_operate(op, ioctx, c, obj));
+  ASSERT_EQ(0, rados_aio_wait_for_complete(c));
+  ASSERT_EQ(0, rados_aio_get_return_value(c));
+  rados_aio_release(c);
+  rados_release_read_op(op);
+  ASSERT_EQ(0, rval);
+  ASSERT_EQ(2 * len, size);
+  ASSERT_EQ(2 * len, bytes_read);
+  ASSERT_EQ(0, memcmp(data, buf + len, len));
+}
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/*
+ * the point of compound ops: the same updates, one round trip instead
+ * of three.  print both so the difference shows up in test logs.
+ */
+TEST_F(CReadOpsTest, Latency) {
+  const int n = 200;
+  const char *keys[] = { "k" };
+  const char *vals[] = { "v" };
+  size_t lens[] = { 1 };
+
+  double start = now();
+  for (int i = 0; i < n; i++) {
+    ASSERT_EQ(0, rados_setxattr(ioctx, obj, "attr", data, len));
+    ASSERT_EQ((int)len, rados_write(ioctx, obj, data, len, 0));
+    rados_write_op_t op = rados_create_write_op();
+    rados_write_op_omap_set(op, keys, vals, lens, 1);
+    ASSERT_EQ(0, rados_write_op_operate(op, ioctx, obj, NULL));
+    rados_release_write_op(op);
+  }
+  double separate = now() - start;
+
+  start = now();
+  for (int i = 0; i < n; i++) {
+    rados_write_op_t op = rados_create_write_op();
+    rados_write_op_setxattr(op, "attr", data, len);
+    rados_write_op_write(op, data, len, 0);
+    rados_write_op_omap_set(op, keys, vals, lens, 1);
+    ASSERT_EQ(0, rados_write_op_operate(op, ioctx, obj, NULL));
+    rados_release_write_op(op);
+  }
+  double compound = now() - start;
+
+  std::cout << "separate ops: " << separate / n * 1000.0 << " ms/update, "
+	    << "compound op: " << compound / n * 1000.0 << " ms/update"
+	    << std::endl;
+}
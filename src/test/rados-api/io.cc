@@ -455,3 +455,34 @@ TEST(LibRadosIo, XattrListPP) {
   ioctx.close();
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
+
+TEST(LibRadosIo, ReadPolicyPP) {
+  char buf[128];
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  cluster.ioctx_create(pool_name.c_str(), ioctx);
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl;
+  bl.append(buf, sizeof(buf));
+  ASSERT_EQ(0, ioctx.write_full("foo", bl));
+  int policies[] = { LIBRADOS_READ_PRIMARY, LIBRADOS_READ_BALANCE,
+		     LIBRADOS_READ_LOCALIZE, LIBRADOS_READ_LEAST_LOADED };
+  for (unsigned i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i) {
+    ASSERT_EQ(0, ioctx.set_read_policy(policies[i]));
+    // a read right after a write must see it, wherever it goes
+    memset(buf, 'a' + i, sizeof(buf));
+    bufferlist wbl;
+    wbl.append(buf, sizeof(buf));
+    ASSERT_EQ(0, ioctx.write_full("foo", wbl));
+    for (int n = 0; n < 20; n++) {
+      bufferlist rbl;
+      ASSERT_EQ((int)sizeof(buf), ioctx.read("foo", rbl, sizeof(buf), 0));
+      ASSERT_EQ(0, memcmp(buf, rbl.c_str(), sizeof(buf)));
+    }
+  }
+  ASSERT_EQ(-EINVAL, ioctx.set_read_policy(42));
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
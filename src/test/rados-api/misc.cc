@@ -338,3 +338,191 @@ TEST(LibRadosMisc, CloneRange) {
   rados_ioctx_destroy(ioctx);
   ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
 }
+
+TEST(LibRadosMisc, CopyFromPP) {
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name.c_str(), ioctx));
+
+  bufferlist bl;
+  bl.append("copy me");
+  ASSERT_EQ(0, ioctx.write_full("src", bl));
+  bufferlist xbl;
+  xbl.append("xattr");
+  ASSERT_EQ(0, ioctx.setxattr("src", "myattr", xbl));
+  map<string, bufferlist> omap;
+  omap["key"].append("value");
+  ASSERT_EQ(0, ioctx.omap_set("src", omap));
+  bufferlist hbl;
+  hbl.append("header");
+  ASSERT_EQ(0, ioctx.omap_set_header("src", hbl));
+
+  // the old contents of the target are all replaced
+  bufferlist old;
+  old.append("something much longer than the source");
+  ASSERT_EQ(0, ioctx.write_full("dst", old));
+  ASSERT_EQ(0, ioctx.setxattr("dst", "oldattr", xbl));
+
+  ObjectWriteOperation op;
+  op.copy_from("src", ioctx, 0);
+  ASSERT_EQ(0, ioctx.operate("dst", &op));
+
+  bufferlist bl2;
+  ASSERT_EQ((int)bl.length(), ioctx.read("dst", bl2, 100, 0));
+  ASSERT_TRUE(bl.contents_equal(bl2));
+  map<string, bufferlist> attrs;
+  ASSERT_EQ(0, ioctx.getxattrs("dst", attrs));
+  ASSERT_EQ(1u, attrs.size());
+  ASSERT_TRUE(attrs["myattr"].contents_equal(xbl));
+  map<string, bufferlist> omap2;
+  ASSERT_EQ(0, ioctx.omap_get_vals("dst", "", 100, &omap2));
+  ASSERT_EQ(1u, omap2.size());
+  ASSERT_TRUE(omap2["key"].contents_equal(omap["key"]));
+  bufferlist hbl2;
+  ASSERT_EQ(0, ioctx.omap_get_header("dst", &hbl2));
+  ASSERT_TRUE(hbl.contents_equal(hbl2));
+
+  // a missing source
+  ObjectWriteOperation op2;
+  op2.copy_from("nosuchobject", ioctx, 0);
+  ASSERT_EQ(-ENOENT, ioctx.operate("dst", &op2));
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
+TEST(LibRadosMisc, CopyFromOtherPoolPP) {
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  std::string pool_name2 = pool_name + "-src";
+  ASSERT_EQ(0, cluster.pool_create(pool_name2.c_str()));
+  IoCtx ioctx, src_ioctx;
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name.c_str(), ioctx));
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name2.c_str(), src_ioctx));
+
+  bufferlist bl;
+  bl.append("from another pool");
+  ASSERT_EQ(0, src_ioctx.write_full("src", bl));
+
+  ObjectWriteOperation op;
+  op.copy_from("src", src_ioctx, 0);
+  ASSERT_EQ(0, ioctx.operate("dst", &op));
+  bufferlist bl2;
+  ASSERT_EQ((int)bl.length(), ioctx.read("dst", bl2, 100, 0));
+  ASSERT_TRUE(bl.contents_equal(bl2));
+
+  src_ioctx.close();
+  ioctx.close();
+  ASSERT_EQ(0, cluster.pool_delete(pool_name2.c_str()));
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
+TEST(LibRadosMisc, CopyFromDataOnlyPP) {
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name.c_str(), ioctx));
+
+  bufferlist bl, xbl, dbl;
+  bl.append("data");
+  xbl.append("xattr");
+  dbl.append("dst xattr");
+  ASSERT_EQ(0, ioctx.write_full("src", bl));
+  ASSERT_EQ(0, ioctx.setxattr("src", "srcattr", xbl));
+  ASSERT_EQ(0, ioctx.setxattr("dst", "dstattr", dbl));
+
+  // the data is replaced, our own xattrs are left alone
+  ObjectWriteOperation op;
+  op.copy_from("src", ioctx, 0, LIBRADOS_COPY_FROM_DATA_ONLY);
+  ASSERT_EQ(0, ioctx.operate("dst", &op));
+  bufferlist bl2;
+  ASSERT_EQ((int)bl.length(), ioctx.read("dst", bl2, 100, 0));
+  ASSERT_TRUE(bl.contents_equal(bl2));
+  map<string, bufferlist> attrs;
+  ASSERT_EQ(0, ioctx.getxattrs("dst", attrs));
+  ASSERT_EQ(1u, attrs.size());
+  ASSERT_TRUE(attrs["dstattr"].contents_equal(dbl));
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
+TEST(LibRadosMisc, CopyFromVersionPP) {
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name.c_str(), ioctx));
+
+  bufferlist bl;
+  bl.append("versioned");
+  ASSERT_EQ(0, ioctx.write_full("src", bl));
+  uint64_t v = ioctx.get_last_version();
+
+  ObjectWriteOperation op1;
+  op1.copy_from("src", ioctx, v - 1);
+  ASSERT_EQ(-ERANGE, ioctx.operate("dst", &op1));
+  ObjectWriteOperation op2;
+  op2.copy_from("src", ioctx, v + 1);
+  ASSERT_EQ(-EOVERFLOW, ioctx.operate("dst", &op2));
+  ObjectWriteOperation op3;
+  op3.copy_from("src", ioctx, v);
+  ASSERT_EQ(0, ioctx.operate("dst", &op3));
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
+TEST(LibRadosMisc, CopyFromBigPP) {
+  Rados cluster;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  IoCtx ioctx;
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name.c_str(), ioctx));
+
+  // larger than osd_copyfrom_max_chunk, so it takes several reads
+  unsigned len = 20 << 20;
+  bufferlist bl;
+  bufferptr bp(len);
+  for (unsigned i = 0; i < len; i++)
+    bp[i] = i % 251;
+  bl.append(bp);
+  ASSERT_EQ(0, ioctx.write_full("src", bl));
+
+  ObjectWriteOperation op;
+  op.copy_from("src", ioctx, 0);
+  ASSERT_EQ(0, ioctx.operate("dst", &op));
+  bufferlist bl2;
+  ASSERT_EQ((int)len, ioctx.read("dst", bl2, len + 1, 0));
+  ASSERT_TRUE(bl.contents_equal(bl2));
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
+
+TEST(LibRadosMisc, CopyFrom) {
+  char buf[128];
+  rados_t cluster;
+  rados_ioctx_t ioctx;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool(pool_name, &cluster));
+  rados_ioctx_create(cluster, pool_name.c_str(), &ioctx);
+  memset(buf, 0xcc, sizeof(buf));
+  ASSERT_EQ(0, rados_write_full(ioctx, "src", buf, sizeof(buf)));
+
+  rados_write_op_t op = rados_create_write_op();
+  rados_write_op_copy_from(op, ioctx, "src", 0, 0);
+  ASSERT_EQ(0, rados_write_op_operate(op, ioctx, "dst", NULL));
+  rados_release_write_op(op);
+
+  char buf2[sizeof(buf)];
+  memset(buf2, 0, sizeof(buf2));
+  ASSERT_EQ((int)sizeof(buf2), rados_read(ioctx, "dst", buf2, sizeof(buf2), 0));
+  ASSERT_EQ(0, memcmp(buf, buf2, sizeof(buf)));
+  rados_ioctx_destroy(ioctx);
+  ASSERT_EQ(0, destroy_one_pool(pool_name, &cluster));
+}
@@ -349,3 +349,61 @@ TEST(LibRadosSnapshots, SelfManagedSnapRollbackPP) {
   ioctx.close();
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
 }
+
+TEST(LibRadosSnapshots, ListSnapsPP) {
+  std::vector<uint64_t> my_snaps;
+  Rados cluster;
+  IoCtx ioctx;
+  std::string pool_name = get_temp_pool_name();
+  ASSERT_EQ("", create_one_pool_pp(pool_name, cluster));
+  ASSERT_EQ(0, cluster.ioctx_create(pool_name.c_str(), ioctx));
+
+  my_snaps.push_back(-2);
+  ASSERT_EQ(0, ioctx.selfmanaged_snap_create(&my_snaps.back()));
+  ::std::reverse(my_snaps.begin(), my_snaps.end());
+  ASSERT_EQ(0, ioctx.selfmanaged_snap_set_write_ctx(my_snaps[0], my_snaps));
+  ::std::reverse(my_snaps.begin(), my_snaps.end());
+  char buf[128];
+  memset(buf, 0xcc, sizeof(buf));
+  bufferlist bl1;
+  bl1.append(buf, sizeof(buf));
+  ASSERT_EQ((int)sizeof(buf), ioctx.write("foo", bl1, sizeof(buf), 0));
+
+  my_snaps.push_back(-2);
+  ASSERT_EQ(0, ioctx.selfmanaged_snap_create(&my_snaps.back()));
+  ::std::reverse(my_snaps.begin(), my_snaps.end());
+  ASSERT_EQ(0, ioctx.selfmanaged_snap_set_write_ctx(my_snaps[0], my_snaps));
+  ::std::reverse(my_snaps.begin(), my_snaps.end());
+  bufferlist bl2;
+  bl2.append(buf, sizeof(buf) / 2);
+  ASSERT_EQ((int)sizeof(buf) / 2, ioctx.write("foo", bl2, sizeof(buf) / 2, 0));
+
+  snap_set_t ss;
+  // only readable from the snapdir
+  ASSERT_EQ(-EINVAL, ioctx.list_snaps("foo", &ss));
+  ioctx.snap_set_read(SNAP_DIR);
+  ASSERT_EQ(0, ioctx.list_snaps("foo", &ss));
+  ASSERT_EQ(my_snaps[1], ss.seq);
+
+  // the clone made by the second write, then the head
+  ASSERT_EQ(2u, ss.clones.size());
+  ASSERT_EQ(my_snaps[1], ss.clones[0].cloneid);
+  ASSERT_EQ(1u, ss.clones[0].snaps.size());
+  ASSERT_EQ(my_snaps[1], ss.clones[0].snaps[0]);
+  ASSERT_EQ(sizeof(buf), ss.clones[0].size);
+  ASSERT_EQ(1u, ss.clones[0].overlap.size());
+  ASSERT_EQ(sizeof(buf) / 2, ss.clones[0].overlap[0].first);
+  ASSERT_EQ(sizeof(buf) / 2, ss.clones[0].overlap[0].second);
+  ASSERT_EQ((snap_t)SNAP_HEAD, ss.clones[1].cloneid);
+  ASSERT_EQ(sizeof(buf), ss.clones[1].size);
+
+  ASSERT_EQ(-ENOENT, ioctx.list_snaps("bar", &ss));
+
+  ioctx.snap_set_read(SNAP_HEAD);
+  ASSERT_EQ(0, ioctx.selfmanaged_snap_remove(my_snaps.back()));
+  my_snaps.pop_back();
+  ASSERT_EQ(0, ioctx.selfmanaged_snap_remove(my_snaps.back()));
+  my_snaps.pop_back();
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, cluster));
+}
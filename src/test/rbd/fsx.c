@@ -150,6 +150,8 @@ int 	mapped_reads = 0;		/* -R flag disables it */
 int	fsxgoodfd = 0;
 int	o_direct;			/* -Z */
 int	aio = 0;
+int	crash_write_log = 0;		/* -K flag */
+int	crash_closes = 0;
 
 int num_clones = 0;
 
@@ -498,6 +500,15 @@ create_image()
 		simple_err("Error reading ceph config file", r);
 		goto failed_shutdown;
 	}
+	if (crash_write_log) {
+		r = rados_conf_set(cluster, "rbd_write_log_crash_on_close",
+				   "true");
+		if (r < 0) {
+			simple_err("Error setting rbd_write_log_crash_on_close",
+				   r);
+			goto failed_shutdown;
+		}
+	}
 	r = rados_connect(cluster);
 	if (r < 0) {
 		simple_err("Error connecting to cluster", r);
@@ -787,6 +798,35 @@ void clone_imagename(char *buf, size_t len, int clones)
 		strncpy(buf, iname, len);
 }
 
+/*
+ * the write log is only used by the holder of the exclusive lock, so
+ * take it whenever the image is opened. we keep it across a close, so
+ * the next open replays what the last one left in the log.
+ */
+int
+open_image(const char *name, rbd_image_t *imagep)
+{
+	int ret = rbd_open(ioctx, name, imagep, NULL);
+	if (ret < 0 || !crash_write_log)
+		return ret;
+	ret = rbd_lock_exclusive(*imagep, "fsx");
+	if (ret < 0 && ret != -EEXIST) {
+		rbd_close(*imagep);
+		return ret;
+	}
+	return 0;
+}
+
+/* release the lock, destaging the write log, before closing for good */
+int
+close_image_for_good(rbd_image_t img)
+{
+	int ret;
+	if (crash_write_log && (ret = rbd_unlock(img, "fsx")) < 0)
+		return ret;
+	return rbd_close(img);
+}
+
 void
 do_clone()
 {
@@ -830,8 +870,11 @@ do_clone()
 		simple_err("do_clone: rbd clone", ret);
 		exit(165);
 	}
-	rbd_close(image);
-	if ((ret = rbd_open(ioctx, imagename, &image, NULL)) < 0) {
+	if ((ret = close_image_for_good(image)) < 0) {
+		simple_err("do_clone: rbd close", ret);
+		exit(166);
+	}
+	if ((ret = open_image(imagename, &image)) < 0) {
 		simple_err("do_clone: rbd open", ret);
 		exit(166);
 	}
@@ -914,6 +957,7 @@ writefileimage()
 void
 docloseopen(void)
 {
+	char name[1024];
 	int ret;
 
 	if (testcalls <= simulatedopcount)
@@ -921,11 +965,21 @@ docloseopen(void)
 
 	if (debug)
 		prt("%lu close/open\n", testcalls);
+	if (crash_write_log) {
+		/* every other crash is in the middle of a write */
+		ret = rados_conf_set(cluster, "rbd_write_log_crash_torn",
+				     crash_closes++ % 2 ? "true" : "false");
+		if (ret < 0) {
+			prterrcode("docloseopen: rados_conf_set", ret);
+			report_failure(184);
+		}
+	}
 	if ((ret = rbd_close(image)) < 0) {
 		prterrcode("docloseopen: close", ret);
 		report_failure(180);
 	}
-	ret = rbd_open(ioctx, iname, &image, NULL);
+	clone_imagename(name, sizeof(name), num_clones);
+	ret = open_image(name, &image);
 	if (ret < 0) {
 		prterrcode("docloseopen: open", ret);
 		report_failure(181);
@@ -1068,7 +1122,7 @@ void
 usage(void)
 {
 	fprintf(stdout, "usage: %s",
-		"fsx [-dnqxAFLOWZ] [-b opnum] [-c Prob] [-l flen] [-m start:end] [-o oplen] [-p progressinterval] [-r readbdy] [-s style] [-t truncbdy] [-w writebdy] [-D startingop] [-N numops] [-P dirpath] [-S seed] pname iname\n\
+		"fsx [-dnqxAFKLOWZ] [-b opnum] [-c Prob] [-l flen] [-m start:end] [-o oplen] [-p progressinterval] [-r readbdy] [-s style] [-t truncbdy] [-w writebdy] [-D startingop] [-N numops] [-P dirpath] [-S seed] pname iname\n\
 	-b opnum: beginning operation number (default 1)\n\
 	-c P: 1 in P chance of file close+open at each op (default infinity)\n\
 	-d: debug output for all operations\n\
@@ -1095,6 +1149,9 @@ usage(void)
 #endif
 "        -H: Do not use punch hole calls\n"
 "        -C: Do not use clone calls\n"
+"	-K: take the exclusive lock, and leave the write log (rbd_write_log_path)\n\
+	    without destaging it at each close, as if the client crashed (every\n\
+	    other time while a write was half done); use with -c\n"
 "	-L: fsxLite - no file creations & no file size changes\n\
 	-N numops: total # operations to do (default infinity)\n\
 	-O: use oplen (see -o flag) for every op (default random)\n\
@@ -1281,7 +1338,7 @@ main(int argc, char **argv)
 
 	setvbuf(stdout, (char *)0, _IOLBF, 0); /* line buffered stdout */
 
-	while ((ch = getopt(argc, argv, "b:c:dfl:m:no:p:qr:s:t:w:xyACD:FHLN:OP:RS:WZ"))
+	while ((ch = getopt(argc, argv, "b:c:dfl:m:no:p:qr:s:t:w:xyACD:FHKLN:OP:RS:WZ"))
 	       != EOF)
 		switch (ch) {
 		case 'b':
@@ -1385,6 +1442,9 @@ main(int argc, char **argv)
 		case 'H':
 			punch_hole_calls = 0;
 			break;
+		case 'K':
+			crash_write_log = 1;
+			break;
 		case 'L':
 			prt("lite mode not supported for rbd\n");
 			exit(1);
@@ -1454,7 +1514,7 @@ main(int argc, char **argv)
 		prterrcode(iname, ret);
 		exit(90);
 	}
-	ret = rbd_open(ioctx, iname, &image, NULL);
+	ret = open_image(iname, &image);
 	if (ret < 0) {
 		simple_err("Error opening image", ret);
 		exit(91);
@@ -1513,7 +1573,7 @@ main(int argc, char **argv)
 	while (numops == -1 || numops--)
 		test();
 
-	if ((ret = rbd_close(image)) < 0) {
+	if ((ret = close_image_for_good(image)) < 0) {
 		prterrcode("rbd_close", ret);
 		report_failure(99);
 	}
@@ -46,6 +46,8 @@ using ::librbd::parent_spec;
 using ::librbd::cls_client::get_protection_status;
 using ::librbd::cls_client::set_protection_status;
 using ::librbd::cls_client::old_snapshot_add;
+using ::librbd::cls_client::object_map_resize;
+using ::librbd::cls_client::object_map_update;
 
 static char *random_buf(size_t len)
 {
@@ -876,3 +878,64 @@ TEST(cls_rbd, snapid_race)
   ioctx.close();
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
 }
+
+TEST(cls_rbd, object_map)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  string oid = "rbd_object_map.test";
+  bufferlist bl;
+
+  // updating a map that doesn't exist fails
+  ASSERT_EQ(-ENOENT, object_map_update(&ioctx, oid, 0, 1, true));
+
+  // resizing creates it, with nothing marked
+  ASSERT_EQ(0, object_map_resize(&ioctx, oid, 20));
+  ASSERT_EQ(3, ioctx.read(oid, bl, 0, 0));
+  for (uint64_t i = 0; i < 20; ++i)
+    ASSERT_FALSE(object_map_test(bl.c_str(), i));
+
+  ASSERT_EQ(-EINVAL, object_map_update(&ioctx, oid, 5, 5, true));
+  ASSERT_EQ(-ERANGE, object_map_update(&ioctx, oid, 20, 30, true));
+  ASSERT_EQ(0, object_map_update(&ioctx, oid, 6, 18, true));
+  ASSERT_EQ(0, object_map_update(&ioctx, oid, 9, 10, false));
+  bl.clear();
+  ASSERT_EQ(3, ioctx.read(oid, bl, 0, 0));
+  for (uint64_t i = 0; i < 20; ++i)
+    ASSERT_EQ(i >= 6 && i < 18 && i != 9, object_map_test(bl.c_str(), i));
+
+  // updates batched into one op apply in order
+  librados::ObjectWriteOperation op;
+  object_map_update(&op, 0, 2, true);
+  object_map_update(&op, 1, 2, false);
+  ASSERT_EQ(0, ioctx.operate(oid, &op));
+  bl.clear();
+  ASSERT_EQ(3, ioctx.read(oid, bl, 0, 0));
+  ASSERT_TRUE(object_map_test(bl.c_str(), 0));
+  ASSERT_FALSE(object_map_test(bl.c_str(), 1));
+
+  // shrinking drops the bits past the end, and they stay clear when
+  // it grows again
+  ASSERT_EQ(0, object_map_resize(&ioctx, oid, 12));
+  bl.clear();
+  ASSERT_EQ(2, ioctx.read(oid, bl, 0, 0));
+  ASSERT_EQ(0, object_map_resize(&ioctx, oid, 40));
+  bl.clear();
+  ASSERT_EQ(5, ioctx.read(oid, bl, 0, 0));
+  for (uint64_t i = 0; i < 40; ++i)
+    ASSERT_EQ(i == 0 || (i >= 6 && i < 12 && i != 9),
+	      object_map_test(bl.c_str(), i));
+
+  ASSERT_EQ(0, object_map_resize(&ioctx, oid, 0));
+  bl.clear();
+  ASSERT_EQ(0, ioctx.read(oid, bl, 0, 0));
+  ASSERT_EQ(0, ioctx.remove(oid));
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
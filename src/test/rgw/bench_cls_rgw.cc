@@ -0,0 +1,160 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Time the bucket index ops rgw issues for each object it writes and
+ * removes (prepare, then complete, against one index object), and
+ * listing the index, as in test_cls_rgw.  Each of these cls methods
+ * reads the index header and the object's entry, some of them more
+ * than once; compare the osd's cls_read_cache_hits perf counter
+ * (ceph --admin-daemon <sock> perf dump) before and after a run to see
+ * how many of those reads were served from the op's read cache.
+ */
+
+#include "include/types.h"
+#include "cls/rgw/cls_rgw_client.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace librados;
+using std::string;
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static string name(const char *prefix, int n)
+{
+  std::ostringstream ss;
+  ss << prefix << "-" << n;
+  return ss.str();
+}
+
+static int index_op(IoCtx& ioctx, string& oid, uint8_t op, int i, uint64_t epoch,
+		    uint64_t size)
+{
+  string obj = name("obj", i);
+  string tag = name("tag", i);
+  string loc = name("loc", i);
+
+  ObjectWriteOperation prepare;
+  cls_rgw_bucket_prepare_op(prepare, op, tag, obj, loc);
+  int r = ioctx.operate(oid, &prepare);
+  if (r < 0)
+    return r;
+
+  ObjectWriteOperation complete;
+  rgw_bucket_dir_entry_meta meta;
+  meta.category = 0;
+  meta.size = size;
+  cls_rgw_bucket_complete_op(complete, op, tag, epoch, obj, meta);
+  return ioctx.operate(oid, &complete);
+}
+
+static void report(const char *what, int n, double elapsed)
+{
+  std::cout << what << ": " << n << " in " << elapsed << " s, "
+	    << (elapsed * 1000000 / n) << " us each" << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " pool [objects (1000)]" << std::endl;
+    return 1;
+  }
+  const char *pool = argv[1];
+  int num = argc > 2 ? atoi(argv[2]) : 1000;
+  string oid = "bench_cls_rgw_index";
+
+  Rados rados;
+  int r = rados.init(getenv("CEPH_CLIENT_ID"));
+  if (r == 0)
+    r = rados.conf_read_file(NULL);
+  if (r == 0)
+    r = rados.conf_parse_env(NULL);
+  if (r == 0)
+    r = rados.connect();
+  if (r < 0) {
+    std::cerr << "failed to connect: " << strerror(-r) << std::endl;
+    return 1;
+  }
+  IoCtx ioctx;
+  r = rados.ioctx_create(pool, ioctx);
+  if (r < 0) {
+    std::cerr << "failed to open pool " << pool << ": " << strerror(-r) << std::endl;
+    return 1;
+  }
+
+  ioctx.remove(oid);
+  ObjectWriteOperation init;
+  cls_rgw_bucket_init(init);
+  r = ioctx.operate(oid, &init);
+  if (r < 0) {
+    std::cerr << "bucket_init: " << strerror(-r) << std::endl;
+    return 1;
+  }
+
+  uint64_t epoch = 0;
+  double start = now();
+  for (int i = 0; i < num; i++) {
+    r = index_op(ioctx, oid, CLS_RGW_OP_ADD, i, ++epoch, 4096);
+    if (r < 0) {
+      std::cerr << "add " << i << ": " << strerror(-r) << std::endl;
+      return 1;
+    }
+  }
+  report("add (prepare+complete)", num, now() - start);
+
+  // overwrite each object, as a second put of the same name does
+  start = now();
+  for (int i = 0; i < num; i++) {
+    r = index_op(ioctx, oid, CLS_RGW_OP_ADD, i, ++epoch, 8192);
+    if (r < 0) {
+      std::cerr << "overwrite " << i << ": " << strerror(-r) << std::endl;
+      return 1;
+    }
+  }
+  report("overwrite (prepare+complete)", num, now() - start);
+
+  start = now();
+  int lists = 0;
+  string marker;
+  while (true) {
+    rgw_bucket_dir dir;
+    bool truncated = false;
+    string prefix;
+    r = cls_rgw_list_op(ioctx, oid, marker, prefix, 100, &dir, &truncated);
+    if (r < 0) {
+      std::cerr << "list: " << strerror(-r) << std::endl;
+      return 1;
+    }
+    lists++;
+    if (!truncated || dir.m.empty())
+      break;
+    marker = dir.m.rbegin()->first;
+  }
+  report("list (100 entries)", lists, now() - start);
+
+  start = now();
+  for (int i = 0; i < num; i++) {
+    r = index_op(ioctx, oid, CLS_RGW_OP_DEL, i, ++epoch, 0);
+    if (r < 0) {
+      std::cerr << "remove " << i << ": " << strerror(-r) << std::endl;
+      return 1;
+    }
+  }
+  report("remove (prepare+complete)", num, now() - start);
+
+  ioctx.remove(oid);
+  rados.shutdown();
+  return 0;
+}
@@ -23,6 +23,7 @@
 #include <map>
 #include <pthread.h>
 #include <semaphore.h>
+#include <set>
 #include <sstream>
 #include <stdarg.h>
 #include <stdio.h>
@@ -202,6 +203,89 @@ private:
   std::string m_suffix;
 };
 
+// lists every part of the pool at once, and checks that together they
+// are the whole pool, with no object in more than one part
+class RadosListPartsR : public SysTestRunnable
+{
+public:
+  RadosListPartsR(int argc, const char **argv,
+		  const std::string &pool_name, int num_parts)
+    : SysTestRunnable(argc, argv),
+      m_pool_name(pool_name),
+      m_num_parts(num_parts)
+  {
+  }
+
+  ~RadosListPartsR()
+  {
+  }
+
+  int run(void)
+  {
+    rados_t cl;
+    RETURN1_IF_NONZERO(rados_create(&cl, NULL));
+    rados_conf_parse_argv(cl, m_argc, m_argv);
+    RETURN1_IF_NONZERO(rados_conf_read_file(cl, NULL));
+    std::string log_name = SysTestSettings::inst().get_log_name(get_id_str());
+    if (!log_name.empty())
+      rados_conf_set(cl, "log_file", log_name.c_str());
+    RETURN1_IF_NONZERO(rados_connect(cl));
+    pool_setup_sem->wait();
+    pool_setup_sem->post();
+
+    rados_ioctx_t io_ctx;
+    RETURN1_IF_NOT_VAL(-EEXIST, rados_pool_create(cl, m_pool_name.c_str()));
+    RETURN1_IF_NONZERO(rados_ioctx_create(cl, m_pool_name.c_str(), &io_ctx));
+
+    vector <rados_list_ctx_t> parts(m_num_parts);
+    for (int i = 0; i < m_num_parts; ++i)
+      RETURN1_IF_NONZERO(rados_objects_list_open_part(io_ctx, i, m_num_parts,
+						      &parts[i]));
+
+    // one object from each part in turn, so all the cursors are open
+    // together
+    std::set <std::string> seen;
+    int open = m_num_parts;
+    while (open > 0) {
+      for (int i = 0; i < m_num_parts; ++i) {
+	if (!parts[i])
+	  continue;
+	const char *obj_name;
+	int ret = rados_objects_list_next(parts[i], &obj_name, NULL);
+	if (ret == -ENOENT) {
+	  rados_objects_list_close(parts[i]);
+	  parts[i] = NULL;
+	  --open;
+	  continue;
+	}
+	if (ret != 0) {
+	  printf("%s: rados_objects_list_next error: %d\n", get_id_str(), ret);
+	  return ret;
+	}
+	if (!seen.insert(obj_name).second) {
+	  printf("%s: object %s listed twice\n", get_id_str(), obj_name);
+	  return -EDOM;
+	}
+      }
+    }
+    if ((int)seen.size() != g_num_objects) {
+      printf("%s: the parts have %d objects between them, not %d\n",
+	     get_id_str(), (int)seen.size(), g_num_objects);
+      return -EDOM;
+    }
+    printf("%s: listed %d objects in %d parts\n", get_id_str(),
+	   (int)seen.size(), m_num_parts);
+
+    rados_ioctx_destroy(io_ctx);
+    rados_shutdown(cl);
+
+    return 0;
+  }
+private:
+  std::string m_pool_name;
+  int m_num_parts;
+};
+
 const char *get_id_str()
 {
   return "main";
@@ -323,6 +407,35 @@ int main(int argc, const char **argv)
     }
   }
 
+  // Test 6... list objects in parallel parts
+  RETURN1_IF_NONZERO(pool_setup_sem->reinit(0));
+  RETURN1_IF_NONZERO(modify_sem->reinit(0));
+  {
+    StRadosCreatePool r1(argc, argv, NULL, pool_setup_sem, NULL,
+			 pool, g_num_objects, ".obj");
+    StRadosListObjects r2(argc, argv, pool, false, 0,
+			  pool_setup_sem, NULL, 0, 4);
+    StRadosListObjects r3(argc, argv, pool, false, 0,
+			  pool_setup_sem, NULL, 1, 4);
+    StRadosListObjects r4(argc, argv, pool, false, 0,
+			  pool_setup_sem, NULL, 2, 4);
+    StRadosListObjects r5(argc, argv, pool, false, 0,
+			  pool_setup_sem, NULL, 3, 4);
+    RadosListPartsR r6(argc, argv, pool, 4);
+    vector < SysTestRunnable* > vec;
+    vec.push_back(&r1);
+    vec.push_back(&r2);
+    vec.push_back(&r3);
+    vec.push_back(&r4);
+    vec.push_back(&r5);
+    vec.push_back(&r6);
+    error = SysTestRunnable::run_until_finished(vec);
+    if (!error.empty()) {
+      printf("got error: %s\n", error.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+
   printf("******* SUCCESS **********\n"); 
   return EXIT_SUCCESS;
 }
@@ -22,6 +22,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/time.h>
 #include <sstream>
 #include <string>
 
@@ -33,12 +34,15 @@ StRadosListObjects(int argc, const char **argv,
 		   bool accept_list_errors,
 		   int midway_cnt,
 		   CrossProcessSem *pool_setup_sem,
-		   CrossProcessSem *midway_sem)
+		   CrossProcessSem *midway_sem,
+		   int part, int num_parts)
   : SysTestRunnable(argc, argv),
     m_accept_list_errors(accept_list_errors),
     m_midway_cnt(midway_cnt),
     m_pool_setup_sem(pool_setup_sem),
-    m_midway_sem(midway_sem)
+    m_midway_sem(midway_sem),
+    m_part(part),
+    m_num_parts(num_parts)
 {
 }
 
@@ -65,8 +69,17 @@ run()
   int ret, saw = 0;
   const char *obj_name;
   rados_list_ctx_t h;
-  printf("%s: listing objects.\n", get_id_str());
-  RETURN1_IF_NONZERO(rados_objects_list_open(io_ctx, &h));
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+  if (m_num_parts > 1) {
+    printf("%s: listing objects, part %d of %d.\n", get_id_str(),
+	   m_part, m_num_parts);
+    RETURN1_IF_NONZERO(rados_objects_list_open_part(io_ctx, m_part,
+						    m_num_parts, &h));
+  } else {
+    printf("%s: listing objects.\n", get_id_str());
+    RETURN1_IF_NONZERO(rados_objects_list_open(io_ctx, &h));
+  }
   while (true) {
     ret = rados_objects_list_next(h, &obj_name, NULL);
     if (ret == -ENOENT) {
@@ -90,8 +103,10 @@ run()
     }
   }
   rados_objects_list_close(h);
+  gettimeofday(&end, NULL);
 
-  printf("%s: saw %d objects\n", get_id_str(), saw);
+  printf("%s: saw %d objects in %.3f seconds\n", get_id_str(), saw,
+	 (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0);
 
   rados_ioctx_destroy(io_ctx);
   rados_shutdown(cl);
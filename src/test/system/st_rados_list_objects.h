@@ -27,6 +27,9 @@ class CrossProcessSem;
  * 3. list some objects
  * 4. modify_sem->wait()
  * 5. list some objects
+ *
+ * With num_parts > 1, only part 'part' of the pool is listed (see
+ * rados_objects_list_open_part).
  */
 class StRadosListObjects : public SysTestRunnable
 {
@@ -37,7 +40,8 @@ public:
 		     bool accept_list_errors,
 		     int midway_cnt,
 		     CrossProcessSem *pool_setup_sem,
-		     CrossProcessSem *midway_sem);
+		     CrossProcessSem *midway_sem,
+		     int part = 0, int num_parts = 1);
   ~StRadosListObjects();
   virtual int run();
 private:
@@ -46,6 +50,8 @@ private:
   int m_midway_cnt;
   CrossProcessSem *m_pool_setup_sem;
   CrossProcessSem *m_midway_sem;
+  int m_part;
+  int m_num_parts;
 };
 
 #endif
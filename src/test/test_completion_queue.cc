@@ -0,0 +1,132 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "librados/AioCompletionImpl.h"
+#include "librados/CompletionQueueImpl.h"
+#include "gtest/gtest.h"
+
+#include <poll.h>
+
+using librados::AioCompletionImpl;
+using librados::CompletionQueueImpl;
+
+static bool readable(int fd)
+{
+  struct pollfd p;
+  p.fd = fd;
+  p.events = POLLIN;
+  p.revents = 0;
+  return ::poll(&p, 1, 0) == 1 && (p.revents & POLLIN);
+}
+
+// as IoCtxImpl does when an aio completes
+static void post(CompletionQueueImpl *q, AioCompletionImpl *c)
+{
+  c->lock.Lock();
+  q->post(c);
+  c->lock.Unlock();
+}
+
+static int ref(AioCompletionImpl *c)
+{
+  Mutex::Locker l(c->lock);
+  return c->ref;
+}
+
+TEST(CompletionQueue, Order)
+{
+  CompletionQueueImpl q;
+  ASSERT_EQ(0, q.init());
+  AioCompletionImpl *c[5];
+  for (int i = 0; i < 5; i++) {
+    c[i] = new AioCompletionImpl;
+    post(&q, c[i]);
+  }
+
+  // reaped in the order they were posted, a few at a time
+  AioCompletionImpl *out[5];
+  ASSERT_EQ(2, q.reap(out, 2));
+  ASSERT_EQ(c[0], out[0]);
+  ASSERT_EQ(c[1], out[1]);
+  ASSERT_EQ(3, q.reap(out, 5));
+  ASSERT_EQ(c[2], out[0]);
+  ASSERT_EQ(c[3], out[1]);
+  ASSERT_EQ(c[4], out[2]);
+  ASSERT_EQ(0, q.reap(out, 5));
+
+  for (int i = 0; i < 5; i++)
+    c[i]->release();
+}
+
+TEST(CompletionQueue, Refs)
+{
+  CompletionQueueImpl q;
+  ASSERT_EQ(0, q.init());
+  AioCompletionImpl *c = new AioCompletionImpl;
+  ASSERT_EQ(1, ref(c));
+
+  // the queue holds a ref until it is reaped...
+  post(&q, c);
+  ASSERT_EQ(2, ref(c));
+  AioCompletionImpl *out;
+  ASSERT_EQ(1, q.reap(&out, 1));
+  ASSERT_EQ(c, out);
+  // ...and then only the caller's is left
+  ASSERT_EQ(1, ref(c));
+
+  // released before it was reaped: the queue's ref keeps it alive
+  // until then, and reaping frees it
+  post(&q, c);
+  c->release();
+  ASSERT_EQ(1, ref(c));
+  ASSERT_EQ(1, q.reap(&out, 1));
+  ASSERT_EQ(c, out);
+}
+
+TEST(CompletionQueue, DestroyUnreaped)
+{
+  CompletionQueueImpl *q = new CompletionQueueImpl;
+  ASSERT_EQ(0, q->init());
+  AioCompletionImpl *c = new AioCompletionImpl;
+  post(q, c);
+  ASSERT_EQ(2, ref(c));
+  delete q;
+  ASSERT_EQ(1, ref(c));
+  c->release();
+}
+
+TEST(CompletionQueue, EventFd)
+{
+  CompletionQueueImpl q;
+  ASSERT_EQ(0, q.init());
+  ASSERT_FALSE(readable(q.fd));
+
+  AioCompletionImpl *c[3];
+  for (int i = 0; i < 3; i++)
+    c[i] = new AioCompletionImpl;
+
+  // a burst of completions is a single wakeup
+  post(&q, c[0]);
+  post(&q, c[1]);
+  ASSERT_TRUE(readable(q.fd));
+
+  // still readable while anything is left to reap...
+  AioCompletionImpl *out[3];
+  ASSERT_EQ(1, q.reap(out, 1));
+  ASSERT_TRUE(readable(q.fd));
+  // ...and drained by taking the last one
+  ASSERT_EQ(1, q.reap(out, 1));
+  ASSERT_FALSE(readable(q.fd));
+  uint64_t v;
+  ASSERT_EQ(-1, ::read(q.fd, &v, sizeof(v)));
+  ASSERT_EQ(EAGAIN, errno);
+
+  // and signalled again by the next one
+  post(&q, c[2]);
+  ASSERT_TRUE(readable(q.fd));
+  ASSERT_EQ(1, q.reap(out, 3));
+  ASSERT_FALSE(readable(q.fd));
+
+  for (int i = 0; i < 3; i++)
+    c[i]->release();
+}
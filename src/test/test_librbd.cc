@@ -21,9 +21,11 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -1308,3 +1310,659 @@ TEST(LibRBD, LockingPP)
   ioctx.close();
   ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
 }
+
+struct diff_extent {
+  uint64_t offset;
+  uint64_t length;
+  bool exists;
+};
+
+static int vector_iterate_cb(uint64_t off, size_t len, int exists, void *arg)
+{
+  vector<diff_extent> *diff = static_cast<vector<diff_extent> *>(arg);
+  diff_extent e = { off, len, exists != 0 };
+  diff->push_back(e);
+  return 0;
+}
+
+TEST(LibRBD, DiffIteratePP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    librbd::Image image;
+    int order = 0;
+    const char *name = "testimg";
+    uint64_t size = 20 << 20;
+
+    ASSERT_EQ(0, create_image_pp(rbd, ioctx, name, size, &order));
+    ASSERT_EQ(0, rbd.open(ioctx, image, name, NULL));
+    uint64_t object_size = 1ull << order;
+
+    bufferlist bl;
+    bl.append(string(4096, 'a'));
+    ASSERT_EQ(4096, image.write(0, 4096, bl));
+    ASSERT_EQ(0, image.snap_create("one"));
+    ASSERT_EQ(4096, image.write(object_size + 8192, 4096, bl));
+
+    // since snapshot one, only the second write
+    vector<diff_extent> diff;
+    ASSERT_EQ(0, image.diff_iterate("one", 0, size, vector_iterate_cb,
+				    (void *)&diff));
+    ASSERT_EQ(1u, diff.size());
+    ASSERT_EQ(object_size + 8192, diff[0].offset);
+    ASSERT_EQ(4096u, diff[0].length);
+    ASSERT_TRUE(diff[0].exists);
+
+    // since the beginning, everything that was written, in order
+    diff.clear();
+    ASSERT_EQ(0, image.diff_iterate(NULL, 0, size, vector_iterate_cb,
+				    (void *)&diff));
+    ASSERT_EQ(2u, diff.size());
+    ASSERT_EQ(0u, diff[0].offset);
+    ASSERT_EQ(4096u, diff[0].length);
+    ASSERT_EQ(object_size, diff[1].offset);
+    ASSERT_EQ(8192u + 4096, diff[1].length);
+
+    // limited to the range asked for
+    diff.clear();
+    ASSERT_EQ(0, image.diff_iterate(NULL, 1024, 1024, vector_iterate_cb,
+				    (void *)&diff));
+    ASSERT_EQ(1u, diff.size());
+    ASSERT_EQ(1024u, diff[0].offset);
+    ASSERT_EQ(1024u, diff[0].length);
+
+    // as of snapshot one, nothing changed since itself
+    ASSERT_EQ(0, image.snap_set("one"));
+    diff.clear();
+    ASSERT_EQ(0, image.diff_iterate("one", 0, size, vector_iterate_cb,
+				    (void *)&diff));
+    ASSERT_EQ(0u, diff.size());
+    ASSERT_EQ(-ENOENT, image.diff_iterate("two", 0, size, vector_iterate_cb,
+					  (void *)&diff));
+    ASSERT_EQ(0, image.snap_set(NULL));
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
+static double now_seconds()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+TEST(LibRBD, ConcurrentManagementOpsPP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    librbd::Image image;
+    int order = 20;
+    const char *name = "testimg";
+    const char *name2 = "testimg2";
+    uint64_t num_objs = 64;
+    uint64_t size = num_objs << order;
+
+    ASSERT_EQ(0, create_image_pp(rbd, ioctx, name, size, &order));
+    ASSERT_EQ(0, rbd.open(ioctx, image, name, NULL));
+    bufferlist bl;
+    bl.append(string(4096, 'x'));
+    for (uint64_t i = 0; i < num_objs; ++i)
+      ASSERT_EQ(4096, image.write(i << order, 4096, bl));
+
+    // the same results at any concurrency, only the time taken differs
+    const char *levels[] = { "1", "4", "16" };
+    for (unsigned l = 0; l < sizeof(levels) / sizeof(levels[0]); ++l) {
+      ASSERT_EQ(0, rados.conf_set("rbd_concurrent_management_ops",
+				  levels[l]));
+
+      double start = now_seconds();
+      ASSERT_EQ(0, image.copy(ioctx, name2));
+      double copy_time = now_seconds() - start;
+
+      double shrink_time;
+      {
+	librbd::Image image2;
+	ASSERT_EQ(0, rbd.open(ioctx, image2, name2, NULL));
+	for (uint64_t i = 0; i < num_objs; i += 7) {
+	  bufferlist read_bl;
+	  ASSERT_EQ(4096, image2.read(i << order, 4096, read_bl));
+	  ASSERT_TRUE(read_bl.contents_equal(bl));
+	}
+
+	start = now_seconds();
+	ASSERT_EQ(0, image2.resize(size / 2));
+	shrink_time = now_seconds() - start;
+      }
+
+      start = now_seconds();
+      ASSERT_EQ(0, rbd.remove(ioctx, name2));
+      double remove_time = now_seconds() - start;
+
+      cout << "rbd_concurrent_management_ops " << levels[l] << ": copy "
+	   << copy_time << "s, shrink " << shrink_time << "s, remove "
+	   << remove_time << "s" << std::endl;
+    }
+    ASSERT_EQ(0, rados.conf_set("rbd_concurrent_management_ops", "10"));
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
+struct cache_stress_t {
+  librbd::Image *image;
+  int id;
+  uint64_t num_objs;
+  int order;
+  int r;
+};
+
+// each thread owns its own 4k block of every object, so all of them
+// hit every shard and none overwrite each other
+static void *cache_stress_thread(void *arg)
+{
+  cache_stress_t *t = (cache_stress_t *)arg;
+  t->r = 0;
+  for (int pass = 0; pass < 4 && t->r == 0; ++pass) {
+    bufferlist bl;
+    bl.append(string(4096, 'a' + t->id + pass));
+    for (uint64_t i = 0; i < t->num_objs; ++i) {
+      uint64_t off = (i << t->order) + 4096 * t->id;
+      if (t->image->write(off, 4096, bl) != 4096) {
+	t->r = -EIO;
+	break;
+      }
+      bufferlist read_bl;
+      if (t->image->read(off, 4096, read_bl) != 4096 ||
+	  !read_bl.contents_equal(bl)) {
+	t->r = -EIO;
+	break;
+      }
+    }
+    if (pass == 1 && t->r == 0)
+      t->r = t->image->flush();
+  }
+  return NULL;
+}
+
+TEST(LibRBD, CacheShardsStressPP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    int order = 20;
+    const char *name = "testimg";
+    const int num_threads = 8;
+    uint64_t num_objs = 16;
+    uint64_t size = num_objs << order;
+
+    ASSERT_EQ(0, create_image_pp(rbd, ioctx, name, size, &order));
+    ASSERT_EQ(0, rados.conf_set("rbd_cache", "true"));
+    ASSERT_EQ(0, rados.conf_set("rbd_cache_shards", "4"));
+    {
+      librbd::Image image;
+      ASSERT_EQ(0, rbd.open(ioctx, image, name, NULL));
+      pthread_t threads[num_threads];
+      cache_stress_t args[num_threads];
+      for (int i = 0; i < num_threads; ++i) {
+	args[i].image = &image;
+	args[i].id = i;
+	args[i].num_objs = num_objs;
+	args[i].order = order;
+	ASSERT_EQ(0, pthread_create(&threads[i], NULL, cache_stress_thread,
+				    &args[i]));
+      }
+      for (int i = 0; i < num_threads; ++i)
+	pthread_join(threads[i], NULL);
+      for (int i = 0; i < num_threads; ++i)
+	ASSERT_EQ(0, args[i].r);
+      // closing the image flushes what is still dirty
+    }
+    ASSERT_EQ(0, rados.conf_set("rbd_cache", "false"));
+    ASSERT_EQ(0, rados.conf_set("rbd_cache_shards", "1"));
+
+    // everything made it to the osds
+    librbd::Image image;
+    ASSERT_EQ(0, rbd.open(ioctx, image, name, NULL));
+    for (uint64_t i = 0; i < num_objs; ++i) {
+      for (int id = 0; id < num_threads; ++id) {
+	bufferlist read_bl;
+	ASSERT_EQ(4096, image.read((i << order) + 4096 * id, 4096, read_bl));
+	ASSERT_EQ(string(4096, 'a' + id + 3), string(read_bl.c_str(), 4096));
+      }
+    }
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
+class CancelProgress : public librbd::ProgressContext
+{
+public:
+  CancelProgress(uint64_t after) : m_after(after) {}
+  int update_progress(uint64_t offset, uint64_t src_size)
+  {
+    return offset >= m_after ? -ECANCELED : 0;
+  }
+private:
+  uint64_t m_after;
+};
+
+TEST(LibRBD, CancelManagementOpsPP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    int order = 20;
+    const char *name = "testimg";
+    uint64_t num_objs = 16;
+    uint64_t size = num_objs << order;
+
+    ASSERT_EQ(0, create_image_pp(rbd, ioctx, name, size, &order));
+    {
+      librbd::Image image;
+      ASSERT_EQ(0, rbd.open(ioctx, image, name, NULL));
+      bufferlist bl;
+      bl.append(string(4096, 'x'));
+      for (uint64_t i = 0; i < num_objs; ++i)
+	ASSERT_EQ(4096, image.write(i << order, 4096, bl));
+
+      // a cancelled shrink leaves the size alone, and the objects it
+      // didn't get to
+      CancelProgress cancel_resize(4 << order);
+      ASSERT_EQ(-ECANCELED, image.resize_with_progress(0, cancel_resize));
+      uint64_t cur_size;
+      ASSERT_EQ(0, image.size(&cur_size));
+      ASSERT_EQ(size, cur_size);
+      bufferlist read_bl;
+      ASSERT_EQ(4096, image.read((num_objs - 1) << order, 4096, read_bl));
+      ASSERT_TRUE(read_bl.contents_equal(bl));
+    }
+
+    // a cancelled remove leaves the image
+    CancelProgress cancel_remove(0);
+    ASSERT_EQ(-ECANCELED, rbd.remove_with_progress(ioctx, name,
+						   cancel_remove));
+    ASSERT_EQ(1, test_ls_pp(rbd, ioctx, 1, name));
+    ASSERT_EQ(0, rbd.remove(ioctx, name));
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
+TEST(LibRBD, CopyOnReadPP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    int order = 20;
+    uint64_t num_objs = 4;
+    uint64_t size = num_objs << order;
+    bufferlist bl;
+    bl.append(string(4096, 'p'));
+
+    // every object of the parent but the last has something in it
+    ASSERT_EQ(0, rbd.create2(ioctx, "parent", size, RBD_FEATURE_LAYERING,
+			     &order));
+    {
+      librbd::Image parent;
+      ASSERT_EQ(0, rbd.open(ioctx, parent, "parent", NULL));
+      for (uint64_t i = 0; i < num_objs - 1; ++i)
+	ASSERT_EQ(4096, parent.write(i << order, 4096, bl));
+      ASSERT_EQ(0, parent.snap_create("snap"));
+      ASSERT_EQ(0, parent.snap_protect("snap"));
+    }
+    ASSERT_EQ(0, rbd.clone(ioctx, "parent", "snap", ioctx, "child",
+			   RBD_FEATURE_LAYERING, &order));
+
+    ASSERT_EQ(0, rados.conf_set("rbd_clone_copy_on_read", "true"));
+    {
+      librbd::Image child;
+      ASSERT_EQ(0, rbd.open(ioctx, child, "child", NULL));
+      uint64_t used;
+      ASSERT_EQ(0, child.used_size(&used));
+      ASSERT_EQ(0u, used);
+      for (uint64_t i = 0; i < num_objs; ++i) {
+	bufferlist read_bl;
+	ASSERT_EQ(4096, child.read(i << order, 4096, read_bl));
+	if (i < num_objs - 1) {
+	  ASSERT_TRUE(read_bl.contents_equal(bl));
+	} else {
+	  ASSERT_TRUE(read_bl.is_zero());
+	}
+      }
+      // closing waits for the copies
+    }
+    ASSERT_EQ(0, rados.conf_set("rbd_clone_copy_on_read", "false"));
+
+    {
+      // the child has its own copy of what was in the parent, and
+      // nothing for the empty object
+      librbd::Image child;
+      ASSERT_EQ(0, rbd.open(ioctx, child, "child", NULL));
+      uint64_t used;
+      ASSERT_EQ(0, child.used_size(&used));
+      ASSERT_EQ((num_objs - 1) << order, used);
+      for (uint64_t i = 0; i < num_objs - 1; ++i) {
+	bufferlist read_bl;
+	ASSERT_EQ(4096, child.read(i << order, 4096, read_bl));
+	ASSERT_TRUE(read_bl.contents_equal(bl));
+      }
+    }
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
+TEST(LibRBD, LargeAioPP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    librbd::Image image;
+    int order = 12;
+    uint64_t size = 2 << 20;
+    ASSERT_EQ(0, rbd.create(ioctx, "large_aio", size, &order));
+    ASSERT_EQ(0, rbd.open(ioctx, image, "large_aio", NULL));
+
+    // spans a few hundred objects, starting and ending part way into one
+    uint64_t off = 1000;
+    size_t len = (1 << 20) + 3000;
+    bufferlist bl;
+    for (size_t i = 0; i < len; ++i)
+      bl.append((char)(i * 7 + i / 4096));
+
+    librbd::RBD::AioCompletion *comp =
+      new librbd::RBD::AioCompletion(NULL, NULL);
+    ASSERT_EQ(0, image.aio_write(off, len, bl, comp));
+    comp->wait_for_complete();
+    ASSERT_EQ(0, comp->get_return_value());
+    comp->release();
+
+    bufferlist read_bl;
+    comp = new librbd::RBD::AioCompletion(NULL, NULL);
+    ASSERT_EQ(0, image.aio_read(off, len, read_bl, comp));
+    comp->wait_for_complete();
+    ASSERT_EQ((ssize_t)len, comp->get_return_value());
+    comp->release();
+    ASSERT_TRUE(read_bl.contents_equal(bl));
+
+    // a discard in the middle reads back as zeros
+    comp = new librbd::RBD::AioCompletion(NULL, NULL);
+    ASSERT_EQ(0, image.aio_discard(off + 5000, 100000, comp));
+    comp->wait_for_complete();
+    ASSERT_EQ(0, comp->get_return_value());
+    comp->release();
+    read_bl.clear();
+    ASSERT_EQ(100000, image.read(off + 5000, 100000, read_bl));
+    ASSERT_TRUE(read_bl.is_zero());
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
+// start count aio ops on image and wait for them all
+static void aio_burst(librbd::Image &image, bool write, int count)
+{
+  bufferlist bl;
+  bl.append(string(4096, 'q'));
+  vector<bufferlist> read_bls(count);
+  vector<librbd::RBD::AioCompletion*> comps;
+  for (int i = 0; i < count; ++i) {
+    librbd::RBD::AioCompletion *comp =
+      new librbd::RBD::AioCompletion(NULL, NULL);
+    if (write)
+      ASSERT_EQ(0, image.aio_write(i * 4096, 4096, bl, comp));
+    else
+      ASSERT_EQ(0, image.aio_read(i * 4096, 4096, read_bls[i], comp));
+    comps.push_back(comp);
+  }
+  for (int i = 0; i < count; ++i) {
+    comps[i]->wait_for_complete();
+    ASSERT_LE(0, comps[i]->get_return_value());
+    comps[i]->release();
+  }
+}
+
+static string block_oid(librbd::Image& image, uint64_t objno)
+{
+  librbd::image_info_t info;
+  image.stat(info, sizeof(info));
+  char buf[RBD_MAX_BLOCK_NAME_SIZE + 17];
+  snprintf(buf, sizeof(buf), "%s.%016llx", info.block_name_prefix,
+	   (unsigned long long)objno);
+  return buf;
+}
+
+static bool is_zero(const bufferlist& bl)
+{
+  for (unsigned i = 0; i < bl.length(); ++i) {
+    if (bl[i])
+      return false;
+  }
+  return true;
+}
+
+TEST(LibRBD, ObjectMapPP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    const char *name = "objmap";
+    int order = 22;
+    uint64_t obj_size = 1 << order;
+    ASSERT_EQ(0, rbd.create2(ioctx, name, 4 * obj_size,
+			     RBD_FEATURE_OBJECT_MAP, &order));
+    uint64_t missing, stale, size;
+    string oid0, oid3;
+    bufferlist bl;
+    bl.append(string(4096, 'a'));
+
+    {
+      librbd::Image image;
+      ASSERT_EQ(0, rbd.open(ioctx, image, name, NULL));
+      // only the lock holder trusts a clear bit
+      ASSERT_EQ(0, image.lock_exclusive("objmap"));
+      oid0 = block_oid(image, 0);
+      oid3 = block_oid(image, 3);
+
+      // objects that were never written read as zeroes, and so does
+      // the rest of one that was
+      ASSERT_EQ(4096, image.write(obj_size + 4096, 4096, bl));
+      bufferlist read_bl;
+      ASSERT_EQ((ssize_t)obj_size, image.read(0, obj_size, read_bl));
+      ASSERT_TRUE(is_zero(read_bl));
+      read_bl.clear();
+      ASSERT_EQ(3 * 4096, image.read(obj_size, 3 * 4096, read_bl));
+      bufferlist part;
+      part.substr_of(read_bl, 0, 4096);
+      ASSERT_TRUE(is_zero(part));
+      part.substr_of(read_bl, 4096, 4096);
+      ASSERT_TRUE(part.contents_equal(bl));
+      part.substr_of(read_bl, 8192, 4096);
+      ASSERT_TRUE(is_zero(part));
+      read_bl.clear();
+      ASSERT_EQ((ssize_t)obj_size,
+		image.read(2 * obj_size, obj_size, read_bl));
+      ASSERT_TRUE(is_zero(read_bl));
+      uint64_t used;
+      ASSERT_EQ(0, image.used_size(&used));
+      ASSERT_EQ(obj_size, used);
+      ASSERT_EQ(0, image.object_map_check(&missing, &stale));
+      ASSERT_EQ(0u, missing);
+      ASSERT_EQ(0u, stale);
+
+      // discarding a whole object removes it
+      ASSERT_EQ(4096, image.write(2 * obj_size, 4096, bl));
+      ASSERT_EQ(0, ioctx.stat(block_oid(image, 2), &size, NULL));
+      ASSERT_EQ((int)obj_size, image.discard(2 * obj_size, obj_size));
+      ASSERT_EQ(-ENOENT, ioctx.stat(block_oid(image, 2), &size, NULL));
+      read_bl.clear();
+      ASSERT_EQ((ssize_t)obj_size,
+		image.read(2 * obj_size, obj_size, read_bl));
+      ASSERT_TRUE(is_zero(read_bl));
+
+      // so does trimming it off by a resize; grown back, it reads as
+      // zeroes
+      ASSERT_EQ(0, image.resize(obj_size));
+      ASSERT_EQ(-ENOENT, ioctx.stat(block_oid(image, 1), &size, NULL));
+      ASSERT_EQ(0, image.resize(4 * obj_size));
+      read_bl.clear();
+      ASSERT_EQ((ssize_t)obj_size, image.read(obj_size, obj_size, read_bl));
+      ASSERT_TRUE(is_zero(read_bl));
+      ASSERT_EQ(0, image.object_map_check(&missing, &stale));
+      ASSERT_EQ(0u, missing);
+
+      // an object the map doesn't know about reads as a hole until
+      // the map is rebuilt
+      ASSERT_EQ(4096, image.write(0, 4096, bl));
+      ASSERT_EQ(0, ioctx.write(oid3, bl, bl.length(), 0));
+      ASSERT_EQ(0, image.object_map_check(&missing, &stale));
+      ASSERT_EQ(1u, missing);
+      read_bl.clear();
+      ASSERT_EQ(4096, image.read(3 * obj_size, 4096, read_bl));
+      ASSERT_TRUE(is_zero(read_bl));
+      ASSERT_EQ(0, image.object_map_rebuild());
+      ASSERT_EQ(0, image.object_map_check(&missing, &stale));
+      ASSERT_EQ(0u, missing);
+      ASSERT_EQ(0u, stale);
+      read_bl.clear();
+      ASSERT_EQ(4096, image.read(3 * obj_size, 4096, read_bl));
+      ASSERT_TRUE(read_bl.contents_equal(bl));
+      ASSERT_EQ(0, image.unlock("objmap"));
+    }
+
+    // removing the image removes the objects in the map
+    ASSERT_EQ(0, rbd.remove(ioctx, name));
+    ASSERT_EQ(-ENOENT, ioctx.stat(oid0, &size, NULL));
+    ASSERT_EQ(-ENOENT, ioctx.stat(oid3, &size, NULL));
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
+
+TEST(LibRBD, QosPP)
+{
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  string pool_name = get_temp_pool_name();
+
+  ASSERT_EQ("", create_one_pool_pp(pool_name, rados));
+  ASSERT_EQ(0, rados.ioctx_create(pool_name.c_str(), ioctx));
+
+  {
+    librbd::RBD rbd;
+    int order = 0;
+    ASSERT_EQ(0, rbd.create(ioctx, "qos", 4 << 20, &order));
+
+    {
+      librbd::Image image;
+      ASSERT_EQ(0, rbd.open(ioctx, image, "qos", NULL));
+      uint64_t limit;
+      ASSERT_EQ(-EINVAL, image.qos_get_limit("iops", &limit));
+      ASSERT_EQ(-EINVAL, image.qos_set_limit("iops", 10));
+      ASSERT_EQ(0, image.qos_get_limit("write_iops", &limit));
+      ASSERT_EQ(0u, limit);
+
+      // the image's own limit takes effect at once: a second's worth
+      // goes straight away, the rest at 20 a second
+      ASSERT_EQ(0, image.qos_set_limit("write_iops", 20));
+      ASSERT_EQ(0, image.qos_get_limit("write_iops", &limit));
+      ASSERT_EQ(20u, limit);
+      double start = now_seconds();
+      aio_burst(image, true, 40);
+      ASSERT_GE(now_seconds() - start, 0.9);
+
+      // reads aren't limited
+      aio_burst(image, false, 40);
+    }
+
+    {
+      // the limit is kept with the image, and the config overrides it:
+      // at 20 a second these would take half a second, at 10, two
+      ASSERT_EQ(0, rados.conf_set("rbd_qos_write_iops_limit", "10"));
+      librbd::Image image;
+      ASSERT_EQ(0, rbd.open(ioctx, image, "qos", NULL));
+      uint64_t limit;
+      ASSERT_EQ(0, image.qos_get_limit("write_iops", &limit));
+      ASSERT_EQ(20u, limit);
+      double start = now_seconds();
+      aio_burst(image, true, 30);
+      ASSERT_GE(now_seconds() - start, 1.5);
+      ASSERT_EQ(0, rados.conf_set("rbd_qos_write_iops_limit", "0"));
+
+      // synchronous writes wait their turn too
+      ASSERT_EQ(0, image.qos_set_limit("write_iops", 0));
+      ASSERT_EQ(0, image.qos_set_limit("write_bps", 64 << 10));
+      bufferlist bl;
+      bl.append(string(64 << 10, 'b'));
+      start = now_seconds();
+      for (int i = 0; i < 2; ++i)
+	ASSERT_EQ(64 << 10, image.write(i << 16, 64 << 10, bl));
+      ASSERT_GE(now_seconds() - start, 0.9);
+      ASSERT_EQ(0, image.qos_set_limit("write_bps", 0));
+      ASSERT_EQ(0, image.snap_create("snap"));
+    }
+
+    {
+      // a snapshot has no limits of its own to set
+      librbd::Image image;
+      ASSERT_EQ(0, rbd.open(ioctx, image, "qos", "snap"));
+      ASSERT_EQ(-EROFS, image.qos_set_limit("write_iops", 10));
+    }
+  }
+
+  ioctx.close();
+  ASSERT_EQ(0, destroy_one_pool_pp(pool_name, rados));
+}
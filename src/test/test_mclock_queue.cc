@@ -0,0 +1,152 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "include/types.h"
+#include "common/mClockQueue.h"
+#include "gtest/gtest.h"
+
+#include <map>
+
+typedef mClockQueue<int, int> IntQueue;
+
+/*
+ * A server that completes `rate` items/sec against clients that each
+ * keep `depth` items outstanding.  Items are the client id, so we can
+ * count how much service each client received.
+ */
+struct Sim {
+  IntQueue q;
+  map<int, int> outstanding;
+  map<int, int> served;
+  int idle;
+
+  Sim() : idle(0) {}
+
+  void add_client(int c, double res, double wgt, double lim) {
+    q.set_client_info(c, res, wgt, lim);
+    outstanding[c] = 0;
+    served[c] = 0;
+  }
+
+  void run(double secs, double rate, int depth) {
+    for (double now = 0; now < secs; now += 1.0 / rate) {
+      for (map<int, int>::iterator p = outstanding.begin();
+	   p != outstanding.end();
+	   ++p) {
+	while (p->second < depth) {
+	  q.enqueue(p->first, p->first, now);
+	  p->second++;
+	}
+      }
+      int c;
+      if (q.dequeue(now, &c, NULL, NULL)) {
+	served[c]++;
+	outstanding[c]--;
+      } else {
+	idle++;
+      }
+    }
+  }
+};
+
+TEST(mClockQueue, Fifo)
+{
+  IntQueue q;
+  for (int i = 0; i < 10; i++)
+    q.enqueue(0, i, 0);
+  ASSERT_EQ(10u, q.length());
+  for (int i = 0; i < 10; i++) {
+    int v;
+    ASSERT_TRUE(q.dequeue(1, &v, NULL, NULL));
+    ASSERT_EQ(i, v);
+  }
+  ASSERT_TRUE(q.empty());
+}
+
+TEST(mClockQueue, Remove)
+{
+  IntQueue q;
+  q.enqueue(0, 1, 0);
+  q.enqueue(1, 2, 0);
+  q.enqueue(0, 1, 0);
+  q.enqueue(1, 3, 0);
+  list<int> removed;
+  q.remove(1, &removed);
+  ASSERT_EQ(2u, removed.size());
+  ASSERT_EQ(2u, q.length());
+  int v;
+  ASSERT_TRUE(q.dequeue(1, &v, NULL, NULL));
+  ASSERT_NE(1, v);
+  ASSERT_TRUE(q.dequeue(1, &v, NULL, NULL));
+  ASSERT_NE(1, v);
+  ASSERT_FALSE(q.dequeue(1, &v, NULL, NULL));
+}
+
+TEST(mClockQueue, Weight)
+{
+  Sim s;
+  s.add_client(1, 0, 1, 0);
+  s.add_client(2, 0, 3, 0);
+  s.run(10, 1000, 32);
+  // 1:3 split of 10000 items
+  ASSERT_NEAR(2500, s.served[1], 50);
+  ASSERT_NEAR(7500, s.served[2], 50);
+}
+
+TEST(mClockQueue, Reservation)
+{
+  Sim s;
+  s.add_client(1, 600, 1, 0);
+  s.add_client(2, 0, 9, 0);
+  s.run(10, 1000, 32);
+  // the reservation holds even though the weight says 10%
+  ASSERT_GE(s.served[1], 5900);
+  ASSERT_NEAR(10000, s.served[1] + s.served[2], 1);
+}
+
+TEST(mClockQueue, Limit)
+{
+  Sim s;
+  s.add_client(1, 0, 1, 200);
+  s.add_client(2, 0, 1, 0);
+  s.run(10, 1000, 32);
+  ASSERT_LE(s.served[1], 2040);
+  ASSERT_GE(s.served[2], 7900);
+}
+
+TEST(mClockQueue, LimitBreak)
+{
+  // alone and over its limit: served anyway...
+  Sim s;
+  s.add_client(1, 0, 1, 200);
+  s.run(10, 1000, 32);
+  ASSERT_NEAR(10000, s.served[1], 1);
+  ASSERT_EQ(0, s.idle);
+
+  // ...unless the limit is strict
+  Sim t;
+  t.q.set_limit_break(false);
+  t.add_client(1, 0, 1, 200);
+  t.run(10, 1000, 32);
+  ASSERT_NEAR(2000, t.served[1], 40);
+  ASSERT_GT(t.idle, 7900);
+}
+
+TEST(mClockQueue, Phase)
+{
+  IntQueue q;
+  q.set_client_info(1, 10, 1, 0);
+  q.set_client_info(2, 0, 1, 0);
+  q.enqueue(2, 2, 0);
+  q.enqueue(1, 1, 0);
+  IntQueue::phase_t phase;
+  double arrival;
+  int v;
+  ASSERT_TRUE(q.dequeue(0.5, &v, &phase, &arrival));
+  ASSERT_EQ(1, v);
+  ASSERT_EQ(IntQueue::PHASE_RESERVATION, phase);
+  ASSERT_EQ(0, arrival);
+  ASSERT_TRUE(q.dequeue(0.5, &v, &phase, &arrival));
+  ASSERT_EQ(2, v);
+  ASSERT_EQ(IntQueue::PHASE_WEIGHT, phase);
+}
@@ -122,3 +122,35 @@ TEST(pg_t, split)
   ASSERT_TRUE(s.count(pg_t(7, 0, -1)));
 
 }
+
+TEST(pg_missing_t, rmissing)
+{
+  hobject_t a(object_t("a"), "", 1, 1, 0);
+  hobject_t b(object_t("b"), "", 1, 2, 0);
+  pg_missing_t missing;
+  missing.add(a, eversion_t(1, 10), eversion_t());
+  missing.add(b, eversion_t(1, 5), eversion_t(1, 2));
+  ASSERT_EQ(2u, missing.rmissing.size());
+  ASSERT_EQ(b, *missing.rmissing.begin()->second);
+
+  // rmissing points into missing, so a copy must be re-keyed
+  pg_missing_t copy(missing);
+  missing.got(b, eversion_t(1, 5));
+  ASSERT_EQ(1u, missing.rmissing.size());
+  ASSERT_EQ(2u, copy.rmissing.size());
+  ASSERT_EQ(&copy.missing.find(b)->first, copy.rmissing.begin()->second);
+
+  copy.revise_need(b, eversion_t(1, 20));
+  ASSERT_EQ(2u, copy.rmissing.size());
+  ASSERT_EQ(a, *copy.rmissing.begin()->second);
+  ASSERT_EQ(b, *copy.rmissing.rbegin()->second);
+
+  bufferlist bl;
+  copy.encode(bl);
+  bufferlist::iterator p = bl.begin();
+  pg_missing_t decoded;
+  decoded.decode(p);
+  ASSERT_EQ(2u, decoded.rmissing.size());
+  ASSERT_EQ(&decoded.missing.find(a)->first, decoded.rmissing.begin()->second);
+  ASSERT_TRUE(decoded.approx_mem_usage() > 0);
+}
@@ -0,0 +1,73 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <errno.h>
+
+#include "include/types.h"
+#include "librbd/CopyOnRead.h"
+#include "gtest/gtest.h"
+
+using librbd::CopyOnRead;
+
+TEST(RbdCopyOnRead, Disabled) {
+  CopyOnRead cor;
+  ASSERT_EQ(-EBUSY, cor.start(0));
+  ASSERT_EQ(0u, cor.get_pending());
+}
+
+TEST(RbdCopyOnRead, Once) {
+  CopyOnRead cor;
+  cor.set_max_ops(4);
+
+  ASSERT_EQ(0, cor.start(3));
+  // a second read of the object while it is being copied doesn't
+  // copy it again
+  ASSERT_EQ(-EEXIST, cor.start(3));
+  ASSERT_FALSE(cor.was_copied(3));
+  cor.finish(3, 0);
+  ASSERT_TRUE(cor.was_copied(3));
+  ASSERT_EQ(-EEXIST, cor.start(3));
+  ASSERT_FALSE(cor.was_copied(4));
+
+  // until a rollback
+  cor.reset();
+  ASSERT_FALSE(cor.was_copied(3));
+  ASSERT_EQ(0, cor.start(3));
+  cor.finish(3, 0);
+}
+
+TEST(RbdCopyOnRead, Failed) {
+  CopyOnRead cor;
+  cor.set_max_ops(1);
+
+  ASSERT_EQ(0, cor.start(7));
+  cor.finish(7, -EIO);
+  ASSERT_FALSE(cor.was_copied(7));
+  // the next read tries again
+  ASSERT_EQ(0, cor.start(7));
+  cor.finish(7, 0);
+  ASSERT_TRUE(cor.was_copied(7));
+}
+
+TEST(RbdCopyOnRead, MaxOps) {
+  CopyOnRead cor;
+  cor.set_max_ops(2);
+
+  ASSERT_EQ(0, cor.start(0));
+  ASSERT_EQ(0, cor.start(1));
+  ASSERT_EQ(-EBUSY, cor.start(2));
+  ASSERT_EQ(2u, cor.get_pending());
+
+  cor.finish(0, 0);
+  ASSERT_EQ(0, cor.start(2));
+  cor.finish(1, 0);
+  cor.finish(2, 0);
+  cor.wait_for_pending();
+  ASSERT_EQ(0u, cor.get_pending());
+
+  // neighbours are tracked separately
+  ASSERT_TRUE(cor.was_copied(0));
+  ASSERT_TRUE(cor.was_copied(1));
+  ASSERT_TRUE(cor.was_copied(2));
+  ASSERT_FALSE(cor.was_copied(3));
+}
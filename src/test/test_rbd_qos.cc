@@ -0,0 +1,185 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <vector>
+
+#include "common/Clock.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "include/Context.h"
+#include "include/utime.h"
+#include "librbd/Qos.h"
+#include "test/unit.h"
+
+using librbd::Qos;
+using librbd::TokenBucket;
+
+TEST(RbdTokenBucket, Unlimited) {
+  TokenBucket b;
+  utime_t now(100, 0);
+  ASSERT_EQ(0, b.get_wait(now, 1 << 30));
+  b.take(1 << 30);
+  ASSERT_EQ(0, b.get_wait(now, 1 << 30));
+}
+
+TEST(RbdTokenBucket, Burst) {
+  TokenBucket b;
+  utime_t now(100, 0);
+  b.set_limit(10, 5, now);
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_EQ(0, b.get_wait(now, 1));
+    b.take(1);
+  }
+  ASSERT_DOUBLE_EQ(0.1, b.get_wait(now, 1));
+  ASSERT_EQ(0, b.get_wait(now + utime_t(0, 100000000), 1));
+
+  // a long quiet spell only earns a burst's worth
+  now += 10;
+  for (int i = 0; i < 5; ++i) {
+    ASSERT_EQ(0, b.get_wait(now, 1));
+    b.take(1);
+  }
+  ASSERT_LT(0, b.get_wait(now, 1));
+}
+
+TEST(RbdTokenBucket, Large) {
+  TokenBucket b;
+  utime_t now(100, 0);
+  b.set_limit(100, 50, now);
+  // more than a burst goes once the bucket is full...
+  ASSERT_EQ(0, b.get_wait(now, 200));
+  b.take(200);
+  // ...and what follows pays for it
+  ASSERT_DOUBLE_EQ(1.51, b.get_wait(now, 1));
+  ASSERT_DOUBLE_EQ(2.0, b.get_wait(now, 50));
+}
+
+TEST(RbdTokenBucket, ChangeLimit) {
+  TokenBucket b;
+  utime_t now(100, 0);
+  b.set_limit(10, 10, now);
+  b.take(10);
+  ASSERT_DOUBLE_EQ(0.1, b.get_wait(now, 1));
+  // raising the limit doesn't forgive what is owed
+  b.set_limit(100, 100, now);
+  ASSERT_DOUBLE_EQ(0.01, b.get_wait(now, 1));
+  b.set_limit(0, 0, now);
+  ASSERT_EQ(0, b.get_wait(now, 1));
+}
+
+struct IoLog {
+  Mutex lock;
+  Cond cond;
+  std::vector<int> sent;
+  IoLog() : lock("IoLog::lock") {}
+
+  void wait_for(size_t n) {
+    Mutex::Locker l(lock);
+    while (sent.size() < n)
+      cond.Wait(lock);
+  }
+};
+
+class C_Sent : public Context {
+public:
+  C_Sent(IoLog *log, int id) : m_log(log), m_id(id) {}
+  void finish(int r) {
+    Mutex::Locker l(m_log->lock);
+    m_log->sent.push_back(m_id);
+    m_log->cond.Signal();
+  }
+private:
+  IoLog *m_log;
+  int m_id;
+};
+
+// start count ios; return how many went at once
+static int start_ios(Qos &qos, IoLog &log, bool write, int count,
+		     uint64_t len)
+{
+  int now = 0;
+  for (int i = 0; i < count; ++i) {
+    Context *ctx = new C_Sent(&log, i);
+    if (qos.start_io(write, len)) {
+      ctx->complete(0);
+      ++now;
+    } else {
+      qos.queue_io(write, len, ctx);
+    }
+  }
+  return now;
+}
+
+TEST(RbdQos, Unlimited) {
+  Qos qos(g_ceph_context);
+  ASSERT_FALSE(qos.is_active());
+  IoLog log;
+  ASSERT_EQ(100, start_ios(qos, log, true, 100, 1 << 20));
+  qos.shut_down();
+}
+
+TEST(RbdQos, Iops) {
+  Qos qos(g_ceph_context);
+  qos.set_limits(0, 100, 0, 0, 0.1);
+  ASSERT_TRUE(qos.is_active());
+
+  IoLog log;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  // the burst goes at once, the rest at 100 a second
+  ASSERT_EQ(10, start_ios(qos, log, true, 60, 4096));
+  qos.drain_writes();
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+  ASSERT_GE(elapsed, 0.45);
+
+  // in the order they were made
+  ASSERT_EQ(60u, log.sent.size());
+  for (int i = 0; i < 60; ++i)
+    ASSERT_EQ(i, log.sent[i]);
+
+  // reads aren't limited
+  IoLog read_log;
+  ASSERT_EQ(50, start_ios(qos, read_log, false, 50, 4096));
+  qos.shut_down();
+}
+
+TEST(RbdQos, Bandwidth) {
+  Qos qos(g_ceph_context);
+  qos.set_limits(0, 0, 1 << 20, 0, 0.25);
+
+  IoLog log;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  // 1 MB a second, 256k at once: 1 MB in 64k reads takes 3/4 second
+  ASSERT_EQ(4, start_ios(qos, log, false, 16, 65536));
+  log.wait_for(16);
+  double elapsed = ceph_clock_now(g_ceph_context) - start;
+  ASSERT_GE(elapsed, 0.7);
+  qos.shut_down();
+}
+
+TEST(RbdQos, ShutDown) {
+  Qos qos(g_ceph_context);
+  qos.set_limits(1, 1, 0, 0, 1);
+
+  IoLog log;
+  ASSERT_EQ(1, start_ios(qos, log, true, 10, 4096));
+  ASSERT_EQ(1, start_ios(qos, log, false, 10, 4096));
+  // whatever is still held back goes now
+  qos.shut_down();
+  ASSERT_EQ(20u, log.sent.size());
+  ASSERT_FALSE(qos.is_active());
+}
+
+TEST(RbdQos, Lifted) {
+  Qos qos(g_ceph_context);
+  qos.set_limits(0, 1, 0, 0, 1);
+
+  IoLog log;
+  ASSERT_EQ(1, start_ios(qos, log, true, 10, 4096));
+  // lifting the limit lets the queue go
+  qos.set_limits(0, 0, 0, 0, 1);
+  qos.drain_writes();
+  ASSERT_EQ(10u, log.sent.size());
+  ASSERT_FALSE(qos.is_active());
+  ASSERT_EQ(1, start_ios(qos, log, true, 1, 4096));
+  qos.shut_down();
+}
@@ -0,0 +1,121 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "include/types.h"
+#include "librbd/Readahead.h"
+#include "gtest/gtest.h"
+
+using librbd::Readahead;
+
+static const uint64_t image_size = 1ull << 30;
+static const uint64_t object_size = 4 << 20;
+
+TEST(RbdReadahead, Sequential) {
+  Readahead ra;
+  ra.set_trigger_requests(4);
+  ra.set_max_bytes(1 << 20);
+
+  // nothing until the stream is long enough
+  for (int i = 0; i < 3; i++)
+    ASSERT_EQ(0u, ra.update(i * 4096, 4096, image_size, object_size).second);
+
+  // then the first window is as big as the stream so far
+  Readahead::extent_t e = ra.update(3 * 4096, 4096, image_size, object_size);
+  ASSERT_EQ(4u * 4096, e.first);
+  ASSERT_EQ(4u * 4096, e.second);
+  ASSERT_EQ(4u * 4096, ra.get_pending());
+
+  // nothing more until the reader is halfway through it
+  ASSERT_EQ(0u, ra.update(4 * 4096, 4096, image_size, object_size).second);
+  ra.dec_pending(e.second);
+
+  // and the next window doubles
+  e = ra.update(5 * 4096, 4096, image_size, object_size);
+  ASSERT_EQ(8u * 4096, e.first);
+  ASSERT_EQ(8u * 4096, e.second);
+  ra.dec_pending(e.second);
+
+  // until it reaches max_bytes
+  uint64_t off = 6 * 4096;
+  uint64_t biggest = 0;
+  for (int i = 0; i < 1000; i++, off += 4096) {
+    e = ra.update(off, 4096, image_size, object_size);
+    if (e.second) {
+      ASSERT_LE(e.second, 1u << 20);
+      biggest = MAX(biggest, e.second);
+      ra.dec_pending(e.second);
+    }
+  }
+  ASSERT_EQ(1u << 20, biggest);
+}
+
+TEST(RbdReadahead, Random) {
+  Readahead ra;
+  ra.set_trigger_requests(2);
+  for (int i = 0; i < 100; i++) {
+    uint64_t off = (i * 7919 % 1000) * 65536;
+    ASSERT_EQ(0u, ra.update(off, 4096, image_size, object_size).second);
+  }
+}
+
+TEST(RbdReadahead, ObjectBoundary) {
+  Readahead ra;
+  ra.set_trigger_requests(1);
+  ra.set_max_bytes(1 << 20);
+
+  // a 128k window that would end 32k into the next object stops at it
+  uint64_t off = object_size - 224 * 1024;
+  Readahead::extent_t e = ra.update(off, 128 * 1024, image_size, object_size);
+  ASSERT_EQ(object_size - 96 * 1024, e.first);
+  ASSERT_EQ(96u * 1024, e.second);
+  ra.dec_pending(e.second);
+
+  // a boundary before the middle of the window is left alone
+  Readahead ra2;
+  ra2.set_trigger_requests(1);
+  off = object_size - 160 * 1024;
+  e = ra2.update(off, 128 * 1024, image_size, object_size);
+  ASSERT_EQ(object_size - 32 * 1024, e.first);
+  ASSERT_EQ(128u * 1024, e.second);
+}
+
+TEST(RbdReadahead, ImageEnd) {
+  Readahead ra;
+  ra.set_trigger_requests(1);
+  uint64_t size = 10 * 4096;
+  Readahead::extent_t e = ra.update(0, 4 * 4096, size, object_size);
+  ASSERT_EQ(4u * 4096, e.first);
+  ASSERT_EQ(4u * 4096, e.second);
+  ra.dec_pending(e.second);
+  e = ra.update(4 * 4096, 4 * 4096, size, object_size);
+  ASSERT_EQ(8u * 4096, e.first);
+  ASSERT_EQ(2u * 4096, e.second);
+  ra.dec_pending(e.second);
+  ASSERT_EQ(0u, ra.update(8 * 4096, 2 * 4096, size, object_size).second);
+}
+
+TEST(RbdReadahead, Budget) {
+  Readahead ra;
+  ra.set_trigger_requests(1);
+  ra.set_max_bytes(64 * 1024);
+  Readahead::extent_t e = ra.update(0, 64 * 1024, image_size, object_size);
+  ASSERT_EQ(64u * 1024, e.second);
+  // the budget is used up until that prefetch completes
+  ASSERT_EQ(0u, ra.update(64 * 1024, 64 * 1024, image_size, object_size).second);
+  ra.dec_pending(e.second);
+  ASSERT_NE(0u, ra.update(128 * 1024, 64 * 1024, image_size, object_size).second);
+}
+
+TEST(RbdReadahead, DisableAfter) {
+  Readahead ra;
+  ra.set_trigger_requests(1);
+  ra.set_disable_after_bytes(1 << 20);
+  uint64_t off = 0;
+  while (!ra.is_disabled()) {
+    Readahead::extent_t e = ra.update(off, 65536, image_size, object_size);
+    ra.dec_pending(e.second);
+    off += 65536;
+  }
+  ASSERT_EQ(1u << 20, off);
+  ASSERT_EQ(0u, ra.update(off, 65536, image_size, object_size).second);
+}
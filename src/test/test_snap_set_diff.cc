@@ -0,0 +1,162 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "librados/snap_set_diff.h"
+#include "test/unit.h"
+
+using librados::clone_info_t;
+using librados::snap_set_t;
+using librados::SNAP_HEAD;
+
+static clone_info_t clone(librados::snap_t id, librados::snap_t first,
+			  librados::snap_t last, uint64_t size)
+{
+  clone_info_t c;
+  c.cloneid = id;
+  for (librados::snap_t s = first; s <= last; ++s)
+    c.snaps.push_back(s);
+  c.size = size;
+  return c;
+}
+
+static clone_info_t head(uint64_t size)
+{
+  clone_info_t c;
+  c.cloneid = SNAP_HEAD;
+  c.size = size;
+  return c;
+}
+
+TEST(SnapSetDiff, Unchanged) {
+  // written before snap 1, never since
+  snap_set_t ss;
+  ss.seq = 0;
+  ss.clones.push_back(head(4096));
+
+  interval_set<uint64_t> diff;
+  uint64_t end_size;
+  bool end_exists;
+  calc_snap_set_diff(g_ceph_context, ss, 1, SNAP_HEAD, &diff, &end_size,
+		     &end_exists);
+  ASSERT_TRUE(diff.empty());
+  ASSERT_EQ(4096u, end_size);
+  ASSERT_TRUE(end_exists);
+
+  // but all of it is new since the beginning of time
+  calc_snap_set_diff(g_ceph_context, ss, 0, SNAP_HEAD, &diff, &end_size,
+		     &end_exists);
+  ASSERT_EQ(1, diff.num_intervals());
+  ASSERT_EQ(0u, diff.range_start());
+  ASSERT_EQ(4096u, diff.range_end());
+}
+
+TEST(SnapSetDiff, Overwrite) {
+  // 8k written before snap 2; then 4k~1k overwritten
+  snap_set_t ss;
+  ss.seq = 2;
+  clone_info_t c = clone(2, 1, 2, 8192);
+  c.overlap.push_back(make_pair(0, 4096));
+  c.overlap.push_back(make_pair(5120, 3072));
+  ss.clones.push_back(c);
+  ss.clones.push_back(head(8192));
+
+  interval_set<uint64_t> diff;
+  uint64_t end_size;
+  bool end_exists;
+  calc_snap_set_diff(g_ceph_context, ss, 2, SNAP_HEAD, &diff, &end_size,
+		     &end_exists);
+  ASSERT_EQ(1, diff.num_intervals());
+  ASSERT_TRUE(diff.contains(4096, 1024));
+  ASSERT_EQ(8192u, end_size);
+  ASSERT_TRUE(end_exists);
+
+  // from snap 1 to snap 2 nothing changed
+  calc_snap_set_diff(g_ceph_context, ss, 1, 2, &diff, &end_size,
+		     &end_exists);
+  ASSERT_TRUE(diff.empty());
+  ASSERT_TRUE(end_exists);
+}
+
+TEST(SnapSetDiff, Grow) {
+  // 4k before snap 3, extended to 12k after
+  snap_set_t ss;
+  ss.seq = 3;
+  clone_info_t c = clone(3, 3, 3, 4096);
+  c.overlap.push_back(make_pair(0, 4096));
+  ss.clones.push_back(c);
+  ss.clones.push_back(head(12288));
+
+  interval_set<uint64_t> diff;
+  uint64_t end_size;
+  bool end_exists;
+  calc_snap_set_diff(g_ceph_context, ss, 3, SNAP_HEAD, &diff, &end_size,
+		     &end_exists);
+  ASSERT_EQ(1, diff.num_intervals());
+  ASSERT_EQ(4096u, diff.range_start());
+  ASSERT_EQ(12288u, diff.range_end());
+  ASSERT_EQ(12288u, end_size);
+}
+
+TEST(SnapSetDiff, Created) {
+  // didn't exist at snap 4: the head has only been written since
+  snap_set_t ss;
+  ss.seq = 4;
+  ss.clones.push_back(head(4096));
+
+  interval_set<uint64_t> diff;
+  uint64_t end_size;
+  bool end_exists;
+  calc_snap_set_diff(g_ceph_context, ss, 4, SNAP_HEAD, &diff, &end_size,
+		     &end_exists);
+  ASSERT_EQ(1, diff.num_intervals());
+  ASSERT_TRUE(diff.contains(0, 4096));
+  ASSERT_TRUE(end_exists);
+}
+
+TEST(SnapSetDiff, Removed) {
+  // existed at snap 5, removed since
+  snap_set_t ss;
+  ss.seq = 5;
+  ss.clones.push_back(clone(5, 5, 5, 8192));
+
+  interval_set<uint64_t> diff;
+  uint64_t end_size;
+  bool end_exists;
+  calc_snap_set_diff(g_ceph_context, ss, 5, SNAP_HEAD, &diff, &end_size,
+		     &end_exists);
+  ASSERT_EQ(1, diff.num_intervals());
+  ASSERT_TRUE(diff.contains(0, 8192));
+  ASSERT_FALSE(end_exists);
+
+  // and never existed as far as snap 6 onwards is concerned
+  calc_snap_set_diff(g_ceph_context, ss, 6, SNAP_HEAD, &diff, &end_size,
+		     &end_exists);
+  ASSERT_TRUE(diff.empty());
+  ASSERT_FALSE(end_exists);
+}
+
+TEST(SnapSetDiff, Recreated) {
+  // existed at snap 1, removed, snap 2 taken, recreated, then
+  // snap 3 taken and overwritten: clone 3 only holds snap 3
+  snap_set_t ss;
+  ss.seq = 3;
+  ss.clones.push_back(clone(1, 1, 1, 4096));
+  clone_info_t c = clone(3, 3, 3, 4096);
+  c.overlap.push_back(make_pair(0, 4096));
+  ss.clones.push_back(c);
+  ss.clones.push_back(head(4096));
+
+  interval_set<uint64_t> diff;
+  uint64_t end_size;
+  bool end_exists;
+  calc_snap_set_diff(g_ceph_context, ss, 2, 3, &diff, &end_size,
+		     &end_exists);
+  ASSERT_TRUE(diff.contains(0, 4096));
+  ASSERT_TRUE(end_exists);
+
+  // it didn't exist at snap 2
+  calc_snap_set_diff(g_ceph_context, ss, 1, 2, &diff, &end_size,
+		     &end_exists);
+  ASSERT_TRUE(diff.contains(0, 4096));
+  ASSERT_FALSE(end_exists);
+}